@@ -1,6 +1,9 @@
 global _entry_isr80h_32
 
 extern isr80h_handler
+extern preempt_schedule_irq
+extern task_exit_to_user
+extern user_registers
 
 _entry_isr80h_32:
 	push dword 0    ; err code
@@ -9,6 +12,18 @@ _entry_isr80h_32:
 	push esp
 	call isr80h_handler
 	add esp, 4
+
+	; A wakeup during the call may want the CPU before user space resumes
+	push esp
+	call preempt_schedule_irq
+	add esp, 4
+
+	; exit_group() from another thread
+	call task_exit_to_user
+
+	; Per-CPU data is reached through the kernel's %fs up to here
+	call user_registers
+
 	popad
 	add esp, 8 ; clear erros
 	iretd
\ No newline at end of file
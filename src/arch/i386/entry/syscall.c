@@ -59,6 +59,4 @@ void isr80h_handler(struct registers* regs){
 
 	*regs = current->regs;
 	regs->ax = res;
-
-	user_registers();
 }
@@ -4,7 +4,9 @@
 #define X86_32 1
 
 /*GDT*/
-#define TOTAL_GDT_SEGMENTS 6
+// Per CPU one TSS descriptor from GDT_TSS_BASE_INDEX and one per-CPU data
+// descriptor from GDT_PERCPU_BASE_INDEX, MAX_CPUS is in def/config.h
+#define TOTAL_GDT_SEGMENTS (GDT_PERCPU_BASE_INDEX + MAX_CPUS)
 
 #define GDT_NULL_INDEX        0 
 #define GDT_KERNEL_CODE_INDEX 1
@@ -12,16 +14,24 @@
 #define GDT_USER_CODE_INDEX   3
 #define GDT_USER_DATA_INDEX   4
 #define GDT_TSS_BASE_INDEX    5
+#define GDT_PERCPU_BASE_INDEX (GDT_TSS_BASE_INDEX + MAX_CPUS)
 
 #define GDT_KERNEL_CODE  (GDT_KERNEL_CODE_INDEX << 3)
 #define GDT_KERNEL_DATA  (GDT_KERNEL_DATA_INDEX << 3)
 #define GDT_USER_CODE    ((GDT_USER_CODE_INDEX << 3) | 3)
 #define GDT_USER_DATA    ((GDT_USER_DATA_INDEX << 3) | 3)
 #define GDT_TSS(index)   ((index) << 3)
+#define GDT_PERCPU(cpu)  ((GDT_PERCPU_BASE_INDEX + (cpu)) << 3)
 
 /* PIC */
 #define TIMER_FREQUENCY 20
 
+/* SMP */
+// Real mode entry of the application processors, SIPI vector 0x08
+#define SMP_TRAMPOLINE_PHYS 0x8000
+// Per-CPU areas are aligned to it so no two CPUs share a line
+#define L1_CACHE_BYTES 64
+
 /* Memory */
 #define PAGE_SIZE 0x1000
 #define PAGE_SHIFT 12
@@ -63,6 +63,24 @@ static __always_inline void arch_atomic_sub(int i, atomic_t *v){
 	);
 }
 
+static __always_inline void arch_atomic_or(int i, atomic_t *v){
+	__asm__ volatile(
+		"lock orl %1, %0"
+		: "+m" (v->value)
+		: "ir" (i)
+		: "memory"
+	);
+}
+
+static __always_inline void arch_atomic_andnot(int i, atomic_t *v){
+	__asm__ volatile(
+		"lock andl %1, %0"
+		: "+m" (v->value)
+		: "ir" (~i)
+		: "memory"
+	);
+}
+
 static __always_inline void arch_atomic_inc(atomic_t *v){
 	__asm__ volatile(
 		"lock incl %0"
@@ -3,19 +3,70 @@
 
 #include <def/compile.h>
 #include <asm/tss.h>
+#include <asm/cpuflags.h>
+#include <stdint.h>
 
 struct task;
 struct tss;
 
 struct cpu {
 	int id;
+	int apic_id;
 	struct tss tss;
-	struct task *current;
 };
 
 #define cpu_relax() __asm__ volatile("pause" ::: "memory")
 
-void cpu_init();
+/* sti only takes effect after hlt, an interrupt can't land in between */
+#define safe_halt() __asm__ volatile("sti; hlt" ::: "memory")
+
+static inline void cpuid(uint32_t op, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx){
+	__asm__ volatile("cpuid"
+		: "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		: "a"(op), "c"(0));
+}
+
+static inline uint64_t rdmsr(uint32_t msr){
+	uint32_t lo, hi;
+	__asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val){
+	__asm__ volatile("wrmsr" :: "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static inline unsigned long read_cr0(void){
+	unsigned long val;
+	__asm__ volatile("mov %%cr0, %0" : "=r"(val));
+	return val;
+}
+
+static inline unsigned long read_cr4(void){
+	unsigned long val;
+	__asm__ volatile("mov %%cr4, %0" : "=r"(val));
+	return val;
+}
+
+static inline void write_cr0(unsigned long val){
+	__asm__ volatile("mov %0, %%cr0" :: "r"(val) : "memory");
+}
+
+static inline void write_cr4(unsigned long val){
+	__asm__ volatile("mov %0, %%cr4" :: "r"(val) : "memory");
+}
+
+/* CR0.TS, set makes the next FPU/SSE instruction trap with #NM */
+static inline void clts(void){
+	__asm__ volatile("clts" ::: "memory");
+}
+
+static inline void stts(void){
+	write_cr0(read_cr0() | X86_CR0_TS);
+}
+
+void cpu_init(int id);
 struct cpu* get_cpu(void);
+struct cpu* cpu_data(int id);
 
 #endif
@@ -3,18 +3,28 @@
 
 #include <stdint.h>
 
+/*
+* divl faults when the quotient does not fit in 32 bits, so the high word
+* is divided first and only its remainder goes into edx.
+*/
 static inline uint32_t __do_div_arch(uint64_t *n, uint32_t base){
 	uint32_t low = (uint32_t)(*n);
 	uint32_t high = (uint32_t)(*n >> 32);
+	uint32_t upper = 0;
 	uint32_t rem;
 
+	if(high >= base){
+		upper = high / base;
+		high = high % base;
+	}
+
 	asm (
 		"divl %4"
 		: "=a"(low), "=d"(rem)
 		: "a"(low), "d"(high), "r"(base)
 	);
 
-	*n = low;
+	*n = ((uint64_t)upper << 32) | low;
 	return rem;
 }
 
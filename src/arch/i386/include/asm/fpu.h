@@ -0,0 +1,47 @@
+#ifndef _X86_FPU_H
+#define _X86_FPU_H
+
+#include <asm/percpu.h>
+#include <def/compile.h>
+#include <stdint.h>
+
+struct task;
+struct registers;
+
+#define FPU_STATE_SIZE  512  // FXSAVE image, FSAVE's 108 bytes fit too
+#define FPU_STATE_ALIGN 16
+
+#define MXCSR_DEFAULT 0x1F80  // all SSE exceptions masked, round to nearest
+
+/*
+* x87/SSE registers of a task. The state is only allocated once the task
+* first touches the FPU, most never do.
+*/
+struct fpu {
+	void* buf;       // kmalloc()'ed, state is buf aligned up
+	void* state;
+	int initialized; // state holds registers, not just zeroes
+};
+
+/* The task whose registers are live in this CPU's FPU, if any */
+DECLARE_PER_CPU(struct task*, fpu_owner);
+
+void fpu_init_cpu(void);
+
+void fpu_switch_out(struct task* prev);
+int fpu_copy(struct task* dst, struct task* src);
+void fpu_reset(struct task* task);
+void fpu_release(struct task* task);
+
+asmlinkage void device_not_available_handler(struct registers* regs);
+
+/*
+* FPU/SSE use in kernel code, task or softirq context. Whoever owned the
+* FPU gets its registers saved first and reloads them on its next use;
+* softirqs and preemption stay off in between. Not from hardirqs, not
+* nested.
+*/
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+#endif
@@ -29,6 +29,7 @@ struct IDTr_ptr{
 }__attribute__((packed));
 
 void idt_init();
+void idt_load(void);
 void idt_set_gate(uint8_t interrupt_num, uint32_t base, uint16_t selector, uint8_t flags);
 
 #endif
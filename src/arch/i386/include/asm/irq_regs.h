@@ -0,0 +1,24 @@
+#ifndef _X86_IRQ_REGS_H
+#define _X86_IRQ_REGS_H
+
+#include <asm/percpu.h>
+#include <asm/ptrace.h>
+
+/*
+* Frame of the interrupt this CPU is handling, for code that runs from it
+* without being handed the frame, like the tick. NULL outside of one.
+*/
+DECLARE_PER_CPU(struct registers*, irq_regs);
+
+static inline struct registers* get_irq_regs(void){
+	return this_cpu_read(irq_regs);
+}
+
+// Returns the previous frame, put back once the interrupt is done
+static inline struct registers* set_irq_regs(struct registers* regs){
+	struct registers* old = this_cpu_read(irq_regs);
+	this_cpu_write(irq_regs, regs);
+	return old;
+}
+
+#endif
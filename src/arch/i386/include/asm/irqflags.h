@@ -0,0 +1,46 @@
+#ifndef _X86_IRQFLAGS_H
+#define _X86_IRQFLAGS_H
+
+#include <def/compile.h>
+#include <asm/cpuflags.h>
+
+static __always_inline void local_irq_enable(void){
+	__asm__ volatile ("sti" ::: "memory");
+}
+
+static __always_inline void local_irq_disable(void){
+	__asm__ volatile ("cli" ::: "memory");
+}
+
+static __always_inline unsigned long local_save_flags(void){
+	unsigned long flags;
+
+	__asm__ volatile(
+		"pushf ; pop %0"
+		: "=rm" (flags)
+		:: "memory"
+	);
+
+	return flags;
+}
+
+static __always_inline int irqs_disabled_flags(unsigned long flags){
+	return !(flags & X86_EFLAGS_IF);
+}
+
+static __always_inline int irqs_disabled(void){
+	return irqs_disabled_flags(local_save_flags());
+}
+
+#define local_irq_save(flags) do { \
+	(flags) = local_save_flags();  \
+	local_irq_disable();           \
+} while(0)
+
+static __always_inline void local_irq_restore(unsigned long flags){
+	if(!irqs_disabled_flags(flags)){
+		local_irq_enable();
+	}
+}
+
+#endif
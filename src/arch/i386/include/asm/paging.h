@@ -15,6 +15,10 @@
 #define _PAGE_RW       0x2
 #define _PAGE_P        0x1
 
+/* Non-present PTE holding a swap entry in bits 2..31 */
+#define _PAGE_SWAP     0x2
+#define _PAGE_SWP_SHIFT 2
+
 #define PAGE_MASK 0xFFFFF000
 #define FLAGS_MASK (~PAGE_MASK)
 #define PAGE_SHIFT 12
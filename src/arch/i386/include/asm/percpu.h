@@ -0,0 +1,103 @@
+#ifndef _X86_PERCPU_H
+#define _X86_PERCPU_H
+
+#include <def/config.h>
+#include <def/compile.h>
+#include <stdint.h>
+
+/*
+* Per-CPU variables are defined into .data..percpu, a template every CPU
+* gets its own copy of at boot. %fs holds a flat data segment based at the
+* distance from the template to this CPU's copy, so `%fs:var` is this
+* CPU's `var` and an access is one instruction, with no CPU number to look
+* up and no shared cache line. Before the copies exist the segment is
+* based at 0 and reaches the template itself.
+*
+* A task can move to another CPU between two accesses, but never within
+* one: a read-modify-write like this_cpu_inc() is safe with preemption on.
+*/
+
+#define __percpu_section __attribute__((section(".data..percpu")))
+
+#define DEFINE_PER_CPU(type, name) __percpu_section __typeof__(type) name
+#define DECLARE_PER_CPU(type, name) extern __percpu_section __typeof__(type) name
+
+// Distance from the template to each CPU's copy, see setup_per_cpu_areas()
+extern unsigned long __per_cpu_offset[MAX_CPUS];
+DECLARE_PER_CPU(unsigned long, this_cpu_off);
+
+#define __percpu_arg(x) "%%fs:%" #x
+
+// Scalars up to the register width only, %z picks the operand size suffix
+#define __percpu_check_size(var) \
+	_Static_assert(sizeof(var) == 1 || sizeof(var) == 2 || sizeof(var) == 4, "bad per-CPU access size")
+
+#define this_cpu_read(var) ({                                      \
+	__percpu_check_size(var);                                      \
+	__typeof__(var) __ret;                                         \
+	__asm__ volatile("mov%z1 " __percpu_arg(1) ", %0"              \
+		: "=q"(__ret) : "m"(var));                                 \
+	__ret;                                                         \
+})
+
+#define this_cpu_write(var, val) do {                              \
+	__percpu_check_size(var);                                      \
+	__asm__ volatile("mov%z0 %1, " __percpu_arg(0)                 \
+		: "=m"(var) : "qi"((__typeof__(var))(val)));               \
+} while(0)
+
+#define this_cpu_add(var, val) do {                                \
+	__percpu_check_size(var);                                      \
+	__asm__ volatile("add%z0 %1, " __percpu_arg(0)                 \
+		: "+m"(var) : "qi"((__typeof__(var))(val)));               \
+} while(0)
+
+#define this_cpu_sub(var, val) do {                                \
+	__percpu_check_size(var);                                      \
+	__asm__ volatile("sub%z0 %1, " __percpu_arg(0)                 \
+		: "+m"(var) : "qi"((__typeof__(var))(val)));               \
+} while(0)
+
+#define this_cpu_or(var, val) do {                                 \
+	__percpu_check_size(var);                                      \
+	__asm__ volatile("or%z0 %1, " __percpu_arg(0)                  \
+		: "+m"(var) : "qi"((__typeof__(var))(val)));               \
+} while(0)
+
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+#define this_cpu_dec(var) this_cpu_sub(var, 1)
+
+/* Subtract and tell whether it reached zero, still a single instruction */
+#define this_cpu_sub_and_test(var, val) ({                         \
+	__percpu_check_size(var);                                      \
+	uint8_t __zero;                                                \
+	__asm__ volatile("sub%z0 %2, " __percpu_arg(0) "\n\tsete %1"   \
+		: "+m"(var), "=qm"(__zero) : "qi"((__typeof__(var))(val))); \
+	__zero;                                                        \
+})
+
+#define per_cpu_ptr(ptr, cpu) \
+	((__typeof__(ptr))((unsigned long)(ptr) + __per_cpu_offset[(cpu)]))
+
+#define this_cpu_ptr(ptr) \
+	((__typeof__(ptr))((unsigned long)(ptr) + this_cpu_read(this_cpu_off)))
+
+#define per_cpu(var, cpu) (*per_cpu_ptr(&(var), (cpu)))
+
+/*
+* Load this CPU's per-CPU segment into %fs, on every entry from user
+* space. The task register names the CPU; its per-CPU descriptor sits
+* MAX_CPUS entries after its TSS one.
+*/
+static __always_inline void percpu_load_segment(void){
+	uint16_t tr;
+
+	__asm__ volatile("str %0" : "=rm"(tr));
+
+	uint16_t sel = tr ? tr + ((GDT_PERCPU_BASE_INDEX - GDT_TSS_BASE_INDEX) << 3) : GDT_KERNEL_DATA;
+	__asm__ volatile("mov %0, %%fs" :: "rm"(sel) : "memory");
+}
+
+void setup_per_cpu_areas(void);
+
+#endif
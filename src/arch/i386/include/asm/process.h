@@ -2,19 +2,25 @@
 #define _X86_PROCESS_H
 
 #include <asm/cpu.h>
+#include <asm/percpu.h>
 #include <def/compile.h>
 
-#define current get_cpu()->current
-
 struct task;
 struct registers;
 
+DECLARE_PER_CPU(struct task*, current_task);
+
+#define current this_cpu_read(current_task)
+#define set_current(task) this_cpu_write(current_task, (task))
+
 extern asmlinkage void ret_from_registers(struct registers* regs);
 
 void start_thread_user(struct registers* regs, void* entry_point, void* user_stack);
 void start_thread_kernel(struct registers* regs, void* entry_point, void* kernel_stack);
 
-void copy_thread(struct task *p, struct task *c, int (*fn)(void*), void* args);
+int copy_thread(struct task *p, struct task *c, unsigned long usp, int (*fn)(void*), void* args);
+void release_thread(struct task* task);
+void flush_thread(void);
 void context_switch(struct task* prev, struct task* to);
 
 #endif
@@ -0,0 +1,20 @@
+#ifndef _X86_SMP_H
+#define _X86_SMP_H
+
+#include <asm/percpu.h>
+#include <def/config.h>
+#include <stdint.h>
+
+DECLARE_PER_CPU(int, cpu_number);
+
+/* 0 until the CPU loaded its per-CPU segment, the template says so */
+static inline int smp_processor_id(void){
+	return this_cpu_read(cpu_number);
+}
+
+void arch_send_reschedule(int cpu);
+void arch_send_call_function_ipi(int cpu);
+
+int smp_intr_init(void);
+
+#endif
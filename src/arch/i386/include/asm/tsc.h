@@ -0,0 +1,19 @@
+#ifndef _X86_TSC_H
+#define _X86_TSC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+static inline uint64_t rdtsc(void){
+	uint32_t lo, hi;
+	__asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+// 0 until calibrated, or when the TSC is not usable
+extern uint32_t tsc_khz;
+
+int tsc_init(void);
+time_ns_t tsc_cycles_to_ns(uint64_t cycles);
+
+#endif
@@ -0,0 +1,203 @@
+#include <arch/i386/apic.h>
+#include <arch/i386/pic.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <mm/mmu.h>
+#include <asm/cpu.h>
+#include <asm/irqflags.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+/**
+* Local APIC.
+*
+* Every CPU reaches its own local APIC at the same physical address. The
+* boot CPU keeps taking the PIC interrupts through LINT0 in virtual wire
+* mode; the local APICs only add the IPIs and a per-CPU timer.
+*/
+
+#define MSR_APIC_BASE        0x1B
+#define MSR_APIC_BASE_ENABLE (1 << 11)
+#define MSR_APIC_BASE_MASK   0xFFFFF000
+
+#define CPUID_1_EDX_APIC (1 << 9)
+
+// Registers, offsets from the base
+#define APIC_ID         0x020
+#define APIC_TPR        0x080
+#define APIC_EOI        0x0B0
+#define APIC_SVR        0x0F0
+#define APIC_ESR        0x280
+#define APIC_ICR_LOW    0x300
+#define APIC_ICR_HIGH   0x310
+#define APIC_LVT_TIMER  0x320
+#define APIC_LVT_LINT0  0x350
+#define APIC_LVT_LINT1  0x360
+#define APIC_LVT_ERROR  0x370
+#define APIC_TIMER_INIT 0x380
+#define APIC_TIMER_CUR  0x390
+#define APIC_TIMER_DIV  0x3E0
+
+#define APIC_SVR_ENABLE         (1 << 8)
+#define APIC_LVT_MASKED         (1 << 16)
+#define APIC_LVT_TIMER_PERIODIC (1 << 17)
+#define APIC_TIMER_DIV_16       0x3
+
+// ICR delivery modes and flags
+#define APIC_DM_FIXED   0x000
+#define APIC_DM_NMI     0x400
+#define APIC_DM_INIT    0x500
+#define APIC_DM_STARTUP 0x600
+#define APIC_DM_EXTINT  0x700
+#define APIC_ICR_BUSY   (1 << 12)
+#define APIC_ICR_ASSERT (1 << 14)
+#define APIC_ICR_LEVEL  (1 << 15)
+
+#define IPI_WAIT_LOOPS  100000
+
+#define CALIBRATE_MS    10
+#define CALIBRATE_COUNT (PIT_FREQUENCY * CALIBRATE_MS / 1000)
+#define CALIBRATE_LOOPS 1000000
+
+static volatile uint32_t* lapic;
+static uint32_t lapic_timer_freq; // timer counts per second, divided by 16
+
+static inline uint32_t lapic_read(uint32_t reg){
+	return lapic[reg >> 2];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val){
+	lapic[reg >> 2] = val;
+}
+
+int lapic_present(void){
+	return lapic != NULL;
+}
+
+uint8_t lapic_id(void){
+	return lapic_read(APIC_ID) >> 24;
+}
+
+void lapic_eoi(void){
+	lapic_write(APIC_EOI, 0);
+}
+
+/* Map the local APIC, `phys` 0 takes the address the firmware left in the MSR */
+int __init lapic_init(uintptr_t phys){
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if(!(edx & CPUID_1_EDX_APIC)){
+		return -ENODEV;
+	}
+
+	if(!phys){
+		phys = rdmsr(MSR_APIC_BASE) & MSR_APIC_BASE_MASK;
+	}
+
+	lapic = mmu_ioremap(phys, PAGE_SIZE);
+	if(!lapic){
+		return -ENOMEM;
+	}
+
+	printk("APIC: local APIC at %#lx\n", phys);
+	return SUCCESS;
+}
+
+/* Enable this CPU's local APIC, only the boot CPU takes PIC interrupts and NMIs */
+void lapic_setup(int bsp){
+	wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | MSR_APIC_BASE_ENABLE);
+
+	lapic_write(APIC_TPR, 0);
+	lapic_write(APIC_LVT_TIMER, APIC_LVT_MASKED);
+	lapic_write(APIC_LVT_LINT0, bsp ? APIC_DM_EXTINT : APIC_LVT_MASKED);
+	lapic_write(APIC_LVT_LINT1, bsp ? APIC_DM_NMI : APIC_LVT_MASKED);
+	lapic_write(APIC_LVT_ERROR, APIC_LVT_MASKED);
+
+	// The error status only updates on write
+	lapic_write(APIC_ESR, 0);
+	lapic_write(APIC_ESR, 0);
+
+	lapic_eoi();
+	lapic_write(APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+int lapic_ipi_wait(void){
+	for(int i = 0; i < IPI_WAIT_LOOPS; i++){
+		if(!(lapic_read(APIC_ICR_LOW) & APIC_ICR_BUSY)){
+			return SUCCESS;
+		}
+
+		cpu_relax();
+	}
+
+	return -ETIME;
+}
+
+// The ICR is two registers, an IPI sent from an interrupt can't land in between
+static void lapic_icr_write(uint8_t apic_id, uint32_t low){
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	lapic_ipi_wait();
+	lapic_write(APIC_ICR_HIGH, (uint32_t)apic_id << 24);
+	lapic_write(APIC_ICR_LOW, low);
+
+	local_irq_restore(flags);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector){
+	lapic_icr_write(apic_id, APIC_DM_FIXED | vector);
+}
+
+void lapic_send_init(uint8_t apic_id){
+	lapic_icr_write(apic_id, APIC_DM_INIT | APIC_ICR_LEVEL | APIC_ICR_ASSERT);
+	lapic_ipi_wait();
+
+	// Deassert, only the old discrete APICs look at it
+	lapic_icr_write(apic_id, APIC_DM_INIT | APIC_ICR_LEVEL);
+	lapic_ipi_wait();
+}
+
+/* Start `apic_id` in real mode at page `page` (address page << 12) */
+void lapic_send_startup(uint8_t apic_id, uint8_t page){
+	lapic_icr_write(apic_id, APIC_DM_STARTUP | page);
+	lapic_ipi_wait();
+}
+
+/*
+* The timer runs off the bus clock, the same on every CPU, so the boot CPU
+* measures it once against PIT channel 2.
+*/
+int __init lapic_timer_calibrate(void){
+	int loops = 0;
+
+	lapic_write(APIC_TIMER_DIV, APIC_TIMER_DIV_16);
+	lapic_write(APIC_LVT_TIMER, APIC_LVT_MASKED);
+
+	pit_ch2_start(CALIBRATE_COUNT);
+	lapic_write(APIC_TIMER_INIT, 0xFFFFFFFF);
+
+	while(!pit_ch2_expired()){
+		if(++loops > CALIBRATE_LOOPS){
+			lapic_write(APIC_TIMER_INIT, 0);
+			return -ETIME;
+		}
+	}
+
+	uint32_t elapsed = 0xFFFFFFFF - lapic_read(APIC_TIMER_CUR);
+	lapic_write(APIC_TIMER_INIT, 0);
+
+	lapic_timer_freq = elapsed * (1000 / CALIBRATE_MS);
+	printk("APIC: timer %u kHz\n", lapic_timer_freq / 1000);
+
+	return lapic_timer_freq ? SUCCESS : -EINVAL;
+}
+
+/* Periodic interrupt on APIC_TIMER_VECTOR for this CPU */
+void lapic_timer_start(uint32_t hz){
+	lapic_write(APIC_TIMER_DIV, APIC_TIMER_DIV_16);
+	lapic_write(APIC_LVT_TIMER, APIC_TIMER_VECTOR | APIC_LVT_TIMER_PERIODIC);
+	lapic_write(APIC_TIMER_INIT, lapic_timer_freq / hz);
+}
@@ -24,6 +24,14 @@ void atomic_sub(int i, atomic_t *v){
 	arch_atomic_sub(i, v);
 }
 
+void atomic_or(int i, atomic_t *v){
+	arch_atomic_or(i, v);
+}
+
+void atomic_andnot(int i, atomic_t *v){
+	arch_atomic_andnot(i, v);
+}
+
 void atomic_inc(atomic_t *v){
 	arch_atomic_inc(v);
 }
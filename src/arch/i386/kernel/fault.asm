@@ -1,13 +1,54 @@
 global page_fault_entry
+global device_not_available_entry
 
 extern page_fault_handler
+extern device_not_available_handler
+extern kernel_registers
+extern task_exit_to_user
+extern user_registers
 
 page_fault_entry:
 	push dword 14 ; int num
 	pushad
+
+	; Per-CPU data, current included, is reached through the kernel's %fs
+	call kernel_registers
+
 	push esp
 	call page_fault_handler
 	add esp, 4
+
+	test dword [esp+44], 3
+	jz .restore
+
+	; exit_group() from another thread
+	call task_exit_to_user
+	call user_registers
+
+.restore:
+	popad
+	add esp, 8 ; clear codes
+	iretd
+
+device_not_available_entry:
+	push dword 0 ; no error code
+	push dword 7 ; int num
+	pushad
+
+	call kernel_registers
+
+	push esp
+	call device_not_available_handler
+	add esp, 4
+
+	test dword [esp+44], 3
+	jz .restore
+
+	; exit_group() from another thread
+	call task_exit_to_user
+	call user_registers
+
+.restore:
 	popad
 	add esp, 8 ; clear codes
-	iretd
\ No newline at end of file
+	iretd
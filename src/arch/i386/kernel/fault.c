@@ -2,6 +2,7 @@
 #include <kernel/panic.h>
 #include <kernel/printk.h>
 #include <mm/page.h>
+#include <mm/swap.h>
 #include <mm/vma.h>
 #include <def/errno.h>
 #include <def/linker.h>
@@ -12,6 +13,7 @@
 
 
 extern void page_fault_entry();
+extern void device_not_available_entry();
 
 typedef struct {
 	unsigned long addr;
@@ -79,7 +81,8 @@ static int vm_handle_file(struct vm_region* region, uintptr_t addr){
 	size_t region_offset = page_addr - region->start;
 	off_t file_offset = region->file_offset + region_offset;
 
-	struct page* page = page_alloc(0, 0x0);
+	uint16_t flags = (region->mem_flags & MEM_SHARED) ? 0x0 : PG_ANON;
+	struct page* page = page_alloc_reclaim(0, flags);
 	if (!page) return -ENOMEM;
 
 	void* kernel_virt = (void*)page_to_virt(page);
@@ -115,7 +118,7 @@ static int vm_handle_file(struct vm_region* region, uintptr_t addr){
 
 static int vm_handle_stack(struct vm_region* region, uintptr_t addr){
 	uintptr_t page_addr = addr & ~(PAGE_SIZE - 1);
-	struct page* page = page_alloc(1, 0x0);
+	struct page* page = page_alloc_reclaim(0, PG_ANON);
 	if (!page) return -ENOMEM;
 
 	void* kernel_virt = (void*)page_to_virt(page);
@@ -150,9 +153,20 @@ static int vm_handle_cow(struct vm_region* region, uintptr_t addr){
 		page_addr
 	);
 
+	// Unmapped or swapped out since, the access faults again
+	if (!phys) return SUCCESS;
+
 	struct page* page = phys_to_page(phys);
 	if (!page) return -ENOENT;
 
+	/* Sole owner of a page kept in the swap cache: drop the stale slot
+	* and write to the page in place.
+	*/
+	if((page->flags & PG_SWAPCACHE) && !(page->flags & PG_WRITEBACK) &&
+		atomic_read(&page->refcount) == 2 && swap_count(page_swp_entry(page)) == 1){
+		swap_cache_del(page);
+	}
+
 	if(atomic_read(&page->refcount) == 1){
 		mmu_set_flags(
 			current->mm->ctx,
@@ -164,8 +178,23 @@ static int vm_handle_cow(struct vm_region* region, uintptr_t addr){
 		return SUCCESS;
 	}
 
-	struct page* new_page = page_alloc(1, 0x0);
-	if (!new_page) return -ENOMEM;
+	/* Reclaim run by the allocation may swap this very page out, it
+	* holds our fault_lock already. Keep the page until it is copied and
+	* check the PTE still maps it before replacing it.
+	*/
+	page_get(page);
+
+	struct page* new_page = page_alloc_reclaim(0, PG_ANON);
+	if (!new_page){
+		page_put(page);
+		return -ENOMEM;
+	}
+
+	if (mmu_translate(current->mm->ctx, page_addr) != phys){
+		page_free(new_page);
+		page_put(page);
+		return SUCCESS;
+	}
 
 	memcpy(
 		(void*)page_to_virt(new_page),
@@ -183,22 +212,138 @@ static int vm_handle_cow(struct vm_region* region, uintptr_t addr){
 
 	if(IS_ERR_VALUE(res)){
 		page_free(new_page);
+		page_put(page);
 		return res;
 	}
 
 	mmu_invlpg(current->mm->ctx, page_addr);
 
+	// Our reference and the one the old PTE held
+	page_put(page);
 	page_put(page);
 
 	return SUCCESS;
 }
 
+static int vm_handle_swap(struct vm_region* region, uintptr_t addr, swp_entry_t entry){
+	uintptr_t page_addr = addr & ~(PAGE_SIZE - 1);
+
+	struct page* page = swapin_readahead(entry);
+	if (IS_ERR_VALUE(page)) return PTR_ERR(page);
+
+	/* Cache plus this PTE are the only users: take the page out of the
+	* cache and map it as is. Otherwise map it read only so the first
+	* write goes through vm_handle_cow.
+	*/
+	mem_flags_t flags = region->mem_flags;
+	if (swap_count(entry) == 2 && !(page->flags & PG_WRITEBACK)) {
+		swap_cache_del(page);
+	}
+	else {
+		flags &= ~MEM_WRITE;
+	}
+
+	int res = mmu_mmap(
+		current->mm->ctx,
+		page_to_phys(page),
+		page_addr,
+		PAGE_SIZE,
+		flags
+	);
+
+	if(IS_ERR_VALUE(res)){
+		page_put(page);
+		return res;
+	}
+
+	swap_free(entry);
+	mmu_invlpg(current->mm->ctx, page_addr);
+
+	return SUCCESS;
+}
+
+/* Kernel access (e.g. copy_from_user) to a swapped out user page */
+static int vm_kernel_swapin(uintptr_t addr){
+	swp_entry_t entry;
+
+	if (!current || !current->mm || addr >= USER_SPACE_END)
+		return -EFAULT;
+
+	struct mm_struct* mm = current->mm;
+
+	struct vm_region* region = vma_lookup(mm, addr);
+	if (!region)
+		return -EFAULT;
+
+	mutex_lock(&mm->fault_lock);
+
+	int res;
+	if (mmu_translate(mm->ctx, addr))
+		res = SUCCESS;
+	else if (mmu_get_swap_entry(mm->ctx, addr, &entry) == SUCCESS)
+		res = vm_handle_swap(region, addr, entry);
+	else
+		res = -EFAULT;
+
+	mutex_unlock(&mm->fault_lock);
+	return res;
+}
+
+/*
+* Threads sharing the address space fault on it concurrently, so the PTE
+* is looked at again under fault_lock: a racing fault may have mapped,
+* swapped in or copied it already. Reclaim, KSM, compaction and fork
+* rewrite PTEs under the same lock. -EFAULT for a bad access.
+*/
+static int handle_mm_fault(struct vm_region* region, pf_info_t* pf){
+	struct paging_ctx* ctx = current->mm->ctx;
+
+	if (pf->write && !(region->mem_flags & MEM_WRITE))
+		return -EFAULT;
+
+	if (!pf->write && !(region->mem_flags & MEM_READ))
+		return -EFAULT;
+
+	if (pf->exec && !(region->mem_flags & MEM_EXEC))
+		return -EFAULT;
+
+	if(pf->present){
+		if(pf->write){
+			return vm_handle_cow(region, pf->addr);
+		}
+
+		return -EFAULT;
+	}
+
+	if(mmu_translate(ctx, pf->addr)){
+		return SUCCESS;
+	}
+
+	swp_entry_t entry;
+	if(mmu_get_swap_entry(ctx, pf->addr, &entry) == SUCCESS){
+		return vm_handle_swap(region, pf->addr, entry);
+	}
+
+	if(region->mem_flags & MEM_GROWSDOWN){
+		return vm_handle_stack(region, pf->addr);
+	}
+
+	if(region->file){
+		return vm_handle_file(region, pf->addr);
+	}
+
+	return -1;
+}
+
 void page_fault_handler(struct registers* regs){
 	pf_info_t pf = pf_decode(regs->err_code, cr2());
 	
 	int handle_res = -1;
 
 	if(!current || !pf.user){
+		if (!pf.present && vm_kernel_swapin(pf.addr) == SUCCESS){
+			return;
+		}
 
 		struct exception_entry* e = find_extable(regs->ip);
 		if (e){
@@ -217,41 +362,14 @@ void page_fault_handler(struct registers* regs){
 		goto segfault;
 	}
 
-	if(pf.present){
-		if (pf.write && !(region->mem_flags & MEM_WRITE))
-			goto segfault;
+	mutex_lock(&current->mm->fault_lock);
+	handle_res = handle_mm_fault(region, &pf);
+	mutex_unlock(&current->mm->fault_lock);
 
-		if (!pf.write && !(region->mem_flags & MEM_READ))
-			goto segfault;
-
-		if (pf.exec && !(region->mem_flags & MEM_EXEC))
-			goto segfault;
-
-		if(pf.write && (region->mem_flags & MEM_WRITE)){
-			handle_res = vm_handle_cow(region, pf.addr);
-			goto check_res;
-		}
-		
+	if(handle_res == -EFAULT){
 		goto segfault;
 	}
 
-	if (pf.write && !(region->mem_flags & MEM_WRITE))
-		goto segfault;
-
-	if (!pf.write && !(region->mem_flags & MEM_READ))
-		goto segfault;
-
-	if (pf.exec && !(region->mem_flags & MEM_EXEC))
-		goto segfault;
-
-	if(region->mem_flags & MEM_GROWSDOWN){
-		handle_res = vm_handle_stack(region, pf.addr);
-	}
-	else if(region->file){
-		handle_res = vm_handle_file(region, pf.addr);
-	}
-
-check_res:
 	if(handle_res != 0){
 		printk("page_fault_handler: handler: failed with status \"%d\"!\n", handle_res);
 		goto kill;
@@ -274,4 +392,12 @@ void __init fault_init(){
 		GDT_KERNEL_CODE,
 		(IDT_PRESENT | IDT_DPL0 | IDT_TYPE_INT_GATE32)
 	);
+
+	// Lazy FPU switching, see fpu.c
+	idt_set_gate(
+		0x7,
+		(uint32_t)device_not_available_entry,
+		GDT_KERNEL_CODE,
+		(IDT_PRESENT | IDT_DPL0 | IDT_TYPE_INT_GATE32)
+	);
 }
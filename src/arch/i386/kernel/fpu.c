@@ -0,0 +1,226 @@
+#include <asm/fpu.h>
+#include <asm/cpu.h>
+#include <asm/irqflags.h>
+#include <kernel/sched.h>
+#include <kernel/softirq.h>
+#include <kernel/preempt.h>
+#include <kernel/printk.h>
+#include <kernel/panic.h>
+#include <mm/kheap.h>
+#include <lib/string.h>
+#include <lib/assert.h>
+#include <def/errno.h>
+
+/**
+* Lazy FPU/SSE switching.
+*
+* CR0.TS is left set whenever nobody owns the FPU, so the first x87/SSE
+* instruction of a task traps with #NM: only then are its registers loaded
+* and the task made the CPU's fpu_owner. The owner has its registers saved
+* when switched out and TS set again, tasks that don't use the FPU never
+* pay for it. Ownership doesn't outlive a switch, so a task moving to
+* another CPU has nothing left behind.
+*/
+
+#define CPUID_1_EDX_FPU  (1 << 0)
+#define CPUID_1_EDX_FXSR (1 << 24)
+#define CPUID_1_EDX_SSE  (1 << 25)
+
+DEFINE_PER_CPU(struct task*, fpu_owner);
+static DEFINE_PER_CPU(int, in_kernel_fpu);
+
+static int fpu_has_fxsr;
+static int fpu_has_sse;
+
+static inline void fpu_save(void* state){
+	if(fpu_has_fxsr){
+		__asm__ volatile("fxsave (%0)" :: "r"(state) : "memory");
+	} else {
+		// Reinitializes the FPU, its registers are given up right after
+		__asm__ volatile("fnsave (%0); fwait" :: "r"(state) : "memory");
+	}
+}
+
+static inline void fpu_restore(void* state){
+	if(fpu_has_fxsr){
+		__asm__ volatile("fxrstor (%0)" :: "r"(state) : "memory");
+	} else {
+		__asm__ volatile("frstor (%0)" :: "r"(state) : "memory");
+	}
+}
+
+// Power-on state, x87 and SSE exceptions masked
+static inline void fpu_init_regs(void){
+	uint32_t mxcsr = MXCSR_DEFAULT;
+
+	__asm__ volatile("fninit");
+
+	if(fpu_has_sse){
+		__asm__ volatile("ldmxcsr %0" :: "m"(mxcsr));
+	}
+}
+
+// Save the owner's registers and give the FPU up, preemption off
+static void fpu_unlazy(void){
+	struct task* owner = this_cpu_read(fpu_owner);
+
+	if(owner){
+		fpu_save(owner->fpu.state);
+		this_cpu_write(fpu_owner, NULL);
+		stts();
+	}
+}
+
+static int fpu_alloc(struct fpu* fpu){
+	void* buf = kmalloc(FPU_STATE_SIZE + FPU_STATE_ALIGN - 1);
+	if(!buf){
+		return -ENOMEM;
+	}
+
+	// fxsave wants it 16 byte aligned, kmalloc() doesn't promise that
+	fpu->buf = buf;
+	fpu->state = (void*)(((uintptr_t)buf + FPU_STATE_ALIGN - 1) & ~(uintptr_t)(FPU_STATE_ALIGN - 1));
+	fpu->initialized = 0;
+
+	return SUCCESS;
+}
+
+/* Each CPU, from cpu_init() */
+__init void fpu_init_cpu(void){
+	uint32_t eax, ebx, ecx, edx;
+	unsigned long cr0, cr4;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if(!(edx & CPUID_1_EDX_FPU)){
+		panic("Setup: fpu: no x87 FPU");
+	}
+
+	fpu_has_fxsr = !!(edx & CPUID_1_EDX_FXSR);
+	fpu_has_sse = fpu_has_fxsr && (edx & CPUID_1_EDX_SSE);
+
+	// Native FPU, errors raised as #MF, and nobody owns it yet
+	cr0 = read_cr0();
+	cr0 &= ~X86_CR0_EM;
+	cr0 |= X86_CR0_MP | X86_CR0_NE | X86_CR0_TS;
+	write_cr0(cr0);
+
+	if(fpu_has_fxsr){
+		cr4 = read_cr4() | X86_CR4_OSFXSR;
+		if(fpu_has_sse){
+			cr4 |= X86_CR4_OSXMMEXCPT;
+		}
+		write_cr4(cr4);
+	}
+}
+
+/* From context_switch(), interrupts off */
+void fpu_switch_out(struct task* prev){
+	if(this_cpu_read(fpu_owner) == prev){
+		fpu_unlazy();
+	}
+}
+
+/* fork(): the child starts off with a copy of the parent's registers */
+int fpu_copy(struct task* dst, struct task* src){
+	memset(&dst->fpu, 0, sizeof(dst->fpu));
+
+	if(!src->fpu.state){
+		return SUCCESS;
+	}
+
+	int ret = fpu_alloc(&dst->fpu);
+	if(ret){
+		return ret;
+	}
+
+	preempt_disable();
+
+	if(this_cpu_read(fpu_owner) == src){
+		fpu_unlazy();
+	}
+
+	preempt_enable();
+
+	memcpy(dst->fpu.state, src->fpu.state, FPU_STATE_SIZE);
+	dst->fpu.initialized = src->fpu.initialized;
+
+	return SUCCESS;
+}
+
+/* exec(): the new program starts from the power-on state, the buffer is kept */
+void fpu_reset(struct task* task){
+	preempt_disable();
+
+	// Whatever is live belongs to the old program, no need to save it
+	if(this_cpu_read(fpu_owner) == task){
+		this_cpu_write(fpu_owner, NULL);
+		stts();
+	}
+
+	task->fpu.initialized = 0;
+
+	preempt_enable();
+}
+
+/* The task is gone from every CPU */
+void fpu_release(struct task* task){
+	if(task->fpu.buf){
+		kfree(task->fpu.buf);
+	}
+
+	memset(&task->fpu, 0, sizeof(task->fpu));
+}
+
+/* #NM, a task touched the FPU with TS set; interrupt gate, interrupts off */
+asmlinkage void device_not_available_handler(struct registers* regs){
+	struct task* task = current;
+
+	if(!regs_is_user_mode(regs)){
+		printk("FPU used by the kernel outside kernel_fpu_begin() at %#010lx\n", regs->ip);
+		panic("Killed thread\n");
+	}
+
+	if(!task->fpu.state){
+		local_irq_enable();
+
+		if(fpu_alloc(&task->fpu)){
+			printk("No memory for the FPU state of \"[%d:%s]\"\n", task->pid, task->name);
+			task_exit(task, -ENOMEM);
+			schedule();
+			unreachable();
+		}
+
+		local_irq_disable();
+	}
+
+	clts();
+
+	if(task->fpu.initialized){
+		fpu_restore(task->fpu.state);
+	} else {
+		fpu_init_regs();
+		task->fpu.initialized = 1;
+	}
+
+	this_cpu_write(fpu_owner, task);
+}
+
+void kernel_fpu_begin(void){
+	BUG_ON(in_irq());
+
+	local_bh_disable();
+
+	BUG_ON(this_cpu_read(in_kernel_fpu));
+	this_cpu_write(in_kernel_fpu, 1);
+
+	fpu_unlazy();
+	clts();
+	fpu_init_regs();
+}
+
+void kernel_fpu_end(void){
+	stts();
+	this_cpu_write(in_kernel_fpu, 0);
+
+	local_bh_enable();
+}
@@ -2,11 +2,15 @@
 #include <kernel/clock.h>
 #include <kernel/interrupt.h>
 #include <kernel/printk.h>
+#include <kernel/preempt.h>
 #include <mm/kheap.h>
 #include <asm/idt.h>
+#include <asm/irq_regs.h>
 #include <def/errno.h>
 #include <lib/string.h>
 #include <arch/i386/pic.h>
+#include <arch/i386/apic.h>
+#include <asm/smp.h>
 
 static const char* exception_messages[] = {
 	"Division By Zero", "Debug", "Non Maskable Interrupt", "Breakpoint",
@@ -26,6 +30,8 @@ static struct IDTr_ptr idtr_ptr;
 
 static struct irq_desc irq_table[TOTAL_INTERRUPTS];
 
+DEFINE_PER_CPU(struct registers*, irq_regs);
+
 extern void kernel_registers();
 extern void user_registers();
 
@@ -61,6 +67,11 @@ __init void idt_init(){
 	printk("Setup: idt: loaded \"%#lx\".\n", &idtr_ptr);
 }
 
+/* Application processors share the boot CPU's table */
+void idt_load(void){
+	_idt_load(&idtr_ptr);
+}
+
 void interrupts_enable(){
 	__asm__ volatile ("sti");
 }
@@ -190,7 +201,7 @@ static void _print_frame(struct registers* regs){
 }
 
 static void _build_irq_info(struct irq_info* info, struct registers* regs){
-	info->cpu.cpu_id = 0;
+	info->cpu.cpu_id = smp_processor_id();
 	info->cpu.regs = regs;
 	info->cpu.from_user = regs_is_user_mode(regs);
 
@@ -213,9 +224,14 @@ void __cdecl interrupt_handler(struct registers* regs){
 
 	int interrupt = regs->int_no;
 
-	if(likely(current))
+	// Only user frames, a system call keeps its own in there
+	int from_user = regs_is_user_mode(regs);
+	if(likely(current) && from_user)
 		current->regs = *regs;
 
+	preempt_count_add(HARDIRQ_OFFSET);
+	struct registers* old_regs = set_irq_regs(regs);
+
 	struct irq_handler_node* h = irq_table[interrupt].handlers;
 
 	struct irq_info info;
@@ -253,11 +269,22 @@ void __cdecl interrupt_handler(struct registers* regs){
 	if(info.route.irq_id == IRQ_WR_TIMER)
 		clockevent_fire();
 
-	if(likely(current))
+	set_irq_regs(old_regs);
+	preempt_count_sub(HARDIRQ_OFFSET);
+
+	if(likely(current) && from_user)
 		*regs = current->regs;
 }
 
+/* Local APIC vectors, timer and IPIs, sit above the PIC ones */
 void interrupt_eoi(uint8_t interrupt){
+	if(interrupt >= APIC_VECTOR_BASE){
+		if(interrupt != APIC_SPURIOUS_VECTOR){
+			lapic_eoi();
+		}
+		return;
+	}
+
 	pic_send_eoi(interrupt);
 }
 
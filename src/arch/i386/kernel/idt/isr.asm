@@ -6,13 +6,13 @@ global kernel_thread_trampoline
 ; methods
 extern interrupt_handler
 extern interrupt_eoi
-extern schedule
-extern task_exit
+extern irq_exit_softirq
+extern kernel_thread_exit
+extern preempt_schedule_irq
+extern task_exit_to_user
+extern user_registers
 extern panic
 
-; vars
-extern need_resched
-
 ;struct registers {
 ;	// pushad regs order
 ;	unsigned long di (00), si (04), bp (08), ksp (12);
@@ -76,15 +76,21 @@ _ret_from_intr:
 	call interrupt_eoi
 	add esp, 4
 
+	; Bottom halves, with the interrupt acknowledged
+	call irq_exit_softirq
+
 .no_eoi:
-	mov eax, [need_resched]
-	test eax, eax
-	jz .restore
+	push esp
+	call preempt_schedule_irq
+	add esp, 4
 
-	mov dword [need_resched], 0
-	call schedule
+	; iret would null the kernel data segments, the per-CPU %fs included
+	test dword [esp+44], 3
+	jz .restore
 
-	mov ebp, esp
+	; exit_group() from another thread
+	call task_exit_to_user
+	call user_registers
 
 .restore:
 	popad       ; restore all registers
@@ -97,7 +103,7 @@ kernel_thread_trampoline:
 	call eax
 
 	push eax
-	call task_exit
+	call kernel_thread_exit
 
 	push _trampoline_return_msg
 	call panic
@@ -124,7 +130,12 @@ ret_from_fork:
 
 ; ss and sp is removed and kernel_thread_trampoline
 ; access args correctly.
+	jmp .restore
+
 .not_same_priv:
+	call user_registers
+
+.restore:
 	popad
 	add esp,8 ; clear err_code and int_no
 	iret
@@ -13,6 +13,22 @@
 #define PIC_COMMAND   0x43
 #define PIC_FREQUENCY 1193182
 
+// PIT channel 0 modes, lobyte/hibyte access
+#define PIT_MODE_ONESHOT  0x30 // interrupt on terminal count
+#define PIT_MODE_PERIODIC 0x36 // square wave
+#define PIT_READBACK_CH0  0xC2 // latch count and status
+
+#define PIT_STATUS_OUT       0x80
+#define PIT_STATUS_NULLCOUNT 0x40
+
+// Channel 2, gated through the keyboard controller port B
+#define PIT_CHANNEL2      0x42
+#define PIT_MODE_CH2_ONESHOT 0xB0
+#define PIT_PORT_B        0x61
+#define PIT_PORT_B_GATE2  0x01
+#define PIT_PORT_B_SPKR   0x02
+#define PIT_PORT_B_OUT2   0x20
+
 #define PIC_READ_IRR 0x0a
 #define PIC_READ_ISR 0x0b
 
@@ -63,16 +79,66 @@ static void _irq15_handler() {
     outb(PIC1_COMMAND, PIC_EOI);
 }
 
-void __init pic_init(uint32_t frequency) {
-	pic_remap();
+static uint16_t pit_oneshot_count;
 
+void pit_set_periodic(uint32_t frequency) {
 	uint16_t divisor = (uint16_t)(PIC_FREQUENCY / frequency);
 
-	outb(PIC_CHANNEL0, 0x36);                  // Channel 0, lobyte/hibyte
-	outb(PIC_COMMAND, divisor & 0xFF);         // low end
+	outb(PIC_COMMAND, PIT_MODE_PERIODIC);
+	outb(PIC_CHANNEL0, divisor & 0xFF);        // low end
 	outb(PIC_CHANNEL0, (divisor >> 8) & 0xFF); // high end
 }
 
+void pit_set_oneshot(uint16_t count) {
+	pit_oneshot_count = count;
+
+	outb(PIC_COMMAND, PIT_MODE_ONESHOT);
+	outb(PIC_CHANNEL0, count & 0xFF);
+	outb(PIC_CHANNEL0, (count >> 8) & 0xFF);
+}
+
+/*
+* PIT cycles since the last pit_set_oneshot. After the terminal count OUT
+* stays high and the counter keeps going down from 0xFFFF, which gives the
+* overshoot for up to one more wrap.
+*/
+uint32_t pit_oneshot_elapsed(void) {
+	outb(PIC_COMMAND, PIT_READBACK_CH0);
+
+	uint8_t status = inb(PIC_CHANNEL0);
+	uint16_t count = inb(PIC_CHANNEL0);
+	count |= inb(PIC_CHANNEL0) << 8;
+
+	if (status & PIT_STATUS_OUT)
+		return pit_oneshot_count + (uint16_t)(0x10000 - count);
+
+	if ((status & PIT_STATUS_NULLCOUNT) || count > pit_oneshot_count)
+		return 0;
+
+	return pit_oneshot_count - count;
+}
+
+/*
+* Start a one-shot countdown on channel 2 with the speaker off. Channel 0
+* is left alone, so this works as a reference while the tick runs.
+*/
+void pit_ch2_start(uint16_t count) {
+	outb(PIT_PORT_B, (inb(PIT_PORT_B) & ~PIT_PORT_B_SPKR) | PIT_PORT_B_GATE2);
+
+	outb(PIC_COMMAND, PIT_MODE_CH2_ONESHOT);
+	outb(PIT_CHANNEL2, count & 0xFF);
+	outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+}
+
+int pit_ch2_expired(void) {
+	return !!(inb(PIT_PORT_B) & PIT_PORT_B_OUT2);
+}
+
+void __init pic_init(uint32_t frequency) {
+	pic_remap();
+	pit_set_periodic(frequency);
+}
+
 void pic_send_eoi(uint8_t irq)
 {
     if(irq == 7){
@@ -0,0 +1,275 @@
+#include <arch/i386/apic.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <mm/mmu.h>
+#include <asm/page.h>
+#include <lib/string.h>
+#include <def/compile.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+/**
+* CPU enumeration.
+*
+* The ACPI MADT lists one local APIC entry per CPU. Machines from before
+* ACPI have the Intel MP table instead, found through the "_MP_" floating
+* pointer. Both anchors live in the first KiB of the EBDA or in the BIOS
+* ROM; the tables they point to can be anywhere and get mapped.
+*/
+
+#define BIOS_EBDA_SEGMENT 0x40E
+#define BIOS_BASEMEM_TOP  0x9FC00
+#define BIOS_ROM_START    0xE0000
+#define BIOS_ROM_END      0x100000
+
+struct acpi_rsdp {
+	char signature[8];
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t revision;
+	uint32_t rsdt_addr;
+} __packed;
+
+struct acpi_sdt_header {
+	char signature[4];
+	uint32_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __packed;
+
+struct acpi_madt {
+	struct acpi_sdt_header header;
+	uint32_t lapic_addr;
+	uint32_t flags;
+} __packed;
+
+#define MADT_TYPE_LAPIC 0
+#define MADT_LAPIC_ENABLED (1 << 0)
+
+struct madt_entry {
+	uint8_t type;
+	uint8_t length;
+} __packed;
+
+struct madt_lapic {
+	struct madt_entry entry;
+	uint8_t processor_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __packed;
+
+struct mpf_intel {
+	char signature[4];
+	uint32_t config;
+	uint8_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	uint8_t feature[5];
+} __packed;
+
+struct mpc_table {
+	char signature[4];
+	uint16_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem[8];
+	char product[12];
+	uint32_t oem_ptr;
+	uint16_t oem_size;
+	uint16_t entries;
+	uint32_t lapic_addr;
+	uint16_t ext_length;
+	uint8_t ext_checksum;
+	uint8_t reserved;
+} __packed;
+
+#define MPC_TYPE_PROCESSOR 0
+#define MPC_CPU_ENABLED    (1 << 0)
+
+struct mpc_cpu {
+	uint8_t type;
+	uint8_t apic_id;
+	uint8_t apic_ver;
+	uint8_t flags;
+	uint32_t signature;
+	uint32_t features;
+	uint32_t reserved[2];
+} __packed;
+
+// Every other MP table entry type is 8 bytes
+#define MPC_ENTRY_SIZE 8
+
+static int __init checksum_ok(const void* data, size_t len){
+	const uint8_t* p = data;
+	uint8_t sum = 0;
+
+	while(len--){
+		sum += *p++;
+	}
+
+	return sum == 0;
+}
+
+// The first MiB is in the direct map, tables above it are mapped on demand
+static void* __init map_table(uintptr_t phys, size_t size){
+	if(phys + size <= BIOS_ROM_END){
+		return (void*)__va(phys);
+	}
+
+	return mmu_ioremap(phys, size);
+}
+
+static void* __init scan_anchor(uintptr_t start, size_t len, const char* sig, size_t sig_len, size_t size){
+	for(uintptr_t phys = start; phys + size <= start + len; phys += 16){
+		void* p = (void*)__va(phys);
+
+		if(!memcmp(p, sig, sig_len) && checksum_ok(p, size)){
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static void* __init find_anchor(const char* sig, size_t sig_len, size_t size){
+	uintptr_t ebda = (uintptr_t)*(uint16_t*)__va(BIOS_EBDA_SEGMENT) << 4;
+	void* p = NULL;
+
+	if(ebda){
+		p = scan_anchor(ebda, KiB(1), sig, sig_len, size);
+	}
+
+	if(!p){
+		p = scan_anchor(BIOS_BASEMEM_TOP, KiB(1), sig, sig_len, size);
+	}
+
+	if(!p){
+		p = scan_anchor(BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START, sig, sig_len, size);
+	}
+
+	return p;
+}
+
+static struct acpi_sdt_header* __init acpi_map_sdt(uintptr_t phys){
+	struct acpi_sdt_header* hdr = map_table(phys, sizeof(*hdr));
+	if(!hdr){
+		return NULL;
+	}
+
+	hdr = map_table(phys, hdr->length);
+	if(!hdr || !checksum_ok(hdr, hdr->length)){
+		return NULL;
+	}
+
+	return hdr;
+}
+
+static int __init acpi_parse_madt(uintptr_t* lapic_phys, uint8_t* apic_ids, int max){
+	struct acpi_rsdp* rsdp = find_anchor("RSD PTR ", 8, sizeof(struct acpi_rsdp));
+	if(!rsdp){
+		return -ENOENT;
+	}
+
+	struct acpi_sdt_header* rsdt = acpi_map_sdt(rsdp->rsdt_addr);
+	if(!rsdt){
+		return -ENOENT;
+	}
+
+	uint32_t* tables = (uint32_t*)(rsdt + 1);
+	size_t nr_tables = (rsdt->length - sizeof(*rsdt)) / sizeof(uint32_t);
+
+	for(size_t i = 0; i < nr_tables; i++){
+		struct acpi_sdt_header* hdr = acpi_map_sdt(tables[i]);
+		if(!hdr || memcmp(hdr->signature, "APIC", 4)){
+			continue;
+		}
+
+		struct acpi_madt* madt = (struct acpi_madt*)hdr;
+		uint8_t* entry = (uint8_t*)(madt + 1);
+		uint8_t* end = (uint8_t*)madt + madt->header.length;
+		int nr = 0;
+
+		*lapic_phys = madt->lapic_addr;
+
+		while(entry + sizeof(struct madt_entry) <= end && nr < max){
+			struct madt_entry* e = (struct madt_entry*)entry;
+			if(e->length < sizeof(struct madt_entry)){
+				break;
+			}
+
+			if(e->type == MADT_TYPE_LAPIC){
+				struct madt_lapic* cpu = (struct madt_lapic*)e;
+				if(cpu->flags & MADT_LAPIC_ENABLED){
+					apic_ids[nr++] = cpu->apic_id;
+				}
+			}
+
+			entry += e->length;
+		}
+
+		return nr ? nr : -ENOENT;
+	}
+
+	return -ENOENT;
+}
+
+static int __init mp_parse_table(uintptr_t* lapic_phys, uint8_t* apic_ids, int max){
+	struct mpf_intel* mpf = find_anchor("_MP_", 4, sizeof(struct mpf_intel));
+
+	// No config table means one of the default two CPU setups, not worth it
+	if(!mpf || !mpf->config){
+		return -ENOENT;
+	}
+
+	struct mpc_table* mpc = map_table(mpf->config, sizeof(*mpc));
+	if(!mpc){
+		return -ENOENT;
+	}
+
+	mpc = map_table(mpf->config, mpc->length);
+	if(!mpc || memcmp(mpc->signature, "PCMP", 4) || !checksum_ok(mpc, mpc->length)){
+		return -ENOENT;
+	}
+
+	uint8_t* entry = (uint8_t*)(mpc + 1);
+	int nr = 0;
+
+	*lapic_phys = mpc->lapic_addr;
+
+	for(int i = 0; i < mpc->entries && nr < max; i++){
+		if(*entry != MPC_TYPE_PROCESSOR){
+			entry += MPC_ENTRY_SIZE;
+			continue;
+		}
+
+		struct mpc_cpu* cpu = (struct mpc_cpu*)entry;
+		if(cpu->flags & MPC_CPU_ENABLED){
+			apic_ids[nr++] = cpu->apic_id;
+		}
+
+		entry += sizeof(struct mpc_cpu);
+	}
+
+	return nr ? nr : -ENOENT;
+}
+
+int __init mp_find_config(uintptr_t* lapic_phys, uint8_t* apic_ids, int max){
+	int nr = acpi_parse_madt(lapic_phys, apic_ids, max);
+	if(nr > 0){
+		printk("SMP: %d CPUs in the ACPI MADT\n", nr);
+		return nr;
+	}
+
+	nr = mp_parse_table(lapic_phys, apic_ids, max);
+	if(nr > 0){
+		printk("SMP: %d CPUs in the MP table\n", nr);
+		return nr;
+	}
+
+	return -ENOENT;
+}
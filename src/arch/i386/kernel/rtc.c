@@ -118,6 +118,15 @@ int rtc_read(struct rtc_time* tm){
 	return 0;
 }
 
+/* Spin until the seconds register changes, lines up with an RTC update */
+void rtc_wait_second(void){
+	uint8_t second = cmos_read(CMOS_REG_SECONDS);
+
+	while(cmos_read(CMOS_REG_SECONDS) == second){
+		cpu_relax();
+	}
+}
+
 time_ns_t rtc_time_to_unix_ns(const struct rtc_time* tm){
 	uint64_t seconds = rtc_days_since_epoch(tm) * 86400ULL;
 	seconds += (uint64_t)tm->hour * 3600ULL;
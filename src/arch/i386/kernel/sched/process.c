@@ -2,7 +2,9 @@
 #include <kernel/printk.h>
 #include <lib/string.h>
 #include <asm/cpuflags.h>
+#include <asm/fpu.h>
 #include <mm/vma.h>
+#include <def/errno.h>
 
 extern asmlinkage void _switch_to(struct task* prev, struct task* to);
 extern asmlinkage __no_return void ret_from_fork();
@@ -29,7 +31,7 @@ void start_thread_kernel(struct registers* regs, void* entry_point, void* kernel
 	regs->ksp = (uint32_t)kernel_stack;
 }
 
-void copy_thread(struct task *p, struct task *c, int (*fn)(void*), void* args){
+int copy_thread(struct task *p, struct task *c, unsigned long usp, int (*fn)(void*), void* args){
 	unsigned long* ksp = c->kstack + PROC_KERNEL_STACK_SIZE;
 
 	// Create kernel thread
@@ -46,9 +48,19 @@ void copy_thread(struct task *p, struct task *c, int (*fn)(void*), void* args){
 	}
 
 	// Create user thread
+	int ret = fpu_copy(c, p);
+	if(ret){
+		return ret;
+	}
+
 	memcpy(&c->regs, &p->regs, sizeof(struct registers));
 	c->regs.ax = 0;
 
+	// clone() with a stack of its own
+	if(usp){
+		c->regs.sp = usp;
+	}
+
 out:
 	ksp = (unsigned long*)((uint8_t*)ksp - sizeof(struct registers));
 	memcpy(ksp, &c->regs, sizeof(struct registers));
@@ -61,14 +73,20 @@ out:
 
 
 	c->regs.ksp = (unsigned long)ksp;
-	return;
+	return SUCCESS;
 }
 
-void context_switch(struct task* prev, struct task* to){
-	#undef current
-	struct cpu* cpu = get_cpu();
+void release_thread(struct task* task){
+	fpu_release(task);
+}
+
+/* exec(): nothing of the old program's thread state carries over */
+void flush_thread(void){
+	fpu_reset(current);
+}
 
-	if(prev == to || to == cpu->current){
+void context_switch(struct task* prev, struct task* to){
+	if(prev == to || to == current){
 		return;
 	}
 
@@ -77,6 +95,8 @@ void context_switch(struct task* prev, struct task* to){
 
 	// TODO: do some checks here, like if the tasks are valid or permissions
 
+	fpu_switch_out(prev);
+
 	if(to->mm){
 		mmu_context_switch(to->mm->ctx);
 	}
@@ -86,7 +106,8 @@ void context_switch(struct task* prev, struct task* to){
 
 void asmlinkage cpu_update_current_task(struct task* cur){
 	struct cpu* cpu = get_cpu();
-	cpu->current = cur;
-	cpu->current->state = TASK_RUNNING;
+
+	set_current(cur);
+	cur->state = TASK_RUNNING;
 	cpu->tss.esp0 = (unsigned long)(cur->kstack + PROC_KERNEL_STACK_SIZE);
 }
\ No newline at end of file
@@ -9,12 +9,18 @@
 #include <def/linker.h>
 #include <arch/i386/rtc.h>
 #include <asm/cpu.h>
+#include <asm/smp.h>
+#include <asm/percpu.h>
+#include <asm/process.h>
+#include <asm/tsc.h>
+#include <asm/fpu.h>
 #include <asm/gdt.h>
 #include <asm/idt.h>
 #include <asm/page.h>
 #include <asm/paging.h>
 #include <arch/i386/pic.h>
 #include <lib/string.h>
+#include <lib/div64.h>
 #include <asm-generic/paging_ctx.h>
 
 #include "e820.h"
@@ -39,14 +45,35 @@ static struct cpu cpus[MAX_CPUS];
 static struct gdt_entry gdt[TOTAL_GDT_SEGMENTS];
 static struct gdt_descriptor gdt_descriptor;
 
+unsigned long __per_cpu_offset[MAX_CPUS];
+
+DEFINE_PER_CPU(unsigned long, this_cpu_off);
+DEFINE_PER_CPU(int, cpu_number);
+DEFINE_PER_CPU(struct task*, current_task);
+
 extern void fault_init();
 extern uint8_t supports_pse;
 
 static int pit_clockevent_start(void* data, uint32_t hz){
-	pic_init(hz);
+	pit_set_periodic(hz);
+	return 0;
+}
+
+static int pit_clockevent_next(void* data, uint64_t delta_ns){
+	uint64_t count = delta_ns * PIT_FREQUENCY;
+	do_div(count, NSEC_PER_SEC);
+
+	pit_set_oneshot(count ? (uint16_t)count : 1);
 	return 0;
 }
 
+static uint64_t pit_clockevent_elapsed(void* data){
+	uint64_t ns = (uint64_t)pit_oneshot_elapsed() * NSEC_PER_SEC;
+	do_div(ns, PIT_FREQUENCY);
+
+	return ns;
+}
+
 static void pit_clockevent_stop(void* data){
 	pic_disable();
 }
@@ -54,7 +81,10 @@ static void pit_clockevent_stop(void* data){
 static const struct clockevent pit_clockevent = {
 	.name = "pit",
 	.start_periodic = pit_clockevent_start,
+	.set_next_event = pit_clockevent_next,
+	.elapsed_ns = pit_clockevent_elapsed,
 	.stop = pit_clockevent_stop,
+	.max_delta_ns = 0xFFFFULL * NSEC_PER_SEC / PIT_FREQUENCY,
 	.data = 0x0,
 };
 
@@ -75,6 +105,10 @@ static void __init setup_clock(void){
 		printk("Setup: RTC sync failed, keeping monotonic clock at boot zero.\n");
 	}
 
+	pic_init(TIMER_FREQUENCY);
+
+	tsc_init();
+
 	if(clockevent_register(&pit_clockevent) != 0){
 		panic("Setup: clockevent register failed!");
 	}
@@ -94,9 +128,10 @@ static inline void gdt_set_tss(int cpu, struct tss *tss){
 		GDT_FLAG_32BIT
 	);
 
-	printk("Setup: tss: loaded \"%#lx\" idx %d (%#x).\n", tss, idx, GDT_TSS(idx));
-
+	// The task register names the CPU, locks and printk need it first
 	tss_load(GDT_TSS(idx));
+
+	printk("Setup: tss: loaded \"%#lx\" idx %d (%#x).\n", tss, idx, GDT_TSS(idx));
 }
 
 static inline void tss_init(int cpu){
@@ -112,16 +147,33 @@ static inline void tss_init(int cpu){
 	gdt_set_tss(cpu, t);
 }
 
-// no SMP yet, just use cpu 0
-
 struct cpu* get_cpu(void){
-	return &cpus[0];
+	return &cpus[smp_processor_id()];
+}
+
+struct cpu* cpu_data(int id){
+	return &cpus[id];
+}
+
+static inline void gdt_set_percpu(int cpu, unsigned long offset){
+	gdt[GDT_PERCPU_BASE_INDEX + cpu] = GDT_ENTRY(offset, 0xFFFFF, GDT_DATA_RING0, GDT_FLAGS_DEFAULT);
 }
 
-__init void cpu_init(void){
-	struct cpu *cpu = &cpus[0];
-	cpu->id = 0;
+/* The boot CPU loaded the GDT in gdt_setup(), the others share it */
+__init void cpu_init(int id){
+	struct cpu *cpu = &cpus[id];
+
+	if(id != 0){
+		gdt_load(&gdt_descriptor);
+	}
+
+	// Before anything asks smp_processor_id()
+	__asm__ volatile("mov %0, %%fs" :: "r"(GDT_PERCPU(id)) : "memory");
+
+	cpu->id = id;
 	tss_init(cpu->id);
+
+	fpu_init_cpu();
 }
 
 static __init void gdt_setup(){
@@ -135,6 +187,11 @@ static __init void gdt_setup(){
 
 	memcpy(gdt, _gdt, sizeof(gdt));
 
+	// Based at the template until setup_per_cpu_areas()
+	for(int cpu = 0; cpu < MAX_CPUS; cpu++){
+		gdt_set_percpu(cpu, 0);
+	}
+
 	gdt_descriptor.addr = (uintptr_t)gdt;
 	gdt_descriptor.size = sizeof(gdt) - 1;
 
@@ -273,6 +330,38 @@ static __init void setup_memblock(void){
 	}
 }
 
+/*
+* Give every CPU its own copy of .data..percpu, each on its own cache
+* lines, and rebase its per-CPU segment onto it. What the boot CPU wrote
+* to the template so far is carried into every copy.
+*/
+__init void setup_per_cpu_areas(void){
+	const size_t size = ALIGN((size_t)(__per_cpu_end - __per_cpu_start), L1_CACHE_BYTES);
+
+	for(int cpu = 0; cpu < MAX_CPUS; cpu++){
+		void* area = memblock_alloc(size, L1_CACHE_BYTES);
+		if(!area){
+			panic("Setup: No memory for the per-CPU areas!");
+		}
+
+		area = (void*)__va(area);
+		memcpy(area, __per_cpu_start, (size_t)(__per_cpu_end - __per_cpu_start));
+
+		unsigned long offset = (unsigned long)area - (unsigned long)__per_cpu_start;
+		__per_cpu_offset[cpu] = offset;
+
+		per_cpu(this_cpu_off, cpu) = offset;
+		per_cpu(cpu_number, cpu) = cpu;
+
+		gdt_set_percpu(cpu, offset);
+	}
+
+	// Reloading the selector reads the new base
+	__asm__ volatile("mov %0, %%fs" :: "r"(GDT_PERCPU(0)) : "memory");
+
+	printk("Setup: per-CPU: %d areas of %u bytes.\n", MAX_CPUS, size);
+}
+
 __init void* extend_brk(size_t size, size_t align){
 	_brk_end = ALIGN(_brk_end, align);
 
@@ -291,7 +380,7 @@ __init void setup_arch(void){
 
 	gdt_setup();
 
-	cpu_init();
+	cpu_init(0);
 
 	setup_clock();
 
@@ -332,5 +421,7 @@ __init void setup_arch(void){
 
 	memblock_dump_all();
 
+	setup_per_cpu_areas();
+
 	syscalls_init();
 }
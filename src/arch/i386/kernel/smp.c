@@ -0,0 +1,48 @@
+#include <arch/i386/apic.h>
+#include <kernel/interrupt.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+#include <kernel/init.h>
+#include <asm/cpu.h>
+#include <def/errno.h>
+
+/**
+* Inter-processor interrupts, sent through the local APICs to the APIC id
+* each CPU recorded when it came up.
+*/
+
+void arch_send_reschedule(int cpu){
+	lapic_send_ipi(cpu_data(cpu)->apic_id, APIC_RESCHEDULE_VECTOR);
+}
+
+void arch_send_call_function_ipi(int cpu){
+	lapic_send_ipi(cpu_data(cpu)->apic_id, APIC_CALL_FUNCTION_VECTOR);
+}
+
+static void reschedule_interrupt(struct irq_info* info){
+	smp_reschedule_interrupt();
+}
+
+static void call_function_interrupt(struct irq_info* info){
+	smp_call_function_interrupt();
+}
+
+// Application processors tick from their local timer, the boot CPU from the clock event
+static void lapic_timer_interrupt(struct irq_info* info){
+	scheduler_tick();
+}
+
+/* The handlers are shared, the vectors are the same on every CPU */
+int __init smp_intr_init(void){
+	int res = interrupt_register(APIC_RESCHEDULE_VECTOR, reschedule_interrupt, NULL);
+	if(res != SUCCESS){
+		return res;
+	}
+
+	res = interrupt_register(APIC_CALL_FUNCTION_VECTOR, call_function_interrupt, NULL);
+	if(res != SUCCESS){
+		return res;
+	}
+
+	return interrupt_register(APIC_TIMER_VECTOR, lapic_timer_interrupt, NULL);
+}
@@ -0,0 +1,159 @@
+#include <arch/i386/apic.h>
+#include <arch/i386/pic.h>
+#include <kernel/printk.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+#include <kernel/init.h>
+#include <asm/cpu.h>
+#include <asm/idt.h>
+#include <asm/page.h>
+#include <asm/paging.h>
+#include <asm-generic/paging_ctx.h>
+#include <lib/string.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+/**
+* Application processor bring-up.
+*
+* Each AP gets INIT, then STARTUP IPIs pointing at a copy of the real mode
+* trampoline. The trampoline switches to protected mode with paging on
+* swapper_pgdir, whose first 4 MiB are identity mapped until every AP is
+* up, and jumps to start_secondary() on the stack of the CPU's idle task.
+* APs are started one at a time: trampoline_params and booting_cpu are
+* shared.
+*/
+
+struct trampoline_params {
+	uint32_t cr3;
+	uint32_t cr4;
+	uint32_t cr0;
+	uint32_t stack;
+	uint32_t entry;
+} __packed;
+
+extern char trampoline_start[];
+extern char trampoline_end[];
+extern char trampoline_params[];
+
+extern struct paging_ctx kernel_ctx;
+
+#define AP_BOOT_TIMEOUT_MS 1000
+
+static volatile int booting_cpu;
+
+// Busy wait on PIT channel 2, good for up to 54 ms
+static void __init pit_delay_us(uint32_t us){
+	pit_ch2_start((us * (PIT_FREQUENCY / 1000)) / 1000);
+
+	while(!pit_ch2_expired()){
+		cpu_relax();
+	}
+}
+
+static __no_return void start_secondary(void){
+	const int cpu = booting_cpu;
+
+	cpu_init(cpu);
+	idt_load();
+
+	lapic_setup(0);
+	lapic_timer_start(TIMER_FREQUENCY);
+
+	sched_init_secondary();
+
+	printk("SMP: CPU %d (APIC %u) online\n", cpu, lapic_id());
+	set_cpu_online(cpu);
+
+	cpu_idle();
+}
+
+static int __init smp_boot_cpu(int cpu, uint8_t apic_id){
+	struct task* idle = sched_init_idle(cpu);
+	if(IS_ERR_VALUE(idle)){
+		return PTR_ERR(idle);
+	}
+
+	struct trampoline_params* params = (void*)(__va(SMP_TRAMPOLINE_PHYS) +
+		(trampoline_params - trampoline_start));
+
+	params->cr3 = __pa(swapper_pgdir);
+	params->cr4 = read_cr4();
+	params->cr0 = read_cr0();
+	params->stack = (uint32_t)idle->kstack + PROC_KERNEL_STACK_SIZE;
+	params->entry = (uint32_t)start_secondary;
+
+	cpu_data(cpu)->apic_id = apic_id;
+	booting_cpu = cpu;
+
+	lapic_send_init(apic_id);
+	pit_delay_us(10000);
+
+	// The second STARTUP is ignored by a CPU that already runs
+	for(int i = 0; i < 2 && !cpu_online(cpu); i++){
+		lapic_send_startup(apic_id, SMP_TRAMPOLINE_PHYS >> PAGE_SHIFT);
+		pit_delay_us(200);
+	}
+
+	for(int ms = 0; ms < AP_BOOT_TIMEOUT_MS && !cpu_online(cpu); ms++){
+		pit_delay_us(1000);
+	}
+
+	if(!cpu_online(cpu)){
+		printk("SMP: CPU %d (APIC %u) did not start\n", cpu, apic_id);
+		return -ETIME;
+	}
+
+	return SUCCESS;
+}
+
+static int __init smp_init(void){
+	uint8_t apic_ids[MAX_CPUS];
+	uintptr_t lapic_phys = 0;
+
+	int nr = mp_find_config(&lapic_phys, apic_ids, MAX_CPUS);
+	if(nr < 2){
+		printk("SMP: one CPU\n");
+		return SUCCESS;
+	}
+
+	if(lapic_init(lapic_phys) != SUCCESS || lapic_timer_calibrate() != SUCCESS){
+		printk("SMP: no usable local APIC, staying on one CPU\n");
+		return SUCCESS;
+	}
+
+	int res = smp_intr_init();
+	if(res != SUCCESS){
+		return res;
+	}
+
+	lapic_setup(1);
+	cpu_data(0)->apic_id = lapic_id();
+
+	memcpy((void*)__va(SMP_TRAMPOLINE_PHYS), trampoline_start, trampoline_end - trampoline_start);
+
+	const size_t kernel_idx = KERNEL_VIRT_BASE >> PGDIR_SHIFT;
+	swapper_pgdir[0] = swapper_pgdir[kernel_idx];
+
+	int cpu = 1;
+	for(int i = 0; i < nr && cpu < MAX_CPUS; i++){
+		if(apic_ids[i] == cpu_data(0)->apic_id){
+			continue;
+		}
+
+		// A late starter would take the next CPU's number and parameters
+		if(smp_boot_cpu(cpu, apic_ids[i]) != SUCCESS){
+			break;
+		}
+
+		cpu++;
+	}
+
+	swapper_pgdir[0].val = 0;
+	kernel_ctx.ops->flush_all(&kernel_ctx);
+
+	printk("SMP: %d CPUs online\n", num_online_cpus());
+	return SUCCESS;
+}
+
+arch_initcall(smp_init);
@@ -1,63 +1,196 @@
 #include <sync/spinlock.h>
 #include <sync/barrier.h>
-#include <asm/cpuflags.h>
+#include <kernel/preempt.h>
+#include <kernel/softirq.h>
+#include <kernel/smp.h>
+#include <asm/irqflags.h>
+#include <asm/smp.h>
+#include <asm/tsc.h>
 
-static __always_inline void  local_irq_enable(){
-	__asm__ volatile ("sti" ::: "memory");
+/*
+* The holder can't be preempted: a task waiting for a lock whose holder
+* got switched out would spin for a whole timeslice.
+*
+* Tickets: the low half of the word is the one being served, the high
+* half the next one to draw. Drawing is a single xadd; waiters only read
+* the word until the holder's release bumps the low half, so a release is
+* one cache line transfer and the waiters get the lock in order.
+*/
+
+#define TICKET_SHIFT 16
+#define TICKET_NEXT  (1 << TICKET_SHIFT)
+
+#define ticket_owner(val) ((uint16_t)(val))
+#define ticket_next(val)  ((uint16_t)((unsigned int)(val) >> TICKET_SHIFT))
+
+#ifdef CONFIG_LOCKSTAT
+/* Accounted on this CPU's slot, interrupts off so a nested lock can't tear it */
+static inline void lockstat_acquired(spinlock_t* lock, uint64_t wait_start, int contended){
+    if(!lock->class){
+        return;
+    }
+
+    unsigned long flags;
+    local_irq_save(flags);
+
+    struct lock_class_stats* stats = &lock->class->stats[smp_processor_id()];
+    uint64_t now = rdtsc();
+
+    stats->acquisitions++;
+
+    if(contended){
+        uint64_t wait = now - wait_start;
+
+        stats->contentions++;
+        stats->wait_cycles += wait;
+        if(wait > stats->wait_max){
+            stats->wait_max = wait;
+        }
+    }
+
+    lock->acquired_at = now;
+
+    local_irq_restore(flags);
 }
 
-static __always_inline void local_irq_disable(){
-	__asm__ volatile ("cli" ::: "memory");
+static inline void lockstat_release(spinlock_t* lock){
+    if(!lock->class){
+        return;
+    }
+
+    unsigned long flags;
+    local_irq_save(flags);
+
+    struct lock_class_stats* stats = &lock->class->stats[smp_processor_id()];
+    uint64_t hold = rdtsc() - lock->acquired_at;
+
+    stats->hold_cycles += hold;
+    if(hold > stats->hold_max){
+        stats->hold_max = hold;
+    }
+
+    local_irq_restore(flags);
 }
 
-static __always_inline unsigned long local_save_flags(void) {
-	unsigned long flags;
+#define lockstat_wait_start() rdtsc()
+#else
+static inline void lockstat_acquired(spinlock_t* lock, uint64_t wait_start, int contended){}
+static inline void lockstat_release(spinlock_t* lock){}
 
-	asm volatile(
-		"pushf ; pop %0"
-		: "=rm" (flags)
-		:: "memory"
-	);
+#define lockstat_wait_start() 0
+#endif
 
-	return flags;
+void spinlock_init(spinlock_t* lock) {
+    atomic_set(&lock->tickets, 0);
 }
 
-static __always_inline void local_restore_flags(unsigned long flags){
-	if(flags & X86_EFLAGS_IF){
-		local_irq_enable();
-	}
+int spin_is_locked(spinlock_t* lock){
+    int val = atomic_read(&lock->tickets);
+    return ticket_owner(val) != ticket_next(val);
 }
 
-void spinlock_init(spinlock_t* lock) {
-    atomic_set(&lock->locked, 0);
+static inline void __spin_lock(spinlock_t* lock) {
+    int val = atomic_fetch_add(&lock->tickets, TICKET_NEXT);
+    uint16_t ticket = ticket_next(val);
+
+    if (likely(ticket_owner(val) == ticket)) {
+        lockstat_acquired(lock, 0, 0);
+        return;
+    }
+
+    uint64_t wait_start = lockstat_wait_start();
+
+    /*
+    * The holder may be waiting for us to answer a cross-CPU call, a TLB
+    * shootdown say. With interrupts off the IPI never lands, so pick the
+    * call up from our slot ourselves. With them on the IPI handler does,
+    * and polling too could run it twice.
+    */
+    const int poll_calls = irqs_disabled();
+
+    while (ticket_owner(atomic_read(&lock->tickets)) != ticket){
+        if (poll_calls){
+            smp_call_function_interrupt();
+        }
+
+        __asm__ volatile("pause");
+    }
+
+    smp_mb(); // acquire barrier
+    lockstat_acquired(lock, wait_start, 1);
 }
 
-void spin_lock(spinlock_t* lock) {
-    while (1) {
-        if (atomic_cmpxchg(&lock->locked, 0, 1) == 0){
-			break;
-		}
+static inline int __spin_trylock(spinlock_t* lock) {
+    int val = atomic_read(&lock->tickets);
+
+    if (ticket_owner(val) != ticket_next(val)){
+        return 0;
+    }
 
-        while (atomic_read(&lock->locked)){
-			__asm__ volatile("pause");
-		}
+    if (atomic_cmpxchg(&lock->tickets, val, (int)((unsigned int)val + TICKET_NEXT)) != val){
+        return 0;
     }
 
     smp_mb(); // acquire barrier
+    return 1;
 }
 
-void spin_unlock(spinlock_t* lock) {
+/* Only the holder writes the low half, no lock prefix needed */
+static inline void __spin_unlock(spinlock_t* lock) {
+    lockstat_release(lock);
+
     smp_mb(); // release barrier
-    atomic_set(&lock->locked, 0);
+    __asm__ volatile("incw %0" : "+m"(*(volatile uint16_t*)&lock->tickets.value) :: "memory");
+}
+
+void spin_lock(spinlock_t* lock) {
+    preempt_disable();
+    __spin_lock(lock);
 }
 
+int spin_trylock(spinlock_t* lock) {
+    preempt_disable();
+
+    if (!__spin_trylock(lock)){
+        preempt_enable();
+        return 0;
+    }
+
+    lockstat_acquired(lock, 0, 0);
+    return 1;
+}
+
+void spin_unlock(spinlock_t* lock) {
+    __spin_unlock(lock);
+    preempt_enable();
+}
+
+/*
+* Interrupts go off before the ticket is drawn, so an interrupt handler
+* taking the same lock can't queue behind a ticket that is never used.
+* Cross-CPU calls from the holder are still answered while waiting, see
+* __spin_lock().
+*/
 void spin_lock_irqsave(spinlock_t* lock, unsigned long* flags){
-    *flags = local_save_flags();
-    local_irq_disable();
-    spin_lock(lock);
+    local_irq_save(*flags);
+    preempt_disable();
+    __spin_lock(lock);
 }
 
+/* Interrupts come back first, a pending reschedule can then run at once */
 void spin_unlock_irqrestore(spinlock_t* lock, unsigned long* flags){
-    spin_unlock(lock);
-    local_restore_flags(*flags);
+    __spin_unlock(lock);
+    local_irq_restore(*flags);
+    preempt_enable();
+}
+
+void spin_lock_bh(spinlock_t* lock){
+    local_bh_disable();
+    __spin_lock(lock);
+}
+
+/* Softirqs raised meanwhile run from local_bh_enable() */
+void spin_unlock_bh(spinlock_t* lock){
+    __spin_unlock(lock);
+    local_bh_enable();
 }
@@ -0,0 +1,180 @@
+#include <arch/i386/pic.h>
+#include <arch/i386/rtc.h>
+#include <kernel/clock.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <asm/cpu.h>
+#include <asm/tsc.h>
+#include <lib/div64.h>
+#include <def/errno.h>
+
+/**
+* TSC clocksource.
+*
+* The TSC rate is measured against PIT channel 2, or against the RTC
+* seconds when the PIT gate does not respond. Cycles are turned into ns
+* with ns = (cycles * mult) >> shift, so reading the clock is a rdtsc and
+* two 32 bit multiplies.
+*/
+
+#define CPUID_1_EDX_TSC      (1 << 4)
+#define CPUID_80000007_EDX_INVARIANT (1 << 8)
+
+#define CALIBRATE_MS     10
+#define CALIBRATE_COUNT  (PIT_FREQUENCY * CALIBRATE_MS / 1000)
+#define CALIBRATE_RUNS   5
+#define CALIBRATE_LOOPS  1000000  // gives up on a PIT that never fires
+
+// The best two runs must agree to 1/TSC_MAX_SPREAD
+#define TSC_MAX_SPREAD   200
+
+uint32_t tsc_khz;
+
+static uint32_t tsc_mult;
+static uint32_t tsc_shift;
+static uint64_t tsc_base_cycles;
+static time_ns_t tsc_base_ns;
+
+time_ns_t tsc_cycles_to_ns(uint64_t cycles){
+	return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+static time_ns_t tsc_read_ns(void* data){
+	return tsc_base_ns + tsc_cycles_to_ns(rdtsc() - tsc_base_cycles);
+}
+
+static const struct clocksource tsc_clocksource = {
+	.name = "tsc",
+	.read_ns = tsc_read_ns,
+	.data = 0x0,
+};
+
+static int __init tsc_supported(void){
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	return !!(edx & CPUID_1_EDX_TSC);
+}
+
+static int __init tsc_invariant(void){
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+	if(eax < 0x80000007){
+		return 0;
+	}
+
+	cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return !!(edx & CPUID_80000007_EDX_INVARIANT);
+}
+
+// TSC kHz over one CALIBRATE_MS countdown of PIT channel 2, 0 on timeout
+static uint32_t __init pit_calibrate_tsc(void){
+	int loops = 0;
+
+	pit_ch2_start(CALIBRATE_COUNT);
+	uint64_t start = rdtsc();
+
+	while(!pit_ch2_expired()){
+		if(++loops > CALIBRATE_LOOPS){
+			return 0;
+		}
+	}
+
+	uint64_t delta = rdtsc() - start;
+	do_div(delta, CALIBRATE_MS);
+
+	return delta;
+}
+
+// Slow, one full second between two RTC updates
+static uint32_t __init rtc_calibrate_tsc(void){
+	rtc_wait_second();
+	uint64_t start = rdtsc();
+	rtc_wait_second();
+
+	uint64_t delta = rdtsc() - start;
+	do_div(delta, 1000);
+
+	return delta;
+}
+
+/*
+* Best of a few PIT runs, interrupts and SMIs only make a run longer. When
+* the two best runs still disagree the TSC is not trusted.
+*/
+static uint32_t __init tsc_calibrate(void){
+	uint32_t best = 0, second = 0;
+
+	for(int i = 0; i < CALIBRATE_RUNS; i++){
+		uint32_t khz = pit_calibrate_tsc();
+		if(!khz){
+			printk("TSC: PIT channel 2 does not count, using the RTC\n");
+			return rtc_calibrate_tsc();
+		}
+
+		if(!best || khz < best){
+			second = best;
+			best = khz;
+		} else if(!second || khz < second){
+			second = khz;
+		}
+	}
+
+	if(second - best > best / TSC_MAX_SPREAD){
+		printk("TSC: calibration unstable (%u kHz vs %u kHz)\n", best, second);
+		return 0;
+	}
+
+	return best;
+}
+
+// Largest shift up to 32 that keeps mult in 32 bits
+static void __init tsc_calc_mult_shift(uint32_t khz){
+	uint64_t mult;
+
+	for(tsc_shift = 32; tsc_shift > 0; tsc_shift--){
+		mult = (1000000ULL << tsc_shift) + khz / 2;
+		do_div(mult, khz);
+
+		if(mult <= 0xFFFFFFFFULL){
+			break;
+		}
+	}
+
+	tsc_mult = mult;
+}
+
+/*
+* Register the TSC as the clocksource, continuing from the current
+* monotonic time. The software tick clock stays in place otherwise.
+*/
+int __init tsc_init(void){
+	if(!tsc_supported()){
+		printk("TSC: not supported, keeping the software tick clock\n");
+		return -ENOTSUP;
+	}
+
+	uint32_t khz = tsc_calibrate();
+	if(!khz){
+		printk("TSC: unusable, keeping the software tick clock\n");
+		return -EINVAL;
+	}
+
+	tsc_calc_mult_shift(khz);
+
+	tsc_base_ns = clock_get_monotonic_ns();
+	tsc_base_cycles = rdtsc();
+	tsc_khz = khz;
+
+	int res = clocksource_register(&tsc_clocksource);
+	if(res != SUCCESS){
+		tsc_khz = 0;
+		return res;
+	}
+
+	printk("TSC: %u.%03u MHz%s, mult %u shift %u\n",
+		khz / 1000, khz % 1000, tsc_invariant() ? " invariant" : "", tsc_mult, tsc_shift);
+
+	return SUCCESS;
+}
@@ -2,21 +2,100 @@
 #include <mm/vma.h>
 #include <asm/page.h>
 #include <def/config.h>
+#include <kernel/smp.h>
+#include <sync/barrier.h>
+#include <asm/irqflags.h>
+
+extern struct paging_ctx kernel_ctx;
 
 #define ADDR_NOT_ALING(addr) ((uintptr_t)(addr) & (PAGE_SIZE - 1))
 
-static void x86_invlpg(uintptr_t virt){
+static void __invlpg(void* virt){
 	__asm__ volatile("invlpg (%0)" :: "r"(virt) : "memory");
 }
 
-static void x86_invlpg_all(void){
+static void __flush_tlb(void* unused){
 	__asm__ volatile(
 		"mov %%cr3, %%eax\n\r"
 		"mov %%eax, %%cr3\n\r"
-		::: "memory"
+		::: "eax", "memory"
 	);
 }
 
+struct flush_request {
+	struct paging_ctx *ctx;
+	uintptr_t vaddr;
+};
+
+// Kernel mappings are shared by every address space
+static inline int flush_global(struct paging_ctx *ctx, uintptr_t virt){
+	return ctx == &kernel_ctx || virt > USER_SPACE_END;
+}
+
+/* A CPU that switched to another context since only leaves the mask */
+static int flush_ctx_active(struct paging_ctx *ctx){
+	if(this_cpu_read(active_ctx) == ctx){
+		return 1;
+	}
+
+	atomic_andnot(1 << smp_processor_id(), &ctx->cpu_mask);
+	return 0;
+}
+
+static void __invlpg_ctx(void* info){
+	struct flush_request *req = info;
+
+	if(flush_ctx_active(req->ctx)){
+		__invlpg((void*)req->vaddr);
+	}
+}
+
+static void __flush_tlb_ctx(void* info){
+	if(flush_ctx_active(info)){
+		__flush_tlb(NULL);
+	}
+}
+
+/*
+* Other CPUs flush too when they may hold the translation: all of them for
+* kernel addresses, those in the context's `cpu_mask` for user ones. The
+* mask is read after the PTE store, with interrupts off so it is read on
+* the CPU that flushed locally.
+*/
+static void x86_invlpg(struct paging_ctx *ctx, uintptr_t virt){
+	unsigned long flags;
+
+	local_irq_save(flags);
+	__invlpg((void*)virt);
+
+	if(flush_global(ctx, virt)){
+		smp_call_function(__invlpg, (void*)virt);
+	} else {
+		struct flush_request req = { .ctx = ctx, .vaddr = virt };
+
+		smp_mb();
+		smp_call_function_many(atomic_read(&ctx->cpu_mask), __invlpg_ctx, &req);
+	}
+
+	local_irq_restore(flags);
+}
+
+static void x86_invlpg_all(struct paging_ctx *ctx){
+	unsigned long flags;
+
+	local_irq_save(flags);
+	__flush_tlb(NULL);
+
+	if(ctx == &kernel_ctx){
+		smp_call_function(__flush_tlb, NULL);
+	} else {
+		smp_mb();
+		smp_call_function_many(atomic_read(&ctx->cpu_mask), __flush_tlb_ctx, ctx);
+	}
+
+	local_irq_restore(flags);
+}
+
 static pte_t x86_mk_pte(uintptr_t phys, uint32_t flags) {
 	return (pte_t){ .val = (phys & PAGE_MASK) | (flags & FLAGS_MASK) | _PAGE_P };
 }
@@ -45,6 +124,26 @@ static void x86_clear(pte_t *dst) {
 	dst->val = 0;
 }
 
+static int x86_young(pte_t p) {
+	return p.val & _PAGE_ACCESSED;
+}
+
+static pte_t x86_mkold(pte_t p) {
+	return (pte_t){ .val = p.val & ~_PAGE_ACCESSED };
+}
+
+static pte_t x86_mk_swap(swp_entry_t entry) {
+	return (pte_t){ .val = (entry.val << _PAGE_SWP_SHIFT) | _PAGE_SWAP };
+}
+
+static int x86_swap(pte_t p) {
+	return (p.val & (_PAGE_P | _PAGE_SWAP)) == _PAGE_SWAP;
+}
+
+static swp_entry_t x86_to_swp(pte_t p) {
+	return (swp_entry_t){ .val = p.val >> _PAGE_SWP_SHIFT };
+}
+
 static void* x86_to_virt(pte_t p) {
 	return (void*)__va(x86_pte_phys(p));
 }
@@ -63,6 +162,11 @@ const struct paging_ops arch_paging_ops = {
 	.pte_leaf = x86_leaf,
 	.set_pte = x86_set,
 	.clear_pte = x86_clear,
+	.pte_young = x86_young,
+	.pte_mkold = x86_mkold,
+	.mk_swap = x86_mk_swap,
+	.pte_swap = x86_swap,
+	.pte_to_swp = x86_to_swp,
 	.pte_to_virt = x86_to_virt,
 	.mk_table = x86_mk_table,
 	.flush_tlb_one = x86_invlpg,
@@ -5,21 +5,30 @@
 #include <def/config.h>
 #include <def/errno.h>
 #include <fs/vfs.h>
+#include <sync/rcu.h>
 
 #define BLKDEV_MAJOR_HASH_SIZE 31
 
+/*
+* Registered majors, looked up under RCU. Updaters serialize on
+* major_names_lock and free unregistered names after a grace period.
+*/
 static struct blk_major_name{
 	char name[32];
 	int major;
 	struct blk_major_name *next;
+	struct rcu_head rcu;
 } * major_names[BLKDEV_MAJOR_HASH_SIZE];
 
+static spinlock_t major_names_lock;
+
 static struct list_head disks[BLKDEV_MAJOR_HASH_SIZE];
 
 static inline unsigned int major_to_index(unsigned int major){
 	return major % BLKDEV_MAJOR_HASH_SIZE;
 }
 
+// major_names_lock held
 static int find_free_major(){
 	for(int i = BLKDEV_MAJOR_HASH_SIZE - 1; i > 0; i--){
 		if(major_names[i] == NULL){
@@ -30,6 +39,23 @@ static int find_free_major(){
 	return 0;
 }
 
+static int blkdev_major_registered(unsigned int major){
+	struct blk_major_name* entry;
+	int found = 0;
+
+	rcu_read_lock();
+
+	for (entry = rcu_dereference(major_names[major_to_index(major)]); entry; entry = rcu_dereference(entry->next)) {
+		if (entry->major == major) {
+			found = 1;
+			break;
+		}
+	}
+
+	rcu_read_unlock();
+	return found;
+}
+
 int blkdev_register(unsigned int major, const char* name){
 	if (major >= BLKDEV_MAJOR_HASH_SIZE) {
 		return -EINVAL;
@@ -37,9 +63,25 @@ int blkdev_register(unsigned int major, const char* name){
 
 	struct blk_major_name** cur, *entry;
 
+	size_t name_len = strnlen(name, sizeof(entry->name));
+	if (name_len == 0) {
+		return -EINVAL;
+	} else if (name_len >= 32) {
+		return -ENAMETOOLONG;
+	}
+
+	entry = kmalloc(sizeof(struct blk_major_name));
+	if(!entry){
+		return -ENOMEM;
+	}
+
+	spin_lock(&major_names_lock);
+
 	if(major == 0){
 		major = find_free_major();
 		if(major == 0){
+			spin_unlock(&major_names_lock);
+			kfree(entry);
 			return -ENOENT;
 		}
 	}
@@ -51,29 +93,25 @@ int blkdev_register(unsigned int major, const char* name){
 	}
 
 	if(*cur){
+		spin_unlock(&major_names_lock);
+		kfree(entry);
 		return -ENOENT;
 	}
 
-	size_t name_len = strnlen(name, sizeof(entry->name));
-	if (name_len == 0) {
-		return -EINVAL;
-	} else if (name_len >= 32) {
-		return -ENAMETOOLONG;
-	}
-
-	entry = kmalloc(sizeof(struct blk_major_name));
-	if(!entry){
-		return -ENOMEM;
-	}
-
 	strncpy(entry->name, name, name_len);
 	entry->name[name_len] = '\0';
 	entry->major = major;
-	*cur = entry;
+	entry->next = NULL;
+	rcu_assign_pointer(*cur, entry);
 
+	spin_unlock(&major_names_lock);
 	return SUCCESS;
 }
 
+static void blk_major_name_free(struct rcu_head* head){
+	kfree(container_of(head, struct blk_major_name, rcu));
+}
+
 void blkdev_unregister(unsigned int major, const char *name){
 	struct blk_major_name** cur, * entry;
 
@@ -83,19 +121,23 @@ void blkdev_unregister(unsigned int major, const char *name){
 	if (major >= BLKDEV_MAJOR_HASH_SIZE)
 		return;
 
+	spin_lock(&major_names_lock);
+
 	cur = &major_names[major_to_index(major)];
 
 	while (*cur) {
 		entry = *cur;
 
 		if (entry->major == major && strcmp(entry->name, name) == 0) {
-			*cur = entry->next;
-			kfree(entry);
-			return;
+			rcu_assign_pointer(*cur, entry->next);
+			call_rcu(&entry->rcu, blk_major_name_free);
+			break;
 		}
 
 		cur = &entry->next;
 	}
+
+	spin_unlock(&major_names_lock);
 }
 
 int add_disk(struct gendisk* disk){
@@ -105,8 +147,7 @@ int add_disk(struct gendisk* disk){
 	if (disk->major >= BLKDEV_MAJOR_HASH_SIZE)
 		return -EINVAL;
 
-	struct blk_major_name* entry = major_names[major_to_index(disk->major)];
-	if (!entry)
+	if (!blkdev_major_registered(disk->major))
 		return -EINVAL;
 
 	if (disk->minors_total <= 0)
@@ -126,7 +167,7 @@ int add_disk(struct gendisk* disk){
 	}
 
 	queue->head = queue->tail = NULL;
-	spinlock_init(&queue->lock);
+	spinlock_init_class(&queue->lock, "queue->lock");
 	queue->elevator = &fifo_elevator;
 	queue->bdev = bdev;
 
@@ -221,6 +262,7 @@ const struct file_operations def_blk_fops = {
 
 static __init int blkdev_init(){
 	memset(major_names, 0x0, sizeof(major_names));
+	spinlock_init(&major_names_lock);
 	for (int i = 0; i < BLKDEV_MAJOR_HASH_SIZE; i++){
     	INIT_LIST_HEAD(&disks[i]);
 	}
@@ -3,17 +3,14 @@
 #include <lib/string.h>
 #include <def/errno.h>
 #include <mm/kheap.h>
+#include <mm/swap.h>
 #include <fs/partition.h>
+#include <kernel/completion.h>
 
 #define GPT_PARTITION -1
 
-struct sync_wait {
-	volatile int done;
-};
-
 static void scan_endio(struct bio *bio){
-	struct sync_wait *wait = bio->private;
-	wait->done = 1;
+	complete(bio->private);
 }
 
 static int block_read(struct blkdev* dev, sector_t sector, unsigned int nr_sectors, void* buffer){
@@ -21,22 +18,26 @@ static int block_read(struct blkdev* dev, sector_t sector, unsigned int nr_secto
 	if(!bio) return -ENOMEM;
 	memset(bio, 0x0, sizeof(struct bio));
 
-	struct sync_wait wait = {0};
+	struct completion done;
+	init_completion(&done);
 
 	bio->sector = sector + dev->start_sector;
 	bio->nr_sectors = nr_sectors;
 	bio->buffer = buffer;
 	bio->op = BLK_READ;
 	bio->end_io = scan_endio;
-	bio->private = &wait;
+	bio->private = &done;
 	bio->next = NULL;
 
-	blk_submit_bio(dev, bio);
+	int res = blk_submit_bio(dev, bio);
+	if(IS_ERR_VALUE(res)){
+		kfree(bio);
+		return res;
+	}
 
-	while (!wait.done)
-		asm volatile ("hlt");
+	wait_for_completion(&done);
 
-	int res = bio->status;
+	res = bio->status;
 	kfree(bio);
 	return res;
 }
@@ -119,6 +120,14 @@ static void parse_mbr_partitions(struct gendisk* disk, uint8_t *sector0){
 		printk("BLK: found MBR partition \"%s%d\" (major=%u minor=%u)\n", 
 			disk->name, bdev_part->minor, bdev_part->major, bdev_part->minor);
 
+		if (part->type == MBR_TYPE_LINUX_SWAP) {
+			res = swap_activate_bdev(bdev_part);
+			if (IS_ERR_VALUE(res)) {
+				printk("BLK: failed to activate swap on \"%s%d\" %d\n",
+					disk->name, bdev_part->minor, res);
+			}
+		}
+
 		continue;
 parse_fail:
 		printk("BLK-code: parse_mbr_partitions: failted to parse part \"%d\" %d", i+1, res);
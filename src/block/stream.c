@@ -4,18 +4,15 @@
 #include <lib/div64.h>
 #include <mm/kheap.h>
 #include <fs/vfs.h>
+#include <kernel/preempt.h>
+#include <kernel/completion.h>
 #include <def/errno.h>
 
 #define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
 #define ALIGN_DOWN(x, a) ((x) & ~((a) - 1))
 
-struct sync_wait {
-	volatile int done;
-};
-
 static void stream_endio(struct bio *bio){
-	struct sync_wait *wait = bio->private;
-	wait->done = 1;
+	complete(bio->private);
 }
 
 static int stream_flush(struct Stream* stream){
@@ -23,7 +20,8 @@ static int stream_flush(struct Stream* stream){
 		return SUCCESS;
 	}
 
-	struct sync_wait wait = {0};
+	struct completion done;
+	init_completion(&done);
 
 	struct bio bio;
 	bio.sector = stream->cachedSectorLBA + stream_bdev(stream)->start_sector;
@@ -31,15 +29,17 @@ static int stream_flush(struct Stream* stream){
 	bio.nr_sectors = stream->sector_size;
 	bio.op = BLK_WRITE;
 	bio.bdev = stream_bdev(stream);
-	bio.private = &wait;
+	bio.private = &done;
 	bio.end_io = stream_endio;
 
-	blk_submit_bio(bio.bdev, &bio);
-
-	while(!wait.done){
-		// TODO: Add sleep queue
+	// Nothing completes a bio that didn't make it in
+	int res = blk_submit_bio(bio.bdev, &bio);
+	if(IS_ERR_VALUE(res)){
+		return res;
 	}
 
+	wait_for_completion(&done);
+
 	if(IS_ERR_VALUE(bio.status)){
 		return bio.status;
 	}
@@ -119,15 +119,14 @@ int stream_read(struct Stream *stream, void *buffer, int total){
 			bio.op = BLK_READ;
 			bio.bdev = stream_bdev(stream);
 			bio.end_io = stream_endio;
-			struct sync_wait wait = {0};
-			bio.private = &wait;
+			struct completion done;
+			init_completion(&done);
+			bio.private = &done;
 
 			int res = blk_submit_bio(bio.bdev, &bio);
 			if(IS_ERR_VALUE(res)) return res;
 
-			while(!wait.done){
-				// TODO: Add sleep queue
-			}
+			wait_for_completion(&done);
 
 			res = bio.status;
 
@@ -146,6 +145,8 @@ int stream_read(struct Stream *stream, void *buffer, int total){
 		bufPtr += toRead;
 		stream->pos += toRead;
 		totalRemaining -= toRead;
+
+		cond_resched();
 	}
 
 	return total - totalRemaining;
@@ -169,7 +170,8 @@ int stream_write(struct Stream *stream, const void *buffer, int total){
 				return ret;
 			}
 
-			struct sync_wait wait = {0};
+			struct completion done;
+			init_completion(&done);
 			struct bio bio;
 
 			bio.sector = sector + stream_bdev(stream)->start_sector;
@@ -177,15 +179,16 @@ int stream_write(struct Stream *stream, const void *buffer, int total){
 			bio.nr_sectors = stream->sector_size;
 			bio.op = BLK_READ;
 			bio.bdev = stream_bdev(stream);
-			bio.private = &wait;
+			bio.private = &done;
 			bio.end_io = stream_endio;
 
-			blk_submit_bio(bio.bdev, &bio);
-
-			while(!wait.done){
-				// TODO: Add sleep queue
+			int res = blk_submit_bio(bio.bdev, &bio);
+			if(IS_ERR_VALUE(res)){
+				return res;
 			}
 
+			wait_for_completion(&done);
+
 			if(IS_ERR_VALUE(bio.status)){
 				return bio.status;
 			}
@@ -204,6 +207,8 @@ int stream_write(struct Stream *stream, const void *buffer, int total){
 		bufPtr += toWrite;
 		stream->pos += toWrite;
 		totalRemaining -= toWrite;
+
+		cond_resched();
 	}
 
 	return total - totalRemaining;
@@ -1,14 +1,19 @@
 #include <kernel/clock.h>
+#include <kernel/hrtimer.h>
+#include <kernel/softirq.h>
+#include <kernel/syscall.h>
+#include <kernel/uaccess.h>
 #include <def/errno.h>
 #include <lib/div64.h>
 #include <lib/list.h>
 #include <mm/kheap.h>
 #include <sync/spinlock.h>
+#include <sync/rcu.h>
+#include <lib/rculist.h>
 
 /*
  * TODO:
  * Make SMP-safe readings.
- * Callbacks currently run under clockevent_lock.
  */
 
 static volatile tick_t clock_ticks;
@@ -19,21 +24,47 @@ static time_ns_t clock_tick_ns_remainder;
 static time_ns_t clock_remainder_accum;
 static uint32_t clock_hz;
 
-static spinlock_t clockevent_lock;
+/*
+* In one-shot mode the clock event is always armed and the software clock
+* is clock_monotonic_ns plus the time elapsed on it, folded in whenever it
+* is re-armed. A registered clocksource (the TSC) replaces all of that.
+*/
+static int clock_oneshot;
+static int clockevent_armed;
+
+// Shortest one-shot, anything closer fires right away
+#define CLOCKEVENT_MIN_DELTA_NS 5000
+
+static spinlock_t clockevent_lock;  // registration, listeners are walked under RCU
 static spinlock_t clocksource_lock;
+static spinlock_t clock_base_lock;
 
 struct clockevent_listener {
 	void (*handler)(void* data);
+	tick_t (*next_tick)(void* data);
 	void* data;
+	int irq;        // runs from the interrupt, not TIMER_SOFTIRQ
 	struct list_head node;
 };
 
 static LIST_HEAD(clockevent_listeners);
+static void clockevent_run_softirq(void);
 static const struct clockevent* current_clockevent;
 static const struct clocksource* current_clocksource;
 
 static time_ns_t _clocksource_read_default(void* data){
-	return clock_monotonic_ns;
+	unsigned long flags;
+
+	spin_lock_irqsave(&clock_base_lock, &flags);
+
+	time_ns_t now = clock_monotonic_ns;
+	if(clockevent_armed){
+		now += clockevent_elapsed_ns();
+	}
+
+	spin_unlock_irqrestore(&clock_base_lock, &flags);
+
+	return now;
 }
 
 static const struct clocksource default_clocksource = {
@@ -49,7 +80,9 @@ int clock_init(uint32_t timer_hz){
 
 	spinlock_init(&clockevent_lock);
 	spinlock_init(&clocksource_lock);
+	spinlock_init(&clock_base_lock);
 	INIT_LIST_HEAD(&clockevent_listeners);
+	open_softirq(TIMER_SOFTIRQ, clockevent_run_softirq);
 
 	clock_tick_ns = NSEC_PER_SEC;
 	clock_tick_ns_remainder = do_div(clock_tick_ns, timer_hz);
@@ -60,12 +93,14 @@ int clock_init(uint32_t timer_hz){
 	clock_realtime_offset_ns = 0;
 	current_clocksource = &default_clocksource;
 	current_clockevent = 0x0;
+	clock_oneshot = 0;
+	clockevent_armed = 0;
 
 	return SUCCESS;
 }
 
 void clock_set_realtime_ns(time_ns_t time_ns){
-	clock_realtime_offset_ns = (int64_t)time_ns - (int64_t)clock_monotonic_ns;
+	clock_realtime_offset_ns = (int64_t)time_ns - (int64_t)clock_get_monotonic_ns();
 }
 
 static void clock_tick(void){
@@ -82,6 +117,15 @@ static void clock_tick(void){
 	}
 }
 
+/* One-shot mode, the tick count follows the monotonic clock */
+void clock_advance_ticks(tick_t ticks){
+	clock_ticks += ticks;
+}
+
+time_ns_t clock_tick_period_ns(void){
+	return clock_tick_ns;
+}
+
 tick_t clock_get_ticks(void){
 	return clock_ticks;
 }
@@ -136,6 +180,102 @@ int clockevent_start_periodic(uint32_t hz){
 	return event->start_periodic(event->data, hz);
 }
 
+static int clockevent_set_next_event(uint64_t delta_ns){
+	const struct clockevent* event = current_clockevent;
+	if(!event || !event->set_next_event){
+		return -ENOTSUP;
+	}
+
+	if(delta_ns > event->max_delta_ns){
+		delta_ns = event->max_delta_ns;
+	}
+
+	if(delta_ns < CLOCKEVENT_MIN_DELTA_NS){
+		delta_ns = CLOCKEVENT_MIN_DELTA_NS;
+	}
+
+	return event->set_next_event(event->data, delta_ns);
+}
+
+// Whether the monotonic clock is interpolated from the clock event
+static inline int clock_interpolated(void){
+	return current_clocksource == &default_clocksource;
+}
+
+// Move the time elapsed on the armed event into the base
+static void clock_fold_elapsed(void){
+	if(clockevent_armed){
+		clock_monotonic_ns += clockevent_elapsed_ns();
+		clockevent_armed = 0;
+	}
+}
+
+/*
+* Arm the one-shot for an absolute monotonic time, capped by the device
+* range; the handler just re-arms if it fires early.
+*/
+void clockevent_program(time_ns_t expires){
+	unsigned long flags;
+
+	spin_lock_irqsave(&clock_base_lock, &flags);
+
+	time_ns_t now;
+
+	if(clock_interpolated()){
+		clock_fold_elapsed();
+		now = clock_monotonic_ns;
+	} else {
+		now = current_clocksource->read_ns(current_clocksource->data);
+	}
+
+	uint64_t delta = (int64_t)(expires - now) > 0 ? expires - now : 0;
+
+	if(clockevent_set_next_event(delta) == SUCCESS){
+		clockevent_armed = 1;
+	}
+
+	spin_unlock_irqrestore(&clock_base_lock, &flags);
+}
+
+/* Leave the periodic tick for one-shot events, hrtimers drive it from here */
+int clock_switch_to_oneshot(void){
+	unsigned long flags;
+
+	if(!clockevent_max_delta_ns()){
+		return -ENOTSUP;
+	}
+
+	spin_lock_irqsave(&clock_base_lock, &flags);
+	clock_oneshot = 1;
+	clockevent_armed = 0;
+	spin_unlock_irqrestore(&clock_base_lock, &flags);
+
+	return SUCCESS;
+}
+
+int clock_is_oneshot(void){
+	return clock_oneshot;
+}
+
+uint64_t clockevent_elapsed_ns(void){
+	const struct clockevent* event = current_clockevent;
+	if(!event || !event->elapsed_ns){
+		return 0;
+	}
+
+	return event->elapsed_ns(event->data);
+}
+
+/* 0 when the clock event can't do one-shot */
+uint64_t clockevent_max_delta_ns(void){
+	const struct clockevent* event = current_clockevent;
+	if(!event || !event->set_next_event || !event->elapsed_ns){
+		return 0;
+	}
+
+	return event->max_delta_ns;
+}
+
 void clockevent_stop(void){
 	const struct clockevent* event = current_clockevent;
 	if(event && event->stop){
@@ -144,6 +284,12 @@ void clockevent_stop(void){
 }
 
 int clockevent_register_listener(void (*handler)(void* data), void* data){
+	return clockevent_register_nohz_listener(handler, 0x0, data);
+}
+
+static int clockevent_add_listener(void (*handler)(void* data), tick_t (*next_tick)(void* data), void* data, int irq){
+	unsigned long flags;
+
 	if(!handler){
 		return -EINVAL;
 	}
@@ -154,26 +300,107 @@ int clockevent_register_listener(void (*handler)(void* data), void* data){
 	}
 
 	listener->handler = handler;
+	listener->next_tick = next_tick;
 	listener->data = data;
+	listener->irq = irq;
 	INIT_LIST_HEAD(&listener->node);
 
-	spin_lock(&clockevent_lock);
-	list_add_tail(&listener->node, &clockevent_listeners);
-	spin_unlock(&clockevent_lock);
+	spin_lock_irqsave(&clockevent_lock, &flags);
+	list_add_tail_rcu(&listener->node, &clockevent_listeners);
+	spin_unlock_irqrestore(&clockevent_lock, &flags);
 
 	return SUCCESS;
 }
 
+int clockevent_register_nohz_listener(void (*handler)(void* data), tick_t (*next_tick)(void* data), void* data){
+	return clockevent_add_listener(handler, next_tick, data, 0);
+}
+
+/* For what needs the interrupted context, like the scheduler tick */
+int clockevent_register_irq_listener(void (*handler)(void* data), tick_t (*next_tick)(void* data), void* data){
+	return clockevent_add_listener(handler, next_tick, data, 1);
+}
+
+/* Earliest tick any listener needs */
+tick_t clockevent_next_tick(void){
+	struct clockevent_listener* listener;
+	tick_t next = TICK_NONE;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(listener, &clockevent_listeners, node){
+		tick_t tick = listener->next_tick
+			? listener->next_tick(listener->data)
+			: clock_ticks + 1;
+
+		if(tick < next){
+			next = tick;
+		}
+	}
+	rcu_read_unlock();
+
+	return next;
+}
+
+static void clockevent_run(int irq){
+	struct clockevent_listener* listener;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(listener, &clockevent_listeners, node){
+		if(listener->irq == irq){
+			listener->handler(listener->data);
+		}
+	}
+	rcu_read_unlock();
+}
+
+static void clockevent_run_softirq(void){
+	clockevent_run(0);
+}
+
+/* From the timer interrupt, the rest of the listeners follow it */
+void clockevent_run_listeners(void){
+	clockevent_run(1);
+	raise_softirq_irqoff(TIMER_SOFTIRQ);
+}
+
+/*
+* Timer interrupt. In one-shot mode the hrtimer queue runs everything,
+* the tick included; with a periodic only device timers expire at tick
+* resolution.
+*/
 void clockevent_fire(void){
-	struct list_head *pos, *next;
+	if(clock_oneshot){
+		if(clock_interpolated()){
+			spin_lock(&clock_base_lock);
+			clock_fold_elapsed();
+			spin_unlock(&clock_base_lock);
+		}
+
+		hrtimer_interrupt();
+		return;
+	}
 
 	clock_tick();
+	hrtimer_run_queues();
+	clockevent_run_listeners();
+}
 
-	spin_lock(&clockevent_lock);
-	for(pos = clockevent_listeners.next; pos != &clockevent_listeners; pos = next){
-		next = pos->next;
-		struct clockevent_listener* listener = list_entry(pos, struct clockevent_listener, node);
-		listener->handler(listener->data);
+SYSCALL_DEFINE2(clock_gettime, clockid_t, which, __user struct timespec*, tp){
+	time_ns_t now;
+
+	switch(which){
+		case CLOCK_REALTIME:  now = clock_get_realtime_ns(); break;
+		case CLOCK_MONOTONIC: now = clock_get_monotonic_ns(); break;
+		default: return -EINVAL;
 	}
-	spin_unlock(&clockevent_lock);
+
+	struct timespec ts;
+	ts.tv_nsec = do_div(now, NSEC_PER_SEC);
+	ts.tv_sec = now;
+
+	if(!tp || copy_to_user(tp, &ts, sizeof(ts))){
+		return -EFAULT;
+	}
+
+	return SUCCESS;
 }
@@ -1,10 +1,32 @@
 #include <kernel/sched.h>
 #include <kernel/syscall.h>
+#include <kernel/uaccess.h>
 #include <def/errno.h>
 #include <mm/vma.h>
+#include <mm/swap.h>
+#include <fs/fdtable.h>
+#include <fs/fs_struct.h>
 
-static struct task *copy_process() {
+#define CLONE_SUPPORTED \
+	(CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_THREAD | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+#define KSTACK_ORDER 1
+
+_Static_assert((PAGE_SIZE << KSTACK_ORDER) == PROC_KERNEL_STACK_SIZE, "kernel stack order mismatch");
+
+/* Fork runs in process context, so a fragmented heap is compacted or reclaimed */
+static void *kstack_alloc(void) {
+	struct page *page = page_alloc_reclaim(KSTACK_ORDER, PG_KERNEL);
+	if (!page) {
+		return NULL;
+	}
+
+	return (void*)page_to_virt(page);
+}
+
+static struct task *copy_process(unsigned long flags, void __user *stack, int __user *parent_tid, int __user *child_tid) {
 	struct task *cur = current;
+	int ret = -ENOMEM;
 
 	struct task *child = task_create(cur->name, cur->priority);
 	if (!child){
@@ -14,45 +36,102 @@ static struct task *copy_process() {
 	pid_t child_pid = pid_alloc();
 	if(child_pid < 0){
 		kfree(child);
-		return ERR_PTR(-ENOENT);
+		return ERR_PTR(child_pid);
 	}
 
-	void *new_kstack = kmalloc(PROC_KERNEL_STACK_SIZE);
-	if (!new_kstack) {
-		kfree(child);
-		pid_free(child_pid);
-		return ERR_PTR(-ENOMEM);
+	child->pid = child_pid;
+	child->tgid = child_pid;
+
+	child->kstack = kstack_alloc();
+	if (!child->kstack) {
+		goto out_free_task;
 	}
 
-	child->kstack = new_kstack;
-	copy_thread(cur, child, 0x0, 0x0);
+	ret = copy_thread(cur, child, (unsigned long)stack, 0x0, 0x0);
+	if (ret) {
+		goto out_free_kstack;
+	}
 
-	struct mm_struct *c_mm = vma_dup(cur->mm);
-	if (!c_mm) {
-		kfree(new_kstack);
-		kfree(child);
-		pid_free(child_pid);
-		return ERR_PTR(-ENOMEM);
+	ret = -ENOMEM;
+
+	if (flags & CLONE_VM) {
+		vma_get(cur->mm);
+		child->mm = cur->mm;
+	} else if (!(child->mm = vma_dup(cur->mm))) {
+		goto out_release_thread;
+	}
+
+	if (flags & CLONE_FILES) {
+		files_get(cur->files);
+		child->files = cur->files;
+	} else if (!(child->files = files_dup(cur->files))) {
+		goto out_put_mm;
 	}
 
-	child->mm = c_mm;
+	if (flags & CLONE_FS) {
+		fs_get(cur->fs);
+		child->fs = cur->fs;
+	} else if (!(child->fs = fs_copy(cur->fs))) {
+		goto out_put_files;
+	}
 
-	for (int i = 0; i < PROC_FD_MAX; i++) {
-		child->file_table[i] = cur->file_table[i];
-		if (child->file_table[i]){
-			file_get(child->file_table[i]);
+	if (flags & CLONE_PARENT_SETTID) {
+		if (copy_to_user(parent_tid, &child->pid, sizeof(child->pid))) {
+			ret = -EFAULT;
+			goto out_put_fs;
 		}
 	}
 
-	child->parent = cur;
-	list_add(&child->sibling, &cur->children);
+	if (flags & CLONE_CHILD_CLEARTID) {
+		child->clear_child_tid = child_tid;
+	}
+
+	if (flags & CLONE_THREAD) {
+		ret = task_add_thread(cur->group_leader, child);
+		if (ret) {
+			goto out_put_fs;
+		}
+	}
+
+	attach_pid(child);
+
+	if (!(flags & CLONE_THREAD)) {
+		task_add_child(cur, child);
+	}
 
-	child->pid = child_pid;
 	return child;
+
+out_put_fs:
+	fs_put(child->fs);
+out_put_files:
+	files_put(child->files);
+out_put_mm:
+	vma_put(child->mm);
+out_release_thread:
+	release_thread(child);
+out_free_kstack:
+	kfree(child->kstack);
+out_free_task:
+	kfree(child);
+	pid_free(child_pid);
+	return ERR_PTR(ret);
+}
+
+static pid_t do_fork(unsigned long flags, void __user *stack, int __user *parent_tid, int __user *child_tid) {
+	struct task* child = copy_process(flags, stack, parent_tid, child_tid);
+	if(IS_ERR_VALUE(child)){
+		return PTR_ERR(child);
+	}
+
+	// It may be gone already once woken
+	pid_t pid = child->pid;
+	wake_up_new_task(child);
+
+	return pid;
 }
 
 pid_t kernel_thread(int (*fn)(void*), const char* name, void* args){
-	struct task* task = task_create(name, 0);
+	struct task* task = task_create(name, DEFAULT_PRIO);
 	if(!task){
 		return -ENOMEM;
 	}
@@ -64,26 +143,44 @@ pid_t kernel_thread(int (*fn)(void*), const char* name, void* args){
 	}
 
 	task->pid = pid_alloc();
-	if(task->pid == -1){
+	if(task->pid < 0){
+		pid_t err = task->pid;
 		kfree(ksp);
 		kfree(task);
-		return -ENOENT;
+		return err;
 	}
 
 	task->kstack = ksp;
-	copy_thread(0x0, task, fn, args);
+	task->tgid = task->pid;
+	copy_thread(0x0, task, 0x0, fn, args);
+
+	files_get(&init_files);
+	task->files = &init_files;
+	fs_get(&init_fs);
+	task->fs = &init_fs;
 
-	task->state = TASK_READY;
-	scheduler_add(task);
+	attach_pid(task);
+
+	wake_up_new_task(task);
 	return task->pid;
 }
 
 SYSCALL_DEFINE0(fork){
-	struct task* child = copy_process();
-	if(IS_ERR_VALUE(child)){
-		return PTR_ERR(child);
+	return do_fork(0, NULL, NULL, NULL);
+}
+
+/*
+* fork() sharing what `flags` asks for. A thread runs on `stack`, the
+* parent's stack pointer when NULL.
+*/
+SYSCALL_DEFINE4(clone, unsigned long, flags, void __user*, stack, int __user*, parent_tid, int __user*, child_tid){
+	if(flags & ~CLONE_SUPPORTED){
+		return -EINVAL;
+	}
+
+	if((flags & CLONE_THREAD) && !(flags & CLONE_VM)){
+		return -EINVAL;
 	}
 
-	scheduler_add(child);
-	return child->pid;
+	return do_fork(flags, stack, parent_tid, child_tid);
 }
@@ -0,0 +1,236 @@
+#include <kernel/futex.h>
+#include <kernel/sched.h>
+#include <kernel/syscall.h>
+#include <kernel/hrtimer.h>
+#include <kernel/clock.h>
+#include <kernel/init.h>
+#include <sync/spinlock.h>
+#include <mm/mmu.h>
+#include <mm/vma.h>
+#include <lib/list.h>
+#include <def/errno.h>
+
+/**
+* Fast user-space locking.
+*
+* User space takes an uncontended lock with atomics on a 32-bit word and
+* only calls in to sleep while the word holds a value, or to wake the
+* sleepers once it changed it. Sleepers are hashed by the word: by its
+* physical address in a shared mapping, which other processes may map
+* elsewhere, and by address space and virtual address in a private one,
+* whose pages can be swapped, migrated or copied on write meanwhile.
+*
+* A sleeper is queued before it reads the word, so a waker that changed
+* the word after the read finds it queued.
+*/
+
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+struct futex_key {
+	uintptr_t addr;
+	struct mm_struct* mm;  // NULL when addr is physical
+};
+
+struct futex_q {
+	struct list_head list;
+	struct futex_key key;
+	struct task* task;
+	int woken;             // taken off the queue by futex_wake()
+};
+
+struct futex_bucket {
+	spinlock_t lock;
+	struct list_head waiters;
+};
+
+static struct futex_bucket futex_queues[FUTEX_HASH_SIZE];
+
+static struct futex_bucket* futex_hash(const struct futex_key* key){
+	uint32_t hash = (uint32_t)(key->addr >> 2) ^ (uint32_t)((uintptr_t)key->mm >> 6);
+	return &futex_queues[(hash * 0x9E3779B9u) >> (32 - FUTEX_HASH_BITS)];
+}
+
+static inline int futex_match(const struct futex_key* a, const struct futex_key* b){
+	return a->addr == b->addr && a->mm == b->mm;
+}
+
+static int futex_get_key(uint32_t __user* uaddr, struct futex_key* key){
+	struct mm_struct* mm = current->mm;
+	uintptr_t vaddr = (uintptr_t)uaddr;
+	uint32_t val;
+
+	if(!mm){
+		return -EFAULT;
+	}
+
+	if(vaddr & (sizeof(uint32_t) - 1)){
+		return -EINVAL;
+	}
+
+	// Fault it in, a shared one has no frame to hash by before
+	if(copy_from_user(&val, uaddr, sizeof(val))){
+		return -EFAULT;
+	}
+
+	struct vm_region* region = vma_lookup(mm, vaddr);
+	if(!region){
+		return -EFAULT;
+	}
+
+	if(!(region->mem_flags & MEM_SHARED)){
+		key->addr = vaddr;
+		key->mm = mm;
+		return SUCCESS;
+	}
+
+	// Shared pages are neither swapped nor migrated, the frame stays
+	uintptr_t phys = mmu_translate(mm->ctx, vaddr);
+	if(!phys){
+		return -EFAULT;
+	}
+
+	key->addr = (phys & ~(uintptr_t)(PAGE_SIZE - 1)) | (vaddr & (PAGE_SIZE - 1));
+	key->mm = NULL;
+	return SUCCESS;
+}
+
+int futex_wait(uint32_t __user* uaddr, uint32_t val, time_ns_t expires){
+	struct futex_q q = {
+		.task = current,
+		.woken = 0,
+	};
+	unsigned long flags;
+	uint32_t cur;
+
+	int ret = futex_get_key(uaddr, &q.key);
+	if(ret){
+		return ret;
+	}
+
+	struct futex_bucket* bucket = futex_hash(&q.key);
+
+	spin_lock_irqsave(&bucket->lock, &flags);
+	list_add_tail(&q.list, &bucket->waiters);
+	spin_unlock_irqrestore(&bucket->lock, &flags);
+
+	if(copy_from_user(&cur, uaddr, sizeof(cur))){
+		ret = -EFAULT;
+	} else if(cur != val){
+		ret = -EAGAIN;
+	}
+
+	spin_lock_irqsave(&bucket->lock, &flags);
+
+	while(!ret && !q.woken){
+		time_ns_t now = clock_get_monotonic_ns();
+
+		if(expires && (int64_t)(expires - now) <= 0){
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		// exit_group() from another thread
+		if(current->group_leader->group_exit){
+			ret = -EINTR;
+			break;
+		}
+
+		task_sleep(current);
+		spin_unlock_irqrestore(&bucket->lock, &flags);
+
+		if(expires){
+			schedule_timeout(expires - now);
+		} else {
+			schedule();
+		}
+
+		spin_lock_irqsave(&bucket->lock, &flags);
+	}
+
+	// A wakeup taken counts even if the word changed meanwhile
+	if(q.woken){
+		ret = SUCCESS;
+	} else {
+		list_remove(&q.list);
+	}
+
+	spin_unlock_irqrestore(&bucket->lock, &flags);
+	return ret;
+}
+
+/* Returns how many were woken */
+int futex_wake(uint32_t __user* uaddr, int nr){
+	struct futex_q *q, *tmp;
+	struct futex_key key;
+	unsigned long flags;
+	int woken = 0;
+
+	int ret = futex_get_key(uaddr, &key);
+	if(ret){
+		return ret;
+	}
+
+	if(nr <= 0){
+		return 0;
+	}
+
+	struct futex_bucket* bucket = futex_hash(&key);
+
+	spin_lock_irqsave(&bucket->lock, &flags);
+
+	list_for_each_entry_safe(q, tmp, &bucket->waiters, list){
+		if(!futex_match(&q->key, &key)){
+			continue;
+		}
+
+		list_remove(&q->list);
+		q->woken = 1;
+		task_wakeup(q->task);
+
+		if(++woken == nr){
+			break;
+		}
+	}
+
+	spin_unlock_irqrestore(&bucket->lock, &flags);
+	return woken;
+}
+
+SYSCALL_DEFINE4(futex, uint32_t __user*, uaddr, int, op, uint32_t, val, const struct timespec __user*, timeout){
+	struct timespec ts;
+	time_ns_t expires = 0;
+
+	switch(op){
+		case FUTEX_WAIT:
+			if(timeout){
+				if(copy_from_user(&ts, timeout, sizeof(ts))){
+					return -EFAULT;
+				}
+
+				if(!timespec_valid(&ts)){
+					return -EINVAL;
+				}
+
+				expires = clock_get_monotonic_ns() + timespec_to_ns(&ts);
+			}
+
+			return futex_wait(uaddr, val, expires);
+
+		case FUTEX_WAKE:
+			return futex_wake(uaddr, (int)val);
+
+		default: return -ENOSYS;
+	}
+}
+
+static int __init futex_init(void){
+	for(int i = 0; i < FUTEX_HASH_SIZE; i++){
+		spinlock_init(&futex_queues[i].lock);
+		INIT_LIST_HEAD(&futex_queues[i].waiters);
+	}
+
+	return SUCCESS;
+}
+
+core_initcall(futex_init);
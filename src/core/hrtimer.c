@@ -0,0 +1,299 @@
+#include <kernel/hrtimer.h>
+#include <kernel/clock.h>
+#include <kernel/sched.h>
+#include <kernel/syscall.h>
+#include <kernel/uaccess.h>
+#include <kernel/tick.h>
+#include <kernel/init.h>
+#include <kernel/printk.h>
+#include <sync/spinlock.h>
+#include <lib/div64.h>
+#include <def/errno.h>
+
+/**
+* High resolution timers.
+*
+* Pending timers sit in a red-black tree ordered by expiry on the
+* monotonic clock. With a one-shot capable clock event the device is armed
+* for the earliest one, and the periodic tick itself is just another
+* hrtimer (see tick.c). Otherwise timers run from the periodic tick.
+*/
+
+struct hrtimer_base {
+	spinlock_t lock;
+	struct rb_root_cached active;
+	time_ns_t next_event;  // what the clock event is armed for
+	struct hrtimer* running;  // callback in progress, the one clock event runs them one at a time
+	int highres;
+};
+
+static struct hrtimer_base hrtimer_base;
+
+void hrtimer_init(struct hrtimer* timer, enum hrtimer_restart (*function)(struct hrtimer*)){
+	RB_CLEAR_NODE(&timer->node);
+	timer->expires = 0;
+	timer->function = function;
+}
+
+static void enqueue_hrtimer(struct hrtimer* timer){
+	struct rb_node** link = &hrtimer_base.active.rb_root.rb_node;
+	struct rb_node* parent = NULL;
+	int leftmost = 1;
+
+	while(*link){
+		parent = *link;
+		struct hrtimer* entry = rb_entry(parent, struct hrtimer, node);
+
+		if((int64_t)(timer->expires - entry->expires) < 0){
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = 0;
+		}
+	}
+
+	rb_link_node(&timer->node, parent, link);
+	rb_insert_color_cached(&timer->node, &hrtimer_base.active, leftmost);
+}
+
+static void dequeue_hrtimer(struct hrtimer* timer){
+	rb_erase_cached(&timer->node, &hrtimer_base.active);
+}
+
+static struct hrtimer* hrtimer_first(void){
+	struct rb_node* node = rb_first_cached(&hrtimer_base.active);
+	return node ? rb_entry(node, struct hrtimer, node) : NULL;
+}
+
+// Re-arm the clock event, even without timers so the clock keeps folding
+static void hrtimer_reprogram(time_ns_t now){
+	struct hrtimer* first = hrtimer_first();
+	time_ns_t expires = first ? first->expires : now + clockevent_max_delta_ns();
+
+	hrtimer_base.next_event = expires;
+	clockevent_program(expires);
+}
+
+void hrtimer_start(struct hrtimer* timer, time_ns_t expires){
+	unsigned long flags;
+
+	spin_lock_irqsave(&hrtimer_base.lock, &flags);
+
+	if(hrtimer_queued(timer)){
+		dequeue_hrtimer(timer);
+	}
+
+	timer->expires = expires;
+	enqueue_hrtimer(timer);
+
+	if(hrtimer_base.highres && (int64_t)(expires - hrtimer_base.next_event) < 0){
+		hrtimer_base.next_event = expires;
+		clockevent_program(expires);
+	}
+
+	spin_unlock_irqrestore(&hrtimer_base.lock, &flags);
+}
+
+/*
+* Returns 1 if the timer was pending. A callback already running on another
+* CPU is waited for, so the timer can be freed afterwards; never call this
+* from the timer's own callback. An early interrupt is left armed, it just
+* re-arms.
+*/
+int hrtimer_cancel(struct hrtimer* timer){
+	unsigned long flags;
+	int res = 0;
+
+	spin_lock_irqsave(&hrtimer_base.lock, &flags);
+
+	while(hrtimer_base.running == timer){
+		spin_unlock_irqrestore(&hrtimer_base.lock, &flags);
+		cpu_relax();
+		spin_lock_irqsave(&hrtimer_base.lock, &flags);
+	}
+
+	// A restarting callback has queued it again by now
+	if(hrtimer_queued(timer)){
+		dequeue_hrtimer(timer);
+		res = 1;
+	}
+
+	spin_unlock_irqrestore(&hrtimer_base.lock, &flags);
+	return res;
+}
+
+static void __run_hrtimers(time_ns_t now){
+	struct hrtimer* timer;
+
+	while((timer = hrtimer_first()) && (int64_t)(timer->expires - now) <= 0){
+		dequeue_hrtimer(timer);
+		hrtimer_base.running = timer;
+
+		spin_unlock(&hrtimer_base.lock);
+		enum hrtimer_restart restart = timer->function(timer);
+		spin_lock(&hrtimer_base.lock);
+
+		hrtimer_base.running = NULL;
+
+		// The callback may have started it again itself
+		if(restart == HRTIMER_RESTART && !hrtimer_queued(timer)){
+			enqueue_hrtimer(timer);
+		}
+	}
+}
+
+/* One-shot clock event interrupt */
+void hrtimer_interrupt(void){
+	time_ns_t now = clock_get_monotonic_ns();
+
+	spin_lock(&hrtimer_base.lock);
+	__run_hrtimers(now);
+	hrtimer_reprogram(clock_get_monotonic_ns());
+	spin_unlock(&hrtimer_base.lock);
+}
+
+/* Periodic tick, used while the clock event can't do one-shot */
+void hrtimer_run_queues(void){
+	if(hrtimer_base.highres){
+		return;
+	}
+
+	spin_lock(&hrtimer_base.lock);
+	__run_hrtimers(clock_get_monotonic_ns());
+	spin_unlock(&hrtimer_base.lock);
+}
+
+static enum hrtimer_restart hrtimer_wakeup(struct hrtimer* timer){
+	struct hrtimer_sleeper* sleeper = container_of(timer, struct hrtimer_sleeper, timer);
+	struct task* task = sleeper->task;
+
+	sleeper->task = NULL;
+	if(task){
+		task_wakeup(task);
+	}
+
+	return HRTIMER_NORESTART;
+}
+
+void hrtimer_init_sleeper(struct hrtimer_sleeper* sleeper, struct task* task){
+	hrtimer_init(&sleeper->timer, hrtimer_wakeup);
+	sleeper->task = task;
+}
+
+/*
+* Sleep for at most `timeout` ns, the caller sets TASK_BLOCKED first so a
+* wakeup in between is not lost. Returns the time left, 0 on timeout.
+*/
+time_ns_t schedule_timeout(time_ns_t timeout){
+	struct hrtimer_sleeper sleeper;
+	time_ns_t expires = clock_get_monotonic_ns() + timeout;
+
+	hrtimer_init_sleeper(&sleeper, current);
+	hrtimer_start(&sleeper.timer, expires);
+
+	schedule();
+
+	hrtimer_cancel(&sleeper.timer);
+
+	time_ns_t now = clock_get_monotonic_ns();
+	return (int64_t)(expires - now) > 0 ? expires - now : 0;
+}
+
+/* Sleep until `expires` on the monotonic clock */
+int hrtimer_nanosleep(time_ns_t expires){
+	struct hrtimer_sleeper sleeper;
+
+	hrtimer_init_sleeper(&sleeper, current);
+
+	do {
+		task_sleep(current);
+		hrtimer_start(&sleeper.timer, expires);
+
+		if(sleeper.task){
+			schedule();
+		} else {
+			current->state = TASK_RUNNING;
+		}
+
+		hrtimer_cancel(&sleeper.timer);
+	} while(sleeper.task);
+
+	return SUCCESS;
+}
+
+static int do_clock_nanosleep(clockid_t which, int flags, const struct timespec __user* rqtp, struct timespec __user* rmtp){
+	struct timespec ts;
+
+	if(!rqtp || copy_from_user(&ts, rqtp, sizeof(ts))){
+		return -EFAULT;
+	}
+
+	if(!timespec_valid(&ts)){
+		return -EINVAL;
+	}
+
+	time_ns_t expires = timespec_to_ns(&ts);
+
+	switch(which){
+		case CLOCK_MONOTONIC:
+			break;
+
+		case CLOCK_REALTIME:
+			// Absolute wall clock time, taken against the offset right now
+			if(flags & TIMER_ABSTIME){
+				expires -= clock_get_realtime_ns() - clock_get_monotonic_ns();
+			}
+			break;
+
+		default: return -EINVAL;
+	}
+
+	if(!(flags & TIMER_ABSTIME)){
+		expires += clock_get_monotonic_ns();
+	}
+
+	hrtimer_nanosleep(expires);
+
+	// Nothing interrupts a sleep yet, so there is never time left
+	if(rmtp && !(flags & TIMER_ABSTIME)){
+		struct timespec rem = { 0, 0 };
+		if(copy_to_user(rmtp, &rem, sizeof(rem))){
+			return -EFAULT;
+		}
+	}
+
+	return SUCCESS;
+}
+
+SYSCALL_DEFINE2(nanosleep, const __user struct timespec*, rqtp, __user struct timespec*, rmtp){
+	return do_clock_nanosleep(CLOCK_MONOTONIC, 0, rqtp, rmtp);
+}
+
+SYSCALL_DEFINE4(clock_nanosleep, clockid_t, which, int, flags, const __user struct timespec*, rqtp, __user struct timespec*, rmtp){
+	return do_clock_nanosleep(which, flags, rqtp, rmtp);
+}
+
+static int __init hrtimers_init(void){
+	spinlock_init(&hrtimer_base.lock);
+	hrtimer_base.active = RB_ROOT_CACHED;
+	hrtimer_base.running = NULL;
+	hrtimer_base.highres = 0;
+
+	if(clock_switch_to_oneshot() != SUCCESS){
+		printk("hrtimer: clock event has no one-shot mode, timers run from the tick\n");
+		return SUCCESS;
+	}
+
+	unsigned long flags;
+	spin_lock_irqsave(&hrtimer_base.lock, &flags);
+	hrtimer_base.highres = 1;
+	hrtimer_reprogram(clock_get_monotonic_ns());
+	spin_unlock_irqrestore(&hrtimer_base.lock, &flags);
+
+	tick_setup_sched_timer();
+
+	printk("hrtimer: high resolution mode, %llu ns max event\n", clockevent_max_delta_ns());
+	return SUCCESS;
+}
+
+core_initcall(hrtimers_init);
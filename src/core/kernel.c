@@ -8,6 +8,7 @@
 #include <def/errno.h>
 #include <fs/vfs.h>
 #include <fs/stat.h>
+#include <fs/fdtable.h>
 #include <mm/memory.h>
 #include <mm/memblock.h>
 
@@ -60,13 +61,22 @@ static int init(void* unused){
 	vfs_mknod("/tty0", 00755 | S_IFCHR, MKDEV(4, 0));
 	struct file* tty = vfs_open("/tty0", 0x0, 0x0);
 
+	// A table of its own, not the one kernel threads share
+	struct files_struct* files = files_alloc();
+	if(!files){
+		panic("init: no memory for the file table");
+	}
+
+	files_put(current->files);
+	current->files = files;
+
 	// stdin  - 0
 	// stdout - 1
 	// stderr - 2
 
-	current->file_table[0] = tty;
+	files->fd[0] = tty;
 	file_get(tty);
-	current->file_table[1] = tty;
+	files->fd[1] = tty;
 
 	kernel_exec("/init", 0x0, 0x0);
 
@@ -84,9 +94,17 @@ __no_return __init void kmain(){
 
 	module_load("Terminal", terminal_init);
 
+	module_load("PID", pid_init);
+
 	module_load("Scheduler", scheduler_init);
 
-	kernel_thread(init, "init", (void*)0xCAFE);
+	pid_t pid = kernel_thread(init, "init", (void*)0xCAFE);
+	if(pid < 0){
+		panic("Failed to create init: %d\n", pid);
+	}
+
+	// Orphans are handed to it
+	init_task = find_task_by_pid(pid);
 
 	do_initcalls();
 
@@ -94,9 +112,8 @@ __no_return __init void kmain(){
 
 	scheduler_start();
 
-	while(1) cpu_relax();
-
-	unreachable();
+	// The boot context becomes the idle task on the first switch
+	cpu_idle();
 }
 
 SYSCALL_DEFINE2(tmp_vt_write, const char*, str, int, len){
@@ -0,0 +1,154 @@
+#ifdef CONFIG_LOCKSTAT
+
+#include <sync/spinlock.h>
+#include <kernel/clock.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <kernel/smp.h>
+#include <def/config.h>
+#include <def/errno.h>
+#include <asm/tsc.h>
+#include <lib/div64.h>
+#include <stddef.h>
+
+/**
+* Spinlock contention statistics, built with `make LOCKSTAT=1`.
+*
+* Locks initialized with spinlock_init_class() are accounted under the
+* class of their init site, every mm's lock under one class and so on.
+* Each CPU counts acquisitions, contended acquisitions, the cycles spent
+* waiting and the cycles the lock was held in its own slot of the class.
+*
+* Every LOCKSTAT_REPORT_SECS, if any annotated lock was taken since, the
+* classes are printed from the tick, the most waited on first.
+*/
+
+#define LOCKSTAT_REPORT_SECS 10
+#define LOCKSTAT_MAX_CLASSES 32
+
+static struct lock_class* lock_classes;
+static spinlock_t lock_classes_lock;
+
+static unsigned long last_acquisitions;
+static tick_t next_report;
+
+void lockstat_set_class(spinlock_t* lock, struct lock_class* class){
+	lock->class = class;
+
+	if(atomic_cmpxchg(&class->registered, 0, 1) != 0){
+		return;
+	}
+
+	unsigned long flags;
+	spin_lock_irqsave(&lock_classes_lock, &flags);
+
+	class->next = lock_classes;
+	lock_classes = class;
+
+	spin_unlock_irqrestore(&lock_classes_lock, &flags);
+}
+
+static void lock_class_sum(struct lock_class* class, struct lock_class_stats* sum){
+	int cpu;
+
+	*sum = (struct lock_class_stats){0};
+
+	for_each_online_cpu(cpu){
+		struct lock_class_stats* stats = &class->stats[cpu];
+
+		sum->acquisitions += stats->acquisitions;
+		sum->contentions += stats->contentions;
+		sum->wait_cycles += stats->wait_cycles;
+		sum->hold_cycles += stats->hold_cycles;
+
+		if(stats->wait_max > sum->wait_max){
+			sum->wait_max = stats->wait_max;
+		}
+
+		if(stats->hold_max > sum->hold_max){
+			sum->hold_max = stats->hold_max;
+		}
+	}
+}
+
+static unsigned long lockstat_acquisitions(void){
+	struct lock_class_stats sum;
+	unsigned long total = 0;
+
+	for(struct lock_class* class = lock_classes; class; class = class->next){
+		lock_class_sum(class, &sum);
+		total += sum.acquisitions;
+	}
+
+	return total;
+}
+
+static void lockstat_report(void* unused){
+	if(clock_get_ticks() < next_report){
+		return;
+	}
+
+	next_report = clock_get_ticks() + LOCKSTAT_REPORT_SECS * TIMER_FREQUENCY;
+
+	unsigned long total = lockstat_acquisitions();
+	if(total == last_acquisitions){
+		return;
+	}
+
+	last_acquisitions = total;
+
+	// Too big for the stack, the tick only runs one report at a time
+	static struct lock_class* sorted[LOCKSTAT_MAX_CLASSES];
+	static struct lock_class_stats sums[LOCKSTAT_MAX_CLASSES];
+	int nr = 0;
+
+	// Most waited on first
+	for(struct lock_class* class = lock_classes; class && nr < LOCKSTAT_MAX_CLASSES; class = class->next){
+		struct lock_class_stats sum;
+		int i = nr++;
+
+		lock_class_sum(class, &sum);
+
+		for(; i > 0 && sums[i - 1].wait_cycles < sum.wait_cycles; i--){
+			sorted[i] = sorted[i - 1];
+			sums[i] = sums[i - 1];
+		}
+
+		sorted[i] = class;
+		sums[i] = sum;
+	}
+
+	printk("Lockstat: %-20s %10s %10s %12s %12s %12s %12s\n",
+		"class", "acq", "contended", "wait ns", "wait max", "hold avg", "hold max");
+
+	for(int i = 0; i < nr; i++){
+		struct lock_class_stats* sum = &sums[i];
+		uint64_t hold_avg = sum->hold_cycles;
+
+		if(!sum->acquisitions){
+			continue;
+		}
+
+		do_div(hold_avg, sum->acquisitions);
+
+		printk("Lockstat: %-20s %10lu %10lu %12llu %12llu %12llu %12llu\n",
+			sorted[i]->name, sum->acquisitions, sum->contentions,
+			tsc_cycles_to_ns(sum->wait_cycles), tsc_cycles_to_ns(sum->wait_max),
+			tsc_cycles_to_ns(hold_avg), tsc_cycles_to_ns(sum->hold_max));
+	}
+}
+
+static tick_t lockstat_next_tick(void* unused){
+	return next_report;
+}
+
+static int __init lockstat_init(void){
+	next_report = clock_get_ticks() + LOCKSTAT_REPORT_SECS * TIMER_FREQUENCY;
+
+	int res = clockevent_register_nohz_listener(lockstat_report, lockstat_next_tick, NULL);
+	return IS_ERR_VALUE(res) ? res : SUCCESS;
+}
+
+late_initcall(lockstat_init);
+
+#endif
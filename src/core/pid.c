@@ -1,85 +1,167 @@
 #include <kernel/syscall.h>
 #include <kernel/sched.h>
 #include <sync/spinlock.h>
+#include <lib/bitmap.h>
+#include <lib/list.h>
+#include <kernel/uaccess.h>
+#include <def/config.h>
 #include <def/errno.h>
 
-#define PID_FREE 0
-#define PID_ALLOC 1
+/**
+* PID allocation and lookup.
+*
+* Used PIDs are bits of a bitmap. Allocation goes on from the last PID
+* handed out and wraps around to RESERVED_PIDS, so a freed PID is only
+* reused once all the ones after it were, and not before a long while.
+* Tasks are hashed by PID for lookups.
+*/
 
-static pid_t pids[PROC_MAX];
-static pid_t next_free_pid;
-static spinlock_t pid_spinlock;
+// Kernel threads and init, skipped on wraparound
+#define RESERVED_PIDS 300
+
+#define PID_HASH_SIZE 1024
+
+static DECLARE_BITMAP(pid_map, PID_MAX);
+static pid_t last_pid;
+
+static struct list_head pid_hash[PID_HASH_SIZE];
+
+static spinlock_t pid_lock;
+
+static inline struct list_head* pid_hashfn(pid_t pid){
+	return &pid_hash[pid & (PID_HASH_SIZE - 1)];
+}
 
 pid_t pid_alloc(){
-	spin_lock(&pid_spinlock);
-	pid_t start = next_free_pid;
-	pid_t i = start;
-
-	do {
-		if(pids[i] == PID_FREE){
-			pids[i] = PID_ALLOC;
-			next_free_pid = (i + 1) % PROC_MAX;
-			spin_unlock(&pid_spinlock);
-			return i;
-		}
-		i = (i + 1) % PROC_MAX;
-	} while(i != start);
+	spin_lock(&pid_lock);
+
+	size_t pid = find_next_zero_bit(pid_map, PID_MAX, last_pid + 1);
+	if(pid >= PID_MAX){
+		pid = find_next_zero_bit(pid_map, PID_MAX, RESERVED_PIDS);
+	}
+
+	if(pid >= PID_MAX){
+		spin_unlock(&pid_lock);
+		return -EAGAIN;
+	}
+
+	set_bit(pid, pid_map);
+	last_pid = pid;
 
-	spin_unlock(&pid_spinlock);
-	return -ENOENT;
+	spin_unlock(&pid_lock);
+	return pid;
 }
 
 void pid_free(pid_t pid){
-	pids[pid] = PID_FREE;
-	next_free_pid = pid;
+	spin_lock(&pid_lock);
+	clear_bit(pid, pid_map);
+	spin_unlock(&pid_lock);
 }
 
-static int __init pid_init(){
-	for(pid_t i = 0; i < PROC_MAX; i++){
-		pids[i] = PID_FREE;
+void attach_pid(struct task* task){
+	spin_lock(&pid_lock);
+	list_add(&task->pid_chain, pid_hashfn(task->pid));
+	spin_unlock(&pid_lock);
+}
+
+void detach_pid(struct task* task){
+	spin_lock(&pid_lock);
+	list_remove(&task->pid_chain);
+	clear_bit(task->pid, pid_map);
+	spin_unlock(&pid_lock);
+}
+
+struct task* find_task_by_pid(pid_t pid){
+	struct task* task;
+
+	if(pid <= 0 || pid >= PID_MAX){
+		return NULL;
 	}
 
-	next_free_pid = pids[0] = PID_ALLOC; // reserved init
+	spin_lock(&pid_lock);
 
-	spinlock_init(&pid_spinlock);
-	return OK;
+	list_for_each_entry(task, pid_hashfn(pid), pid_chain){
+		if(task->pid == pid){
+			spin_unlock(&pid_lock);
+			return task;
+		}
+	}
+
+	spin_unlock(&pid_lock);
+	return NULL;
 }
 
-core_initcall(pid_init);
+/* Before the first kernel thread */
+int __init pid_init(void){
+	bitmap_zero(pid_map, PID_MAX);
+	set_bit(0, pid_map); // idle tasks
+
+	for(int i = 0; i < PID_HASH_SIZE; i++){
+		INIT_LIST_HEAD(&pid_hash[i]);
+	}
+
+	last_pid = 0;
 
+	spinlock_init(&pid_lock);
+	return OK;
+}
+
+/* The thread group's, threads tell themselves apart by gettid() */
 SYSCALL_DEFINE0(getpid){
+	return current->tgid;
+}
+
+SYSCALL_DEFINE0(gettid){
 	return current->pid;
 }
 
-SYSCALL_DEFINE3(waitpid, pid_t, pid, int*, wstatus, int, options){
-	for (;;) {
-		struct task* child = NULL;
-	
-		if(pid > 0){
-			child = task_get_child(current, pid);
-			if(!child){
-				return -ENOENT;
-			}
-		}else{
-			child = task_find_zombie_child(current);
-		}
+SYSCALL_DEFINE3(waitpid, pid_t, pid, int __user*, wstatus, int, options){
+	pid_t child;
+	int code;
 
-		if(child){
-			if(child->state == TASK_ZOMBIE){
-				if(wstatus){
-					*wstatus = child->exit_code;
-				}
+	int res = task_wait_children(pid, &child, &code, 1, options);
+	if(res <= 0){
+		return res;
+	}
 
-				pid_t child_pid = child->pid;
-				task_destroy(child);
-				return child_pid;
-			}
-		}
+	if(wstatus && copy_to_user(wstatus, &code, sizeof(int))){
+		return -EFAULT;
+	}
 
-		if(options & WNOHANG){
-			return 0;
-		}
+	return child;
+}
+
+// Most children reaped by one waitpids() call
+#define WAITPIDS_MAX 32
 
-		sleep_current();
+/*
+* waitpid() for up to `count` exited children at once, their PIDs and
+* statuses go to `pids` and `wstatus`. Returns how many were reaped.
+*/
+SYSCALL_DEFINE4(waitpids, pid_t __user*, pids, int __user*, wstatus, int, count, int, options){
+	pid_t kpids[WAITPIDS_MAX];
+	int codes[WAITPIDS_MAX];
+
+	if(!pids || count <= 0){
+		return -EINVAL;
+	}
+
+	if(count > WAITPIDS_MAX){
+		count = WAITPIDS_MAX;
 	}
-}
\ No newline at end of file
+
+	int res = task_wait_children(-1, kpids, codes, count, options);
+	if(res <= 0){
+		return res;
+	}
+
+	if(copy_to_user(pids, kpids, res * sizeof(pid_t))){
+		return -EFAULT;
+	}
+
+	if(wstatus && copy_to_user(wstatus, codes, res * sizeof(int))){
+		return -EFAULT;
+	}
+
+	return res;
+}
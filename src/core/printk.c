@@ -1,6 +1,7 @@
 #include <kernel/printk.h>
 #include <def/config.h>
 #include <lib/serial.h>
+#include <sync/spinlock.h>
 #include <stddef.h>
 
 static printk_echo_function _printk_ech = NULL;
@@ -8,7 +9,9 @@ static char printk_circular_buffer[PRINTK_BUFFER_SIZE];
 
 static uint64_t printk_cursor = 0;
 
-// Not SMP-safe, but we don't have SMP yet.
+// Keeps lines from different CPUs apart in the buffer and on the console
+static spinlock_t printk_lock;
+
 static inline void printk_write_char(char c){
 	printk_circular_buffer[printk_cursor % PRINTK_BUFFER_SIZE] = c;
 	printk_cursor++;
@@ -48,6 +51,9 @@ int printk(const char* restrict fmt, ...){
 	int c = vsnprintf(buffer, sizeof(buffer), fmt, args);
 	va_end(args);
 
+	unsigned long flags;
+	spin_lock_irqsave(&printk_lock, &flags);
+
 	if (_printk_ech)
 		_printk_ech(buffer, c);
 
@@ -56,5 +62,7 @@ int printk(const char* restrict fmt, ...){
 		serial_putchar(buffer[i]);
 	}
 
+	spin_unlock_irqrestore(&printk_lock, &flags);
+
 	return c;
 }
\ No newline at end of file
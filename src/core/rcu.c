@@ -0,0 +1,242 @@
+#include <sync/rcu.h>
+#include <sync/spinlock.h>
+#include <kernel/completion.h>
+#include <kernel/sched.h>
+#include <kernel/fork.h>
+#include <kernel/init.h>
+#include <kernel/smp.h>
+#include <kernel/tick.h>
+#include <asm/irq_regs.h>
+#include <asm/irqflags.h>
+#include <asm/percpu.h>
+#include <def/errno.h>
+
+/**
+* RCU grace periods.
+*
+* A grace period starts when a CPU has callbacks waiting and none is
+* running. Every online CPU that isn't idle owes it a quiescent state: it
+* notices the new period from its tick and reports once it switched tasks,
+* or ticked in user mode or idle, after that. Idle CPUs are left out, the
+* idle loop is never in a read section.
+*
+* call_rcu() queues on this CPU. Its next tick moves the batch behind the
+* next grace period, and once that one ended hands it to the "rcu" thread,
+* which runs the callbacks: most free memory, which the tick can't do.
+*/
+
+struct rcu_data {
+	unsigned long gp_seen;     // last grace period this CPU noticed
+	int qs_pending;            // gp_seen still waits for this CPU
+	int passed_quiesc;         // quiescent since noticing gp_seen
+
+	struct rcu_head* next;     // queued since the last tick
+	struct rcu_head* wait;     // waiting for grace period wait_gp
+	unsigned long wait_gp;
+};
+
+static DEFINE_PER_CPU(struct rcu_data, rcu_data);
+
+static struct {
+	spinlock_t lock;
+	unsigned long gp_seq;      // last grace period started
+	unsigned long completed;   // last grace period ended
+	unsigned long qsmask;      // CPUs gp_seq still waits for
+} rcu_state;
+
+// Callbacks whose grace period ended, run by rcu_task, rcu_state.lock
+static struct rcu_head* rcu_done;
+static struct task* rcu_task;
+
+// No task ran yet, so nobody can be in a read section
+static int rcu_scheduler_active;
+
+#define rcu_gp_after_eq(a, b) ((long)((a) - (b)) >= 0)
+
+void call_rcu(struct rcu_head* head, rcu_callback_t func){
+	unsigned long flags;
+
+	head->func = func;
+
+	local_irq_save(flags);
+
+	struct rcu_data* rdp = this_cpu_ptr(&rcu_data);
+	head->next = rdp->next;
+	rdp->next = head;
+
+	local_irq_restore(flags);
+}
+
+struct rcu_synchronize {
+	struct rcu_head head;
+	struct completion done;
+};
+
+static void wakeme_after_rcu(struct rcu_head* head){
+	complete(&container_of(head, struct rcu_synchronize, head)->done);
+}
+
+void synchronize_rcu(void){
+	// Alone, the caller being able to sleep makes it a grace period
+	if(!rcu_scheduler_active || num_online_cpus() <= 1){
+		return;
+	}
+
+	struct rcu_synchronize rs;
+	init_completion(&rs.done);
+
+	call_rcu(&rs.head, wakeme_after_rcu);
+	wait_for_completion(&rs.done);
+}
+
+void __init rcu_scheduler_starting(void){
+	rcu_scheduler_active = 1;
+}
+
+void rcu_note_context_switch(void){
+	this_cpu_ptr(&rcu_data)->passed_quiesc = 1;
+}
+
+// rcu_state.lock held
+static void rcu_start_gp(void){
+	unsigned long mask = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu){
+		if(!idle_cpu(cpu)){
+			mask |= 1UL << cpu;
+		}
+	}
+
+	rcu_state.gp_seq++;
+	rcu_state.qsmask = mask;
+
+	if(!mask){
+		rcu_state.completed = rcu_state.gp_seq;
+		return;
+	}
+
+	// A stopped tick would only notice the new period once it is due again
+	if((mask & 1UL) && smp_processor_id() != 0 && tick_nohz_stopped()){
+		smp_send_reschedule(0);
+	}
+}
+
+// rcu_state.lock held
+static void rcu_report_qs(int cpu){
+	rcu_state.qsmask &= ~(1UL << cpu);
+
+	if(!rcu_state.qsmask){
+		rcu_state.completed = rcu_state.gp_seq;
+	}
+}
+
+/* From every CPU's tick, with interrupts off */
+void rcu_check_callbacks(void){
+	struct rcu_data* rdp = this_cpu_ptr(&rcu_data);
+	struct registers* regs = get_irq_regs();
+	int cpu = smp_processor_id();
+	int wake = 0;
+
+	// Nothing in a read section when the tick came
+	int quiescent = sched_idle() || (regs && regs_is_user_mode(regs));
+	if(quiescent){
+		rdp->passed_quiesc = 1;
+	}
+
+	if(!rdp->next && !rdp->wait && !rdp->qs_pending
+		&& rdp->gp_seen == *(volatile unsigned long*)&rcu_state.gp_seq){
+		return;
+	}
+
+	spin_lock(&rcu_state.lock);
+
+	if(rdp->gp_seen != rcu_state.gp_seq){
+		// Only what happens from now on counts for the new one
+		rdp->gp_seen = rcu_state.gp_seq;
+		rdp->qs_pending = !!(rcu_state.qsmask & (1UL << cpu));
+		rdp->passed_quiesc = quiescent;
+	}
+
+	if(rdp->qs_pending && rdp->passed_quiesc){
+		rdp->qs_pending = 0;
+		rcu_report_qs(cpu);
+	}
+
+	if(rdp->wait && rcu_gp_after_eq(rcu_state.completed, rdp->wait_gp)){
+		while(rdp->wait){
+			struct rcu_head* head = rdp->wait;
+			rdp->wait = head->next;
+			head->next = rcu_done;
+			rcu_done = head;
+		}
+
+		wake = 1;
+	}
+
+	// Readers may hold them until the grace period after the current one
+	if(rdp->next && !rdp->wait){
+		rdp->wait = rdp->next;
+		rdp->wait_gp = rcu_state.gp_seq + 1;
+		rdp->next = NULL;
+	}
+
+	if(rdp->wait && rcu_state.completed == rcu_state.gp_seq
+		&& !rcu_gp_after_eq(rcu_state.gp_seq, rdp->wait_gp)){
+		rcu_start_gp();
+	}
+
+	if(wake && rcu_task){
+		task_wakeup(rcu_task);
+	}
+
+	spin_unlock(&rcu_state.lock);
+}
+
+/* Whether this CPU's tick has to keep running for RCU */
+int rcu_needs_cpu(void){
+	struct rcu_data* rdp = this_cpu_ptr(&rcu_data);
+
+	return rdp->next || rdp->wait || rdp->qs_pending
+		|| rdp->gp_seen != *(volatile unsigned long*)&rcu_state.gp_seq;
+}
+
+static int rcu_thread(void* unused){
+	unsigned long flags;
+
+	rcu_task = current;
+
+	while(1){
+		spin_lock_irqsave(&rcu_state.lock, &flags);
+
+		struct rcu_head* list = rcu_done;
+		rcu_done = NULL;
+
+		if(!list){
+			task_sleep(current);
+			spin_unlock_irqrestore(&rcu_state.lock, &flags);
+
+			schedule();
+			continue;
+		}
+
+		spin_unlock_irqrestore(&rcu_state.lock, &flags);
+
+		while(list){
+			struct rcu_head* head = list;
+			list = head->next;
+			head->func(head);
+		}
+	}
+
+	return SUCCESS;
+}
+
+static int __init rcu_init(void){
+	spinlock_init_class(&rcu_state.lock, "rcu_state.lock");
+
+	pid_t pid = kernel_thread(rcu_thread, "rcu", NULL);
+	return pid < 0 ? pid : SUCCESS;
+}
+
+core_initcall(rcu_init);
@@ -1,4 +1,5 @@
 #include <def/config.h>
+#include <asm/percpu.h>
 
 extern void _set_resgisters_segments(int);
 
@@ -8,4 +9,5 @@ void user_registers(){
 
 void kernel_registers(){
     _set_resgisters_segments(GDT_KERNEL_DATA);
-}
\ No newline at end of file
+    percpu_load_segment();
+}
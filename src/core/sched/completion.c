@@ -0,0 +1,102 @@
+#include <kernel/completion.h>
+#include <kernel/preempt.h>
+#include <lib/assert.h>
+
+// complete_all() lets everybody through from then on
+#define COMPLETION_ALL (~0U)
+
+// wait_for_completion() has no timeout
+#define COMPLETION_FOREVER ((time_ns_t)~0ULL)
+
+void complete(struct completion* x){
+	unsigned long flags;
+
+	spin_lock_irqsave(&x->wait.lock, &flags);
+	if(x->done != COMPLETION_ALL){
+		x->done++;
+	}
+	spin_unlock_irqrestore(&x->wait.lock, &flags);
+
+	wake_up(&x->wait);
+}
+
+void complete_all(struct completion* x){
+	unsigned long flags;
+
+	spin_lock_irqsave(&x->wait.lock, &flags);
+	x->done = COMPLETION_ALL;
+	spin_unlock_irqrestore(&x->wait.lock, &flags);
+
+	wake_up_all(&x->wait);
+}
+
+/* Take one completion if there is one, without sleeping */
+int try_wait_for_completion(struct completion* x){
+	unsigned long flags;
+	int taken = 0;
+
+	spin_lock_irqsave(&x->wait.lock, &flags);
+	if(x->done){
+		if(x->done != COMPLETION_ALL){
+			x->done--;
+		}
+		taken = 1;
+	}
+	spin_unlock_irqrestore(&x->wait.lock, &flags);
+
+	return taken;
+}
+
+int completion_done(struct completion* x){
+	return x->done != 0;
+}
+
+/*
+* The wait_event_timeout() loop, but the condition takes the completion
+* and must run exactly once per wakeup.
+*/
+static time_ns_t do_wait_for_completion(struct completion* x, time_ns_t timeout){
+	struct wait_queue_entry wait;
+
+	if(try_wait_for_completion(x)){
+		return timeout ? timeout : 1;
+	}
+
+	BUG_ON(in_interrupt());
+
+	wait_queue_entry_init(&wait, current, task_default_wakeup);
+	wait_queue_add(&x->wait, &wait);
+
+	while(1){
+		task_sleep(current);
+
+		if(try_wait_for_completion(x)){
+			current->state = TASK_RUNNING;
+			timeout = timeout ? timeout : 1;
+			break;
+		}
+
+		if(timeout == COMPLETION_FOREVER){
+			schedule();
+			continue;
+		}
+
+		timeout = schedule_timeout(timeout);
+		if(!timeout){
+			timeout = try_wait_for_completion(x);
+			break;
+		}
+	}
+
+	wait_queue_remove(&x->wait, &wait);
+	return timeout;
+}
+
+void wait_for_completion(struct completion* x){
+	do_wait_for_completion(x, COMPLETION_FOREVER);
+}
+
+/* 0 when `timeout` ns passed first, otherwise the time left (at least 1) */
+time_ns_t wait_for_completion_timeout(struct completion* x, time_ns_t timeout){
+	return do_wait_for_completion(x, timeout);
+}
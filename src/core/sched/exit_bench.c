@@ -0,0 +1,137 @@
+#ifdef CONFIG_EXIT_BENCH
+
+#include <kernel/sched.h>
+#include <kernel/fork.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <mm/page.h>
+#include <mm/vma.h>
+#include <def/errno.h>
+#include <lib/div64.h>
+#include <asm/irqflags.h>
+#include <asm/tsc.h>
+
+/**
+* Switch latency out of exiting tasks, run once after boot with
+* `make EXIT_BENCH=1`.
+*
+* BENCH_SAMPLES kernel threads are started one after the other on the CPU
+* of a measuring thread. Each maps BENCH_PAGES pages into an address space
+* of its own, wakes the measuring thread and exits with interrupts off, so
+* it can't be preempted on the way. The TSC delta from the exit to the
+* measuring thread running is recorded: the switch in between is what
+* used to tear the address space down.
+*/
+
+#define BENCH_SAMPLES 64
+#define BENCH_PAGES 256
+#define BENCH_BASE 0x10000000UL
+
+static struct task *bench_waiter;
+static volatile uint64_t bench_exit_tsc;
+static volatile int bench_exited;
+
+static struct mm_struct *bench_build_mm(void){
+	const mem_flags_t flags = MEM_READ | MEM_WRITE | MEM_USER;
+	const uintptr_t end = BENCH_BASE + BENCH_PAGES * PAGE_SIZE;
+
+	struct mm_struct *mm = vma_alloc();
+	if (!mm)
+		return NULL;
+
+	mm->ctx = mmu_create_context();
+	if (!mm->ctx)
+		goto out_mm;
+
+	struct vm_region *region = vma_add(mm, BENCH_BASE, end, flags,
+		PROT_MAP_PRIVATE | PROT_MAP_ANONYMOUS, NULL, 0);
+	if (IS_ERR_VALUE(region))
+		goto out_mm;
+
+	for (uintptr_t va = BENCH_BASE; va < end; va += PAGE_SIZE) {
+		struct page *page = page_alloc(0, PG_ANON);
+		if (!page)
+			break;
+
+		if (mmu_mmap(mm->ctx, page_to_phys(page), va, PAGE_SIZE, flags) != SUCCESS) {
+			page_free(page);
+			break;
+		}
+	}
+
+	return mm;
+
+out_mm:
+	vma_destroy(mm);
+	return NULL;
+}
+
+static int bench_exiter(void *cpu){
+	sched_setaffinity(current, 1UL << (int)cpu);
+
+	struct mm_struct *mm = bench_build_mm();
+
+	// Never switched to, it only gets torn down
+	local_irq_disable();
+	current->mm = mm;
+
+	bench_exited = 1;
+	bench_exit_tsc = rdtsc();
+	task_wakeup(bench_waiter);
+
+	return SUCCESS;
+}
+
+static int bench_latency(void *unused){
+	uint64_t min = ~0ULL, max = 0, total = 0;
+	int cpu = current->cpu;
+	int samples = 0;
+
+	bench_waiter = current;
+	sched_setaffinity(current, 1UL << cpu);
+
+	for (int i = 0; i < BENCH_SAMPLES; i++) {
+		bench_exited = 0;
+
+		pid_t pid = kernel_thread(bench_exiter, "bench_exiter", (void *)cpu);
+		if (pid < 0)
+			break;
+
+		while (1) {
+			task_sleep(current);
+			if (bench_exited) {
+				current->state = TASK_RUNNING;
+				break;
+			}
+
+			schedule();
+		}
+
+		uint64_t latency = rdtsc() - bench_exit_tsc;
+
+		if (latency < min) min = latency;
+		if (latency > max) max = latency;
+		total += latency;
+		samples++;
+	}
+
+	if (!samples)
+		return -ENOMEM;
+
+	do_div(total, samples);
+
+	printk("Exit bench: %d exits of %d pages: switch latency min %llu avg %llu max %llu ns\n",
+		samples, BENCH_PAGES, tsc_cycles_to_ns(min), tsc_cycles_to_ns(total),
+		tsc_cycles_to_ns(max));
+
+	return SUCCESS;
+}
+
+static int __init exit_bench_init(void){
+	pid_t pid = kernel_thread(bench_latency, "bench_latency", NULL);
+	return pid < 0 ? pid : SUCCESS;
+}
+
+late_initcall(exit_bench_init);
+
+#endif
@@ -0,0 +1,266 @@
+#include <sync/mutex.h>
+#include <sync/spinlock.h>
+#include <kernel/preempt.h>
+#include <kernel/sched.h>
+#include <lib/assert.h>
+
+#include "sched_internal.h"
+
+/**
+* Mutexes with priority inheritance.
+*
+* Taking a free mutex or releasing one nobody waits on is a single
+* cmpxchg on the owner word. While the owner runs on another CPU a locker
+* spins first, the mutex is likely free again before a sleep and a wakeup
+* would be through. A task that has to wait sets MUTEX_HAS_WAITERS, so the
+* owner's release fails over to the slow path, queues itself by priority
+* and sleeps. The release hands the mutex straight to the top waiter.
+*
+* While a mutex has waiters it sits in its owner's pi_locks, and the owner
+* runs at the highest real-time priority of the top waiters over all of
+* them. When the owner waits on another mutex itself the boost is passed
+* on down the chain.
+*/
+
+// Longest chain of owners a boost is passed through, a deadlock stops there
+#define PI_CHAIN_MAX 16
+
+struct mutex_waiter {
+	struct list_head list;
+	struct task* task;
+	struct mutex* lock;
+	int prio;
+};
+
+spinlock_t pi_lock;
+
+void mutex_init(struct mutex* lock){
+	atomic_set(&lock->owner, 0);
+	INIT_LIST_HEAD(&lock->waiters);
+	INIT_LIST_HEAD(&lock->pi_node);
+}
+
+static inline struct mutex_waiter* top_waiter(struct mutex* lock){
+	return list_first_entry(&lock->waiters, struct mutex_waiter, list);
+}
+
+// Behind the waiters of the same priority
+static void waiter_enqueue(struct mutex* lock, struct mutex_waiter* waiter){
+	struct mutex_waiter* pos;
+
+	list_for_each_entry(pos, &lock->waiters, list){
+		if(waiter->prio > pos->prio){
+			list_add_tail(&waiter->list, &pos->list);
+			return;
+		}
+	}
+
+	list_add_tail(&waiter->list, &lock->waiters);
+}
+
+/* The priority `task` inherits from the mutexes it holds, 0 for none */
+int pi_inherited_prio(struct task* task){
+	struct mutex* lock;
+	int prio = 0;
+
+	list_for_each_entry(lock, &task->pi_locks, pi_node){
+		int top = top_waiter(lock)->prio;
+		if(top > prio){
+			prio = top;
+		}
+	}
+
+	return prio;
+}
+
+static int pi_effective_prio(struct task* task){
+	int prio = pi_inherited_prio(task);
+	return prio > task->rt_priority ? prio : task->rt_priority;
+}
+
+/*
+* `task`'s priority may have changed. Requeue it on the mutex it waits for
+* and recompute that owner's boost, on down the chain until nothing moves.
+*/
+void pi_chain_adjust(struct task* task){
+	for(int depth = 0; depth < PI_CHAIN_MAX; depth++){
+		struct mutex_waiter* waiter = task->pi_blocked_on;
+		if(!waiter || waiter->prio == task->rt_prio){
+			return;
+		}
+
+		struct mutex* lock = waiter->lock;
+
+		list_remove(&waiter->list);
+		waiter->prio = task->rt_prio;
+		waiter_enqueue(lock, waiter);
+
+		task = mutex_owner(lock);
+
+		int prio = pi_effective_prio(task);
+		if(prio == task->rt_prio){
+			return;
+		}
+
+		sched_set_rt_prio(task, prio);
+	}
+}
+
+/* Recompute the boost of `task` itself, then pass it on */
+static void pi_adjust(struct task* task){
+	int prio = pi_effective_prio(task);
+
+	if(prio != task->rt_prio){
+		sched_set_rt_prio(task, prio);
+		pi_chain_adjust(task);
+	}
+}
+
+int mutex_trylock(struct mutex* lock){
+	return atomic_cmpxchg(&lock->owner, 0, (int)current) == 0;
+}
+
+/*
+* Flag the waiters, or take the mutex if it came free meanwhile; a free
+* mutex never has waiters, they get it handed over. pi_lock held.
+*/
+static int mutex_mark_waiters(struct mutex* lock, struct task* task){
+	while(1){
+		int owner = atomic_read(&lock->owner);
+
+		if(!owner){
+			if(atomic_cmpxchg(&lock->owner, 0, (int)task) == 0){
+				return 1;
+			}
+			continue;
+		}
+
+		if((owner & MUTEX_HAS_WAITERS) || atomic_cmpxchg(&lock->owner, owner, owner | MUTEX_HAS_WAITERS) == owner){
+			return 0;
+		}
+	}
+}
+
+/*
+* Spin while the owner is running, until the mutex comes free. Give up once
+* the owner sleeps or somebody waits: the mutex is handed to the waiter,
+* spinning for it is no use.
+*/
+static int mutex_optimistic_spin(struct mutex* lock){
+	int taken = 0;
+
+	preempt_disable();
+
+	while(!this_rq()->need_resched){
+		int owner = atomic_read(&lock->owner);
+
+		if(!owner){
+			if(atomic_cmpxchg(&lock->owner, 0, (int)current) == 0){
+				taken = 1;
+				break;
+			}
+			continue;
+		}
+
+		if((owner & MUTEX_HAS_WAITERS) || !((struct task*)owner)->on_cpu){
+			break;
+		}
+
+		cpu_relax();
+	}
+
+	preempt_enable();
+	return taken;
+}
+
+static void mutex_lock_slowpath(struct mutex* lock){
+	struct task* task = current;
+	struct mutex_waiter waiter;
+	unsigned long flags;
+
+	if(mutex_optimistic_spin(lock)){
+		return;
+	}
+
+	spin_lock_irqsave(&pi_lock, &flags);
+
+	if(mutex_mark_waiters(lock, task)){
+		spin_unlock_irqrestore(&pi_lock, &flags);
+		return;
+	}
+
+	struct task* owner = mutex_owner(lock);
+
+	waiter.task = task;
+	waiter.lock = lock;
+	waiter.prio = task->rt_prio;
+
+	if(list_empty(&lock->waiters)){
+		list_add(&lock->pi_node, &owner->pi_locks);
+	}
+
+	waiter_enqueue(lock, &waiter);
+	task->pi_blocked_on = &waiter;
+
+	pi_adjust(owner);
+
+	// Handed over by mutex_unlock(), other wakeups only go around again
+	while(mutex_owner(lock) != task){
+		task_sleep(task);
+		spin_unlock_irqrestore(&pi_lock, &flags);
+
+		schedule();
+
+		spin_lock_irqsave(&pi_lock, &flags);
+	}
+
+	spin_unlock_irqrestore(&pi_lock, &flags);
+}
+
+void mutex_lock(struct mutex* lock){
+	BUG_ON(in_interrupt());
+
+	if(likely(atomic_cmpxchg(&lock->owner, 0, (int)current) == 0)){
+		return;
+	}
+
+	mutex_lock_slowpath(lock);
+}
+
+static void mutex_unlock_slowpath(struct mutex* lock){
+	struct task* task = current;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pi_lock, &flags);
+
+	struct mutex_waiter* waiter = top_waiter(lock);
+	struct task* next = waiter->task;
+
+	list_remove(&waiter->list);
+	list_remove(&lock->pi_node);
+	next->pi_blocked_on = NULL;
+
+	if(list_empty(&lock->waiters)){
+		atomic_set(&lock->owner, (int)next);
+	} else {
+		atomic_set(&lock->owner, (int)next | MUTEX_HAS_WAITERS);
+		list_add(&lock->pi_node, &next->pi_locks);
+	}
+
+	pi_adjust(next);
+	pi_adjust(task);
+
+	task_wakeup(next);
+
+	spin_unlock_irqrestore(&pi_lock, &flags);
+}
+
+void mutex_unlock(struct mutex* lock){
+	BUG_ON(mutex_owner(lock) != current);
+
+	if(likely(atomic_cmpxchg(&lock->owner, (int)current, 0) == (int)current)){
+		return;
+	}
+
+	mutex_unlock_slowpath(lock);
+}
@@ -0,0 +1,91 @@
+#ifdef CONFIG_PREEMPT_TRACE
+
+#include <kernel/preempt.h>
+#include <kernel/clock.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <kernel/smp.h>
+#include <def/config.h>
+#include <def/errno.h>
+#include <asm/tsc.h>
+#include <stddef.h>
+
+/**
+* Preemption latency tracer, built with `make PREEMPT_TRACE=1`.
+*
+* Every section with the preempt count up, from the outermost disable to
+* the enable that drops it to zero, is timed with the TSC. Each CPU keeps
+* its longest one along with the callers that opened and closed it; new
+* maxima are printed from the tick, at most once a second.
+*
+* Regions that only turn interrupts off, like system calls, are not
+* counted.
+*/
+
+struct preempt_trace {
+	uint64_t start;
+	unsigned long start_ip;
+
+	uint64_t max;
+	unsigned long max_start_ip;
+	unsigned long max_end_ip;
+};
+
+static struct preempt_trace traces[MAX_CPUS];
+static volatile int trace_pending;
+
+void trace_preempt_off(int cpu, unsigned long ip){
+	struct preempt_trace* t = &traces[cpu];
+
+	t->start = rdtsc();
+	t->start_ip = ip;
+}
+
+void trace_preempt_on(int cpu, unsigned long ip){
+	struct preempt_trace* t = &traces[cpu];
+
+	// Entered before the tracer saw the outermost disable
+	if(!t->start){
+		return;
+	}
+
+	uint64_t delta = rdtsc() - t->start;
+	t->start = 0;
+
+	if(delta > t->max){
+		t->max = delta;
+		t->max_start_ip = t->start_ip;
+		t->max_end_ip = ip;
+		trace_pending = 1;
+	}
+}
+
+static void preempt_trace_report(void* unused){
+	int cpu;
+
+	if(!trace_pending){
+		return;
+	}
+
+	trace_pending = 0;
+
+	for_each_online_cpu(cpu){
+		struct preempt_trace* t = &traces[cpu];
+
+		printk("Preempt trace: cpu%d max %llu cycles (%llu ns) from %#lx to %#lx\n",
+			cpu, t->max, tsc_cycles_to_ns(t->max), t->max_start_ip, t->max_end_ip);
+	}
+}
+
+static tick_t preempt_trace_next_tick(void* unused){
+	return trace_pending ? clock_get_ticks() + TIMER_FREQUENCY : TICK_NONE;
+}
+
+static int __init preempt_trace_init(void){
+	int res = clockevent_register_nohz_listener(preempt_trace_report, preempt_trace_next_tick, NULL);
+	return IS_ERR_VALUE(res) ? res : SUCCESS;
+}
+
+late_initcall(preempt_trace_init);
+
+#endif
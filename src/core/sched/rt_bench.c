@@ -0,0 +1,143 @@
+#ifdef CONFIG_RT_BENCH
+
+#include <kernel/sched.h>
+#include <kernel/clock.h>
+#include <kernel/hrtimer.h>
+#include <kernel/fork.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <sync/mutex.h>
+#include <def/errno.h>
+
+/**
+* cyclictest style wakeup latency, run once after boot with
+* `make RT_BENCH=1`.
+*
+* While BENCH_HOGS kernel threads spin at nice 0, a measuring thread
+* sleeps until an absolute time every BENCH_INTERVAL_NS and records how
+* late it got to run. One pass runs it as SCHED_NORMAL, one as SCHED_FIFO,
+* each printing the latency percentiles.
+*
+* A last pass has the SCHED_FIFO thread wait for a mutex held by a nice 19
+* thread doing BENCH_HOLD_LOOPS of work. Priority inheritance lifts the
+* holder above the hogs, so the wait should stay close to what the same
+* work takes uncontended.
+*/
+
+#define BENCH_HOGS 4
+#define BENCH_SAMPLES 200
+#define BENCH_INTERVAL_NS 1000000ULL
+#define BENCH_RT_PRIO 80
+#define BENCH_HOLD_LOOPS 2000000
+
+static time_ns_t bench_samples[BENCH_SAMPLES];
+static volatile int bench_done;
+
+static DEFINE_MUTEX(bench_lock);
+static volatile int bench_holding;
+
+static int bench_hog(void *unused){
+	while (!bench_done)
+		cpu_relax();
+
+	return SUCCESS;
+}
+
+static void bench_work(void){
+	for (volatile int i = 0; i < BENCH_HOLD_LOOPS; i++)
+		;
+}
+
+static void bench_sort(time_ns_t *samples, int nr){
+	for (int i = 1; i < nr; i++) {
+		time_ns_t val = samples[i];
+		int j = i;
+
+		for (; j > 0 && samples[j - 1] > val; j--)
+			samples[j] = samples[j - 1];
+
+		samples[j] = val;
+	}
+}
+
+#define percentile(samples, pct) ((samples)[((BENCH_SAMPLES - 1) * (pct)) / 100])
+
+static void bench_pass(const char *name){
+	time_ns_t next = clock_get_monotonic_ns();
+
+	for (int i = 0; i < BENCH_SAMPLES; i++) {
+		next += BENCH_INTERVAL_NS;
+		hrtimer_nanosleep(next);
+
+		time_ns_t now = clock_get_monotonic_ns();
+		bench_samples[i] = now > next ? now - next : 0;
+	}
+
+	bench_sort(bench_samples, BENCH_SAMPLES);
+
+	printk("RT bench: %d hogs, %s: wakeup latency min %llu p50 %llu p90 %llu p99 %llu max %llu ns\n",
+		BENCH_HOGS, name, bench_samples[0], percentile(bench_samples, 50),
+		percentile(bench_samples, 90), percentile(bench_samples, 99),
+		bench_samples[BENCH_SAMPLES - 1]);
+}
+
+static int bench_holder(void *unused){
+	set_task_nice(current, MAX_NICE);
+
+	mutex_lock(&bench_lock);
+	bench_holding = 1;
+	bench_work();
+	mutex_unlock(&bench_lock);
+
+	return SUCCESS;
+}
+
+static void bench_pi_pass(void){
+	time_ns_t start = clock_get_monotonic_ns();
+	bench_work();
+	time_ns_t alone = clock_get_monotonic_ns() - start;
+
+	pid_t pid = kernel_thread(bench_holder, "bench_holder", NULL);
+	if (pid < 0)
+		return;
+
+	while (!bench_holding)
+		hrtimer_nanosleep(clock_get_monotonic_ns() + BENCH_INTERVAL_NS);
+
+	start = clock_get_monotonic_ns();
+	mutex_lock(&bench_lock);
+	time_ns_t wait = clock_get_monotonic_ns() - start;
+	mutex_unlock(&bench_lock);
+
+	printk("RT bench: %d hogs, SCHED_FIFO waiting on a nice %d holder: lock wait %llu ns, the work alone %llu ns\n",
+		BENCH_HOGS, MAX_NICE, wait, alone);
+}
+
+static int bench_latency(void *unused){
+	struct sched_param param = { .sched_priority = BENCH_RT_PRIO };
+
+	bench_pass("SCHED_NORMAL");
+
+	if (sched_setscheduler(current, SCHED_FIFO, &param) == SUCCESS) {
+		bench_pass("SCHED_FIFO");
+		bench_pi_pass();
+	}
+
+	bench_done = 1;
+	return SUCCESS;
+}
+
+static int __init rt_bench_init(void){
+	for (int i = 0; i < BENCH_HOGS; i++) {
+		pid_t pid = kernel_thread(bench_hog, "bench_hog", NULL);
+		if (pid < 0)
+			return pid;
+	}
+
+	pid_t pid = kernel_thread(bench_latency, "bench_latency", NULL);
+	return pid < 0 ? pid : SUCCESS;
+}
+
+late_initcall(rt_bench_init);
+
+#endif
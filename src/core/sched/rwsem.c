@@ -0,0 +1,174 @@
+#include <sync/rwsem.h>
+#include <kernel/preempt.h>
+#include <kernel/sched.h>
+#include <lib/assert.h>
+
+/**
+* Reader/writer semaphores.
+*
+* The count and the waiters are kept under a spinlock. A locker that
+* can't have it queues at the tail and sleeps until granted: the release
+* that frees it up passes it on to the head of the queue, a writer alone
+* or every reader up to the next writer, and counts them in already.
+* New readers queue as well while somebody waits, so a writer gets its
+* turn.
+*/
+
+struct rwsem_waiter {
+	struct list_head list;
+	struct task* task;
+	int write;
+	int granted;
+};
+
+void init_rwsem(struct rw_semaphore* sem){
+	sem->count = 0;
+	spinlock_init(&sem->lock);
+	INIT_LIST_HEAD(&sem->waiters);
+}
+
+static void rwsem_grant(struct rwsem_waiter* waiter){
+	list_remove(&waiter->list);
+	waiter->granted = 1;
+	task_wakeup(waiter->task);
+}
+
+// Pass the semaphore on to the head of the queue, sem->lock held
+static void rwsem_wake(struct rw_semaphore* sem){
+	struct rwsem_waiter *waiter, *tmp;
+
+	list_for_each_entry_safe(waiter, tmp, &sem->waiters, list){
+		if(waiter->write){
+			if(!sem->count){
+				sem->count = RWSEM_WRITER;
+				rwsem_grant(waiter);
+			}
+			return;
+		}
+
+		sem->count++;
+		rwsem_grant(waiter);
+	}
+}
+
+// Queue and sleep until rwsem_wake() granted it, sem->lock held
+static void rwsem_wait(struct rw_semaphore* sem, int write, unsigned long* flags){
+	struct rwsem_waiter waiter = {
+		.task = current,
+		.write = write,
+		.granted = 0,
+	};
+
+	list_add_tail(&waiter.list, &sem->waiters);
+
+	while(!waiter.granted){
+		task_sleep(waiter.task);
+		spin_unlock_irqrestore(&sem->lock, flags);
+
+		schedule();
+
+		spin_lock_irqsave(&sem->lock, flags);
+	}
+}
+
+int down_read_trylock(struct rw_semaphore* sem){
+	unsigned long flags;
+	int taken = 0;
+
+	spin_lock_irqsave(&sem->lock, &flags);
+
+	if(sem->count >= 0 && list_empty(&sem->waiters)){
+		sem->count++;
+		taken = 1;
+	}
+
+	spin_unlock_irqrestore(&sem->lock, &flags);
+	return taken;
+}
+
+void down_read(struct rw_semaphore* sem){
+	unsigned long flags;
+
+	BUG_ON(in_interrupt());
+
+	spin_lock_irqsave(&sem->lock, &flags);
+
+	if(sem->count >= 0 && list_empty(&sem->waiters)){
+		sem->count++;
+	} else {
+		rwsem_wait(sem, 0, &flags);
+	}
+
+	spin_unlock_irqrestore(&sem->lock, &flags);
+}
+
+void up_read(struct rw_semaphore* sem){
+	unsigned long flags;
+
+	spin_lock_irqsave(&sem->lock, &flags);
+
+	BUG_ON(sem->count <= 0);
+
+	if(!--sem->count){
+		rwsem_wake(sem);
+	}
+
+	spin_unlock_irqrestore(&sem->lock, &flags);
+}
+
+int down_write_trylock(struct rw_semaphore* sem){
+	unsigned long flags;
+	int taken = 0;
+
+	spin_lock_irqsave(&sem->lock, &flags);
+
+	if(!sem->count && list_empty(&sem->waiters)){
+		sem->count = RWSEM_WRITER;
+		taken = 1;
+	}
+
+	spin_unlock_irqrestore(&sem->lock, &flags);
+	return taken;
+}
+
+void down_write(struct rw_semaphore* sem){
+	unsigned long flags;
+
+	BUG_ON(in_interrupt());
+
+	spin_lock_irqsave(&sem->lock, &flags);
+
+	if(!sem->count && list_empty(&sem->waiters)){
+		sem->count = RWSEM_WRITER;
+	} else {
+		rwsem_wait(sem, 1, &flags);
+	}
+
+	spin_unlock_irqrestore(&sem->lock, &flags);
+}
+
+void up_write(struct rw_semaphore* sem){
+	unsigned long flags;
+
+	spin_lock_irqsave(&sem->lock, &flags);
+
+	BUG_ON(sem->count != RWSEM_WRITER);
+
+	sem->count = 0;
+	rwsem_wake(sem);
+
+	spin_unlock_irqrestore(&sem->lock, &flags);
+}
+
+void downgrade_write(struct rw_semaphore* sem){
+	unsigned long flags;
+
+	spin_lock_irqsave(&sem->lock, &flags);
+
+	BUG_ON(sem->count != RWSEM_WRITER);
+
+	sem->count = 1;
+	rwsem_wake(sem);
+
+	spin_unlock_irqrestore(&sem->lock, &flags);
+}
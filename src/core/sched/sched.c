@@ -1,109 +1,1221 @@
 #include <kernel/clock.h>
+#include <kernel/interrupt.h>
+#include <kernel/printk.h>
+#include <kernel/preempt.h>
 #include <kernel/sched.h>
+#include <kernel/syscall.h>
+#include <kernel/tick.h>
+#include <kernel/worker.h>
+#include <kernel/smp.h>
 #include <sync/spinlock.h>
+#include <sync/rcu.h>
+#include <sync/barrier.h>
+#include <asm/irqflags.h>
+#include <asm/cpu.h>
 #include <def/compile.h>
 #include <def/errno.h>
+#include <kernel/uaccess.h>
 #include <lib/string.h>
 #include <mm/kheap.h>
 
-static LIST_HEAD(_readyQueue);
+#include "sched_internal.h"
+
+/**
+* Scheduler core.
+*
+* Runnable tasks wait in the queue of their policy's class, in the run
+* queue of the CPU they belong to. schedule() puts the running task back
+* and asks the classes, highest first, for the next one; the CPU's idle
+* task runs when all of them are empty. New tasks go to the least loaded
+* CPU; a wakeup for another CPU reaches it through a resched IPI.
+*
+* Queues drift out of balance as tasks block and wake, so a CPU about to
+* go idle steals a waiting task from the busiest one, and every CPU
+* rebalances from its tick. Tasks that ran within SCHED_MIGRATION_COST_NS
+* are cache hot and only move once balancing keeps failing without them.
+*/
+
 static LIST_HEAD(_terminateQueue);
 
 static volatile uint8_t scheduling = 0;
-static spinlock_t scheduler_spinlock;
-volatile int need_resched = 0;
 
-static struct task idle_task;
+DEFINE_PER_CPU(struct rq, runqueues);
+DEFINE_PER_CPU(int, __preempt_count);
+static struct task idle_tasks[MAX_CPUS];
+
+/* Resched request for this CPU, consumed on the way out of an interrupt */
+asmlinkage int test_and_clear_resched(void){
+	struct rq* rq = this_rq();
+
+	if(!rq->need_resched){
+		return 0;
+	}
+
+	rq->need_resched = 0;
+	return 1;
+}
+
+/*
+* Halt until the next interrupt, with the tick stopped when nothing needs
+* it. Interrupts stay off from the need_resched check to the hlt so a
+* wakeup can't slip in between; sti holds them off for one instruction.
+* The tick is the boot CPU's, the others keep their local timer running.
+*/
+__no_return void cpu_idle(void){
+	while(1){
+		interrupts_disable();
+
+		if(test_and_clear_resched()){
+			interrupts_enable();
+			schedule();
+			continue;
+		}
+
+		if(smp_processor_id() == 0){
+			tick_nohz_update();
+		}
+
+		safe_halt();
+	}
+}
 
 static int idle_task_routine(void* args){
+	cpu_idle();
+}
+
+#define BALANCE_INTERVAL_TICKS \
+	((SCHED_BALANCE_INTERVAL_MS * TIMER_FREQUENCY + 999) / 1000)
+
+// Failed balances before cache hot tasks are moved anyway
+#define BALANCE_FAILED_MAX 3
+
+/* Real-time while it has a real-time priority, its own or inherited */
+static const struct sched_class* task_sched_class(struct task* task){
+	if(task->rt_prio){
+		return &rt_sched_class;
+	}
+
+	return task->policy == SCHED_BATCH ? &prio_sched_class : &fair_sched_class;
+}
+
+/*
+* Lock the run queue `task` is on. The task can move while we wait for
+* the lock, so check that it is still the right one once we hold it.
+*/
+static struct rq* task_rq_lock(struct task* task, unsigned long* flags){
 	while(1){
+		struct rq* rq = task_rq(task);
+
+		spin_lock_irqsave(&rq->lock, flags);
+		if(likely(rq == task_rq(task))){
+			return rq;
+		}
+
+		spin_unlock_irqrestore(&rq->lock, flags);
+	}
+}
+
+static inline void task_rq_unlock(struct rq* rq, unsigned long* flags){
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/* Two run queues with interrupts off, the lower CPU first so balancers can't deadlock */
+static void double_rq_lock(struct rq* a, struct rq* b){
+	if(a->cpu > b->cpu){
+		struct rq* tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	spin_lock(&a->lock);
+	spin_lock(&b->lock);
+}
+
+static void double_rq_unlock(struct rq* a, struct rq* b){
+	spin_unlock(&a->lock);
+	spin_unlock(&b->lock);
+}
+
+static inline int task_allowed(struct task* task, int cpu){
+	return !!(task->cpus_allowed & (1UL << cpu));
+}
+
+/*
+* Wait for another CPU to finish switching `task` out. Never the calling
+* one: a CPU keeps interrupts off until its switch is done.
+*/
+static void wait_task_off_cpu(struct task* task){
+	while(task->on_cpu){
 		cpu_relax();
 	}
 
-	__builtin_unreachable();
+	smp_rmb();
 }
 
-static struct task* _next(){
-	struct task* next_task = 0x0;
+static void enqueue_task(struct rq* rq, struct task* task, int flags){
+	task->sched_class->enqueue_task(rq, task, flags);
+	list_add_tail(&task->run_list, &rq->tasks);
+	task->on_rq = 1;
+	rq->nr_running++;
+}
 
-	spin_lock(&scheduler_spinlock);
+static void dequeue_task(struct rq* rq, struct task* task){
+	task->sched_class->dequeue_task(rq, task);
+	list_remove(&task->run_list);
+	task->on_rq = 0;
+	rq->nr_running--;
+}
 
-	if(likely(!list_empty(&_readyQueue))){
-		next_task = list_entry(_readyQueue.next, struct task, queue);
-		list_remove(&next_task->queue);
+static struct task* pick_next_task(struct rq* rq){
+	for(const struct sched_class* class = sched_class_highest; class; class = class->next){
+		struct task* task = class->pick_next_task(rq);
+		if(task){
+			list_remove(&task->run_list);
+			task->on_rq = 0;
+			rq->nr_running--;
+			return task;
+		}
 	}
 
-	spin_unlock(&scheduler_spinlock);
+	return NULL;
+}
+
+/* Resched when `task` should run before the one running on `rq` */
+static void check_preempt(struct rq* rq, struct task* task){
+	struct task* cur = rq->curr;
 
-	return next_task;
+	if(cur == rq->idle){
+		resched_curr(rq);
+		return;
+	}
+
+	if(task->sched_class == cur->sched_class){
+		cur->sched_class->check_preempt_curr(rq, task);
+		return;
+	}
+
+	for(const struct sched_class* class = sched_class_highest; class; class = class->next){
+		if(class == cur->sched_class){
+			break;
+		}
+
+		if(class == task->sched_class){
+			resched_curr(rq);
+			break;
+		}
+	}
+}
+
+/*
+* A task was queued on `rq`. Preemption needs the tick again, and only the
+* boot CPU may restart it, the clock catches up on the way.
+*/
+static void kick_tick(struct rq* rq){
+	if(rq->cpu != 0){
+		return;
+	}
+
+	if(smp_processor_id() == 0){
+		tick_nohz_restart();
+	} else {
+		smp_send_reschedule(0);
+	}
+}
+
+/* A resched IPI, need_resched was set by the sender if it wants one */
+void scheduler_ipi(void){
+	if(smp_processor_id() == 0){
+		tick_nohz_restart();
+	}
+}
+
+static unsigned long rq_load(struct rq* rq){
+	return rq->nr_running + (rq->curr != rq->idle);
+}
+
+static inline int rq_idle(struct rq* rq){
+	return rq->curr == rq->idle && !rq->nr_running;
+}
+
+/* Least loaded CPU `task` may use, `prefer` on a tie. Loads are read without the locks. */
+static int find_idlest_cpu(struct task* task, int prefer){
+	int best = -1;
+	unsigned long best_load = ~0UL;
+	int cpu;
+
+	if(task_allowed(task, prefer) && cpu_online(prefer)){
+		best = prefer;
+		best_load = rq_load(cpu_rq(prefer));
+	}
+
+	for_each_online_cpu(cpu){
+		if(!task_allowed(task, cpu)){
+			continue;
+		}
+
+		unsigned long load = rq_load(cpu_rq(cpu));
+		if(load < best_load){
+			best = cpu;
+			best_load = load;
+		}
+	}
+
+	return best < 0 ? prefer : best;
 }
 
-// Request resched on every tick
-static void scheduler_tick(void* unused){
-	need_resched = 1;
+/*
+* Where a woken task runs: its own CPU while that one idles, else any idle
+* CPU it may use, else its own CPU again for the warm cache.
+*/
+static int select_task_rq_wake(struct task* task, int prev){
+	int cpu;
+
+	if(task_allowed(task, prev) && rq_idle(cpu_rq(prev))){
+		return prev;
+	}
+
+	for_each_online_cpu(cpu){
+		if(task_allowed(task, cpu) && rq_idle(cpu_rq(cpu))){
+			return cpu;
+		}
+	}
+
+	return task_allowed(task, prev) ? prev : find_idlest_cpu(task, prev);
+}
+
+/* Move a waiting task between two locked run queues */
+static void move_queued_task(struct rq* src, struct rq* dst, struct task* task){
+	dequeue_task(src, task);
+	task->sched_class->migrate_task_rq(src, task);
+	task->cpu = dst->cpu;
+
+	kick_tick(dst);
+	enqueue_task(dst, task, ENQUEUE_MIGRATED);
+	dst->nr_migrations++;
+}
+
+static int can_migrate_task(struct task* task, struct rq* dst, int aggressive, time_ns_t now){
+	// Queued again by the CPU that is still switching away from it
+	if(task->on_cpu){
+		return 0;
+	}
+
+	if(!task_allowed(task, dst->cpu)){
+		return 0;
+	}
+
+	if(!aggressive && (int64_t)(now - task->last_ran) < (int64_t)SCHED_MIGRATION_COST_NS){
+		dst->nr_hot_skipped++;
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Take up to `max` waiting tasks from `src`, longest waiting first. Both locked. */
+static int pull_tasks(struct rq* dst, struct rq* src, int max, int aggressive){
+	time_ns_t now = clock_get_monotonic_ns();
+	struct task* task;
+	struct task* tmp;
+	int moved = 0;
+
+	list_for_each_entry_safe(task, tmp, &src->tasks, run_list){
+		if(moved >= max){
+			break;
+		}
+
+		if(can_migrate_task(task, dst, aggressive, now)){
+			move_queued_task(src, dst, task);
+			moved++;
+		}
+	}
+
+	return moved;
 }
 
+/* The CPU with the most runnable tasks among those with some waiting */
+static struct rq* find_busiest_rq(struct rq* this_rq){
+	struct rq* busiest = NULL;
+	unsigned long max_load = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu){
+		struct rq* rq = cpu_rq(cpu);
+		if(rq == this_rq || !rq->nr_running){
+			continue;
+		}
+
+		unsigned long load = rq_load(rq);
+		if(load > max_load){
+			busiest = rq;
+			max_load = load;
+		}
+	}
+
+	return busiest;
+}
+
+/*
+* This CPU is about to idle: steal one waiting task from the busiest CPU.
+* Our run queue is locked, so the other lock is only tried.
+*/
+static int idle_steal(struct rq* rq){
+	struct rq* busiest = find_busiest_rq(rq);
+	if(!busiest || !spin_trylock(&busiest->lock)){
+		return 0;
+	}
+
+	int moved = pull_tasks(rq, busiest, 1, rq->balance_failed >= BALANCE_FAILED_MAX);
+	rq->nr_steals += moved;
+
+	spin_unlock(&busiest->lock);
+	return moved;
+}
+
+/*
+* Pull half the difference in runnable tasks from the busiest CPU. Called
+* from the tick with interrupts off and no run queue locked.
+*/
+static void load_balance(struct rq* this_rq){
+	struct rq* busiest = find_busiest_rq(this_rq);
+	if(!busiest){
+		return;
+	}
+
+	double_rq_lock(this_rq, busiest);
+	this_rq->nr_balance++;
+
+	unsigned long this_load = rq_load(this_rq);
+	unsigned long busiest_load = rq_load(busiest);
+
+	// One task apart would only bounce it back and forth
+	if(busiest->nr_running && busiest_load > this_load + 1){
+		int aggressive = this_rq->balance_failed >= BALANCE_FAILED_MAX;
+		int moved = pull_tasks(this_rq, busiest, (busiest_load - this_load) / 2, aggressive);
+
+		if(moved){
+			this_rq->balance_failed = 0;
+
+			if(this_rq->curr == this_rq->idle){
+				resched_curr(this_rq);
+			}
+		} else {
+			this_rq->balance_failed++;
+			this_rq->nr_balance_failed++;
+		}
+	}
+
+	double_rq_unlock(this_rq, busiest);
+}
+
+/*
+* Tasks are waiting on `rq` while a CPU idles. Its tick may be stopped, so
+* wake it to come steal them.
+*/
+static void kick_idle_cpu(struct rq* rq){
+	int cpu;
+
+	for_each_online_cpu(cpu){
+		struct rq* idle_rq = cpu_rq(cpu);
+
+		if(idle_rq != rq && rq_idle(idle_rq)){
+			resched_curr(idle_rq);
+			return;
+		}
+	}
+}
+
+/* Rebalance on every tick while idle, every BALANCE_INTERVAL_TICKS while busy */
+static void sched_balance_tick(struct rq* rq){
+	if(rq->balance_ticks && --rq->balance_ticks && rq->curr != rq->idle){
+		return;
+	}
+
+	rq->balance_ticks = BALANCE_INTERVAL_TICKS;
+
+	load_balance(rq);
+
+	if(rq->nr_running){
+		kick_idle_cpu(rq);
+	}
+}
+
+/*
+* Whether the tick is only needed for listeners: idle, or one runnable
+* task. Asked by the tick code, which runs on the boot CPU.
+*/
+int sched_can_stop_tick(void){
+	return scheduling && !this_rq()->nr_running;
+}
+
+int sched_idle(void){
+	struct rq* rq = this_rq();
+	return rq->curr == rq->idle;
+}
+
+int idle_cpu(int cpu){
+	struct rq* rq = cpu_rq(cpu);
+	return rq->curr == rq->idle;
+}
+
+// The tick needs are covered by sched_can_stop_tick()
+static tick_t scheduler_next_tick(void* unused){
+	return TICK_NONE;
+}
+
+/* Charge this CPU's running task, from its tick with interrupts off */
+void scheduler_tick(void){
+	struct rq* rq = this_rq();
+
+	spin_lock(&rq->lock);
+
+	struct task* cur = rq->curr;
+	if(cur == rq->idle){
+		if(rq->nr_running){
+			resched_curr(rq);
+		}
+	} else {
+		cur->sched_class->task_tick(rq, cur);
+	}
+
+	spin_unlock(&rq->lock);
+
+	sched_balance_tick(rq);
+	rcu_check_callbacks();
+}
+
+// The boot CPU ticks from a clock event listener, in the interrupt
+static void scheduler_tick_listener(void* unused){
+	scheduler_tick();
+}
+
+/*
+* Switch to the best task of this CPU's run queue. Interrupts stay off
+* until the switch is done, so an interrupt can't schedule again while
+* rq->curr is already the next task.
+*/
 asmlinkage void schedule(){
 	if(unlikely(!scheduling)){
 		return;
 	}
 
-	struct task* next_task = _next();
-	struct task* prev_task = current;
+	unsigned long flags;
+	local_irq_save(flags);
+
+	struct rq* rq = this_rq();
+	struct task* prev_task = rq->curr;
+
+	// A worker blocking in a work item lets its pool run the next one
+	if(prev_task->worker && prev_task->state == TASK_BLOCKED){
+		wq_worker_sleeping(prev_task);
+	}
+
+	spin_lock(&rq->lock);
+
+	if(prev_task != rq->idle){
+		prev_task->sched_class->put_prev_task(rq, prev_task);
+		prev_task->last_ran = clock_get_monotonic_ns();
+
+		// Preempted, yielding or woken up again before it got switched out
+		if(prev_task->state == TASK_RUNNING || prev_task->state == TASK_READY){
+			prev_task->state = TASK_READY;
+
+			if(likely(task_allowed(prev_task, rq->cpu))){
+				enqueue_task(rq, prev_task, 0);
+			} else {
+				// Its affinity changed, queued elsewhere once off this CPU
+				prev_task->sched_class->migrate_task_rq(rq, prev_task);
+				prev_task->migrate_pending = 1;
+			}
+		}
+	}
+
+	struct task* next_task = pick_next_task(rq);
+	if(!next_task && idle_steal(rq)){
+		next_task = pick_next_task(rq);
+	}
 
 	if(unlikely(next_task == NULL)){
-		if(prev_task->state == TASK_BLOCKED){
-			next_task = &idle_task;
-		} else{
-			next_task = prev_task;
+		next_task = rq->idle;
+	}
+
+	if(next_task == prev_task && prev_task->state == TASK_READY){
+		prev_task->state = TASK_RUNNING;
+	}
+
+	rq->curr = next_task;
+	next_task->on_cpu = 1;
+
+	spin_unlock(&rq->lock);
+
+	rcu_note_context_switch();
+
+	// Idle time is accounted for the boot CPU, next to its tick
+	if(next_task != prev_task && rq->cpu == 0){
+		if(prev_task == rq->idle){
+			tick_idle_exit();
+		} else if(next_task == rq->idle){
+			tick_idle_enter();
 		}
 	}
 
+	// The preempt count belongs to the task, it is back when it runs again
+	int count = preempt_count();
 	context_switch(prev_task, next_task);
+	this_cpu_write(__preempt_count, count);
+
+	if(prev_task->worker){
+		wq_worker_running(prev_task);
+	}
+
+	local_irq_restore(flags);
 }
 
-static int __init create_idle_task(){
-	memset(&idle_task, 0x0, sizeof(struct task));
+/* preempt_enable() dropped the count to zero */
+void preempt_schedule(void){
+	if(unlikely(!scheduling) || preempt_count() || irqs_disabled()){
+		return;
+	}
+
+	local_irq_disable();
+	int resched = test_and_clear_resched();
+	local_irq_enable();
+
+	if(resched){
+		schedule();
+	}
+}
+
+/*
+* On the way out of an interrupt or a system call, `regs` is what gets
+* resumed. Kernel code is only preempted with nothing held and interrupts
+* on where it was interrupted.
+*/
+asmlinkage void preempt_schedule_irq(struct registers* regs){
+	if(!regs_is_user_mode(regs) && (preempt_count() || irqs_disabled_flags(regs->flags))){
+		return;
+	}
+
+	if(test_and_clear_resched()){
+		schedule();
+	}
+}
+
+/*
+* Preemption point for long kernel loops. System calls run with interrupts
+* off, so the pending ones are let in first: the tick may want the CPU.
+*/
+void cond_resched(void){
+	if(unlikely(!scheduling) || preempt_count()){
+		return;
+	}
+
+	unsigned long flags = local_save_flags();
+	if(irqs_disabled_flags(flags)){
+		// sti holds them off for one more instruction
+		__asm__ volatile("sti; nop; cli" ::: "memory");
+	}
+
+	local_irq_disable();
+	int resched = test_and_clear_resched();
+	local_irq_restore(flags);
+
+	if(resched){
+		schedule();
+	}
+}
+
+/*
+* Idle task of `cpu`. The context that brings the CPU up becomes it, the
+* boot CPU's on its first switch.
+*/
+struct task* __init sched_init_idle(int cpu){
+	struct task* idle = &idle_tasks[cpu];
+	struct rq* rq = cpu_rq(cpu);
+
+	memset(idle, 0x0, sizeof(struct task));
 	void* ksp = kzalloc(PROC_KERNEL_STACK_SIZE);
 	if(!ksp){
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 	}
 
-	memcpy(idle_task.name, "idle task", sizeof(idle_task.name));
-	idle_task.kstack = ksp;
-	copy_thread(0x0, &idle_task, idle_task_routine, 0x0);
-	idle_task.pid = 0;
+	strncpy(idle->name, "idle task", PROC_NAME_MAX);
+	idle->kstack = ksp;
+	copy_thread(0x0, idle, 0x0, idle_task_routine, 0x0);
+	idle->pid = 0;
+	idle->priority = MAX_PRIO - 1;
+	idle->policy = SCHED_NORMAL;
+	idle->sched_class = &fair_sched_class;
+	idle->cpu = cpu;
+	idle->on_cpu = 1;
+	idle->cpus_allowed = CPU_MASK_ALL; // never queued, inherited by what boot forks
+	INIT_LIST_HEAD(&idle->pi_locks);
 
-	current = &idle_task;
+	rq->idle = idle;
+	rq->curr = idle;
 
-	return SUCCESS;
+	return idle;
+}
+
+/* First thing a started CPU does, on its idle task's stack */
+void sched_init_secondary(void){
+	set_current(this_rq()->idle);
+}
+
+static void __init init_rq(int cpu){
+	struct rq* rq = cpu_rq(cpu);
+
+	spinlock_init_class(&rq->lock, "rq->lock");
+	rq->cpu = cpu;
+	rq->nr_running = 0;
+	rq->need_resched = 0;
+	rq->curr = NULL;
+	rq->idle = NULL;
+
+	INIT_LIST_HEAD(&rq->tasks);
+	rq->balance_ticks = BALANCE_INTERVAL_TICKS;
+	rq->balance_failed = 0;
+
+	for(const struct sched_class* class = sched_class_highest; class; class = class->next){
+		class->init(rq);
+	}
 }
 
 int __init scheduler_init(){
-	spinlock_init(&scheduler_spinlock);
-	INIT_LIST_HEAD(&_readyQueue);
 	INIT_LIST_HEAD(&_terminateQueue);
 	scheduling = 0;
 
-	if(clockevent_register_listener(scheduler_tick, 0x0) != SUCCESS){
+	for(int cpu = 0; cpu < MAX_CPUS; cpu++){
+		init_rq(cpu);
+	}
+
+	if(clockevent_register_irq_listener(scheduler_tick_listener, scheduler_next_tick, 0x0) != SUCCESS){
 		return -ENOMEM;
 	}
 
-	return create_idle_task();
+	struct task* idle = sched_init_idle(0);
+	if(IS_ERR_VALUE(idle)){
+		return PTR_ERR(idle);
+	}
+
+	set_current(idle);
+	return SUCCESS;
 }
 
+/* Tasks queued on the other CPUs during boot are waiting for a resched */
 void __init scheduler_start(){
+	int cpu;
+
 	scheduling = 1;
+	rcu_scheduler_starting();
+
+	for_each_online_cpu(cpu){
+		resched_curr(cpu_rq(cpu));
+	}
+}
+
+/* Class state for a task being created, the policy is inherited like fork() */
+void sched_fork(struct task* task){
+	struct task* cur = current;
+
+	task->policy = cur ? cur->policy : SCHED_NORMAL;
+	task->rt_priority = cur ? cur->rt_priority : 0;
+	task->rt_prio = task->rt_priority;   // an inherited boost stays with the parent
+	task->sched_class = task_sched_class(task);
+	INIT_LIST_HEAD(&task->pi_locks);
+	task->pi_blocked_on = NULL;
+	task->cpus_allowed = cur ? cur->cpus_allowed : CPU_MASK_ALL;
+	task->cpu = smp_processor_id();
+	task->on_rq = 0;
+	task->on_cpu = 0;
+	task->migrate_pending = 0;
+	task->sched_class->task_init(task_rq(task), task);
+}
+
+void wake_up_new_task(struct task* task){
+	unsigned long flags;
+
+	task->cpu = find_idlest_cpu(task, smp_processor_id());
+	struct rq* rq = task_rq(task);
+
+	spin_lock_irqsave(&rq->lock, &flags);
+
+	// Placed against the queue it joins
+	task->sched_class->task_init(rq, task);
+
+	kick_tick(rq);
+
+	task->state = TASK_READY;
+	enqueue_task(rq, task, ENQUEUE_NEW);
+	check_preempt(rq, task);
+
+	spin_unlock_irqrestore(&rq->lock, &flags);
+}
+
+/*
+* Lock the run queue a woken task goes to, NULL when it is queued or
+* running already. It moves with its old queue locked and the new one only
+* tried; when that one is busy the task stays, unless its affinity rules
+* this CPU out.
+*/
+static struct rq* wake_rq_lock(struct task* task, unsigned long* flags, int* enqueue_flags){
+	while(1){
+		struct rq* rq = task_rq_lock(task, flags);
+
+		if(unlikely(task->on_rq || task == rq->curr)){
+			task_rq_unlock(rq, flags);
+			return NULL;
+		}
+
+		int allowed = task_allowed(task, rq->cpu);
+
+		// Still being switched out, it can't go anywhere else yet
+		if(task->on_cpu){
+			if(allowed){
+				return rq;
+			}
+
+			task_rq_unlock(rq, flags);
+			wait_task_off_cpu(task);
+			continue;
+		}
+
+		int cpu = select_task_rq_wake(task, rq->cpu);
+		if(cpu == rq->cpu){
+			return rq;
+		}
+
+		struct rq* dst = cpu_rq(cpu);
+		if(!spin_trylock(&dst->lock)){
+			if(allowed){
+				return rq;
+			}
+
+			task_rq_unlock(rq, flags);
+			continue;
+		}
+
+		task->sched_class->migrate_task_rq(rq, task);
+		task->cpu = cpu;
+		dst->nr_migrations++;
+		*enqueue_flags |= ENQUEUE_MIGRATED;
+
+		spin_unlock(&rq->lock);
+		return dst;
+	}
 }
 
+/*
+* Queue a woken task and preempt the running one if the task's class says
+* so. The running task itself is left for schedule() to put back.
+*/
 void scheduler_add(struct task* task){
-	spin_lock(&scheduler_spinlock);
-	list_add_tail(&task->queue, &_readyQueue);
-	spin_unlock(&scheduler_spinlock);
+	unsigned long flags;
+	int enqueue_flags = ENQUEUE_WAKEUP;
+
+	struct rq* rq = wake_rq_lock(task, &flags, &enqueue_flags);
+	if(!rq){
+		return;
+	}
+
+	kick_tick(rq);
+
+	enqueue_task(rq, task, enqueue_flags);
+	check_preempt(rq, task);
+
+	task_rq_unlock(rq, &flags);
+}
+
+/* Queue a task that left a CPU outside its affinity, once it is off it */
+void sched_move_task(struct task* task){
+	unsigned long flags;
+	int cpu = find_idlest_cpu(task, task->cpu);
+	struct rq* rq = cpu_rq(cpu);
+
+	spin_lock_irqsave(&rq->lock, &flags);
+
+	task->migrate_pending = 0;
+	task->cpu = cpu;
+	rq->nr_migrations++;
+
+	kick_tick(rq);
+
+	enqueue_task(rq, task, ENQUEUE_MIGRATED);
+	check_preempt(rq, task);
+
+	spin_unlock_irqrestore(&rq->lock, &flags);
 }
 
 void scheduler_remove(struct task* task){
-	spin_lock(&scheduler_spinlock);
-	list_remove(&task->queue);
-	spin_unlock(&scheduler_spinlock);
+	unsigned long flags;
+	struct rq* rq = task_rq_lock(task, &flags);
+
+	if(task->on_rq){
+		dequeue_task(rq, task);
+	}
+
+	task_rq_unlock(rq, &flags);
+}
+
+void set_task_nice(struct task* task, int nice){
+	unsigned long flags;
+
+	if(nice < MIN_NICE) nice = MIN_NICE;
+	if(nice > MAX_NICE) nice = MAX_NICE;
+
+	struct rq* rq = task_rq_lock(task, &flags);
+
+	int queued = task->on_rq;
+	if(queued){
+		dequeue_task(rq, task);
+	}
+
+	task->sched_class->set_prio(rq, task, NICE_TO_PRIO(nice));
+
+	if(queued){
+		enqueue_task(rq, task, 0);
+	}
+
+	task_rq_unlock(rq, &flags);
+}
+
+/*
+* Move `task` to a new policy and real-time priority, its class changes
+* along. Queued tasks are requeued, a running one goes through
+* put_prev/set_curr and reschedules so the change takes effect.
+*/
+static void sched_change_prio(struct rq* rq, struct task* task, int policy, int rt_prio){
+	int running = task == rq->curr;
+	int queued = task->on_rq;
+
+	if(queued){
+		dequeue_task(rq, task);
+	} else if(running){
+		task->sched_class->put_prev_task(rq, task);
+	}
+
+	const struct sched_class* prev_class = task->sched_class;
+
+	task->policy = policy;
+	task->rt_prio = rt_prio;
+	task->sched_class = task_sched_class(task);
+
+	if(task->sched_class != prev_class){
+		task->sched_class->task_init(rq, task);
+	}
+
+	if(queued){
+		enqueue_task(rq, task, 0);
+		check_preempt(rq, task);
+	} else if(running){
+		task->sched_class->set_curr_task(rq, task);
+		resched_curr(rq);
+	}
+}
+
+/* Inherited priority changed, from the mutex code with pi_lock held */
+void sched_set_rt_prio(struct task* task, int rt_prio){
+	unsigned long flags;
+	struct rq* rq = task_rq_lock(task, &flags);
+
+	if(task->rt_prio != rt_prio){
+		sched_change_prio(rq, task, task->policy, rt_prio);
+	}
+
+	task_rq_unlock(rq, &flags);
+}
+
+int sched_setscheduler(struct task* task, int policy, const struct sched_param* param){
+	unsigned long flags;
+	unsigned long pi_flags;
+	int rt_priority = param->sched_priority;
+
+	if(rt_policy(policy)){
+		if(rt_priority < 1 || rt_priority >= MAX_RT_PRIO){
+			return -EINVAL;
+		}
+	} else if(policy == SCHED_NORMAL || policy == SCHED_BATCH){
+		// No static priorities for these policies
+		if(rt_priority != 0){
+			return -EINVAL;
+		}
+	} else {
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&pi_lock, &pi_flags);
+	struct rq* rq = task_rq_lock(task, &flags);
+
+	if(task->policy == policy && task->rt_priority == rt_priority){
+		task_rq_unlock(rq, &flags);
+		spin_unlock_irqrestore(&pi_lock, &pi_flags);
+		return SUCCESS;
+	}
+
+	// A boost from the mutexes it holds stays until they are released
+	int rt_prio = pi_inherited_prio(task);
+	if(rt_priority > rt_prio){
+		rt_prio = rt_priority;
+	}
+
+	task->rt_priority = rt_priority;
+	sched_change_prio(rq, task, policy, rt_prio);
+
+	task_rq_unlock(rq, &flags);
+
+	// Waiting for a mutex, its place there and its owner's boost follow
+	pi_chain_adjust(task);
+
+	spin_unlock_irqrestore(&pi_lock, &pi_flags);
+	return SUCCESS;
+}
+
+/*
+* Restrict `task` to the CPUs in `mask`. A waiting task moves right away,
+* a running one at its next schedule() and a sleeping one on wakeup.
+*/
+int sched_setaffinity(struct task* task, unsigned long mask){
+	unsigned long flags;
+
+	mask &= cpu_online_mask;
+	if(!mask){
+		return -EINVAL;
+	}
+
+	while(1){
+		struct rq* rq = task_rq_lock(task, &flags);
+		task->cpus_allowed = mask;
+
+		if(task_allowed(task, rq->cpu) || !task->on_rq){
+			if(task == rq->curr){
+				resched_curr(rq);
+			}
+
+			task_rq_unlock(rq, &flags);
+			return SUCCESS;
+		}
+
+		// Queued again by a CPU still switching away from it
+		if(task->on_cpu){
+			task_rq_unlock(rq, &flags);
+			wait_task_off_cpu(task);
+			continue;
+		}
+
+		struct rq* dst = cpu_rq(find_idlest_cpu(task, rq->cpu));
+
+		spin_unlock(&rq->lock);
+		double_rq_lock(rq, dst);
+
+		int moved = task_rq(task) == rq && task->on_rq && !task->on_cpu;
+		if(moved){
+			move_queued_task(rq, dst, task);
+			check_preempt(dst, task);
+		}
+
+		double_rq_unlock(rq, dst);
+		local_irq_restore(flags);
+
+		if(moved){
+			return SUCCESS;
+		}
+	}
+}
+
+/* Per CPU balancer counters, to tune the intervals and the migration cost */
+void sched_report_balance(void){
+	int cpu;
+
+	for_each_online_cpu(cpu){
+		struct rq* rq = cpu_rq(cpu);
+
+		printk("Sched: cpu%d balance %lu failed %lu migrations %lu steals %lu hot %lu\n",
+			cpu, rq->nr_balance, rq->nr_balance_failed, rq->nr_migrations,
+			rq->nr_steals, rq->nr_hot_skipped);
+	}
+}
+
+/*
+* The caller itself or one of its children, with a reference held so a
+* concurrent reap cannot free it; drop it with task_put().
+*/
+static struct task* find_sched_target(pid_t pid){
+	if(pid == 0 || pid == current->pid){
+		task_get(current);
+		return current;
+	}
+
+	struct task* task = task_find_get(pid);
+	if(!task){
+		return ERR_PTR(-ESRCH);
+	}
+
+	if(task->parent != current || task->state == TASK_ZOMBIE){
+		task_put(task);
+		return ERR_PTR(-ESRCH);
+	}
+
+	return task;
+}
+
+static struct task* find_priority_target(int which, pid_t who){
+	if(which != PRIO_PROCESS){
+		return ERR_PTR(-EINVAL);
+	}
+
+	return find_sched_target(who);
+}
+
+/* Raising the priority (lowering nice) takes a privileged caller */
+static int may_set_nice(struct task* task, int nice){
+	if(nice < PRIO_TO_NICE(task->priority) && !task_privileged(current)){
+		return 0;
+	}
+
+	return 1;
+}
+
+SYSCALL_DEFINE1(nice, int, inc){
+	// Anything wider already saturates, and INT_MAX must not overflow the sum
+	const int range = MAX_NICE - MIN_NICE + 1;
+
+	if(inc < 0 && !task_privileged(current)){
+		return -EPERM;
+	}
+
+	if(inc < -range){
+		inc = -range;
+	} else if(inc > range){
+		inc = range;
+	}
+
+	set_task_nice(current, PRIO_TO_NICE(current->priority) + inc);
+	return SUCCESS;
+}
+
+/* Returns 20 - nice like Linux, so the result is never negative */
+SYSCALL_DEFINE2(getpriority, int, which, pid_t, who){
+	struct task* task = find_priority_target(which, who);
+	if(IS_ERR_VALUE(task)){
+		return PTR_ERR(task);
+	}
+
+	int res = 20 - PRIO_TO_NICE(task->priority);
+
+	task_put(task);
+	return res;
+}
+
+SYSCALL_DEFINE3(setpriority, int, which, pid_t, who, int, nice){
+	struct task* task = find_priority_target(which, who);
+	if(IS_ERR_VALUE(task)){
+		return PTR_ERR(task);
+	}
+
+	int res = -EACCES;
+	if(may_set_nice(task, nice)){
+		set_task_nice(task, nice);
+		res = SUCCESS;
+	}
+
+	task_put(task);
+	return res;
+}
+
+SYSCALL_DEFINE3(sched_setscheduler, pid_t, pid, int, policy, const __user struct sched_param*, param){
+	struct sched_param kparam;
+
+	if(!param || copy_from_user(&kparam, param, sizeof(kparam))){
+		return -EFAULT;
+	}
+
+	struct task* task = find_sched_target(pid);
+	if(IS_ERR_VALUE(task)){
+		return PTR_ERR(task);
+	}
+
+	int res = sched_setscheduler(task, policy, &kparam);
+
+	task_put(task);
+	return res;
+}
+
+SYSCALL_DEFINE1(sched_getscheduler, pid_t, pid){
+	struct task* task = find_sched_target(pid);
+	if(IS_ERR_VALUE(task)){
+		return PTR_ERR(task);
+	}
+
+	int res = task->policy;
+
+	task_put(task);
+	return res;
+}
+
+/* The SCHED_RR quantum of `pid`, 0 for the other policies like Linux */
+SYSCALL_DEFINE2(sched_rr_get_interval, pid_t, pid, __user struct timespec*, interval){
+	struct task* task = find_sched_target(pid);
+	if(IS_ERR_VALUE(task)){
+		return PTR_ERR(task);
+	}
+
+	struct timespec ts = { 0, 0 };
+	if(task->policy == SCHED_RR){
+		unsigned int ms = sched_rr_timeslice_ms(task);
+
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	}
+
+	task_put(task);
+
+	if(!interval || copy_to_user(interval, &ts, sizeof(ts))){
+		return -EFAULT;
+	}
+
+	return SUCCESS;
+}
+
+SYSCALL_DEFINE3(sched_setaffinity, pid_t, pid, unsigned int, len, const __user unsigned long*, user_mask_ptr){
+	unsigned long mask;
+
+	if(len < sizeof(mask)){
+		return -EINVAL;
+	}
+
+	if(!user_mask_ptr || copy_from_user(&mask, user_mask_ptr, sizeof(mask))){
+		return -EFAULT;
+	}
+
+	struct task* task = find_sched_target(pid);
+	if(IS_ERR_VALUE(task)){
+		return PTR_ERR(task);
+	}
+
+	int res = sched_setaffinity(task, mask);
+
+	task_put(task);
+	return res;
+}
+
+/* Returns the size of the mask written, like Linux */
+SYSCALL_DEFINE3(sched_getaffinity, pid_t, pid, unsigned int, len, __user unsigned long*, user_mask_ptr){
+	if(len < sizeof(unsigned long)){
+		return -EINVAL;
+	}
+
+	struct task* task = find_sched_target(pid);
+	if(IS_ERR_VALUE(task)){
+		return PTR_ERR(task);
+	}
+
+	unsigned long mask = task->cpus_allowed & cpu_online_mask;
+
+	task_put(task);
+
+	if(!user_mask_ptr || copy_to_user(user_mask_ptr, &mask, sizeof(mask))){
+		return -EFAULT;
+	}
+
+	return sizeof(mask);
 }
@@ -0,0 +1,106 @@
+#ifdef CONFIG_SCHED_BENCH
+
+#include <kernel/sched.h>
+#include <kernel/clock.h>
+#include <kernel/fork.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <def/errno.h>
+#include <asm/tsc.h>
+
+/**
+* Wakeup to run latency under CPU load, run once after boot with
+* `make SCHED_BENCH=1`.
+*
+* BENCH_HOGS kernel threads spin at nice 0 while a sleeper is woken from
+* the timer interrupt BENCH_SAMPLES times; the TSC delta between the
+* wakeup and the sleeper running is recorded. The pass is repeated with
+* the sleeper at nice 0 and at BENCH_NICE.
+*/
+
+#define BENCH_HOGS 4
+#define BENCH_SAMPLES 32
+#define BENCH_NICE (-10)
+
+static struct task *bench_sleeper;
+static volatile tick_t bench_wake_at;
+static volatile uint64_t bench_woken_tsc;
+static volatile int bench_done;
+
+static int bench_hog(void *unused){
+	while (!bench_done)
+		cpu_relax();
+
+	return SUCCESS;
+}
+
+static void bench_tick(void *unused){
+	struct task *task = bench_sleeper;
+
+	if (!task || task->state != TASK_BLOCKED || clock_get_ticks() < bench_wake_at)
+		return;
+
+	bench_woken_tsc = rdtsc();
+	task_wakeup(task);
+}
+
+static tick_t bench_next_tick(void *unused){
+	struct task *task = bench_sleeper;
+
+	if (!task || task->state != TASK_BLOCKED)
+		return TICK_NONE;
+
+	return bench_wake_at;
+}
+
+static void bench_pass(int nice){
+	uint64_t min = ~0ULL, max = 0, total = 0;
+
+	set_task_nice(current, nice);
+
+	for (int i = 0; i < BENCH_SAMPLES; i++) {
+		bench_wake_at = clock_get_ticks() + 2;
+		sleep_current();
+
+		uint64_t latency = rdtsc() - bench_woken_tsc;
+
+		if (latency < min) min = latency;
+		if (latency > max) max = latency;
+		total += latency;
+	}
+
+	printk("Sched bench: %d hogs, sleeper nice %d: wakeup latency min %llu avg %llu max %llu cycles\n",
+		BENCH_HOGS, nice, min, total / BENCH_SAMPLES, max);
+}
+
+static int bench_latency(void *unused){
+	bench_sleeper = current;
+
+	bench_pass(0);
+	bench_pass(BENCH_NICE);
+	sched_report_balance();
+
+	bench_sleeper = NULL;
+	bench_done = 1;
+
+	return SUCCESS;
+}
+
+static int __init sched_bench_init(void){
+	int res = clockevent_register_nohz_listener(bench_tick, bench_next_tick, NULL);
+	if (IS_ERR_VALUE(res))
+		return res;
+
+	for (int i = 0; i < BENCH_HOGS; i++) {
+		pid_t pid = kernel_thread(bench_hog, "bench_hog", NULL);
+		if (pid < 0)
+			return pid;
+	}
+
+	pid_t pid = kernel_thread(bench_latency, "bench_latency", NULL);
+	return pid < 0 ? pid : SUCCESS;
+}
+
+late_initcall(sched_bench_init);
+
+#endif
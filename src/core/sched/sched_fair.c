@@ -0,0 +1,322 @@
+#include <kernel/sched.h>
+#include <kernel/clock.h>
+#include <lib/div64.h>
+#include <def/config.h>
+
+#include "sched_internal.h"
+
+/**
+* Fair class, used by SCHED_NORMAL.
+*
+* Every task accrues virtual runtime, its real runtime scaled by
+* NICE_0_WEIGHT / weight, and the queued tasks sit in a red-black tree
+* keyed by it. The leftmost one, the task that got the least CPU for its
+* weight, runs next. Each runnable task is owed a slice of
+* SCHED_LATENCY_NS proportional to its weight; the running task is only
+* preempted from the tick once it has used its slice, or on wakeup when
+* it is already ahead of the woken task by more than the wakeup
+* granularity.
+*/
+
+#define NICE_0_WEIGHT 1024
+
+// Nice -20..19, each level is ~10% CPU away from its neighbour
+static const unsigned long prio_to_weight[MAX_PRIO] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	 9548,  7620,  6100,  4904,  3906,
+	 3121,  2501,  1991,  1586,  1277,
+	 1024,   820,   655,   526,   423,
+	  335,   272,   215,   172,   137,
+	  110,    87,    70,    56,    45,
+	   36,    29,    23,    18,    15,
+};
+
+static inline struct task* task_of(struct sched_entity* se){
+	return container_of(se, struct task, se);
+}
+
+static inline int64_t entity_key(struct cfs_rq* cfs_rq, struct sched_entity* se){
+	return (int64_t)(se->vruntime - cfs_rq->min_vruntime);
+}
+
+static inline uint64_t max_vruntime(uint64_t a, uint64_t b){
+	return (int64_t)(b - a) > 0 ? b : a;
+}
+
+static inline uint64_t min_vruntime(uint64_t a, uint64_t b){
+	return (int64_t)(b - a) < 0 ? b : a;
+}
+
+static uint64_t calc_delta_fair(uint64_t delta, struct sched_entity* se){
+	if(se->weight != NICE_0_WEIGHT){
+		delta *= NICE_0_WEIGHT;
+		do_div(delta, se->weight);
+	}
+
+	return delta;
+}
+
+static struct sched_entity* pick_first_entity(struct cfs_rq* cfs_rq){
+	struct rb_node* left = rb_first_cached(&cfs_rq->tasks_timeline);
+	return left ? rb_entry(left, struct sched_entity, run_node) : NULL;
+}
+
+/* min_vruntime only moves forward, new and woken tasks are placed from it */
+static void update_min_vruntime(struct cfs_rq* cfs_rq){
+	struct sched_entity* curr = cfs_rq->curr;
+	struct sched_entity* left = pick_first_entity(cfs_rq);
+	uint64_t vruntime = cfs_rq->min_vruntime;
+
+	if(curr){
+		vruntime = curr->vruntime;
+	}
+
+	if(left){
+		vruntime = curr ? min_vruntime(vruntime, left->vruntime) : left->vruntime;
+	}
+
+	cfs_rq->min_vruntime = max_vruntime(cfs_rq->min_vruntime, vruntime);
+}
+
+// Charge the running task for the time since it was last accounted
+static void update_curr(struct cfs_rq* cfs_rq){
+	struct sched_entity* curr = cfs_rq->curr;
+	if(!curr){
+		return;
+	}
+
+	time_ns_t now = clock_get_monotonic_ns();
+	if((int64_t)(now - curr->exec_start) <= 0){
+		return;
+	}
+
+	time_ns_t delta_exec = now - curr->exec_start;
+	curr->exec_start = now;
+	curr->sum_exec_runtime += delta_exec;
+	curr->vruntime += calc_delta_fair(delta_exec, curr);
+
+	update_min_vruntime(cfs_rq);
+}
+
+/*
+* The period stretches past SCHED_LATENCY_NS when there are too many tasks
+* to give each one SCHED_MIN_GRANULARITY_NS.
+*/
+static uint64_t sched_period(unsigned long nr_running){
+	const unsigned long nr_latency = SCHED_LATENCY_NS / SCHED_MIN_GRANULARITY_NS;
+
+	if(nr_running > nr_latency){
+		return nr_running * SCHED_MIN_GRANULARITY_NS;
+	}
+
+	return SCHED_LATENCY_NS;
+}
+
+// Wall clock share of the period, for a task that is running or queued
+static uint64_t sched_slice(struct cfs_rq* cfs_rq, struct sched_entity* se){
+	unsigned long nr_running = cfs_rq->nr_running;
+	unsigned long load = cfs_rq->load;
+
+	if(RB_EMPTY_NODE(&se->run_node)){
+		nr_running++;
+		load += se->weight;
+	}
+
+	uint64_t slice = sched_period(nr_running) * se->weight;
+	do_div(slice, load);
+
+	return slice;
+}
+
+static void place_entity(struct cfs_rq* cfs_rq, struct sched_entity* se, int initial){
+	uint64_t vruntime = cfs_rq->min_vruntime;
+
+	if(initial){
+		// New tasks pay for their first slice, forking can't starve others
+		vruntime += calc_delta_fair(sched_slice(cfs_rq, se), se);
+	} else {
+		// Sleeper credit, bounded so long sleeps don't buy a burst
+		vruntime -= SCHED_LATENCY_NS / 2;
+	}
+
+	se->vruntime = max_vruntime(se->vruntime, vruntime);
+}
+
+static void __enqueue_entity(struct cfs_rq* cfs_rq, struct sched_entity* se){
+	struct rb_node** link = &cfs_rq->tasks_timeline.rb_root.rb_node;
+	struct rb_node* parent = NULL;
+	int64_t key = entity_key(cfs_rq, se);
+	int leftmost = 1;
+
+	while(*link){
+		parent = *link;
+		struct sched_entity* entry = rb_entry(parent, struct sched_entity, run_node);
+
+		// Equal keys go right, FIFO among tasks with the same vruntime
+		if(key < entity_key(cfs_rq, entry)){
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = 0;
+		}
+	}
+
+	rb_link_node(&se->run_node, parent, link);
+	rb_insert_color_cached(&se->run_node, &cfs_rq->tasks_timeline, leftmost);
+}
+
+static void __dequeue_entity(struct cfs_rq* cfs_rq, struct sched_entity* se){
+	rb_erase_cached(&se->run_node, &cfs_rq->tasks_timeline);
+}
+
+static void task_init_fair(struct rq* rq, struct task* task){
+	struct sched_entity* se = &task->se;
+
+	RB_CLEAR_NODE(&se->run_node);
+	se->weight = prio_to_weight[task->priority];
+	se->vruntime = rq->cfs.min_vruntime;
+	se->exec_start = 0;
+	se->prev_sum_exec_runtime = se->sum_exec_runtime;
+}
+
+static void enqueue_task_fair(struct rq* rq, struct task* task, int flags){
+	struct cfs_rq* cfs_rq = &rq->cfs;
+	struct sched_entity* se = &task->se;
+
+	update_curr(cfs_rq);
+
+	if(flags & ENQUEUE_MIGRATED){
+		se->vruntime += cfs_rq->min_vruntime;
+	}
+
+	if(flags & ENQUEUE_NEW){
+		place_entity(cfs_rq, se, 1);
+	} else if(flags & ENQUEUE_WAKEUP){
+		place_entity(cfs_rq, se, 0);
+	}
+
+	__enqueue_entity(cfs_rq, se);
+	cfs_rq->nr_running++;
+	cfs_rq->load += se->weight;
+}
+
+static void dequeue_task_fair(struct rq* rq, struct task* task){
+	struct cfs_rq* cfs_rq = &rq->cfs;
+	struct sched_entity* se = &task->se;
+
+	update_curr(cfs_rq);
+
+	__dequeue_entity(cfs_rq, se);
+	cfs_rq->nr_running--;
+	cfs_rq->load -= se->weight;
+
+	update_min_vruntime(cfs_rq);
+}
+
+static void set_curr_task_fair(struct rq* rq, struct task* task){
+	struct sched_entity* se = &task->se;
+
+	se->exec_start = clock_get_monotonic_ns();
+	se->prev_sum_exec_runtime = se->sum_exec_runtime;
+	rq->cfs.curr = se;
+}
+
+static struct task* pick_next_task_fair(struct rq* rq){
+	struct cfs_rq* cfs_rq = &rq->cfs;
+	struct sched_entity* se = pick_first_entity(cfs_rq);
+	if(!se){
+		return NULL;
+	}
+
+	__dequeue_entity(cfs_rq, se);
+	cfs_rq->nr_running--;
+	cfs_rq->load -= se->weight;
+
+	struct task* task = task_of(se);
+	set_curr_task_fair(rq, task);
+
+	return task;
+}
+
+static void put_prev_task_fair(struct rq* rq, struct task* prev){
+	update_curr(&rq->cfs);
+	rq->cfs.curr = NULL;
+}
+
+/* Preempt only once the running task has used up its slice */
+static void task_tick_fair(struct rq* rq, struct task* cur){
+	struct cfs_rq* cfs_rq = &rq->cfs;
+	struct sched_entity* curr = &cur->se;
+
+	update_curr(cfs_rq);
+
+	if(!cfs_rq->nr_running){
+		return;
+	}
+
+	if(curr->sum_exec_runtime - curr->prev_sum_exec_runtime > sched_slice(cfs_rq, curr)){
+		resched_curr(rq);
+	}
+}
+
+static void check_preempt_curr_fair(struct rq* rq, struct task* task){
+	struct sched_entity* curr = rq->cfs.curr;
+	struct sched_entity* se = &task->se;
+
+	if(!curr){
+		return;
+	}
+
+	update_curr(&rq->cfs);
+
+	// Running task is ahead by more than the granularity, in the woken task's virtual time
+	int64_t gran = calc_delta_fair(SCHED_WAKEUP_GRANULARITY_NS, se);
+	if((int64_t)(curr->vruntime - se->vruntime) > gran){
+		resched_curr(rq);
+	}
+}
+
+/* Called with the task off the tree */
+static void set_prio_fair(struct rq* rq, struct task* task, int prio){
+	if(&task->se == rq->cfs.curr){
+		update_curr(&rq->cfs);
+	}
+
+	task->priority = prio;
+	task->se.weight = prio_to_weight[prio];
+}
+
+/* Each queue has its own clock, carry the vruntime over relative to it */
+static void migrate_task_rq_fair(struct rq* rq, struct task* task){
+	task->se.vruntime -= rq->cfs.min_vruntime;
+}
+
+static void init_fair(struct rq* rq){
+	struct cfs_rq* cfs_rq = &rq->cfs;
+
+	cfs_rq->nr_running = 0;
+	cfs_rq->load = 0;
+	cfs_rq->min_vruntime = 0;
+	cfs_rq->tasks_timeline = RB_ROOT_CACHED;
+	cfs_rq->curr = NULL;
+}
+
+const struct sched_class fair_sched_class = {
+	.next = &prio_sched_class,
+
+	.init = init_fair,
+	.task_init = task_init_fair,
+	.enqueue_task = enqueue_task_fair,
+	.dequeue_task = dequeue_task_fair,
+
+	.pick_next_task = pick_next_task_fair,
+	.put_prev_task = put_prev_task_fair,
+	.set_curr_task = set_curr_task_fair,
+
+	.task_tick = task_tick_fair,
+	.check_preempt_curr = check_preempt_curr_fair,
+	.set_prio = set_prio_fair,
+
+	.migrate_task_rq = migrate_task_rq_fair,
+};
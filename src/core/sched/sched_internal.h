@@ -0,0 +1,133 @@
+#ifndef _SCHED_INTERNAL_H
+#define _SCHED_INTERNAL_H
+
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+#include <sync/spinlock.h>
+#include <lib/bitmap.h>
+#include <asm/percpu.h>
+
+// enqueue_task flags
+#define ENQUEUE_WAKEUP (1 << 0)
+#define ENQUEUE_NEW    (1 << 1)
+#define ENQUEUE_MIGRATED (1 << 2)
+
+/* Real-time class queue, see sched_rt.c */
+struct rt_rq {
+	unsigned long nr_running;
+	DECLARE_BITMAP(bitmap, MAX_RT_PRIO);
+	struct list_head queue[MAX_RT_PRIO];   // highest priority first
+};
+
+/* Fair class queue, see sched_fair.c */
+struct cfs_rq {
+	unsigned long nr_running;    // queued, the running task excluded
+	unsigned long load;          // weight of the queued tasks
+	uint64_t min_vruntime;
+	struct rb_root_cached tasks_timeline;
+	struct sched_entity* curr;
+};
+
+/* Priority arrays, see sched_prio.c */
+struct prio_array {
+	unsigned int nr_active;
+	DECLARE_BITMAP(bitmap, MAX_PRIO);
+	struct list_head queue[MAX_PRIO];
+};
+
+struct prio_rq {
+	unsigned long nr_running;
+	struct prio_array *active;
+	struct prio_array *expired;
+	struct prio_array arrays[2];
+};
+
+/*
+* One run queue per CPU. A task is queued on the run queue of task->cpu
+* and only that CPU runs it; `lock` covers the queue and everything the
+* classes keep in it.
+*/
+struct rq {
+	spinlock_t lock;
+	int cpu;
+
+	unsigned long nr_running;    // queued in any class, `curr` excluded
+	volatile int need_resched;
+
+	struct task* curr;
+	struct task* idle;
+
+	struct rt_rq rt;
+	struct cfs_rq cfs;
+	struct prio_rq prio;
+
+	struct list_head tasks;        // queued tasks, longest waiting first
+	unsigned int balance_ticks;    // ticks left to the periodic balance
+	unsigned int balance_failed;   // balances in a row that moved nothing
+
+	// Balancer counters, see sched_report_balance()
+	unsigned long nr_balance;
+	unsigned long nr_balance_failed;
+	unsigned long nr_migrations;   // tasks moved onto this CPU
+	unsigned long nr_steals;       // of those, taken while going idle
+	unsigned long nr_hot_skipped;  // left behind as cache hot
+};
+
+DECLARE_PER_CPU(struct rq, runqueues);
+
+#define cpu_rq(cpu)    per_cpu_ptr(&runqueues, (cpu))
+#define this_rq()      this_cpu_ptr(&runqueues)
+#define task_rq(task)  cpu_rq((task)->cpu)
+
+/*
+* Scheduling classes, walked from the highest through `next`. All hooks run
+* with the run queue lock held and interrupts off. pick_next_task takes the
+* task off its queue, the running task is never queued.
+*/
+struct sched_class {
+	const struct sched_class* next;
+
+	void (*init)(struct rq* rq);
+	void (*task_init)(struct rq* rq, struct task* task);
+	void (*enqueue_task)(struct rq* rq, struct task* task, int flags);
+	void (*dequeue_task)(struct rq* rq, struct task* task);
+
+	struct task* (*pick_next_task)(struct rq* rq);
+	void (*put_prev_task)(struct rq* rq, struct task* prev);
+	void (*set_curr_task)(struct rq* rq, struct task* task);
+
+	void (*task_tick)(struct rq* rq, struct task* cur);
+	void (*check_preempt_curr)(struct rq* rq, struct task* task);
+	void (*set_prio)(struct rq* rq, struct task* task, int prio);
+
+	// Leaving `rq` for another CPU, off its queue; ENQUEUE_MIGRATED on arrival
+	void (*migrate_task_rq)(struct rq* rq, struct task* task);
+};
+
+extern const struct sched_class rt_sched_class;
+extern const struct sched_class fair_sched_class;
+extern const struct sched_class prio_sched_class;
+
+#define sched_class_highest (&rt_sched_class)
+
+/*
+* Priority inheritance, see mutex.c. pi_lock covers the waiters of every
+* mutex and the PI fields of every task; it nests outside the run queue
+* locks.
+*/
+extern spinlock_t pi_lock;
+
+int pi_inherited_prio(struct task* task);
+void pi_chain_adjust(struct task* task);
+void sched_set_rt_prio(struct task* task, int rt_prio);
+
+/* Have `rq` reschedule on its way out of the next interrupt */
+static inline void resched_curr(struct rq* rq){
+	rq->need_resched = 1;
+
+	if(rq->cpu != smp_processor_id()){
+		smp_send_reschedule(rq->cpu);
+	}
+}
+
+#endif
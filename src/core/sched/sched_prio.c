@@ -0,0 +1,172 @@
+#include <kernel/sched.h>
+#include <lib/bitmap.h>
+#include <lib/string.h>
+
+#include "sched_internal.h"
+
+/*
+* O(1) priority run queue, used by SCHED_BATCH.
+*
+* Each array keeps one FIFO per priority plus a bitmap of the non empty
+* ones, so picking the next task is a find_first_bit. A task that uses up
+* its timeslice goes to the expired array; when the active array runs dry
+* the two are swapped.
+*/
+
+// Timeslices in ms: 800 at nice -20, 100 at nice 0, 5 at nice 19
+#define MIN_TIMESLICE_MS 5
+#define DEF_TIMESLICE_MS 100
+
+static unsigned int task_timeslice(struct task* task){
+	unsigned int ms;
+
+	if(task->priority < DEFAULT_PRIO){
+		ms = (MAX_PRIO - task->priority) * 20;
+	} else {
+		ms = (MAX_PRIO - task->priority) * MIN_TIMESLICE_MS;
+	}
+
+	unsigned int ticks = (ms * TIMER_FREQUENCY) / 1000;
+	return ticks ? ticks : 1;
+}
+
+static void init_prio(struct rq* rq){
+	struct prio_rq* prio_rq = &rq->prio;
+
+	memset(prio_rq, 0x0, sizeof(*prio_rq));
+	prio_rq->active = &prio_rq->arrays[0];
+	prio_rq->expired = &prio_rq->arrays[1];
+
+	for(int i = 0; i < 2; i++){
+		for(int prio = 0; prio < MAX_PRIO; prio++){
+			INIT_LIST_HEAD(&prio_rq->arrays[i].queue[prio]);
+		}
+	}
+}
+
+static void __enqueue(struct prio_rq* prio_rq, struct task* task, struct prio_array* array){
+	list_add_tail(&task->queue, &array->queue[task->priority]);
+	set_bit(task->priority, array->bitmap);
+	array->nr_active++;
+	task->array = array;
+	prio_rq->nr_running++;
+}
+
+/* Best queued priority, MAX_PRIO when nothing is waiting */
+static size_t best_queued_prio(struct prio_rq* prio_rq){
+	size_t prio = find_first_bit(prio_rq->active->bitmap, MAX_PRIO);
+
+	if(prio == MAX_PRIO){
+		prio = find_first_bit(prio_rq->expired->bitmap, MAX_PRIO);
+	}
+
+	return prio;
+}
+
+static void task_init_prio(struct rq* rq, struct task* task){
+	task->time_slice = task_timeslice(task);
+	task->array = NULL;
+}
+
+/* A task that spent its slice starts over in the expired array */
+static void enqueue_task_prio(struct rq* rq, struct task* task, int flags){
+	struct prio_rq* prio_rq = &rq->prio;
+
+	if(!task->time_slice){
+		task->time_slice = task_timeslice(task);
+		__enqueue(prio_rq, task, prio_rq->expired);
+	} else {
+		__enqueue(prio_rq, task, prio_rq->active);
+	}
+}
+
+static void dequeue_task_prio(struct rq* rq, struct task* task){
+	struct prio_array* array = task->array;
+
+	list_remove(&task->queue);
+	if(list_empty(&array->queue[task->priority])){
+		clear_bit(task->priority, array->bitmap);
+	}
+
+	array->nr_active--;
+	task->array = NULL;
+	rq->prio.nr_running--;
+}
+
+static struct task* pick_next_task_prio(struct rq* rq){
+	struct prio_rq* prio_rq = &rq->prio;
+
+	if(!prio_rq->nr_running){
+		return NULL;
+	}
+
+	if(unlikely(!prio_rq->active->nr_active)){
+		struct prio_array* array = prio_rq->active;
+		prio_rq->active = prio_rq->expired;
+		prio_rq->expired = array;
+	}
+
+	size_t prio = find_first_bit(prio_rq->active->bitmap, MAX_PRIO);
+	struct task* next = list_first_entry(&prio_rq->active->queue[prio], struct task, queue);
+	dequeue_task_prio(rq, next);
+
+	return next;
+}
+
+static void put_prev_task_prio(struct rq* rq, struct task* prev){
+}
+
+static void set_curr_task_prio(struct rq* rq, struct task* task){
+}
+
+// Charge the running task a tick, resched once its slice is gone
+static void task_tick_prio(struct rq* rq, struct task* cur){
+	if(cur->time_slice && --cur->time_slice == 0){
+		resched_curr(rq);
+		return;
+	}
+
+	if(find_first_bit(rq->prio.active->bitmap, MAX_PRIO) < (size_t)cur->priority){
+		resched_curr(rq);
+	}
+}
+
+static void check_preempt_curr_prio(struct rq* rq, struct task* task){
+	if(task->priority < rq->curr->priority){
+		resched_curr(rq);
+	}
+}
+
+static void set_prio_prio(struct rq* rq, struct task* task, int prio){
+	task->priority = prio;
+	if(task->time_slice > task_timeslice(task)){
+		task->time_slice = task_timeslice(task);
+	}
+
+	if(task == rq->curr && best_queued_prio(&rq->prio) < (size_t)task->priority){
+		resched_curr(rq);
+	}
+}
+
+// The timeslice left goes along, nothing is relative to the queue
+static void migrate_task_rq_prio(struct rq* rq, struct task* task){
+}
+
+const struct sched_class prio_sched_class = {
+	.next = NULL,
+
+	.init = init_prio,
+	.task_init = task_init_prio,
+	.enqueue_task = enqueue_task_prio,
+	.dequeue_task = dequeue_task_prio,
+
+	.pick_next_task = pick_next_task_prio,
+	.put_prev_task = put_prev_task_prio,
+	.set_curr_task = set_curr_task_prio,
+
+	.task_tick = task_tick_prio,
+	.check_preempt_curr = check_preempt_curr_prio,
+	.set_prio = set_prio_prio,
+
+	.migrate_task_rq = migrate_task_rq_prio,
+};
@@ -0,0 +1,147 @@
+#include <kernel/sched.h>
+#include <lib/bitmap.h>
+#include <lib/string.h>
+
+#include "sched_internal.h"
+
+/**
+* Real-time class, used by SCHED_FIFO and SCHED_RR, and by any task that
+* inherited a real-time priority through a mutex.
+*
+* One FIFO per priority and a bitmap of the non empty ones, like the
+* SCHED_BATCH arrays but without expiry: the highest queued priority always
+* runs next. A SCHED_FIFO task runs until it blocks or a higher one comes
+* in, and goes back to the head of its queue when preempted. A SCHED_RR
+* task does the same within its quantum and moves to the tail once it used
+* it up.
+*/
+
+// Queue index, the highest priority at 0 so find_first_bit picks it
+#define rt_index(rt_prio) (MAX_RT_PRIO - 1 - (rt_prio))
+
+/* SCHED_RR quantum, 2x at nice -20 down to 1/20 at nice 19 */
+unsigned int sched_rr_timeslice_ms(struct task* task){
+	unsigned int ms = SCHED_RR_TIMESLICE_MS * (MAX_PRIO - task->priority) / (MAX_PRIO - DEFAULT_PRIO);
+	return ms ? ms : 1;
+}
+
+static unsigned int rr_timeslice(struct task* task){
+	unsigned int ticks = (sched_rr_timeslice_ms(task) * TIMER_FREQUENCY) / 1000;
+	return ticks ? ticks : 1;
+}
+
+static void init_rt(struct rq* rq){
+	struct rt_rq* rt_rq = &rq->rt;
+
+	memset(rt_rq, 0x0, sizeof(*rt_rq));
+	for(int i = 0; i < MAX_RT_PRIO; i++){
+		INIT_LIST_HEAD(&rt_rq->queue[i]);
+	}
+}
+
+static void task_init_rt(struct rq* rq, struct task* task){
+	task->time_slice = rr_timeslice(task);
+}
+
+/*
+* Put back while running, it was preempted and keeps its place, unless a
+* SCHED_RR task spent its quantum. Everything else queues at the tail.
+*/
+static void enqueue_task_rt(struct rq* rq, struct task* task, int flags){
+	struct rt_rq* rt_rq = &rq->rt;
+	int idx = rt_index(task->rt_prio);
+
+	if(!task->time_slice){
+		task->time_slice = rr_timeslice(task);
+		list_add_tail(&task->queue, &rt_rq->queue[idx]);
+	} else if(!flags){
+		list_add(&task->queue, &rt_rq->queue[idx]);
+	} else {
+		list_add_tail(&task->queue, &rt_rq->queue[idx]);
+	}
+
+	set_bit(idx, rt_rq->bitmap);
+	rt_rq->nr_running++;
+}
+
+static void dequeue_task_rt(struct rq* rq, struct task* task){
+	struct rt_rq* rt_rq = &rq->rt;
+	int idx = rt_index(task->rt_prio);
+
+	list_remove(&task->queue);
+	if(list_empty(&rt_rq->queue[idx])){
+		clear_bit(idx, rt_rq->bitmap);
+	}
+
+	rt_rq->nr_running--;
+}
+
+static struct task* pick_next_task_rt(struct rq* rq){
+	struct rt_rq* rt_rq = &rq->rt;
+
+	if(!rt_rq->nr_running){
+		return NULL;
+	}
+
+	size_t idx = find_first_bit(rt_rq->bitmap, MAX_RT_PRIO);
+	struct task* next = list_first_entry(&rt_rq->queue[idx], struct task, queue);
+	dequeue_task_rt(rq, next);
+
+	return next;
+}
+
+static void put_prev_task_rt(struct rq* rq, struct task* prev){
+}
+
+static void set_curr_task_rt(struct rq* rq, struct task* task){
+}
+
+// Round robin among equals, alone at its level a SCHED_RR task just goes on
+static void task_tick_rt(struct rq* rq, struct task* cur){
+	if(cur->policy != SCHED_RR || (cur->time_slice && --cur->time_slice)){
+		return;
+	}
+
+	if(list_empty(&rq->rt.queue[rt_index(cur->rt_prio)])){
+		cur->time_slice = rr_timeslice(cur);
+		return;
+	}
+
+	resched_curr(rq);
+}
+
+static void check_preempt_curr_rt(struct rq* rq, struct task* task){
+	if(task->rt_prio > rq->curr->rt_prio){
+		resched_curr(rq);
+	}
+}
+
+// Nice only scales the SCHED_RR quantum
+static void set_prio_rt(struct rq* rq, struct task* task, int prio){
+	task->priority = prio;
+	if(task->time_slice > rr_timeslice(task)){
+		task->time_slice = rr_timeslice(task);
+	}
+}
+
+static void migrate_task_rq_rt(struct rq* rq, struct task* task){
+}
+
+const struct sched_class rt_sched_class = {
+	.next = &fair_sched_class,
+
+	.init = init_rt,
+	.task_init = task_init_rt,
+	.enqueue_task = enqueue_task_rt,
+	.dequeue_task = dequeue_task_rt,
+
+	.pick_next_task = pick_next_task_rt,
+	.put_prev_task = put_prev_task_rt,
+	.set_curr_task = set_curr_task_rt,
+
+	.task_tick = task_tick_rt,
+	.check_preempt_curr = check_preempt_curr_rt,
+	.set_prio = set_prio_rt,
+
+	.migrate_task_rq = migrate_task_rq_rt,
+};
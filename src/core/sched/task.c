@@ -1,23 +1,56 @@
 #include <kernel/syscall.h>
 #include <kernel/sched.h>
 #include <kernel/wait.h>
+#include <kernel/fork.h>
+#include <kernel/futex.h>
+#include <kernel/uaccess.h>
+#include <fs/fdtable.h>
+#include <fs/fs_struct.h>
 #include <lib/assert.h>
 #include <lib/string.h>
 #include <mm/vma.h>
+#include <sync/barrier.h>
+#include <asm/cpu.h>
+#include <def/errno.h>
 
 struct task* init_task;
 
+/*
+* Guards the process tree: parents, children, zombies and the waiters
+* for them. An exiting task queues itself on its parent's zombies and
+* only wakes the waiters it matches, which reap from there without
+* looking at the other children.
+*/
+static spinlock_t tasklist_lock;
+
+struct child_waiter {
+	struct list_head list;
+	struct task* task;
+	pid_t pid;  // the child waited for, -1 any
+};
+
 struct task* task_create(const char* name, int priority){ 
 	struct task* new_task = kmalloc(sizeof(struct task)); 
 	if(likely(new_task)){ 
 		memset(new_task, 0, sizeof(struct task)); 
 		strncpy(new_task->name, name, PROC_NAME_MAX); 
 		new_task->priority = priority; 
+		sched_fork(new_task);
 		new_task->state = TASK_NEW; 
 		INIT_LIST_HEAD(&new_task->tasks); 
 		INIT_LIST_HEAD(&new_task->queue); 
 		INIT_LIST_HEAD(&new_task->children); 
 		INIT_LIST_HEAD(&new_task->sibling); 
+		INIT_LIST_HEAD(&new_task->pid_chain);
+		INIT_LIST_HEAD(&new_task->zombies);
+		INIT_LIST_HEAD(&new_task->zombie_node);
+		INIT_LIST_HEAD(&new_task->child_waiters);
+		INIT_LIST_HEAD(&new_task->reap_node);
+		INIT_LIST_HEAD(&new_task->thread_group);
+		INIT_LIST_HEAD(&new_task->thread_node);
+		new_task->group_leader = new_task;
+		new_task->nr_threads = 1;
+		atomic_set(&new_task->usage, 1);
 	} 
 
 	return new_task; 
@@ -33,11 +66,14 @@ static void task_destroy_mm(struct task* task){
 }
 
 static void task_close_files(struct task* task){
-	for(int i = 0; i < PROC_FD_MAX; i++){
-		if(task->file_table[i] != NULL){
-			vfs_close(task->file_table[i]);
-			task->file_table[i] = NULL;
-		}
+	if(task->files){
+		files_put(task->files);
+		task->files = NULL;
+	}
+
+	if(task->fs){
+		fs_put(task->fs);
+		task->fs = NULL;
 	}
 }
 
@@ -62,7 +98,21 @@ int task_default_wakeup(struct wait_queue_entry* entry){
 	return 1;
 }
 
-void task_reparent_children(struct task* task, struct task* new_parent){
+// Wake whoever waits for `child` exiting, tasklist_lock held
+static void task_notify_parent(struct task* parent, struct task* child){
+	struct child_waiter* waiter;
+
+	list_add_tail(&child->zombie_node, &parent->zombies);
+
+	list_for_each_entry(waiter, &parent->child_waiters, list){
+		if(waiter->pid == -1 || waiter->pid == child->pid){
+			task_wakeup(waiter->task);
+		}
+	}
+}
+
+// tasklist_lock held
+static void task_reparent_children(struct task* task, struct task* new_parent){
 	struct task* child;
 	struct task* tmp;
 
@@ -71,101 +121,400 @@ void task_reparent_children(struct task* task, struct task* new_parent){
 
 		list_remove(&child->sibling);
 		list_add(&child->sibling, &new_parent->children);
+
+		if(child->state == TASK_ZOMBIE && !child->nr_threads){
+			list_remove(&child->zombie_node);
+			task_notify_parent(new_parent, child);
+		}
 	}
 }
 
+void task_add_child(struct task* parent, struct task* child){
+	unsigned long flags;
+	spin_lock_irqsave(&tasklist_lock, &flags);
+
+	child->parent = parent;
+	list_add(&child->sibling, &parent->children);
+
+	spin_unlock_irqrestore(&tasklist_lock, &flags);
+}
+
+/*
+* Join `thread` to the group of `leader`, the thread takes no part in the
+* process tree. Fails once the group is exiting.
+*/
+int task_add_thread(struct task* leader, struct task* thread){
+	unsigned long flags;
+	int ret = SUCCESS;
+
+	spin_lock_irqsave(&tasklist_lock, &flags);
+
+	if(leader->group_exit){
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	thread->tgid = leader->tgid;
+	thread->group_leader = leader;
+	thread->parent = NULL;
+	list_add_tail(&thread->thread_node, &leader->thread_group);
+	leader->nr_threads++;
+
+out:
+	spin_unlock_irqrestore(&tasklist_lock, &flags);
+	return ret;
+}
+
+// CLONE_CHILD_CLEARTID: let whoever joins the thread know it is gone
+static void task_clear_child_tid(struct task* task){
+	int zero = 0;
+
+	if(!task->clear_child_tid || task != current){
+		return;
+	}
+
+	if(!copy_to_user(task->clear_child_tid, &zero, sizeof(zero))){
+		futex_wake((uint32_t __user*)task->clear_child_tid, 1);
+	}
+
+	task->clear_child_tid = NULL;
+}
+
 void task_exit(struct task* task, int status){
 	if(unlikely(task->pid == 1)){
 		panic("Attempting to exit init process");
 	}
 
+	task_clear_child_tid(task);
+
+	unsigned long flags;
+	spin_lock_irqsave(&tasklist_lock, &flags);
+
+	struct task* leader = task->group_leader;
+	if(leader->group_exit){
+		status = leader->group_exit_code;
+	}
+
 	task->exit_code = status;
+	// Its own reference goes to the reaper, one more for the parent
+	atomic_inc(&task->usage);
 	task->state = TASK_ZOMBIE;
 
-	task_reparent_children(task, init_task);
+	// A thread's children go to its leader while that one still runs
+	if(task != leader && leader->state != TASK_ZOMBIE){
+		task_reparent_children(task, leader);
+	} else {
+		task_reparent_children(task, init_task);
+	}
+
+	if(task != leader){
+		list_remove(&task->thread_node);
+	}
+
+	// The parent hears of the process once its last thread is gone
+	if(!--leader->nr_threads && leader->parent){
+		task_notify_parent(leader->parent, leader);
+	}
+
+	spin_unlock_irqrestore(&tasklist_lock, &flags);
+}
+
+/*
+* exit_group(): every thread of the group exits with `status`. The others
+* do so on their way back to user mode; sleeping ones are woken for it,
+* those sleeping in the kernel for something else only once that is done.
+*/
+void task_exit_group(struct task* task, int status){
+	struct task* thread;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tasklist_lock, &flags);
+
+	struct task* leader = task->group_leader;
+	if(!leader->group_exit){
+		leader->group_exit = 1;
+		leader->group_exit_code = status;
+	}
+
+	if(leader != task){
+		task_wakeup(leader);
+	}
+
+	list_for_each_entry(thread, &leader->thread_group, thread_node){
+		if(thread != task){
+			task_wakeup(thread);
+		}
+	}
+
+	spin_unlock_irqrestore(&tasklist_lock, &flags);
+}
+
+/* From the interrupt return path, on the way back to user mode */
+asmlinkage void task_exit_to_user(void){
+	struct task* task = current;
+
+	if(unlikely(task->group_leader->group_exit)){
+		task_exit(task, 0);
+		schedule();
+		unreachable();
+	}
+}
+
+void task_put(struct task* task){
+	if(atomic_dec_and_test(&task->usage)){
+		kfree(task);
+	}
+}
+
+/*
+* Look `pid` up with a reference held, dropped by task_put(). The task may
+* still exit meanwhile, only its struct stays.
+*/
+struct task* task_find_get(pid_t pid){
+	unsigned long flags;
+	spin_lock_irqsave(&tasklist_lock, &flags);
+
+	struct task* task = find_task_by_pid(pid);
+	if(task){
+		task_get(task);
+	}
 
-	task_wakeup(task->parent);
+	spin_unlock_irqrestore(&tasklist_lock, &flags);
+	return task;
 }
 
+/* Drop an exited task, the parent's part: its PID goes */
 void task_destroy(struct task* task){
+	unsigned long flags;
+
 	if(task->state != TASK_ZOMBIE){
 		panic("Attempting to destroy a non-zombie task (pid: %d, name: %s)", task->pid, task->name);
 	}
 
-	if(task->pwd){
-		kfree(task->pwd);
-		task->pwd = NULL;
+	// Unhashed under tasklist_lock, task_find_get() pins it or misses it
+	spin_lock_irqsave(&tasklist_lock, &flags);
+	list_remove(&task->tasks);
+	list_remove(&task->sibling);
+	detach_pid(task);
+	spin_unlock_irqrestore(&tasklist_lock, &flags);
+
+	task_put(task);
+}
+
+/*
+* Exited tasks are torn down by the "reaper" thread. Freeing an address
+* space means walking and freeing its page tables, which the switch away
+* from the zombie would otherwise do before the next task gets to run.
+*/
+static LIST_HEAD(reap_list);
+static spinlock_t reap_lock;
+static struct task* reaper_task;
+
+// From the switch away from it, interrupts off
+static void task_queue_reap(struct task* task){
+	spin_lock(&reap_lock);
+
+	list_add_tail(&task->reap_node, &reap_list);
+	if(reaper_task){
+		task_wakeup(reaper_task);
 	}
 
+	spin_unlock(&reap_lock);
+}
+
+static void task_release(struct task* task){
 	if(task->kstack){
 		kfree(task->kstack);
 		task->kstack = NULL;
 	}
 
-	if(task->mm){
-		task_destroy_mm(task);
-		task->mm = NULL;
+	release_thread(task);
+	task_destroy_mm(task);
+	task_close_files(task);
+}
+
+static int reaper_thread(void* unused){
+	unsigned long flags;
+
+	reaper_task = current;
+
+	// Background work, as long as zombies don't pile up
+	set_task_nice(current, MAX_NICE);
+
+	while(1){
+		spin_lock_irqsave(&reap_lock, &flags);
+
+		if(list_empty(&reap_list)){
+			task_sleep(current);
+			spin_unlock_irqrestore(&reap_lock, &flags);
+
+			schedule();
+			continue;
+		}
+
+		struct task* task = list_first_entry(&reap_list, struct task, reap_node);
+		list_remove(&task->reap_node);
+
+		spin_unlock_irqrestore(&reap_lock, &flags);
+
+		task_release(task);
+
+		// Kernel threads have nobody to wait for them
+		if(!task->parent){
+			task_destroy(task);
+		}
+
+		task_put(task);
 	}
 
-	task_close_files(task);
+	return SUCCESS;
+}
 
-	list_remove(&task->tasks);
-	list_remove(&task->sibling);
-	pid_free(task->pid);
-	kfree(task);
+static int __init reaper_init(void){
+	pid_t pid = kernel_thread(reaper_thread, "reaper", NULL);
+	return pid < 0 ? pid : SUCCESS;
 }
 
+core_initcall(reaper_init);
+
+/* Runs on the next task's stack, `prev` is off the CPU once on_cpu drops */
 void asmlinkage task_handle_prev_status(struct task* prev){
-	if(unlikely(prev->pid == 0)){
-		return;
+	int migrate = prev->migrate_pending;
+	int zombie = 0;
+
+	if(likely(prev->pid != 0)){
+		switch (prev->state) {
+			case TASK_ZOMBIE:
+				zombie = 1;
+				break;
+			case TASK_RUNNING:
+				prev->state = TASK_READY;
+				scheduler_add(prev); 
+				break;
+			default: break;
+		}
 	}
 
-	switch (prev->state) {
-		case TASK_ZOMBIE:
-			if(prev->pwd){
-				kfree(prev->pwd);
-				prev->pwd = NULL;
-			}
+	// A zombie can be reaped from here on
+	smp_mb();
+	prev->on_cpu = 0;
 
-			if(prev->kstack){
-				kfree(prev->kstack);
-				prev->kstack = NULL;
-			}
+	if(unlikely(zombie)){
+		task_queue_reap(prev);
+	}
 
-			if(prev->mm){
-				task_destroy_mm(prev);
-				prev->mm = NULL;
-			}
-			break;
-		case TASK_RUNNING:
-			prev->state = TASK_READY;
-			scheduler_add(prev); 
-			return;
-		default: return;
+	if(unlikely(migrate)){
+		sched_move_task(prev);
 	}
 }
 
 struct task* task_get_child(struct task* parent, pid_t pid){
-	struct task* child;
-	list_for_each_entry(child, &parent->children, sibling){
-		if(child->pid == pid){
-			return child;
-		}
+	struct task* child = find_task_by_pid(pid);
+	if(child && child->parent == parent){
+		return child;
 	}
 
 	return NULL;
 }
 
-struct task* task_find_zombie_child(struct task* parent){
-	struct task* child = NULL;
+/*
+* Take up to `max` of the parent's exited children onto `reaped`, only
+* `pid` unless it is -1. Returns how many, -ECHILD without such a child.
+* tasklist_lock held.
+*/
+static int task_take_zombies(struct task* parent, pid_t pid, struct list_head* reaped, int max){
+	struct task *child, *tmp;
+	int nr = 0;
+
+	if(pid != -1){
+		child = task_get_child(parent, pid);
+		if(!child){
+			return -ECHILD;
+		}
 
-	list_for_each_entry(child, &parent->children, sibling){
-		if(child->state == TASK_ZOMBIE){
-			return child;
+		if(child->state != TASK_ZOMBIE || child->nr_threads){
+			return 0;
 		}
+
+		list_remove(&child->zombie_node);
+		list_remove(&child->sibling);
+		list_add_tail(&child->zombie_node, reaped);
+		return 1;
 	}
 
-	return NULL;
+	if(list_empty(&parent->children)){
+		return -ECHILD;
+	}
+
+	list_for_each_entry_safe(child, tmp, &parent->zombies, zombie_node){
+		if(nr == max){
+			break;
+		}
+
+		list_remove(&child->zombie_node);
+		list_remove(&child->sibling);
+		list_add_tail(&child->zombie_node, reaped);
+		nr++;
+	}
+
+	return nr;
+}
+
+/*
+* Reap up to `max` exited children of the current task, `pid` only unless
+* it is -1 (or any other value below 1), filling their PIDs and exit codes
+* in. Sleeps until one exits, unless WNOHANG. Returns how many were reaped,
+* 0 with WNOHANG if none exited yet, or -ECHILD.
+*/
+int task_wait_children(pid_t pid, pid_t* pids, int* codes, int max, int options){
+	struct task* parent = current;
+	struct task *child, *tmp;
+	unsigned long flags;
+	LIST_HEAD(reaped);
+
+	struct child_waiter waiter = {
+		.task = parent,
+		.pid = pid > 0 ? pid : -1,
+	};
+
+	if(max <= 0){
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&tasklist_lock, &flags);
+
+	int nr;
+	while(!(nr = task_take_zombies(parent, waiter.pid, &reaped, max)) && !(options & WNOHANG)){
+		list_add_tail(&waiter.list, &parent->child_waiters);
+		task_sleep(parent);
+		spin_unlock_irqrestore(&tasklist_lock, &flags);
+
+		schedule();
+
+		spin_lock_irqsave(&tasklist_lock, &flags);
+		list_remove(&waiter.list);
+	}
+
+	spin_unlock_irqrestore(&tasklist_lock, &flags);
+
+	int i = 0;
+	list_for_each_entry_safe(child, tmp, &reaped, zombie_node){
+		pids[i] = child->pid;
+		codes[i] = child->exit_code;
+		i++;
+
+		list_remove(&child->zombie_node);
+		task_destroy(child);
+	}
+
+	return nr;
+}
+
+/* Return path of kernel_thread() functions */
+asmlinkage __no_return void kernel_thread_exit(int status){
+	task_exit(current, status);
+	schedule();
+	unreachable();
 }
 
 SYSCALL_DEFINE1(exit, int, status){
@@ -173,3 +522,10 @@ SYSCALL_DEFINE1(exit, int, status){
 	schedule();
 	unreachable();
 }
+
+SYSCALL_DEFINE1(exit_group, int, status){
+	task_exit_group(current, status);
+	task_exit(current, status);
+	schedule();
+	unreachable();
+}
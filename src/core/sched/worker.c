@@ -1,62 +1,665 @@
 #include <kernel/worker.h>
+#include <kernel/sched.h>
 #include <kernel/fork.h>
+#include <kernel/smp.h>
+#include <kernel/clock.h>
+#include <kernel/init.h>
+#include <kernel/printk.h>
+#include <asm/irqflags.h>
+#include <asm/percpu.h>
+#include <lib/stdio.h>
 #include <def/errno.h>
 #include <mm/kheap.h>
 
-static int worker_thread(void *arg)
-{
-	struct work_queue *wq = arg;
+/**
+* Concurrency managed work queues.
+*
+* Every CPU has a pool of workers and there is one unbound pool; work
+* queues only pick the pool their items go to. A bound pool runs one work
+* item at a time: when its running worker blocks, schedule() tells the
+* pool, which wakes an idle worker to carry on with the list. A worker
+* leaving idle makes sure another one is left idle for that, spawning it
+* if needed, so a blocking item never holds up the ones behind it. The
+* unbound pool runs its items side by side on whatever CPU is free.
+*
+* Delayed work arms an hrtimer that queues it on expiry.
+*/
 
-	while (1) {
-		wait_event(&wq->wait, !list_empty(&wq->works));
+#define POOL_MAX_WORKERS 16
+#define POOL_MAX_IDLE 2      // idle workers beyond it exit
 
-		spin_lock(&wq->lock);
+#define WORKER_IDLE     1
+#define WORKER_SLEEPING 2    // blocked in a work item, not counted running
 
-		struct work_struct *work = list_first_entry(&wq->works, struct work_struct, list);
+struct worker_pool {
+	spinlock_t lock;
+	int cpu;                     // -1 for the unbound pool
+	struct list_head worklist;
+
+	struct list_head idle_list;  // most recently idle first
+	struct list_head busy_list;
+	int nr_workers;
+	int nr_idle;
+	int nr_running;              // busy workers not blocked
+	int creating;                // a worker is spawning another
+
+	struct list_head flushers;   // sleeping in flush_work()
+};
+
+struct worker {
+	struct list_head node;       // in the pool's idle or busy list
+	struct task* task;
+	struct worker_pool* pool;
+	unsigned int flags;
+
+	struct work_struct* current_work;
+	work_func_t current_func;
+	struct list_head scheduled;  // queued again while it ran, runs next here
+};
+
+struct wq_flusher {
+	struct list_head list;
+	struct task* task;
+};
+
+static DEFINE_PER_CPU(struct worker_pool, cpu_worker_pools);
+static struct worker_pool unbound_pool;
+
+struct work_queue* system_wq;
+struct work_queue* system_unbound_wq;
+
+// Work waiting and nobody running it
+static int need_more_worker(struct worker_pool* pool){
+	return !list_empty(&pool->worklist) && (pool->cpu < 0 || !pool->nr_running);
+}
+
+// Work waiting and only this worker running
+static int keep_working(struct worker_pool* pool){
+	return !list_empty(&pool->worklist) && (pool->cpu < 0 || pool->nr_running <= 1);
+}
+
+// pool->lock held
+static void wake_up_worker(struct worker_pool* pool){
+	if(!list_empty(&pool->idle_list)){
+		task_wakeup(list_first_entry(&pool->idle_list, struct worker, node)->task);
+	}
+}
+
+// pool->lock held
+static void wake_up_flushers(struct list_head* flushers){
+	struct wq_flusher* flusher;
+
+	list_for_each_entry(flusher, flushers, list){
+		task_wakeup(flusher->task);
+	}
+}
+
+// pool->lock held
+static struct worker* find_worker_executing_work(struct worker_pool* pool, struct work_struct* work){
+	struct worker* worker;
+
+	list_for_each_entry(worker, &pool->busy_list, node){
+		if(worker->current_work == work && worker->current_func == work->func){
+			return worker;
+		}
+	}
+
+	return NULL;
+}
+
+static struct worker_pool* get_pool(struct work_queue* wq, int cpu){
+	if(!(wq->flags & WQ_UNBOUND)){
+		struct worker_pool* pool = per_cpu_ptr(&cpu_worker_pools, cpu);
+
+		// Its CPU came up after the pools were set up
+		if(pool->nr_workers){
+			return pool;
+		}
+	}
+
+	return &unbound_pool;
+}
+
+static void wq_dec_in_flight(struct work_queue* wq){
+	unsigned long flags;
+
+	spin_lock_irqsave(&wq->lock, &flags);
+
+	if(!--wq->nr_in_flight){
+		wake_up_flushers(&wq->flushers);
+	}
+
+	spin_unlock_irqrestore(&wq->lock, &flags);
+}
+
+// Claim a pending item for the queue, 0 once it is being destroyed
+static int wq_inc_in_flight(struct work_queue* wq){
+	unsigned long flags;
+	int res = 1;
+
+	spin_lock_irqsave(&wq->lock, &flags);
+
+	if(wq->stopping){
+		res = 0;
+	} else {
+		wq->nr_in_flight++;
+	}
+
+	spin_unlock_irqrestore(&wq->lock, &flags);
+	return res;
+}
+
+/* Put a work item we hold pending for on a pool's list */
+static void __queue_work(int cpu, struct work_queue* wq, struct work_struct* work){
+	struct worker_pool* pool = get_pool(wq, cpu);
+	struct worker_pool* last = work->pool;
+	unsigned long flags;
+
+	// Still running where it last went, it queues there so it doesn't run twice at once
+	if(last && last != pool){
+		spin_lock_irqsave(&last->lock, &flags);
+
+		if(find_worker_executing_work(last, work)){
+			pool = last;
+		}
+
+		spin_unlock_irqrestore(&last->lock, &flags);
+	}
+
+	spin_lock_irqsave(&pool->lock, &flags);
+
+	work->pool = pool;
+	list_add_tail(&work->list, &pool->worklist);
+
+	if(need_more_worker(pool)){
+		wake_up_worker(pool);
+	}
+
+	spin_unlock_irqrestore(&pool->lock, &flags);
+}
+
+/*
+* Queue `work` on the pool of this CPU, or the unbound pool. Returns 1,
+* 0 if it was pending already, or -ESHUTDOWN.
+*/
+int queue_work(struct work_queue* wq, struct work_struct* work){
+	if(atomic_cmpxchg(&work->data, 0, WORK_PENDING) != 0){
+		return 0;
+	}
+
+	if(!wq_inc_in_flight(wq)){
+		atomic_set(&work->data, 0);
+		return -ESHUTDOWN;
+	}
+
+	work->wq = wq;
+
+	unsigned long flags;
+	local_irq_save(flags);
+	__queue_work(smp_processor_id(), wq, work);
+	local_irq_restore(flags);
+
+	return 1;
+}
+
+enum hrtimer_restart delayed_work_timer_fn(struct hrtimer* timer){
+	struct delayed_work* dwork = container_of(timer, struct delayed_work, timer);
+
+	__queue_work(dwork->cpu, dwork->work.wq, &dwork->work);
+	return HRTIMER_NORESTART;
+}
+
+/* queue_work() once `delay` ns have passed */
+int queue_delayed_work(struct work_queue* wq, struct delayed_work* dwork, time_ns_t delay){
+	struct work_struct* work = &dwork->work;
+
+	if(!delay){
+		return queue_work(wq, work);
+	}
+
+	if(atomic_cmpxchg(&work->data, 0, WORK_PENDING) != 0){
+		return 0;
+	}
+
+	if(!wq_inc_in_flight(wq)){
+		atomic_set(&work->data, 0);
+		return -ESHUTDOWN;
+	}
+
+	work->wq = wq;
+
+	unsigned long flags;
+	local_irq_save(flags);
+	dwork->cpu = smp_processor_id();
+	local_irq_restore(flags);
+
+	hrtimer_start(&dwork->timer, clock_get_monotonic_ns() + delay);
+	return 1;
+}
+
+/*
+* Take the pending bit of an item that didn't start running yet, off its
+* timer or its pool's list. 1 if we hold it now, 0 if it wasn't pending,
+* -EAGAIN while it is on its way to a list.
+*/
+static int try_to_grab_pending(struct work_struct* work, struct delayed_work* dwork){
+	if(dwork && hrtimer_cancel(&dwork->timer)){
+		return 1;
+	}
+
+	if(!work_pending(work)){
+		return 0;
+	}
+
+	struct worker_pool* pool = work->pool;
+	unsigned long flags;
+	int res = -EAGAIN;
+
+	if(!pool){
+		return res;
+	}
+
+	spin_lock_irqsave(&pool->lock, &flags);
+
+	// Only taken off a list together with clearing the bit, under its pool's lock
+	if(work->pool == pool && work_pending(work) && !list_empty(&work->list)){
 		list_remove(&work->list);
+		INIT_LIST_HEAD(&work->list);
+		res = 1;
+	}
+
+	spin_unlock_irqrestore(&pool->lock, &flags);
+	return res;
+}
+
+static int __cancel_work(struct work_struct* work, struct delayed_work* dwork){
+	int res;
+
+	while((res = try_to_grab_pending(work, dwork)) == -EAGAIN){
+		__asm__ volatile("pause");
+	}
+
+	if(res){
+		atomic_set(&work->data, 0);
+		wq_dec_in_flight(work->wq);
+	}
+
+	return res;
+}
+
+/*
+* Wait until `work` is neither pending nor running. An item that keeps
+* queueing itself must be cancelled instead. Returns 1 if it waited.
+*/
+int flush_work(struct work_struct* work){
+	struct wq_flusher flusher = {
+		.task = current,
+	};
+	struct worker_pool* pool;
+	unsigned long flags;
+	int waited = 0;
+
+	while((pool = work->pool)){
+		spin_lock_irqsave(&pool->lock, &flags);
+
+		if(work->pool != pool){
+			// Queued elsewhere meanwhile
+			spin_unlock_irqrestore(&pool->lock, &flags);
+			continue;
+		}
+
+		if(!(work_pending(work) && !list_empty(&work->list)) && !find_worker_executing_work(pool, work)){
+			spin_unlock_irqrestore(&pool->lock, &flags);
+			break;
+		}
+
+		list_add_tail(&flusher.list, &pool->flushers);
+		task_sleep(current);
+		spin_unlock_irqrestore(&pool->lock, &flags);
+
+		schedule();
+
+		spin_lock_irqsave(&pool->lock, &flags);
+		list_remove(&flusher.list);
+		spin_unlock_irqrestore(&pool->lock, &flags);
+
+		waited = 1;
+	}
 
-		spin_unlock(&wq->lock);
+	return waited;
+}
 
-		work->func(work);
+/* Run a delayed item now rather than on its timer, and wait for it */
+int flush_delayed_work(struct delayed_work* dwork){
+	if(hrtimer_cancel(&dwork->timer)){
+		unsigned long flags;
+		local_irq_save(flags);
+		__queue_work(dwork->cpu, dwork->work.wq, &dwork->work);
+		local_irq_restore(flags);
 	}
+
+	return flush_work(&dwork->work);
+}
+
+/* Drop it if pending and wait for it to finish running. Returns 1 if it was pending */
+int cancel_work_sync(struct work_struct* work){
+	int res = __cancel_work(work, NULL);
+	flush_work(work);
+	return res;
+}
+
+/* Returns 1 if it was pending, it may still be running */
+int cancel_delayed_work(struct delayed_work* dwork){
+	return __cancel_work(&dwork->work, dwork);
 }
 
-int queue_work(struct work_queue *wq, struct work_struct *work){
+int cancel_delayed_work_sync(struct delayed_work* dwork){
+	int res = __cancel_work(&dwork->work, dwork);
+	flush_work(&dwork->work);
+	return res;
+}
+
+// pool->lock held
+static void worker_enter_idle(struct worker* worker){
+	struct worker_pool* pool = worker->pool;
+
+	worker->flags |= WORKER_IDLE;
+	pool->nr_running--;
+	pool->nr_idle++;
+
+	list_remove(&worker->node);
+	list_add_head(&worker->node, &pool->idle_list);
+}
+
+// pool->lock held
+static void worker_leave_idle(struct worker* worker){
+	struct worker_pool* pool = worker->pool;
+
+	worker->flags &= ~WORKER_IDLE;
+	pool->nr_running++;
+	pool->nr_idle--;
+
+	list_remove(&worker->node);
+	list_add_tail(&worker->node, &pool->busy_list);
+}
+
+/*
+* Run `work` off the pool's list, with pool->lock held around; it is
+* dropped while the function runs. The item may be freed by it.
+*/
+static void process_one_work(struct worker* worker, struct work_struct* work, unsigned long* flags){
+	struct worker_pool* pool = worker->pool;
+
+	list_remove(&work->list);
 	INIT_LIST_HEAD(&work->list);
 
-	spin_lock(&wq->lock);
-	if (wq->stopping) {
-		spin_unlock(&wq->lock);
-		return -ESHUTDOWN;
+	// Queued again while another worker of ours still runs it
+	struct worker* collision = find_worker_executing_work(pool, work);
+	if(collision){
+		list_add_tail(&work->list, &collision->scheduled);
+		return;
 	}
 
-	list_add(&wq->works, &work->list);
-	spin_unlock(&wq->lock);
+	struct work_queue* wq = work->wq;
 
-	return SUCCESS;
+	worker->current_work = work;
+	worker->current_func = work->func;
+	atomic_set(&work->data, 0);
+
+	// The unbound pool hands the rest to other workers
+	if(need_more_worker(pool)){
+		wake_up_worker(pool);
+	}
+
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	worker->current_func(work);
+	wq_dec_in_flight(wq);
+
+	spin_lock_irqsave(&pool->lock, flags);
+
+	worker->current_work = NULL;
+	worker->current_func = NULL;
+
+	if(!list_empty(&pool->flushers)){
+		wake_up_flushers(&pool->flushers);
+	}
 }
 
-struct work_queue *alloc_work_queue(const char *name){
-	struct work_queue* queue = kmalloc(sizeof(struct work_queue));
-	if(queue){
-		INIT_LIST_HEAD(&queue->works);
-		spinlock_init(&queue->lock);
-		wait_queue_head_init(&queue->wait);
+static int create_worker(struct worker_pool* pool);
+
+static int worker_thread(void* arg){
+	struct worker* worker = arg;
+	struct worker_pool* pool = worker->pool;
+	unsigned long flags;
+
+	if(pool->cpu >= 0){
+		sched_setaffinity(current, 1UL << pool->cpu);
+	}
+
+	spin_lock_irqsave(&pool->lock, &flags);
+
+	worker->task = current;
+	current->worker = worker;
+	list_add_head(&worker->node, &pool->idle_list);
+
+	while(1){
+		if(!need_more_worker(pool)){
+			if(pool->nr_idle > POOL_MAX_IDLE){
+				break;
+			}
+
+			task_sleep(current);
+			spin_unlock_irqrestore(&pool->lock, &flags);
+
+			schedule();
+
+			spin_lock_irqsave(&pool->lock, &flags);
+			continue;
+		}
+
+		worker_leave_idle(worker);
+
+		// Keep one idle to take over if we block
+		if(!pool->nr_idle && !pool->creating && pool->nr_workers < POOL_MAX_WORKERS){
+			pool->creating = 1;
+			spin_unlock_irqrestore(&pool->lock, &flags);
+
+			create_worker(pool);
 
-		pid_t res = kernel_thread(worker_thread, name, queue);
-		if(res < 0){
-			kfree(queue);
-			return NULL;
+			spin_lock_irqsave(&pool->lock, &flags);
+			pool->creating = 0;
 		}
 
-		queue->thread_pid = res;
+		while(keep_working(pool)){
+			process_one_work(worker, list_first_entry(&pool->worklist, struct work_struct, list), &flags);
+
+			while(!list_empty(&worker->scheduled)){
+				process_one_work(worker, list_first_entry(&worker->scheduled, struct work_struct, list), &flags);
+			}
+		}
+
+		worker_enter_idle(worker);
 	}
 
-	return queue;
+	list_remove(&worker->node);
+	pool->nr_idle--;
+	pool->nr_workers--;
+	current->worker = NULL;
+
+	spin_unlock_irqrestore(&pool->lock, &flags);
+
+	kfree(worker);
+	return SUCCESS;
 }
 
-void destroy_work_queue(struct work_queue *wq){
-	spin_lock(&wq->lock);
+/* Counted idle right away, the thread puts itself on the idle list */
+static int create_worker(struct worker_pool* pool){
+	struct worker* worker = kzalloc(sizeof(struct worker));
+	if(!worker){
+		return -ENOMEM;
+	}
+
+	char name[PROC_NAME_MAX];
+	unsigned long flags;
+
+	worker->pool = pool;
+	worker->flags = WORKER_IDLE;
+	INIT_LIST_HEAD(&worker->node);
+	INIT_LIST_HEAD(&worker->scheduled);
+
+	if(pool->cpu >= 0){
+		snprintf(name, sizeof(name), "kworker/%d", pool->cpu);
+	} else {
+		snprintf(name, sizeof(name), "kworker/u");
+	}
+
+	spin_lock_irqsave(&pool->lock, &flags);
+	pool->nr_workers++;
+	pool->nr_idle++;
+	spin_unlock_irqrestore(&pool->lock, &flags);
+
+	pid_t pid = kernel_thread(worker_thread, name, worker);
+	if(pid < 0){
+		spin_lock_irqsave(&pool->lock, &flags);
+		pool->nr_workers--;
+		pool->nr_idle--;
+		spin_unlock_irqrestore(&pool->lock, &flags);
+
+		kfree(worker);
+		return pid;
+	}
+
+	return SUCCESS;
+}
+
+/*
+* A busy worker is about to block, from schedule() with interrupts off:
+* if work is left behind it, an idle worker takes over.
+*/
+void wq_worker_sleeping(struct task* task){
+	struct worker* worker = task->worker;
+	struct worker_pool* pool = worker->pool;
+
+	if(worker->flags & (WORKER_IDLE | WORKER_SLEEPING)){
+		return;
+	}
+
+	spin_lock(&pool->lock);
+
+	worker->flags |= WORKER_SLEEPING;
+	pool->nr_running--;
+
+	if(need_more_worker(pool)){
+		wake_up_worker(pool);
+	}
+
+	spin_unlock(&pool->lock);
+}
+
+/* Back from blocking, interrupts still off */
+void wq_worker_running(struct task* task){
+	struct worker* worker = task->worker;
+	struct worker_pool* pool = worker->pool;
+
+	if(!(worker->flags & WORKER_SLEEPING)){
+		return;
+	}
+
+	spin_lock(&pool->lock);
+
+	worker->flags &= ~WORKER_SLEEPING;
+	pool->nr_running++;
+
+	spin_unlock(&pool->lock);
+}
+
+struct work_queue* alloc_work_queue(const char* name, unsigned int flags){
+	struct work_queue* wq = kzalloc(sizeof(struct work_queue));
+	if(!wq){
+		return NULL;
+	}
+
+	wq->name = name;
+	wq->flags = flags;
+	spinlock_init(&wq->lock);
+	INIT_LIST_HEAD(&wq->flushers);
+
+	return wq;
+}
+
+/* Wait for every item queued so far to be done */
+void flush_work_queue(struct work_queue* wq){
+	struct wq_flusher flusher = {
+		.task = current,
+	};
+	unsigned long flags;
+
+	spin_lock_irqsave(&wq->lock, &flags);
+
+	while(wq->nr_in_flight){
+		list_add_tail(&flusher.list, &wq->flushers);
+		task_sleep(current);
+		spin_unlock_irqrestore(&wq->lock, &flags);
+
+		schedule();
+
+		spin_lock_irqsave(&wq->lock, &flags);
+		list_remove(&flusher.list);
+	}
+
+	spin_unlock_irqrestore(&wq->lock, &flags);
+}
+
+/* New items are refused, the queued ones still run */
+void destroy_work_queue(struct work_queue* wq){
+	unsigned long flags;
+
+	spin_lock_irqsave(&wq->lock, &flags);
 	wq->stopping = 1;
-	spin_unlock(&wq->lock);
-}
\ No newline at end of file
+	spin_unlock_irqrestore(&wq->lock, &flags);
+
+	flush_work_queue(wq);
+	kfree(wq);
+}
+
+static void __init init_worker_pool(struct worker_pool* pool, int cpu){
+	spinlock_init(&pool->lock);
+	pool->cpu = cpu;
+	INIT_LIST_HEAD(&pool->worklist);
+	INIT_LIST_HEAD(&pool->idle_list);
+	INIT_LIST_HEAD(&pool->busy_list);
+	INIT_LIST_HEAD(&pool->flushers);
+}
+
+/* After smp_init(), the CPUs that came up get their pool */
+static int __init workqueue_init(void){
+	int cpu;
+	int res;
+
+	init_worker_pool(&unbound_pool, -1);
+	res = create_worker(&unbound_pool);
+	if(IS_ERR_VALUE(res)){
+		return res;
+	}
+
+	for_each_online_cpu(cpu){
+		struct worker_pool* pool = per_cpu_ptr(&cpu_worker_pools, cpu);
+
+		init_worker_pool(pool, cpu);
+		res = create_worker(pool);
+		if(IS_ERR_VALUE(res)){
+			printk("Workqueue: no worker for CPU %d, using the unbound pool (%d)\n", cpu, res);
+		}
+	}
+
+	system_wq = alloc_work_queue("events", 0);
+	system_unbound_wq = alloc_work_queue("events_unbound", WQ_UNBOUND);
+	if(!system_wq || !system_unbound_wq){
+		return -ENOMEM;
+	}
+
+	return SUCCESS;
+}
+
+subsys_initcall(workqueue_init);
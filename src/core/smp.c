@@ -0,0 +1,121 @@
+#include <kernel/smp.h>
+#include <kernel/sched.h>
+#include <sync/spinlock.h>
+#include <sync/barrier.h>
+#include <sync/atomic.h>
+#include <asm/cpu.h>
+#include <asm/irqflags.h>
+
+/**
+* Cross-CPU calls.
+*
+* smp_call_function() runs a function on every other online CPU and waits
+* for all of them, smp_call_function_many() on those of a mask only. One
+* call is in flight at a time; each target finds it
+* in its own slot when the IPI arrives. A CPU waiting for its turn keeps
+* answering the call in flight, so two CPUs calling each other with
+* interrupts off don't deadlock.
+*/
+
+struct call_data {
+	smp_call_func_t func;
+	void* info;
+	atomic_t pending;
+};
+
+volatile unsigned long cpu_online_mask = 1UL; // the boot CPU
+
+static spinlock_t call_lock;
+static struct call_data* volatile call_slot[MAX_CPUS];
+
+void set_cpu_online(int cpu){
+	smp_wmb();
+	cpu_online_mask |= 1UL << cpu;
+}
+
+int num_online_cpus(void){
+	int cpu, nr = 0;
+
+	for_each_online_cpu(cpu){
+		nr++;
+	}
+
+	return nr;
+}
+
+void smp_send_reschedule(int cpu){
+	arch_send_reschedule(cpu);
+}
+
+void smp_reschedule_interrupt(void){
+	scheduler_ipi();
+}
+
+void smp_call_function_interrupt(void){
+	const int cpu = smp_processor_id();
+	struct call_data* data = call_slot[cpu];
+
+	if(!data){
+		return;
+	}
+
+	call_slot[cpu] = NULL;
+	data->func(data->info);
+
+	smp_mb();
+	atomic_dec(&data->pending);
+}
+
+void smp_call_function(smp_call_func_t func, void* info){
+	smp_call_function_many(CPU_MASK_ALL, func, info);
+}
+
+void smp_call_function_many(unsigned long mask, smp_call_func_t func, void* info){
+	unsigned long flags;
+	int cpu, nr = 0;
+
+	local_irq_save(flags);
+
+	const int self = smp_processor_id();
+
+	mask &= cpu_online_mask & ~(1UL << self);
+	if(!mask){
+		local_irq_restore(flags);
+		return;
+	}
+
+	for_each_online_cpu(cpu){
+		if(mask & (1UL << cpu)){
+			nr++;
+		}
+	}
+
+	while(!spin_trylock(&call_lock)){
+		smp_call_function_interrupt();
+		cpu_relax();
+	}
+
+	struct call_data data = {
+		.func = func,
+		.info = info,
+	};
+
+	atomic_set(&data.pending, nr);
+	smp_wmb();
+
+	for_each_online_cpu(cpu){
+		if(!(mask & (1UL << cpu))){
+			continue;
+		}
+
+		call_slot[cpu] = &data;
+		arch_send_call_function_ipi(cpu);
+	}
+
+	while(atomic_read(&data.pending)){
+		cpu_relax();
+	}
+
+	spin_unlock(&call_lock);
+	local_irq_restore(flags);
+}
@@ -0,0 +1,288 @@
+#include <kernel/softirq.h>
+#include <kernel/sched.h>
+#include <kernel/fork.h>
+#include <kernel/clock.h>
+#include <kernel/init.h>
+#include <kernel/smp.h>
+#include <kernel/printk.h>
+#include <asm/irqflags.h>
+#include <asm/percpu.h>
+#include <lib/assert.h>
+#include <def/errno.h>
+
+/**
+* Softirqs and tasklets.
+*
+* Each CPU has a bitmap of raised softirqs. On the way out of an interrupt,
+* after the EOI, the pending ones run with interrupts on; an interrupt
+* coming in meanwhile only raises more. When they keep coming back, past
+* MAX_SOFTIRQ_RESTART rounds or MAX_SOFTIRQ_TIME, the rest is left to the
+* CPU's ksoftirqd thread so tasks still get to run. Softirqs raised from
+* task context go to ksoftirqd too.
+*
+* Tasklets are queued per CPU and run from TASKLET_SOFTIRQ.
+*/
+
+#define MAX_SOFTIRQ_RESTART 10
+#define MAX_SOFTIRQ_TIME    (NSEC_PER_SEC / 500)  // 2ms
+
+struct tasklet_head {
+	struct tasklet_struct* head;
+	struct tasklet_struct** tail;
+};
+
+DEFINE_PER_CPU(unsigned long, softirq_pending);
+static DEFINE_PER_CPU(struct task*, ksoftirqd);
+static DEFINE_PER_CPU(struct tasklet_head, tasklet_vec);
+
+static softirq_action_t softirq_vec[NR_SOFTIRQS];
+
+void open_softirq(int nr, softirq_action_t action){
+	softirq_vec[nr] = action;
+}
+
+static void wakeup_softirqd(void){
+	struct task* task = this_cpu_read(ksoftirqd);
+
+	if(task){
+		task_wakeup(task);
+	}
+}
+
+void raise_softirq_irqoff(int nr){
+	this_cpu_or(softirq_pending, 1UL << nr);
+
+	// Nothing on the way out of an interrupt to run it
+	if(!in_interrupt()){
+		wakeup_softirqd();
+	}
+}
+
+void raise_softirq(int nr){
+	unsigned long flags;
+
+	local_irq_save(flags);
+	raise_softirq_irqoff(nr);
+	local_irq_restore(flags);
+}
+
+/* Interrupts off, left off */
+static void __do_softirq(void){
+	time_ns_t end = clock_get_monotonic_ns() + MAX_SOFTIRQ_TIME;
+	int restart = MAX_SOFTIRQ_RESTART;
+	unsigned long pending;
+
+	preempt_count_add(SOFTIRQ_OFFSET);
+
+	while((pending = local_softirq_pending())){
+		this_cpu_write(softirq_pending, 0);
+		local_irq_enable();
+
+		for(int nr = 0; pending; nr++, pending >>= 1){
+			if((pending & 1) && softirq_vec[nr]){
+				softirq_vec[nr]();
+			}
+		}
+
+		local_irq_disable();
+
+		if(!--restart || (int64_t)(clock_get_monotonic_ns() - end) >= 0){
+			if(local_softirq_pending()){
+				wakeup_softirqd();
+			}
+			break;
+		}
+	}
+
+	preempt_count_sub(SOFTIRQ_OFFSET);
+}
+
+asmlinkage void do_softirq(void){
+	unsigned long flags;
+
+	if(in_interrupt()){
+		return;
+	}
+
+	local_irq_save(flags);
+
+	if(local_softirq_pending()){
+		__do_softirq();
+	}
+
+	local_irq_restore(flags);
+}
+
+/* From the interrupt return path once the EOI is sent, interrupts off */
+asmlinkage void irq_exit_softirq(void){
+	if(!in_interrupt() && local_softirq_pending()){
+		__do_softirq();
+	}
+}
+
+/* Pending softirqs run here, preemption still held off meanwhile */
+void local_bh_enable(void){
+	preempt_count_sub(SOFTIRQ_OFFSET - 1);
+
+	if(!in_interrupt() && local_softirq_pending()){
+		do_softirq();
+	}
+
+	preempt_enable();
+}
+
+static int ksoftirqd_thread(void* arg){
+	int cpu = (int)arg;
+
+	sched_setaffinity(current, 1UL << cpu);
+
+	while(1){
+		local_irq_disable();
+
+		if(!local_softirq_pending()){
+			task_sleep(current);
+			local_irq_enable();
+
+			schedule();
+			continue;
+		}
+
+		__do_softirq();
+		local_irq_enable();
+
+		cond_resched();
+	}
+
+	return SUCCESS;
+}
+
+static int tasklet_trylock_state(struct tasklet_struct* t, int bit){
+	int old;
+
+	do {
+		old = atomic_read(&t->state);
+		if(old & bit){
+			return 0;
+		}
+	} while(atomic_cmpxchg(&t->state, old, old | bit) != old);
+
+	return 1;
+}
+
+static void tasklet_clear_state(struct tasklet_struct* t, int bit){
+	int old;
+
+	do {
+		old = atomic_read(&t->state);
+	} while(atomic_cmpxchg(&t->state, old, old & ~bit) != old);
+}
+
+void tasklet_init(struct tasklet_struct* t, void (*func)(unsigned long), unsigned long data){
+	t->next = NULL;
+	atomic_set(&t->state, 0);
+	t->func = func;
+	t->data = data;
+}
+
+void tasklet_schedule(struct tasklet_struct* t){
+	unsigned long flags;
+
+	if(!tasklet_trylock_state(t, TASKLET_STATE_SCHED)){
+		return;
+	}
+
+	local_irq_save(flags);
+
+	struct tasklet_head* vec = this_cpu_ptr(&tasklet_vec);
+
+	t->next = NULL;
+	*vec->tail = t;
+	vec->tail = &t->next;
+
+	raise_softirq_irqoff(TASKLET_SOFTIRQ);
+
+	local_irq_restore(flags);
+}
+
+static void tasklet_action(void){
+	struct tasklet_head* vec = this_cpu_ptr(&tasklet_vec);
+	struct tasklet_struct* list;
+
+	local_irq_disable();
+	list = vec->head;
+	vec->head = NULL;
+	vec->tail = &vec->head;
+	local_irq_enable();
+
+	while(list){
+		struct tasklet_struct* t = list;
+		list = list->next;
+
+		if(tasklet_trylock_state(t, TASKLET_STATE_RUN)){
+			// Scheduling it again from here on runs it once more
+			tasklet_clear_state(t, TASKLET_STATE_SCHED);
+			t->func(t->data);
+			tasklet_clear_state(t, TASKLET_STATE_RUN);
+			continue;
+		}
+
+		// Running on another CPU, try again next round
+		local_irq_disable();
+		t->next = NULL;
+		*vec->tail = t;
+		vec->tail = &t->next;
+		raise_softirq_irqoff(TASKLET_SOFTIRQ);
+		local_irq_enable();
+	}
+}
+
+void tasklet_kill(struct tasklet_struct* t){
+	BUG_ON(in_interrupt());
+
+	// Holding SCHED keeps it from being queued again
+	while(!tasklet_trylock_state(t, TASKLET_STATE_SCHED)){
+		do {
+			cond_resched();
+		} while(atomic_read(&t->state) & TASKLET_STATE_SCHED);
+	}
+
+	while(atomic_read(&t->state) & TASKLET_STATE_RUN){
+		__asm__ volatile("pause");
+	}
+
+	tasklet_clear_state(t, TASKLET_STATE_SCHED);
+}
+
+static int __init softirq_init(void){
+	int cpu;
+
+	for(cpu = 0; cpu < MAX_CPUS; cpu++){
+		struct tasklet_head* vec = per_cpu_ptr(&tasklet_vec, cpu);
+
+		vec->head = NULL;
+		vec->tail = &vec->head;
+	}
+
+	open_softirq(TASKLET_SOFTIRQ, tasklet_action);
+	return SUCCESS;
+}
+
+/* After smp_init(), every CPU that came up gets one */
+static int __init ksoftirqd_init(void){
+	int cpu;
+
+	for_each_online_cpu(cpu){
+		pid_t pid = kernel_thread(ksoftirqd_thread, "ksoftirqd", (void*)cpu);
+		if(pid < 0){
+			printk("Softirq: no ksoftirqd for CPU %d (%d)\n", cpu, pid);
+			continue;
+		}
+
+		per_cpu(ksoftirqd, cpu) = find_task_by_pid(pid);
+	}
+
+	return SUCCESS;
+}
+
+core_initcall(softirq_init);
+subsys_initcall(ksoftirqd_init);
@@ -0,0 +1,155 @@
+#include <kernel/tick.h>
+#include <kernel/clock.h>
+#include <kernel/hrtimer.h>
+#include <kernel/sched.h>
+#include <sync/rcu.h>
+#include <lib/div64.h>
+#include <lib/string.h>
+
+/**
+* Periodic tick emulation and dynamic tick.
+*
+* Once the clock event runs in one-shot mode the tick is an hrtimer that
+* re-arms itself every period. It is only needed to preempt between
+* runnable tasks, to run clockevent listeners that are due and while RCU
+* waits on the CPU, so while the CPU idles, or a single task is runnable,
+* it is pushed out to the nearest listener deadline instead. The tick
+* count catches up from the monotonic clock whenever the timer runs or a
+* wakeup restarts it.
+*/
+
+// A running task still sees the tick count move once a second
+#define NOHZ_RUNNING_MAX_NS NSEC_PER_SEC
+
+// Furthest listener deadline the tick is pushed to
+#define NOHZ_MAX_TICKS (1 << 20)
+
+static struct hrtimer tick_timer;
+static int tick_active;
+static int tick_stopped;
+static time_ns_t last_tick_ns;      // monotonic time of the last accounted tick
+static time_ns_t idle_start_ns;
+
+static struct tick_stats tick_stats;
+
+int tick_nohz_stopped(void){
+	return tick_stopped;
+}
+
+// Bring the tick count up to `now`, returns the ticks added
+static tick_t tick_do_update(time_ns_t now){
+	const time_ns_t period = clock_tick_period_ns();
+
+	if((int64_t)(now - last_tick_ns) < (int64_t)period){
+		return 0;
+	}
+
+	uint64_t ticks = now - last_tick_ns;
+	do_div(ticks, (uint32_t)period);
+
+	last_tick_ns += ticks * period;
+	clock_advance_ticks(ticks);
+
+	return ticks;
+}
+
+/* When the tick has to run next, 0 when nothing needs it at all */
+static time_ns_t tick_next_expiry(void){
+	const time_ns_t period = clock_tick_period_ns();
+
+	if(sched_can_stop_tick() && !rcu_needs_cpu()){
+		tick_t now = clock_get_ticks();
+		tick_t next = clockevent_next_tick();
+
+		if(next > now + 1){
+			if(!tick_stopped){
+				tick_stats.nohz_entries++;
+			}
+
+			tick_stopped = 1;
+
+			if(next != TICK_NONE){
+				tick_t delta = next - now < NOHZ_MAX_TICKS ? next - now : NOHZ_MAX_TICKS;
+				return last_tick_ns + delta * period;
+			}
+
+			return sched_idle() ? 0 : last_tick_ns + NOHZ_RUNNING_MAX_NS;
+		}
+	}
+
+	tick_stopped = 0;
+	return last_tick_ns + period;
+}
+
+static enum hrtimer_restart tick_sched_timer(struct hrtimer* timer){
+	tick_t ticks = tick_do_update(clock_get_monotonic_ns());
+
+	if(ticks){
+		tick_stats.ticks_skipped += ticks - 1;
+		clockevent_run_listeners();
+	}
+
+	// A listener woke a task and restarted the tick already
+	if(hrtimer_queued(timer)){
+		return HRTIMER_NORESTART;
+	}
+
+	time_ns_t expires = tick_next_expiry();
+	if(!expires){
+		return HRTIMER_NORESTART;
+	}
+
+	timer->expires = expires;
+	return HRTIMER_RESTART;
+}
+
+/* Push the tick out, or cancel it, when nothing needs it. Idle entry */
+void tick_nohz_update(void){
+	if(!tick_active){
+		return;
+	}
+
+	time_ns_t expires = tick_next_expiry();
+
+	if(expires){
+		if(!hrtimer_queued(&tick_timer) || expires != tick_timer.expires){
+			hrtimer_start(&tick_timer, expires);
+		}
+	} else {
+		hrtimer_cancel(&tick_timer);
+	}
+}
+
+/* Back to the periodic tick, a second task became runnable */
+void tick_nohz_restart(void){
+	if(!tick_active || !tick_stopped){
+		return;
+	}
+
+	tick_stats.ticks_skipped += tick_do_update(clock_get_monotonic_ns());
+	tick_stopped = 0;
+
+	hrtimer_start(&tick_timer, last_tick_ns + clock_tick_period_ns());
+}
+
+void tick_setup_sched_timer(void){
+	hrtimer_init(&tick_timer, tick_sched_timer);
+
+	last_tick_ns = clock_get_monotonic_ns();
+	tick_active = 1;
+	tick_stopped = 0;
+
+	hrtimer_start(&tick_timer, last_tick_ns + clock_tick_period_ns());
+}
+
+void tick_idle_enter(void){
+	idle_start_ns = clock_get_monotonic_ns();
+}
+
+void tick_idle_exit(void){
+	tick_stats.idle_ns += clock_get_monotonic_ns() - idle_start_ns;
+}
+
+void tick_get_stats(struct tick_stats* stats){
+	memcpy(stats, &tick_stats, sizeof(struct tick_stats));
+}
@@ -159,12 +159,12 @@ static void ata_probe_all() {
 
 			ch->ioBase = ioBases[channel];
 			ch->ctrlBase = ctrlBases[channel];
-			spinlock_init(&ch->spinlock);
+			spinlock_init_class(&ch->spinlock, "ata channel");
 
 			struct ATADevice* atadev = &ch->devices[drive];
 			atadev->channel = ch;
 			atadev->drive = drive;
-			INIT_LIST_HEAD(&atadev->sleepQueue);
+			init_completion(&atadev->irqDone);
 
 			uint16_t buffer[WORDS_PER_SECTOR];
 			if (ata_identify(atadev, buffer) == SUCCESS) {
@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #define TRIES 100000
+#define ATA_IRQ_TIMEOUT_NS (5ULL * NSEC_PER_SEC)
 #define WORDS_PER_SECTOR 256
 
 // ATA Registers
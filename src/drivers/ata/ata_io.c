@@ -1,11 +1,11 @@
 #include <device/ata.h>
+#include <kernel/preempt.h>
 #include <def/errno.h>
 
 #include "ata_internal.h"
 
 int ata_flush(struct ATADevice* atadev) {
 	struct ATAChannel* ch = atadev->channel;
-	atadev->irqTriggered = 0;
 
 	outb_p(ATA_IO(ch, ATA_REG_HDDEVSEL), 0xE0 | (atadev->drive << 4));
 	outb_p(ATA_IO(ch, ATA_REG_COMMAND), atadev->info.supports_lba48 ? 
@@ -99,6 +99,8 @@ static int _pio_read(struct ATADevice* atadev, void* buffer, int totalSectors){
 
 		insw(ATA_IO(ch, ATA_REG_DATA), ptr, words);
 		ptr += words;
+
+		cond_resched();
 	}
 
 	return SUCCESS;
@@ -128,6 +130,8 @@ static int _pio_write(struct ATADevice* atadev, const void* buffer, int totalSec
 		for (int i = 0; i < words; i++) {
 			outw_p(ATA_IO(ch, ATA_REG_DATA), *ptr++);
 		}
+
+		cond_resched();
 	}
 
 	return ata_flush(atadev);
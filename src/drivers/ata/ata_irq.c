@@ -1,37 +1,35 @@
 #include <kernel/sched.h>
+#include <kernel/hrtimer.h>
+#include <kernel/clock.h>
 #include <kernel/interrupt.h>
 #include <device/ata.h>
 #include <def/errno.h>
 
 #include "ata_internal.h"
 
-static void ata_irq_handler(struct irq_info* info){
-	struct ATAChannel* channel = (struct ATAChannel*)info->device;
-
-	// Clear drive irq
-	(void)inb_p(ATA_IO(channel, ATA_REG_STATUS));
+// Wake the command's waiter, out of the interrupt
+static void ata_irq_tasklet(unsigned long data){
+	struct ATAChannel* channel = (struct ATAChannel*)data;
 
 	spin_lock(&channel->spinlock);
 
 	struct ATADevice* dev = channel->active;
 
-	if(!dev){
-		goto out;
+	if(dev){
+		channel->active = NULL;
+		complete(&dev->irqDone);
 	}
 
-	dev->irqTriggered = 1;
+	spin_unlock(&channel->spinlock);
+}
 
-	struct task* task;
-    list_for_each_entry(task, &dev->sleepQueue, queue) {
-        task->state = TASK_READY;
-        list_remove(&task->queue);
-        scheduler_add(task);
-    }
+static void ata_irq_handler(struct irq_info* info){
+	struct ATAChannel* channel = (struct ATAChannel*)info->device;
 
-	channel->active = NULL;
+	// Clear drive irq
+	(void)inb_p(ATA_IO(channel, ATA_REG_STATUS));
 
-out:
-	spin_unlock(&channel->spinlock);
+	tasklet_schedule(&channel->irqTasklet);
 }
 
 static int8_t ata_polling(struct ATADevice* atadev){
@@ -60,6 +58,8 @@ void ata_register_irq(char channel){
 	atachannel->irqRegistered = 1;
 	uint8_t irq = (channel == 0 ? IRQ_ATA_PRIMARY : IRQ_ATA_SECONDARY);
 
+	tasklet_init(&atachannel->irqTasklet, ata_irq_tasklet, (unsigned long)atachannel);
+
 	irq_register(irq, ata_irq_handler, atachannel);
 	irq_unmask(irq);
 	outb(ATA_IO(atachannel, ATA_REG_CONTROL), 0x00);
@@ -72,32 +72,26 @@ int ata_wait_irq(struct ATADevice* atadev){
 	if (!t || t->pid == 0)
 		return ata_polling(atadev);
 
-	spin_lock(&channel->spinlock);
+	spin_lock_bh(&channel->spinlock);
 
 	uint8_t status = ata_status(atadev);
 	if (status & ATA_SR_DRQ) {
-		spin_unlock(&channel->spinlock);
+		spin_unlock_bh(&channel->spinlock);
 		return SUCCESS;
 	}
 
+	// An IRQ that came after an earlier timeout must not count
+	reinit_completion(&atadev->irqDone);
 	channel->active = atadev;
 
-	scheduler_remove(t);
-	t->state = TASK_BLOCKED;
-	list_add(&t->queue, &atadev->sleepQueue);
-
-	spin_unlock(&channel->spinlock);
-
-	while (1) {
-		schedule();
+	spin_unlock_bh(&channel->spinlock);
 
-		spin_lock(&channel->spinlock);
-		if (atadev->irqTriggered) {
-			atadev->irqTriggered = 0;
-			spin_unlock(&channel->spinlock);
-			break;
-		}
-		spin_unlock(&channel->spinlock);
+	if (!wait_for_completion_timeout(&atadev->irqDone, ATA_IRQ_TIMEOUT_NS)) {
+		spin_lock_bh(&channel->spinlock);
+		if (channel->active == atadev)
+			channel->active = NULL;
+		spin_unlock_bh(&channel->spinlock);
+		return -ETIME;
 	}
 
 	return OK;
@@ -2,14 +2,23 @@
 #include <kernel/init.h>
 #include <mm/kheap.h>
 #include <lib/string.h>
+#include <lib/rculist.h>
+#include <sync/spinlock.h>
 #include <def/errno.h>
 
 #define MAX_DEVICE_NAME 64
 
+/*
+* Looked up under RCU, registering and unregistering serialize on
+* devices_lock. An unregistered device can be freed once
+* device_unregister() returned.
+*/
 static LIST_HEAD(devices);
+static spinlock_t devices_lock;
 
 static int next_id = 1;
 
+// devices_lock held
 static int duplicate_device(dev_t dev){
 	struct device* pos;
 	list_for_each_entry(pos, &devices, list){
@@ -33,15 +42,17 @@ int __must_check device_register(struct device *dev){
 		return -EINVAL;
 	}
 
+	spin_lock(&devices_lock);
+
 	if(duplicate_device(dev->devt)){
+		spin_unlock(&devices_lock);
 		return -EEXIST;
 	}
 
-	INIT_LIST_HEAD(&dev->list);
-
 	dev->id = next_id++;
-	list_add_tail(&dev->list, &devices);
+	list_add_tail_rcu(&dev->list, &devices);
 
+	spin_unlock(&devices_lock);
 	return SUCCESS;
 }
 
@@ -50,16 +61,19 @@ void device_unregister(struct device *dev){
 		return;
 	}
 
-	if(dev->id == 0){
-		return;
-	}
+	spin_lock(&devices_lock);
 
-	if(list_empty(&dev->list)){
+	if(dev->id == 0 || list_empty(&dev->list)){
+		spin_unlock(&devices_lock);
 		return;
 	}
 
 	dev->id = 0;
-	list_remove(&dev->list);
+	list_remove_rcu(&dev->list);
+
+	spin_unlock(&devices_lock);
+
+	synchronize_rcu();
 }
 
 struct device* device_create(dev_t devt, void *drvdata, const char *name){
@@ -112,40 +126,53 @@ struct device* device_get_by_name(const char* name){
 		return NULL;
 	}
 
-	struct device* pos;
-	list_for_each_entry(pos, &devices, list){
+	struct device* pos, *found = NULL;
+	rcu_read_lock();
+
+	list_for_each_entry_rcu(pos, &devices, list){
 		if(strcmp(pos->name, name) == 0){
-			return pos;
+			found = pos;
+			break;
 		}
 	}
 
-	return NULL;
+	rcu_read_unlock();
+	return found;
 }
 struct device* device_get_by_devt(dev_t devt){
-	struct device* pos;
-	list_for_each_entry(pos, &devices, list){
+	struct device* pos, *found = NULL;
+	rcu_read_lock();
+
+	list_for_each_entry_rcu(pos, &devices, list){
 		if(pos->devt == devt){
-			return pos;
+			found = pos;
+			break;
 		}
 	}
 
-	return NULL;
+	rcu_read_unlock();
+	return found;
 }
 
 struct device* device_get_by_id(int id){
-	struct device* pos;
-	list_for_each_entry(pos, &devices, list){
+	struct device* pos, *found = NULL;
+	rcu_read_lock();
+
+	list_for_each_entry_rcu(pos, &devices, list){
 		if(pos->id == id){
-			return pos;
+			found = pos;
+			break;
 		}
 	}
 
-	return NULL;
+	rcu_read_unlock();
+	return found;
 }
 
 static int __init device_init(){
 	next_id = 1;
 	INIT_LIST_HEAD(&devices);
+	spinlock_init(&devices_lock);
 	return SUCCESS;
 }
 
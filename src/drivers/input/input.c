@@ -7,20 +7,21 @@ static LIST_HEAD(handlers);
 static spinlock_t lock;
 
 int input_register_handler(struct input_handler *handler){
-	spin_lock(&lock);
+	spin_lock_bh(&lock);
 	INIT_LIST_HEAD(&handler->list);
 	list_add(&handler->list, &handlers);
-	spin_unlock(&lock);
+	spin_unlock_bh(&lock);
 	return SUCCESS;
 }
 
 void input_unregister_handler(struct input_handler *handler){
-	spin_lock(&lock);
+	spin_lock_bh(&lock);
 	list_remove(&handler->list);
 	INIT_LIST_HEAD(&handler->list);
-	spin_unlock(&lock);
+	spin_unlock_bh(&lock);
 }
 
+/* From the drivers' tasklets */
 void input_report(const struct input_event *event){
 	spin_lock(&lock);
 
@@ -1,6 +1,8 @@
 #include <kernel/interrupt.h>
 #include <kernel/init.h>
 #include <kernel/input.h>
+#include <kernel/softirq.h>
+#include <sync/barrier.h>
 #include <io/ports.h>
 
 /*
@@ -14,6 +16,13 @@
 #define _IQR_KEYBOARD_INTERRUPT 0x21
 #define _KEYBOARD_KEY_RELEASED 0x80
 
+// Scancodes the IRQ read that the tasklet didn't report yet
+#define _KEYBOARD_RING_SIZE 64
+
+static uint8_t _scancode_ring[_KEYBOARD_RING_SIZE];
+static volatile unsigned int _ring_head;  // written by the IRQ
+static volatile unsigned int _ring_tail;  // written by the tasklet
+
 static enum input_keycode _scancode_to_keycode(uint8_t scancode){
 	switch (scancode) {
 		case 0x01: return KEY_ESC;
@@ -119,9 +128,31 @@ static inline void _keyboard_handle_scancode(uint8_t sc){
 	}
 }
 
+static void _keyboard_tasklet_fn(unsigned long unused){
+	while (_ring_tail != _ring_head) {
+		smp_rmb();
+		uint8_t scancode = _scancode_ring[_ring_tail % _KEYBOARD_RING_SIZE];
+		smp_mb();
+		_ring_tail++;
+
+		_keyboard_handle_scancode(scancode);
+	}
+}
+
+static DECLARE_TASKLET(_keyboard_tasklet, _keyboard_tasklet_fn, 0);
+
 static void _iqr_keyboard_handler(struct irq_info* unused){
 	uint8_t scancode = inb(_PS2_INPUT_PORT);
-	_keyboard_handle_scancode(scancode);
+
+	// Full, the key is lost
+	if (_ring_head - _ring_tail == _KEYBOARD_RING_SIZE)
+		return;
+
+	_scancode_ring[_ring_head % _KEYBOARD_RING_SIZE] = scancode;
+	smp_wmb();
+	_ring_head++;
+
+	tasklet_schedule(&_keyboard_tasklet);
 }
 
 static int __init ps2_keyboard_init(){
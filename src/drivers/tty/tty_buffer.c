@@ -10,15 +10,16 @@ static spinlock_t lock;
 
 static struct tty_buffer *tty_alloc_buffer(void) {
 	struct tty_buffer *buffer;
+	unsigned long flags;
 
-	spin_lock(&lock);
+	spin_lock_irqsave(&lock, &flags);
 	if(buffers_cache) {
 		buffer = buffers_cache;
 		buffers_cache = buffer->next;
-		spin_unlock(&lock);
+		spin_unlock_irqrestore(&lock, &flags);
 		return buffer;
 	}
-	spin_unlock(&lock);
+	spin_unlock_irqrestore(&lock, &flags);
 
 	buffer = kzalloc(sizeof(struct tty_buffer));
 
@@ -26,12 +27,14 @@ static struct tty_buffer *tty_alloc_buffer(void) {
 }
 
 static void tty_free_buffer(struct tty_buffer *buffer) {
+	unsigned long flags;
+
 	memset(buffer, 0x0, sizeof(struct tty_buffer));
 
-	spin_lock(&lock);
+	spin_lock_irqsave(&lock, &flags);
 	buffer->next = buffers_cache;
 	buffers_cache = buffer;
-	spin_unlock(&lock);
+	spin_unlock_irqrestore(&lock, &flags);
 }
 
 static struct tty_buffer *tty_buffer_alloc_chunk(void) {
@@ -56,20 +59,16 @@ static void tty_buffer_free_chunk(struct tty_buffer *buffer) {
 	tty_free_buffer(buffer);
 }
 
-static void flush_to_ldisc(struct tty_struct* tty){
+// Only one runs at a time for a tty, the work item doesn't run concurrently
+static void flush_to_ldisc(struct work_struct* work){
+	struct tty_struct* tty = container_of(work, struct tty_struct, buffer.work);
+	unsigned long flags;
+
 	if(!tty->ldisc || !tty->ldisc->ops->receive_buf){
 		return;
 	}
 
-	spin_lock(&tty->buffer.lock);
-
-	struct tty_buffer *buf = tty->buffer.head;
-
-	size_t available = buf->write_pos - buf->read_pos;
-	if(!available){
-		spin_unlock(&tty->buffer.lock);
-		return;
-	}
+	spin_lock_irqsave(&tty->buffer.lock, &flags);
 
 	while (1) {
 		struct tty_buffer *buf = tty->buffer.head;
@@ -82,9 +81,9 @@ static void flush_to_ldisc(struct tty_struct* tty){
 				struct tty_buffer *next = buf->next;
 				tty->buffer.head = next;
 
-				spin_unlock(&tty->buffer.lock);
+				spin_unlock_irqrestore(&tty->buffer.lock, &flags);
 				tty_buffer_free_chunk(buf);
-				spin_lock(&tty->buffer.lock);
+				spin_lock_irqsave(&tty->buffer.lock, &flags);
 				continue;
 			} else {
 				buf->read_pos = 0;
@@ -93,22 +92,26 @@ static void flush_to_ldisc(struct tty_struct* tty){
 			}
 		}
 
-		// Dispatch 
+		// Dispatch, the IRQ side only appends past write_pos meanwhile
+		spin_unlock_irqrestore(&tty->buffer.lock, &flags);
 		tty->ldisc->ops->receive_buf(tty, &buf->data[buf->read_pos], available);
+		spin_lock_irqsave(&tty->buffer.lock, &flags);
+
 		buf->read_pos += available;
 	}
 	
-	spin_unlock(&tty->buffer.lock);
+	spin_unlock_irqrestore(&tty->buffer.lock, &flags);
 }
 
 int tty_bufhead_init(struct tty_bufhead* bufhead){
 	memset(bufhead, 0x0, sizeof(struct tty_bufhead));
 	spinlock_init(&bufhead->lock);
+	INIT_WORK(&bufhead->work, flush_to_ldisc);
 	return SUCCESS;
 }
 
-// IRQ -> tty_receive_buf -> [tty_worker]
-// [tty_worker] -> flush_to_ldisc -> tty_ldisc_receive_buf
+// IRQ -> [tasklet] -> tty_receive_buf -> [system_wq]
+// [system_wq] -> flush_to_ldisc -> tty_ldisc_receive_buf
 int tty_receive_buf(struct tty_struct* tty, const u8* buffer, size_t len){
 	if (!tty || !buffer || len == 0) {
 		return -EINVAL;
@@ -116,21 +119,22 @@ int tty_receive_buf(struct tty_struct* tty, const u8* buffer, size_t len){
 
 	int written = 0;
 	struct tty_buffer *new_chunk = NULL;
+	unsigned long flags;
 
-	spin_lock(&tty->buffer.lock);
+	spin_lock_irqsave(&tty->buffer.lock, &flags);
 
 	while (written < len) {
 		struct tty_buffer *buf = tty->buffer.tail;
 
 		if (!buf || buf->write_pos == buf->size) {
 			if (!new_chunk) {
-				spin_unlock(&tty->buffer.lock);
+				spin_unlock_irqrestore(&tty->buffer.lock, &flags);
 				new_chunk = tty_buffer_alloc_chunk();
 				if (!new_chunk) {
 					return written > 0 ? (int)written : -ENOMEM;
 				}
 
-				spin_lock(&tty->buffer.lock);
+				spin_lock_irqsave(&tty->buffer.lock, &flags);
 				continue; 
 			}
 
@@ -157,15 +161,13 @@ int tty_receive_buf(struct tty_struct* tty, const u8* buffer, size_t len){
 		written += to_write;
 	}
 
-	spin_unlock(&tty->buffer.lock);
+	spin_unlock_irqrestore(&tty->buffer.lock, &flags);
 
 	if (new_chunk) {
 		tty_buffer_free_chunk(new_chunk);
 	}
 
-	//TODO: Add tty_worker latter
-
-	flush_to_ldisc(tty);
+	schedule_work(&tty->buffer.work);
 
 	return written;
 }
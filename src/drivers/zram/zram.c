@@ -0,0 +1,386 @@
+#include <device/blkdev.h>
+#include <device/zram.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <kernel/syscall.h>
+#include <kernel/uaccess.h>
+#include <mm/zpool.h>
+#include <mm/swap.h>
+#include <mm/kheap.h>
+#include <mm/page.h>
+#include <lib/string.h>
+#include <lib/stdio.h>
+#include <lib/lz4.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+/**
+* Compressed RAM block device.
+*
+* Storage is tracked per 4 KiB block. A block that is one repeated word
+* (zero pages mostly) keeps only that word, a block that compresses below
+* ZPOOL_MAX_SIZE lives in the size class pool, anything else is kept raw
+* in a page of its own.
+*/
+
+#define SECTORS_PER_PAGE_SHIFT (PAGE_SHIFT - 9)
+#define SECTORS_PER_PAGE (1 << SECTORS_PER_PAGE_SHIFT)
+
+#define ZRAM_SAME (1 << 0)
+#define ZRAM_HUGE (1 << 1)
+
+struct zram_entry {
+	union {
+		void *handle;
+		unsigned long element;
+	};
+
+	uint16_t size;
+	uint16_t flags;
+};
+
+struct zram {
+	struct gendisk *disk;
+	struct zram_entry *table;
+	unsigned long nr_pages;
+
+	struct zpool *pool;
+	void *wrkmem;
+	uint8_t *cbuf;   // compression output
+	uint8_t *pbuf;   // partial block read-modify-write
+
+	spinlock_t lock;
+	struct zram_stats stats;
+};
+
+static struct zram *zram_devices[ZRAM_MAX_DEVICES];
+
+static int page_same_filled(const void *ptr, unsigned long *element){
+	const unsigned long *page = ptr;
+	const unsigned long val = page[0];
+
+	for (size_t i = 1; i < PAGE_SIZE / sizeof(unsigned long); i++) {
+		if (page[i] != val)
+			return 0;
+	}
+
+	*element = val;
+	return 1;
+}
+
+static void zram_free_entry(struct zram *zram, unsigned long index){
+	struct zram_entry *entry = &zram->table[index];
+
+	if (entry->flags & ZRAM_SAME) {
+		zram->stats.same_pages--;
+	}
+	else if (entry->flags & ZRAM_HUGE) {
+		page_free(virt_to_page((uintptr_t)entry->handle));
+		zram->stats.huge_pages--;
+	}
+	else if (entry->handle) {
+		zpool_free(zram->pool, entry->handle);
+	}
+	else {
+		return;
+	}
+
+	zram->stats.compr_data_size -= entry->size;
+	zram->stats.orig_data_size -= PAGE_SIZE;
+	zram->stats.pages_stored--;
+
+	memset(entry, 0x0, sizeof(struct zram_entry));
+}
+
+static int zram_read_page(struct zram *zram, unsigned long index, void *dst){
+	struct zram_entry *entry = &zram->table[index];
+
+	if (entry->flags & ZRAM_SAME || !entry->handle) {
+		unsigned long *page = dst;
+		for (size_t i = 0; i < PAGE_SIZE / sizeof(unsigned long); i++)
+			page[i] = entry->element;
+
+		return SUCCESS;
+	}
+
+	if (entry->flags & ZRAM_HUGE) {
+		memcpy(dst, entry->handle, PAGE_SIZE);
+		return SUCCESS;
+	}
+
+	int res = lz4_decompress(entry->handle, entry->size, dst, PAGE_SIZE);
+	if (res != PAGE_SIZE) {
+		printk("ZRAM: \"%s\" block %lu is corrupted %d\n", zram->disk->name, index, res);
+		return -EIO;
+	}
+
+	return SUCCESS;
+}
+
+static int zram_write_page(struct zram *zram, unsigned long index, const void *src){
+	struct zram_entry new_entry = {0};
+	unsigned long element;
+
+	if (page_same_filled(src, &element)) {
+		new_entry.element = element;
+		new_entry.flags = ZRAM_SAME;
+		goto store;
+	}
+
+	size_t clen = lz4_compress(src, PAGE_SIZE, zram->cbuf, ZPOOL_MAX_SIZE, zram->wrkmem);
+
+	if (clen) {
+		new_entry.handle = zpool_alloc(zram->pool, clen);
+		if (!new_entry.handle)
+			return -ENOMEM;
+
+		memcpy(new_entry.handle, zram->cbuf, clen);
+		new_entry.size = clen;
+		goto store;
+	}
+
+	struct page *page = page_alloc(0, PG_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	new_entry.handle = (void*)page_to_virt(page);
+	new_entry.size = PAGE_SIZE;
+	new_entry.flags = ZRAM_HUGE;
+	memcpy(new_entry.handle, src, PAGE_SIZE);
+
+store:
+	zram_free_entry(zram, index);
+	zram->table[index] = new_entry;
+
+	if (new_entry.flags & ZRAM_SAME)
+		zram->stats.same_pages++;
+	else if (new_entry.flags & ZRAM_HUGE)
+		zram->stats.huge_pages++;
+
+	zram->stats.compr_data_size += new_entry.size;
+	zram->stats.orig_data_size += PAGE_SIZE;
+	zram->stats.pages_stored++;
+
+	return SUCCESS;
+}
+
+static int zram_rw_block(struct zram *zram, unsigned long index, unsigned int offset, unsigned int len, uint8_t *buffer, int op){
+	int res;
+
+	if (op == BLK_READ) {
+		zram->stats.num_reads++;
+
+		if (offset == 0 && len == PAGE_SIZE)
+			return zram_read_page(zram, index, buffer);
+
+		res = zram_read_page(zram, index, zram->pbuf);
+		if (res == SUCCESS)
+			memcpy(buffer, zram->pbuf + offset, len);
+
+		return res;
+	}
+
+	zram->stats.num_writes++;
+
+	if (offset == 0 && len == PAGE_SIZE) {
+		res = zram_write_page(zram, index, buffer);
+	}
+	else {
+		res = zram_read_page(zram, index, zram->pbuf);
+		if (res == SUCCESS) {
+			memcpy(zram->pbuf + offset, buffer, len);
+			res = zram_write_page(zram, index, zram->pbuf);
+		}
+	}
+
+	if (IS_ERR_VALUE(res))
+		zram->stats.failed_writes++;
+
+	return res;
+}
+
+static int zram_submit_rq(struct blkdev *bdev, struct request *req){
+	struct zram *zram = bdev->disk->private;
+
+	if (req->op != BLK_READ && req->op != BLK_WRITE)
+		return -ENOTSUP;
+
+	sector_t sector = req->sector;
+	unsigned int nr_sectors = req->nr_sectors;
+	uint8_t *buffer = req->bio_list->buffer;
+
+	if (sector + nr_sectors > bdev->disk->capacity)
+		return -ERANGE;
+
+	int res = SUCCESS;
+
+	spin_lock(&zram->lock);
+
+	while (nr_sectors) {
+		unsigned long index = sector >> SECTORS_PER_PAGE_SHIFT;
+		unsigned int offset = (sector & (SECTORS_PER_PAGE - 1)) * ZRAM_SECTOR_SIZE;
+		unsigned int len = PAGE_SIZE - offset;
+
+		if (len > nr_sectors * ZRAM_SECTOR_SIZE)
+			len = nr_sectors * ZRAM_SECTOR_SIZE;
+
+		res = zram_rw_block(zram, index, offset, len, buffer, req->op);
+		if (IS_ERR_VALUE(res))
+			break;
+
+		buffer += len;
+		sector += len / ZRAM_SECTOR_SIZE;
+		nr_sectors -= len / ZRAM_SECTOR_SIZE;
+	}
+
+	spin_unlock(&zram->lock);
+	return res;
+}
+
+static int zram_open(struct blkdev *bdev, int mode){
+	return bdev ? SUCCESS : -EINVAL;
+}
+
+static int zram_copy_stats(struct zram *zram, struct zram_stats __user *ustats){
+	struct zram_stats stats;
+
+	spin_lock(&zram->lock);
+	zram->stats.mem_used =
+		(uint64_t)(zram->pool->pages + zram->stats.huge_pages) * PAGE_SIZE;
+	stats = zram->stats;
+	spin_unlock(&zram->lock);
+
+	// May fault, so only after the lock is dropped
+	if (copy_to_user(ustats, &stats, sizeof(struct zram_stats)))
+		return -EFAULT;
+
+	return SUCCESS;
+}
+
+static int zram_ioctl(struct blkdev *bdev, unsigned int cmd, unsigned long arg){
+	struct zram *zram = bdev->disk->private;
+
+	switch (cmd) {
+		case ZRAM_IOC_GET_STATS:
+			return zram_copy_stats(zram, (struct zram_stats __user*)arg);
+
+		default: return -ENOTSUP;
+	}
+}
+
+static const struct block_device_ops zram_ops = {
+	.open = zram_open,
+	.submit_request = zram_submit_rq,
+	.ioctl = zram_ioctl,
+};
+
+static void zram_free(struct zram *zram){
+	if (zram->pool) zpool_destroy(zram->pool);
+	if (zram->table) kfree(zram->table);
+	if (zram->wrkmem) kfree(zram->wrkmem);
+	if (zram->cbuf) kfree(zram->cbuf);
+	if (zram->pbuf) kfree(zram->pbuf);
+	if (zram->disk) kfree(zram->disk);
+	kfree(zram);
+}
+
+static struct zram* zram_create(int id, unsigned long size){
+	struct zram *zram = kzalloc(sizeof(struct zram));
+	if (!zram)
+		return NULL;
+
+	zram->nr_pages = size / PAGE_SIZE;
+	zram->table = kzalloc(zram->nr_pages * sizeof(struct zram_entry));
+	zram->pool = zpool_create();
+	zram->wrkmem = kmalloc(LZ4_MEM_COMPRESS);
+	zram->cbuf = kmalloc(ZPOOL_MAX_SIZE);
+	zram->pbuf = kmalloc(PAGE_SIZE);
+	zram->disk = gendisk_alloc();
+
+	if (!zram->table || !zram->pool || !zram->wrkmem ||
+		!zram->cbuf || !zram->pbuf || !zram->disk) {
+		zram_free(zram);
+		return NULL;
+	}
+
+	spinlock_init(&zram->lock);
+
+	struct gendisk *disk = zram->disk;
+	snprintf(disk->name, sizeof(disk->name), "zram%d", id);
+
+	disk->major = ZRAM_MAJOR;
+	disk->first_minor = id;
+	disk->minors_total = 1;
+	disk->sec_size = ZRAM_SECTOR_SIZE;
+	disk->capacity = (uint64_t)zram->nr_pages << SECTORS_PER_PAGE_SHIFT;
+	disk->ops = &zram_ops;
+	disk->private = zram;
+
+	return zram;
+}
+
+#ifdef CONFIG_ZRAM_SWAP
+/* The disk starts out zeroed, give it a swap header to be activated with */
+static int zram_mkswap(struct zram *zram){
+	union swap_header *hdr = kmalloc(sizeof(union swap_header));
+	if (!hdr)
+		return -ENOMEM;
+
+	swap_format_header(hdr, zram->nr_pages);
+
+	spin_lock(&zram->lock);
+	int res = zram_write_page(zram, 0, hdr);
+	spin_unlock(&zram->lock);
+
+	kfree(hdr);
+	return res;
+}
+#endif
+
+static __init int zram_init(){
+	int res = blkdev_register(ZRAM_MAJOR, "zram");
+	if (IS_ERR_VALUE(res)) {
+		printk("ZRAM: failed to register major %d\n", res);
+		return res;
+	}
+
+	struct zram *zram = zram_create(0, ZRAM_DISK_SIZE);
+	if (!zram) {
+		blkdev_unregister(ZRAM_MAJOR, "zram");
+		return -ENOMEM;
+	}
+
+	res = add_disk(zram->disk);
+	if (IS_ERR_VALUE(res)) {
+		zram_free(zram);
+		blkdev_unregister(ZRAM_MAJOR, "zram");
+		return res;
+	}
+
+	zram_devices[0] = zram;
+
+	printk("ZRAM: \"%s\" ready, %lu KiB\n", zram->disk->name, ZRAM_DISK_SIZE / 1024);
+
+#ifdef CONFIG_ZRAM_SWAP
+	res = zram_mkswap(zram);
+	if (res == SUCCESS)
+		res = swap_activate_bdev(zram->disk->bdev);
+
+	if (IS_ERR_VALUE(res))
+		printk("ZRAM: failed to activate swap on \"%s\" %d\n", zram->disk->name, res);
+#endif
+
+	return SUCCESS;
+}
+
+SYSCALL_DEFINE2(zram_stats, unsigned int, id, struct zram_stats __user*, stats){
+	if (id >= ZRAM_MAX_DEVICES || !zram_devices[id])
+		return -ENODEV;
+
+	if (!stats)
+		return -EFAULT;
+
+	return zram_copy_stats(zram_devices[id], stats);
+}
+
+device_initcall(zram_init);
@@ -2,17 +2,31 @@
 #include <kernel/sched.h>
 #include <lib/assert.h>
 #include <lib/string.h>
+#include <lib/rculist.h>
+#include <sync/spinlock.h>
 #include <def/errno.h>
 #include <mm/vma.h>
+#include <fs/fdtable.h>
 
+/*
+* Walked under RCU by every exec. Binary formats live in the kernel image
+* and are only ever unlinked, never freed.
+*/
 static LIST_HEAD(formats);
+static spinlock_t formats_lock;
 
 void binfmt_register(struct binfmt* fmt){
-	list_add(&fmt->formats, &formats);
+	spin_lock(&formats_lock);
+	list_add_rcu(&fmt->formats, &formats);
+	spin_unlock(&formats_lock);
 }
 
 void binfmt_unregister(struct binfmt* fmt){
-	list_remove(&fmt->formats);
+	spin_lock(&formats_lock);
+	list_remove_rcu(&fmt->formats);
+	spin_unlock(&formats_lock);
+
+	synchronize_rcu();
 }
 
 static inline void _push(void** stack, void* data, unsigned long size) {
@@ -113,6 +127,12 @@ static inline void bprm_free(struct binprm* bprm){
 static int exec_binprm(struct binprm* bprm){
 	struct task* cur = current;
 
+	// Nothing of the old image stays open, shared with threads or not
+	struct files_struct* files = files_alloc();
+	if(!files){
+		return -ENOMEM;
+	}
+
 	struct vm_region* region = vma_add(
 		bprm->mm, 
 		PROC_USER_STACK_VIRUTAL_TOP - PROC_USER_STACK_SIZE, 
@@ -124,28 +144,32 @@ static int exec_binprm(struct binprm* bprm){
 	);
 
 	if(IS_ERR_VALUE(region)){
+		files_put(files);
 		return PTR_ERR(region);
 	}
 
 	int res = mmu_context_switch(bprm->mm->ctx);
 	if(IS_ERR_VALUE(res)){
+		files_put(files);
 		return res;
 	}
 
+	// Other threads may still run in the old one
 	if(cur->mm){
-		vma_destroy(cur->mm);
+		vma_put(cur->mm);
 		cur->mm = NULL;
 	}
 	
 	cur->mm = bprm->mm;
 
-	for(int i = 0; i < PROC_FD_MAX; i++){
-		if(cur->file_table[i]){
-			vfs_close(cur->file_table[i]);
-			cur->file_table[i] = NULL;
-		}
+	if(cur->files){
+		files_put(cur->files);
 	}
 
+	cur->files = files;
+
+	flush_thread();
+
 	start_thread_user(
 		&cur->regs, 
 		bprm->entryPoint, 
@@ -162,14 +186,26 @@ static int exec_binprm(struct binprm* bprm){
 	unreachable();
 }
 
+/*
+* Loaders read the file and sleep, so they run outside the read section.
+* The walk carries on from their entry, which still leads back to the
+* list head even if it got unlinked meanwhile.
+*/
 static int load_binprm(struct binprm* bprm){
 	struct binfmt* fmt;
-	list_for_each_entry(fmt, &formats, formats){
+	rcu_read_lock();
+
+	list_for_each_entry_rcu(fmt, &formats, formats){
+		rcu_read_unlock();
+
 		if(fmt->load_binary(bprm) == SUCCESS){
 			return SUCCESS;
 		}
+
+		rcu_read_lock();
 	}
 
+	rcu_read_unlock();
 	return -EINVAL;
 }
 
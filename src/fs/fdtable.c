@@ -0,0 +1,52 @@
+#include <fs/fdtable.h>
+#include <fs/vfs.h>
+#include <mm/kheap.h>
+#include <lib/string.h>
+
+struct files_struct init_files = {
+	.count = { .value = 1 },
+};
+
+struct files_struct* files_alloc(void){
+	struct files_struct* files = kmalloc(sizeof(struct files_struct));
+	if(!files){
+		return NULL;
+	}
+
+	memset(files, 0, sizeof(struct files_struct));
+	atomic_set(&files->count, 1);
+
+	return files;
+}
+
+/* fork(): the same open files, each one referenced once more */
+struct files_struct* files_dup(struct files_struct* files){
+	struct files_struct* new = files_alloc();
+	if(!new){
+		return NULL;
+	}
+
+	for(int i = 0; i < PROC_FD_MAX; i++){
+		new->fd[i] = files->fd[i];
+		if(new->fd[i]){
+			file_get(new->fd[i]);
+		}
+	}
+
+	return new;
+}
+
+void files_put(struct files_struct* files){
+	if(!atomic_dec_and_test(&files->count)){
+		return;
+	}
+
+	for(int i = 0; i < PROC_FD_MAX; i++){
+		if(files->fd[i]){
+			vfs_close(files->fd[i]);
+			files->fd[i] = NULL;
+		}
+	}
+
+	kfree(files);
+}
@@ -0,0 +1,38 @@
+#include <fs/fs_struct.h>
+#include <mm/kheap.h>
+#include <lib/string.h>
+
+struct fs_struct init_fs = {
+	.count = { .value = 1 },
+	.pwd = NULL,
+};
+
+/* fork(): a working directory of its own, the same one to begin with */
+struct fs_struct* fs_copy(struct fs_struct* fs){
+	struct fs_struct* new = kmalloc(sizeof(struct fs_struct));
+	if(!new){
+		return NULL;
+	}
+
+	atomic_set(&new->count, 1);
+	new->pwd = NULL;
+
+	if(fs->pwd && !(new->pwd = strdup(fs->pwd))){
+		kfree(new);
+		return NULL;
+	}
+
+	return new;
+}
+
+void fs_put(struct fs_struct* fs){
+	if(!atomic_dec_and_test(&fs->count)){
+		return;
+	}
+
+	if(fs->pwd){
+		kfree(fs->pwd);
+	}
+
+	kfree(fs);
+}
@@ -2,6 +2,7 @@
 #include <def/config.h>
 #include <def/errno.h>
 #include <fs/vfs.h>
+#include <sync/rcu.h>
 
 extern struct mount *root_mount;
 
@@ -27,6 +28,11 @@ int path_iterate(const char** cursor, struct qstr* comp){
 	return 1;
 }
 
+/*
+* Look `name` up in `parent`, crossing into the mount on top of it. The
+* mount tree is read under RCU: the root of a mount found there is pinned
+* before leaving the read section, and a pinned root keeps it mounted.
+*/
 int vfs_lookup_path(struct inode *parent, struct qstr *name, struct path *res){
 	if (!parent->i_op || !parent->i_op->lookup)
 		return -ENOSYS;
@@ -38,21 +44,41 @@ int vfs_lookup_path(struct inode *parent, struct qstr *name, struct path *res){
 	res->dentry = child;
 	res->mount = NULL;
 
-	spin_lock(&child->lock);
-	if (child->mounted_here){
-		res->mount = child->mounted_here;
+	rcu_read_lock();
+
+	struct mount *mnt = rcu_dereference(child->mounted_here);
+	if (mnt) {
+		inode_get(mnt->mnt_root);
+		res->dentry = mnt->mnt_root;
+		res->mount = mnt;
 	}
-	spin_unlock(&child->lock);
+
+	rcu_read_unlock();
+
+	if (mnt)
+		inode_put(child);
 
 	return SUCCESS;
 }
 
-int vfs_walk_path(const char *path, struct path *res) {
-	if (!root_mount) return -EINVAL;
+// Pin the root of the mount tree
+static struct mount *get_root_mount(struct inode **root){
+	rcu_read_lock();
 
-	struct mount *curr_mnt = root_mount;
-	struct inode *curr_ino = root_mount->mnt_root;
-	inode_get(curr_ino);
+	struct mount *mnt = rcu_dereference(root_mount);
+	if (mnt) {
+		*root = mnt->mnt_root;
+		inode_get(*root);
+	}
+
+	rcu_read_unlock();
+	return mnt;
+}
+
+int vfs_walk_path(const char *path, struct path *res) {
+	struct inode *curr_ino;
+	struct mount *curr_mnt = get_root_mount(&curr_ino);
+	if (!curr_mnt) return -EINVAL;
 
 	const char *cursor = path;
 	struct qstr comp;
@@ -65,20 +91,11 @@ int vfs_walk_path(const char *path, struct path *res) {
 			return err;
 		}
 
-		struct inode *next_ino = next.dentry;
-
 		inode_put(curr_ino);
-		curr_ino = next_ino;
-
-		if (next.mount) {
-			struct mount *next_mnt = next.mount;
-			struct inode *mounted_root = next_mnt->mnt_root;
+		curr_ino = next.dentry;
 
-			inode_get(mounted_root);
-			inode_put(curr_ino);
-			curr_ino = mounted_root;
-			curr_mnt = next_mnt;
-		}
+		if (next.mount)
+			curr_mnt = next.mount;
 	}
 
 	res->mount = curr_mnt;
@@ -87,10 +104,8 @@ int vfs_walk_path(const char *path, struct path *res) {
 }
 
 struct inode* vfs_walk_parent(const char *path, struct qstr *last){
-	if(!root_mount) return ERR_PTR(-EINVAL);
-
-	struct inode *cur = root_mount->mnt_root;
-	inode_get(cur);
+	struct inode *cur;
+	if (!get_root_mount(&cur)) return ERR_PTR(-EINVAL);
 
 	struct qstr comp;
 	const char* cursor = path;
@@ -110,16 +125,8 @@ struct inode* vfs_walk_parent(const char *path, struct qstr *last){
 			return ERR_PTR(err);
 		}
 
-		struct inode *child = next_path.dentry;
 		inode_put(cur);
-		cur = child;
-
-		if (next_path.mount) {
-			struct inode *mounted_root = next_path.mount->mnt_root;
-			inode_get(mounted_root);
-			inode_put(cur);
-			cur = mounted_root;
-		}
+		cur = next_path.dentry;
 	}
 
 	inode_put(cur);
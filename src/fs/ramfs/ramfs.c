@@ -22,7 +22,7 @@ static struct inode* ramfs_alloc_inode(struct super_block *sb) {
 			return NULL;
 		}
 
-		spinlock_init(&rino->spinlock);
+		init_rwsem(&rino->dir_sem);
 		INIT_LIST_HEAD(&rino->children);
 		INIT_LIST_HEAD(&rino->sibling);
 
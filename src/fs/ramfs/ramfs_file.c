@@ -4,6 +4,7 @@
 #include <def/errno.h>
 #include <def/config.h>
 #include <lib/string.h>
+#include <kernel/preempt.h>
 #include <stddef.h>
 
 #include "ramfs_internal.h"
@@ -43,6 +44,8 @@ static int ramfs_read(struct file *file, void *buffer, uint32_t count){
 		total_readed += to_read;
 		page_offset = 0;
 		cur_page_index++;
+
+		cond_resched();
 	}
 
 	file->pos += total_readed;
@@ -92,6 +95,8 @@ static int ramfs_write(struct file *file, const void *buffer, uint32_t count){
 		total_written += to_write;
 		page_offset = 0;
 		cur_page_index++;
+
+		cond_resched();
 	}
 
 	file->pos += total_written;
@@ -2,7 +2,7 @@
 #include <fs/stat.h>
 #include <lib/string.h>
 #include <lib/list.h>
-#include <sync/spinlock.h>
+#include <sync/rwsem.h>
 #include <def/errno.h>
 #include <def/config.h>
 #include <mm/page.h>	
@@ -62,33 +62,36 @@ int ramfs_do_truncate(struct inode *inode, size_t new_size){
 	return 0;
 }
 
-struct inode* ramfs_lookup(struct inode *dir, struct qstr *name){
-	struct ramfs_inode *rdir = dir->private_data;
-
-	spin_lock(&rdir->spinlock);
-
+/* rdir->dir_sem held */
+static struct ramfs_inode* ramfs_find_child(struct ramfs_inode *rdir, struct qstr *name){
 	struct ramfs_inode* rino;
+
 	list_for_each_entry(rino, &rdir->children, sibling){
 		if(strlen(rino->name) == name->len && strncmp(rino->name, name->name, name->len) == 0){
-			inode_get(rino->ino);
-			spin_unlock(&rdir->spinlock);
-			return rino->ino;
+			return rino;
 		}
 	}
 
-	spin_unlock(&rdir->spinlock);
 	return NULL;
 }
 
-static int ramfs_create_common(struct inode *dir, struct qstr *name, umode_t mode, uint8_t isDir, dev_t dev){
+struct inode* ramfs_lookup(struct inode *dir, struct qstr *name){
 	struct ramfs_inode *rdir = dir->private_data;
 
-	struct inode *existing = ramfs_lookup(dir, name);
-	if(existing){
-		inode_put(existing);
-		return -EEXIST;
+	down_read(&rdir->dir_sem);
+
+	struct ramfs_inode* rino = ramfs_find_child(rdir, name);
+	if(rino){
+		inode_get(rino->ino);
 	}
 
+	up_read(&rdir->dir_sem);
+	return rino ? rino->ino : NULL;
+}
+
+static int ramfs_create_common(struct inode *dir, struct qstr *name, umode_t mode, uint8_t isDir, dev_t dev){
+	struct ramfs_inode *rdir = dir->private_data;
+
 	char tmp[name->len + 1];
 	memcpy(tmp, name->name, name->len);
 	tmp[name->len] = '\0';
@@ -98,8 +101,18 @@ static int ramfs_create_common(struct inode *dir, struct qstr *name, umode_t mod
 		return -ENOMEM;
 	}
 
+	// Held from the lookup to the insert, two creates can't both miss
+	down_write(&rdir->dir_sem);
+
+	if(ramfs_find_child(rdir, name)){
+		up_write(&rdir->dir_sem);
+		kfree(rino_name);
+		return -EEXIST;
+	}
+
 	struct inode *inode = inode_new(dir->i_sb);
 	if(!inode){
+		up_write(&rdir->dir_sem);
 		kfree(rino_name);
 		return -ENOMEM;
 	}
@@ -117,9 +130,8 @@ static int ramfs_create_common(struct inode *dir, struct qstr *name, umode_t mod
 	else
 		inode_init_special(inode, mode, dev);
 
-	spin_lock(&rdir->spinlock);
 	list_add(&rino->sibling, &rdir->children);
-	spin_unlock(&rdir->spinlock);
+	up_write(&rdir->dir_sem);
 
 	return SUCCESS;
 }
@@ -127,33 +139,31 @@ static int ramfs_create_common(struct inode *dir, struct qstr *name, umode_t mod
 static int ramfs_remove_common(struct inode *dir, struct qstr *name, uint8_t isFile){
 	struct ramfs_inode *rdir = dir->private_data;
 
-	spin_lock(&rdir->spinlock);
-
-	struct ramfs_inode *rino;
-	list_for_each_entry(rino, &rdir->children, sibling){
-		if(strlen(rino->name) == name->len && strncmp(rino->name, name->name, name->len) == 0){
-			if(S_ISDIR(rino->ino->mode) && isFile){
-				spin_unlock(&rdir->spinlock);
-				return -EINVAL;
-			}
+	down_write(&rdir->dir_sem);
 
-			if(S_ISDIR(rino->ino->mode)){
-				if(!list_empty(&rino->children)){
-					spin_unlock(&rdir->spinlock);
-					return -ENOTEMPTY;
-				}
-			}
+	struct ramfs_inode *rino = ramfs_find_child(rdir, name);
+	if(!rino){
+		up_write(&rdir->dir_sem);
+		return -ENOENT;
+	}
 
-			list_remove(&rino->sibling);
-			spin_unlock(&rdir->spinlock);
+	if(S_ISDIR(rino->ino->mode) && isFile){
+		up_write(&rdir->dir_sem);
+		return -EINVAL;
+	}
 
-			inode_put(rino->ino);
-			return SUCCESS;
+	if(S_ISDIR(rino->ino->mode)){
+		if(!list_empty(&rino->children)){
+			up_write(&rdir->dir_sem);
+			return -ENOTEMPTY;
 		}
 	}
 
-	spin_unlock(&rdir->spinlock);
-	return -ENOENT;
+	list_remove(&rino->sibling);
+	up_write(&rdir->dir_sem);
+
+	inode_put(rino->ino);
+	return SUCCESS;
 }
 
 static int ramfs_mknod(struct inode *dir, struct qstr *name, umode_t mode, dev_t dev){
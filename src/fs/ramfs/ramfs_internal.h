@@ -2,7 +2,7 @@
 #define _RAMFS_INTERNALS_H
 
 #include <lib/list.h>
-#include <sync/spinlock.h>
+#include <sync/rwsem.h>
 
 struct page;
 struct inode;
@@ -15,7 +15,7 @@ struct ramfs_inode {
 
 	struct ramfs_inode *parent;
 
-	spinlock_t spinlock;
+	struct rw_semaphore dir_sem;  // children: read to look up, write to change
 
 	struct list_head children;
 	struct list_head sibling;
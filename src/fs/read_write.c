@@ -1,4 +1,5 @@
 #include <fs/vfs.h>
+#include <fs/fdtable.h>
 #include <kernel/syscall.h>
 #include <kernel/sched.h>
 #include <kernel/uaccess.h>
@@ -10,7 +11,7 @@ static int get_proc_file(int fd, struct file **out){
 		return -EBADF;
 	}
 
-	*out = current->file_table[fd];
+	*out = current->files->fd[fd];
 	if(!*out){
 		return -EBADF;
 	}
@@ -3,7 +3,12 @@
 #include <fs/vfs.h>
 #include <kernel/init.h>
 #include <lib/string.h>
+#include <lib/rculist.h>
 
+/*
+* The file system list and the mount tree, root_mount and every inode's
+* mounted_here, are read under RCU. The locks only order the updaters.
+*/
 static LIST_HEAD(file_systems);
 static spinlock_t file_system_lock;
 
@@ -12,29 +17,30 @@ static spinlock_t mount_lock;
 
 void vfs_register_filesystem(struct file_system_type *fs) {
 	spin_lock(&file_system_lock);
-	INIT_LIST_HEAD(&fs->list);
-	list_add(&fs->list, &file_systems);
+	list_add_rcu(&fs->list, &file_systems);
 	spin_unlock(&file_system_lock);
 }
 
 void vfs_unregister_filesystem(struct file_system_type *fs) {
 	spin_lock(&file_system_lock);
-	list_remove(&fs->list);
+	list_remove_rcu(&fs->list);
 	spin_unlock(&file_system_lock);
+
+	synchronize_rcu();
 }
 
 static const struct file_system_type *find_fs_by_name(const char *name) {
 	struct file_system_type *tmp, *fs = NULL;
-	spin_lock(&file_system_lock);
+	rcu_read_lock();
 
-	list_for_each_entry(tmp, &file_systems, list) {
-	if (strcmp(tmp->name, name) == 0) {
+	list_for_each_entry_rcu(tmp, &file_systems, list) {
+		if (strcmp(tmp->name, name) == 0) {
 			fs = tmp;
 			break;
 		}
 	}
 
-	spin_unlock(&file_system_lock);
+	rcu_read_unlock();
 	return fs;
 }
 
@@ -74,25 +80,33 @@ static char *dup_mount_name(const char *mountpoint) {
 	return name;
 }
 
-static int do_umount(struct mount* mount){
-	struct super_block *sb;
-	struct inode *ino, *tmp;
-
-	int ret = SUCCESS;
+// Something mounted on it, or a reference to one of its inodes
+static int mount_busy(struct mount* mount){
+	struct inode *ino;
 
 	if (!list_empty(&mount->children)) {
-		ret = -EBUSY;
-		goto out_unlock;
+		return -EBUSY;
 	}
 
-	sb = mount->mnt_sb;
-	list_for_each_entry(ino, &sb->s_inodes, i_sb_list) {
+	list_for_each_entry(ino, &mount->mnt_sb->s_inodes, i_sb_list) {
 		if (atomic_read(&ino->refcount) > 1) {
-			ret = -EBUSY;
-			goto out_unlock;
+			return -EBUSY;
 		}
 	}
 
+	return SUCCESS;
+}
+
+static int do_umount(struct mount* mount){
+	struct super_block *sb;
+	struct inode *ino, *tmp;
+
+	int ret = mount_busy(mount);
+	if (ret != SUCCESS) {
+		return ret;
+	}
+
+	sb = mount->mnt_sb;
 	list_for_each_entry_safe(ino, tmp, &sb->s_inodes, i_sb_list) {
 		inode_destroy(ino);
 	}
@@ -105,10 +119,6 @@ static int do_umount(struct mount* mount){
 		list_remove(&mount->sibling);
 	}
 
-	if (mount == root_mount) {
-		root_mount = NULL;
-	}
-
 	if (mount->name) {
 		kfree(mount->name);
 	}
@@ -116,10 +126,23 @@ static int do_umount(struct mount* mount){
 	kfree(mount);
 	super_destroy(sb);
 
-out_unlock:
 	return ret;
 }
 
+// Where path walks find `mnt`, mount_lock held
+static void mount_publish(struct mount *mnt, struct mount *value){
+	struct inode *point = mnt->mnt_mountpoint;
+
+	if (!point) {
+		rcu_assign_pointer(root_mount, value);
+		return;
+	}
+
+	spin_lock(&point->lock);
+	rcu_assign_pointer(point->mounted_here, value);
+	spin_unlock(&point->lock);
+}
+
 int vfs_mount(const char *source, const char *mountpoint, const char *fs_name, unsigned int flags, void *data) {
 	const struct file_system_type *target_fs = find_fs_by_name(fs_name);
 	struct path target_point;
@@ -170,20 +193,14 @@ int vfs_mount(const char *source, const char *mountpoint, const char *fs_name, u
 	mount->mnt_mountpoint = target_point.dentry;
 
 	if (root_mount) {
-		spin_lock(&target_point.dentry->lock);
-		target_point.dentry->mounted_here = mount;
-	} else {
-		root_mount = mount;
-		spin_unlock(&mount_lock);
-		return SUCCESS;
+		struct mount *p = target_point.mount;
+		list_add(&mount->sibling, &p->children);
+		mount->parent = p;
 	}
 
-	struct mount *p = target_point.mount;
-	list_add(&mount->sibling, &p->children);
-	mount->parent = p;
+	mount_publish(mount, mount);
 
 	spin_unlock(&mount_lock);
-	spin_unlock(&target_point.dentry->lock);
 	return SUCCESS;
 
 out_mount:
@@ -199,6 +216,11 @@ out_point:
 	return ret;
 }
 
+/*
+* Unpublished first, so no walk can cross into it anymore. The ones that
+* did before either pinned its root by the grace period's end, and it is
+* busy, or never will.
+*/
 int vfs_umount(const char *mountpoint) {
 	struct path target_path;
 	int err = vfs_walk_path(mountpoint, &target_path);
@@ -209,23 +231,29 @@ int vfs_umount(const char *mountpoint) {
 	inode_put(target_path.dentry); 
 
 	spin_lock(&mount_lock);
-	
-	struct inode *point = mnt->mnt_mountpoint;
-	if (point) {
-		spin_lock(&point->lock);
-		point->mounted_here = NULL;
+
+	int ret = mount_busy(mnt);
+	if (ret != SUCCESS) {
+		spin_unlock(&mount_lock);
+		return ret;
 	}
 
-	int ret = do_umount(mnt);
+	mount_publish(mnt, NULL);
+	spin_unlock(&mount_lock);
 
-	if(unlikely(ret != SUCCESS) && point){
-		point->mounted_here = mnt;
-		spin_unlock(&point->lock);
-	} else if(point) {
+	synchronize_rcu();
+
+	spin_lock(&mount_lock);
+
+	struct inode *point = mnt->mnt_mountpoint;
+	ret = do_umount(mnt);
+
+	if (unlikely(ret != SUCCESS)) {
+		mount_publish(mnt, mnt);
+	} else if (point) {
 		inode_put(point);
-		spin_unlock(&point->lock);
 	}
-	
+
 	spin_unlock(&mount_lock);
 	return ret;
 }
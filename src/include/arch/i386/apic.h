@@ -0,0 +1,35 @@
+#ifndef _X86_APIC_H
+#define _X86_APIC_H
+
+#include <stdint.h>
+
+// Local APIC vectors, above everything the PICs deliver
+#define APIC_TIMER_VECTOR         0xF0
+#define APIC_RESCHEDULE_VECTOR    0xF1
+#define APIC_CALL_FUNCTION_VECTOR 0xF2
+#define APIC_SPURIOUS_VECTOR      0xFF
+
+#define APIC_VECTOR_BASE APIC_TIMER_VECTOR
+
+int lapic_init(uintptr_t phys);
+void lapic_setup(int bsp);
+int lapic_present(void);
+
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint8_t page);
+int lapic_ipi_wait(void);
+
+int lapic_timer_calibrate(void);
+void lapic_timer_start(uint32_t hz);
+
+/*
+* Enabled CPUs from the ACPI MADT, or the MP table on older machines.
+* Returns how many APIC ids were stored, -ENOENT without either table.
+*/
+int mp_find_config(uintptr_t* lapic_phys, uint8_t* apic_ids, int max);
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#define PIT_FREQUENCY 1193182
+
 void pic_init(uint32_t frequency);
 void pic_send_eoi(uint8_t irq);
 void pic_disable();
@@ -10,6 +12,13 @@ void pic_disable();
 void IRQ_set_mask(uint8_t IRQline);
 void IRQ_clear_mask(uint8_t IRQline);
 
+void pit_set_periodic(uint32_t frequency);
+void pit_set_oneshot(uint16_t count);
+uint32_t pit_oneshot_elapsed(void);
+
+void pit_ch2_start(uint16_t count);
+int pit_ch2_expired(void);
+
 uint16_t pic_get_irr(void);
 uint16_t pic_get_isr(void);
 
@@ -14,6 +14,7 @@ struct rtc_time {
 };
 
 int rtc_read(struct rtc_time* tm);
+void rtc_wait_second(void);
 time_ns_t rtc_time_to_unix_ns(const struct rtc_time* tm);
 
 #endif
@@ -14,6 +14,14 @@
 		__exception_table_end = .;   \
 	}
 
+#define PERCPU_SECTION(align) \
+	. = ALIGN((align));        \
+	.data..percpu : AT(ADDR(.data..percpu) - LOAD_OFFSET) { \
+		__per_cpu_start = .;   \
+		*(.data..percpu)       \
+		__per_cpu_end = .;     \
+	}
+
 #define INIT_RAM_FS        \
 	. = ALIGN(4);          \
 	__initramfs_start = .; \
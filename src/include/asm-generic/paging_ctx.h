@@ -3,11 +3,13 @@
 
 #include "paging_fmt.h"
 #include "paging_ops.h"
+#include <sync/atomic.h>
 
 struct paging_ctx {
 	void *root; // pgd
 	const struct paging_format* fmt;
 	const struct paging_ops *ops;
+	atomic_t cpu_mask; // CPUs that loaded it since their last flush IPI for it
 };
 
 #endif
\ No newline at end of file
@@ -4,6 +4,30 @@
 #include <asm/paging.h>
 #include <stdint.h>
 
+/*
+* Arch independent swap entry: the swap area index lives in the low
+* SWP_TYPE_BITS and the slot offset above it. The arch op `mk_swap`
+* packs it into a non-present PTE.
+*/
+typedef struct { unsigned long val; } swp_entry_t;
+
+struct paging_ctx;
+
+#define SWP_TYPE_BITS   3
+#define SWP_OFFSET_BITS 24
+
+static inline swp_entry_t swp_entry(unsigned int type, unsigned long offset){
+	return (swp_entry_t){ .val = (offset << SWP_TYPE_BITS) | type };
+}
+
+static inline unsigned int swp_type(swp_entry_t entry){
+	return entry.val & ((1UL << SWP_TYPE_BITS) - 1);
+}
+
+static inline unsigned long swp_offset(swp_entry_t entry){
+	return entry.val >> SWP_TYPE_BITS;
+}
+
 struct paging_ops {
 	pte_t   (*mk_pte)(uintptr_t phys, uint32_t flags);
 	uintptr_t (*pte_phys)(pte_t pte);
@@ -15,11 +39,19 @@ struct paging_ops {
 	void (*set_pte)(pte_t *dst, pte_t val);
 	void (*clear_pte)(pte_t *dst);
 
+	int (*pte_young)(pte_t pte);
+	pte_t (*pte_mkold)(pte_t pte);
+
+	pte_t (*mk_swap)(swp_entry_t entry);
+	int (*pte_swap)(pte_t pte);
+	swp_entry_t (*pte_to_swp)(pte_t pte);
+
 	void* (*pte_to_virt)(pte_t pte);
 	pte_t (*mk_table)(uintptr_t phys, uint8_t user);
 
-	void (*flush_tlb_one)(uintptr_t vaddr);
-	void (*flush_all)(void);
+	// On every CPU that may hold a translation of `ctx`
+	void (*flush_tlb_one)(struct paging_ctx *ctx, uintptr_t vaddr);
+	void (*flush_all)(struct paging_ctx *ctx);
 };
 
 #endif
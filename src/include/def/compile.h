@@ -93,6 +93,14 @@
     #endif
 #endif
 
+#if HAS_BUILTINS
+    #define barrier()  __asm__ volatile("" ::: "memory")
+    #define _RET_IP_   ((unsigned long)__builtin_return_address(0))
+#else
+    #define barrier()
+    #define _RET_IP_   0UL
+#endif
+
 #define __non_zero(e) (sizeof(char[1 - 2 * !!(e)]) - 1)
 #define stringfy(s) #s
 
@@ -84,7 +84,7 @@
 #define FILESYSTEMS_MAX 8
 
 /*Processes*/
-#define PROC_MAX 32
+#define PID_MAX 32768
 #define PROC_NAME_MAX 32
 #define PROC_ARG_MAX 32
 #define PROC_FD_MAX 16
@@ -95,6 +95,38 @@
 #define PROC_KERNEL_STACK_SIZE KiB(8)
 #define PROC_USER_STACK_VIRUTAL_BUTTOM (PROC_USER_STACK_VIRUTAL_TOP - PROC_USER_STACK_SIZE)
 
+/*Scheduler*/
+// Fair class period, minimum slice and wakeup preemption margin
+#define SCHED_LATENCY_NS 6000000ULL
+#define SCHED_MIN_GRANULARITY_NS 750000ULL
+#define SCHED_WAKEUP_GRANULARITY_NS 1000000ULL
+// Load balancing: tasks that ran this recently are cache hot and stay put
+#define SCHED_MIGRATION_COST_NS 500000ULL
+#define SCHED_BALANCE_INTERVAL_MS 100
+// SCHED_RR quantum at nice 0, nice scales it like the SCHED_BATCH timeslices
+#define SCHED_RR_TIMESLICE_MS 100
+
+/*Swap*/
+#define SWAP_AREAS_MAX 8
+#define SWAP_CLUSTER_MAX 16
+#define SWAP_READAHEAD 8
+
+/*KSM*/
+#ifdef CONFIG_KSM
+#define KSM_RUN 1
+#else
+#define KSM_RUN 0
+#endif
+#define KSM_PAGES_TO_SCAN 100
+#define KSM_SLEEP_MS 200
+
+/*ZRAM*/
+#ifdef CONFIG_ZRAM_SIZE
+#define ZRAM_DISK_SIZE MiB(CONFIG_ZRAM_SIZE)
+#else
+#define ZRAM_DISK_SIZE MiB(16)
+#endif
+
 /*Terminal/Console*/
 #define TERMINALS_MAX 6
 #define TTY_BUFFER_CHUNK_SIZE 1024
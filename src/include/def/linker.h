@@ -12,6 +12,8 @@ extern char __exception_table_start[];
 extern char __exception_table_end[];
 extern char __kernel_data_start[];
 extern char __kernel_data_end[];
+extern char __per_cpu_start[];
+extern char __per_cpu_end[];
 extern char __init_begin[];
 extern char __init_text_start[];
 extern char __init_text_end[];
@@ -35,6 +37,8 @@ extern __exception_table_start
 extern __exception_table_end
 extern __kernel_data_start
 extern __kernel_data_end
+extern __per_cpu_start
+extern __per_cpu_end
 extern __init_begin
 extern __init_text_start
 extern __init_text_end
@@ -3,6 +3,8 @@
 
 #include <kernel/device.h>
 #include <sync/spinlock.h>
+#include <kernel/completion.h>
+#include <kernel/softirq.h>
 #include <lib/string.h>
 #include <stdint.h>
 
@@ -24,10 +26,9 @@ struct ATADevice {
 
 	dev_t devt;
 	struct ATADeviceInfo info;
-	volatile char irqTriggered;
 
 	struct ATAChannel* channel;
-	struct list_head sleepQueue;
+	struct completion irqDone;   // the IRQ of the command in flight came
 };
 
 struct ATAChannel{
@@ -35,7 +36,8 @@ struct ATAChannel{
 	uint16_t ctrlBase;  // 0x3F6 or 0x376
 	struct ATADevice* active;
 	struct ATADevice devices[2];
-	spinlock_t spinlock;
+	spinlock_t spinlock;  // shared with irqTasklet, spin_lock_bh() outside it
+	struct tasklet_struct irqTasklet;
 	char irqRegistered;
 };
 
@@ -2,6 +2,7 @@
 #define _TTY_H
 
 #include <kernel/wait.h>
+#include <kernel/worker.h>
 #include <sync/spinlock.h>
 #include <lib/list.h>
 #include <stddef.h>
@@ -48,6 +49,7 @@ struct tty_bufhead {
 	struct tty_buffer *tail; // Active buffer
 
 	spinlock_t lock;
+	struct work_struct work; // flush_to_ldisc()
 };
 
 struct tty_driver {
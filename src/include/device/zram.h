@@ -0,0 +1,25 @@
+#ifndef _ZRAM_H
+#define _ZRAM_H
+
+#include <stdint.h>
+
+#define ZRAM_MAJOR 10
+#define ZRAM_SECTOR_SIZE 512
+#define ZRAM_MAX_DEVICES 1
+
+// ioctl: copy struct zram_stats to the user buffer at arg, also zram_stats(id, buf)
+#define ZRAM_IOC_GET_STATS 0x5A01
+
+struct zram_stats {
+	uint64_t orig_data_size;   // bytes stored, before compression
+	uint64_t compr_data_size;  // bytes stored, after compression
+	uint64_t mem_used;         // bytes of pool and raw pages backing them
+	uint32_t pages_stored;
+	uint32_t same_pages;       // single value pages, no storage
+	uint32_t huge_pages;       // incompressible, stored raw
+	uint32_t num_reads;
+	uint32_t num_writes;
+	uint32_t failed_writes;
+};
+
+#endif
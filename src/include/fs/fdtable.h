@@ -0,0 +1,30 @@
+#ifndef _FDTABLE_H
+#define _FDTABLE_H
+
+#include <sync/atomic.h>
+#include <def/config.h>
+
+struct file;
+
+/*
+* Open files of a task, shared by the threads cloned with CLONE_FILES.
+* Slots are only filled before the task runs user code and dropped with
+* the last reference, so lookups go without a lock.
+*/
+struct files_struct {
+	atomic_t count;
+	struct file* fd[PROC_FD_MAX];
+};
+
+/* Kernel threads share this one */
+extern struct files_struct init_files;
+
+struct files_struct* files_alloc(void);
+struct files_struct* files_dup(struct files_struct* files);
+void files_put(struct files_struct* files);
+
+static inline void files_get(struct files_struct* files){
+	atomic_inc(&files->count);
+}
+
+#endif
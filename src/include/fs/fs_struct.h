@@ -0,0 +1,22 @@
+#ifndef _FS_STRUCT_H
+#define _FS_STRUCT_H
+
+#include <sync/atomic.h>
+
+/* Working directory of a task, shared by the threads cloned with CLONE_FS */
+struct fs_struct {
+	atomic_t count;
+	char* pwd;
+};
+
+/* Kernel threads share this one */
+extern struct fs_struct init_fs;
+
+struct fs_struct* fs_copy(struct fs_struct* fs);
+void fs_put(struct fs_struct* fs);
+
+static inline void fs_get(struct fs_struct* fs){
+	atomic_inc(&fs->count);
+}
+
+#endif
@@ -7,16 +7,46 @@
 
 #define NSEC_PER_SEC 1000000000ULL
 
+// No deadline, for clockevent listeners that don't need the next tick
+#define TICK_NONE ((tick_t)~0ULL)
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+// clock_nanosleep flags
+#define TIMER_ABSTIME 1
+
+struct timespec {
+	time_t tv_sec;
+	long tv_nsec;
+};
+
+static inline int timespec_valid(const struct timespec* ts){
+	return ts->tv_sec >= 0 && ts->tv_nsec >= 0 && ts->tv_nsec < (long)NSEC_PER_SEC;
+}
+
+static inline time_ns_t timespec_to_ns(const struct timespec* ts){
+	return (time_ns_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
 struct clocksource {
 	const char* name;
 	time_ns_t (*read_ns)(void* data);
 	void* data;
 };
 
+/*
+* One-shot support is optional: set_next_event arms a single interrupt
+* delta_ns from now (at most max_delta_ns), elapsed_ns tells how long ago
+* it was armed, past the expiry too.
+*/
 struct clockevent {
 	const char* name;
 	int (*start_periodic)(void* data, uint32_t hz);
+	int (*set_next_event)(void* data, uint64_t delta_ns);
+	uint64_t (*elapsed_ns)(void* data);
 	void (*stop)(void* data);
+	uint64_t max_delta_ns;
 	void* data;
 };
 
@@ -34,7 +64,27 @@ int clockevent_register(const struct clockevent* event);
 int clockevent_start_periodic(uint32_t hz);
 void clockevent_stop(void);
 
+uint64_t clockevent_elapsed_ns(void);
+uint64_t clockevent_max_delta_ns(void);
+
+int clock_switch_to_oneshot(void);
+int clock_is_oneshot(void);
+void clockevent_program(time_ns_t expires);
+
+/*
+* Listeners run from TIMER_SOFTIRQ after the tick, the irq ones from the
+* timer interrupt itself. `next_tick` returns the tick the listener needs
+* to run at next, or TICK_NONE, so the tick can be stopped until then;
+* listeners without it need every tick.
+*/
 int clockevent_register_listener(void (*handler)(void* data), void* data);
+int clockevent_register_nohz_listener(void (*handler)(void* data), tick_t (*next_tick)(void* data), void* data);
+int clockevent_register_irq_listener(void (*handler)(void* data), tick_t (*next_tick)(void* data), void* data);
+tick_t clockevent_next_tick(void);
+void clockevent_run_listeners(void);
 void clockevent_fire(void);
 
+time_ns_t clock_tick_period_ns(void);
+void clock_advance_ticks(tick_t ticks);
+
 #endif
@@ -0,0 +1,40 @@
+#ifndef _KERNEL_COMPLETION_H
+#define _KERNEL_COMPLETION_H
+
+#include <kernel/wait.h>
+
+/*
+* One-shot event to wait for, like the end of an I/O. Each complete() lets
+* one waiter through, or the next one to come; complete_all() every one
+* until reinit_completion().
+*/
+struct completion {
+	unsigned int done;
+	struct wait_queue_head wait;
+};
+
+#define COMPLETION_INITIALIZER(name) { \
+	.done = 0, \
+	.wait = { .entries = LIST_HEAD_INIT((name).wait.entries) }, \
+}
+
+#define DECLARE_COMPLETION(name) struct completion name = COMPLETION_INITIALIZER(name)
+
+static inline void init_completion(struct completion* x){
+	x->done = 0;
+	wait_queue_head_init(&x->wait);
+}
+
+static inline void reinit_completion(struct completion* x){
+	x->done = 0;
+}
+
+void complete(struct completion* x);
+void complete_all(struct completion* x);
+
+void wait_for_completion(struct completion* x);
+time_ns_t wait_for_completion_timeout(struct completion* x, time_ns_t timeout);
+int try_wait_for_completion(struct completion* x);
+int completion_done(struct completion* x);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _KERNEL_FUTEX_H
+#define _KERNEL_FUTEX_H
+
+#include <kernel/uaccess.h>
+#include <sys/types.h>
+#include <stdint.h>
+
+// futex() ops
+#define FUTEX_WAIT 0  // sleep while *uaddr == val, up to an optional relative timeout
+#define FUTEX_WAKE 1  // wake up to val sleepers on uaddr
+
+/* Sleep until woken on `uaddr` or `expires` on the monotonic clock, 0 for never */
+int futex_wait(uint32_t __user* uaddr, uint32_t val, time_ns_t expires);
+int futex_wake(uint32_t __user* uaddr, int nr);
+
+#endif
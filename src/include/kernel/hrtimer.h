@@ -0,0 +1,46 @@
+#ifndef _KERNEL_HRTIMER_H
+#define _KERNEL_HRTIMER_H
+
+#include <lib/rbtree.h>
+#include <sys/types.h>
+
+struct task;
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,   // re-queued at timer->expires, set by the callback
+};
+
+/*
+* Timer on the monotonic clock. Callbacks run from the timer interrupt
+* with the queue unlocked and may re-arm their own timer.
+*/
+struct hrtimer {
+	struct rb_node node;
+	time_ns_t expires;
+	enum hrtimer_restart (*function)(struct hrtimer* timer);
+};
+
+/* Wakes `task` when the timer expires, task is NULL afterwards */
+struct hrtimer_sleeper {
+	struct hrtimer timer;
+	struct task* volatile task;
+};
+
+static inline int hrtimer_queued(const struct hrtimer* timer){
+	return !RB_EMPTY_NODE(&timer->node);
+}
+
+void hrtimer_init(struct hrtimer* timer, enum hrtimer_restart (*function)(struct hrtimer*));
+void hrtimer_start(struct hrtimer* timer, time_ns_t expires);
+int hrtimer_cancel(struct hrtimer* timer);
+
+void hrtimer_init_sleeper(struct hrtimer_sleeper* sleeper, struct task* task);
+
+void hrtimer_interrupt(void);
+void hrtimer_run_queues(void);
+
+time_ns_t schedule_timeout(time_ns_t timeout);
+int hrtimer_nanosleep(time_ns_t expires);
+
+#endif
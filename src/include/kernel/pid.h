@@ -5,7 +5,21 @@
 
 #define WNOHANG 0x1
 
+struct task;
+
+int pid_init(void);
+
 pid_t pid_alloc();
 void pid_free(pid_t pid);
 
+/* Make the task findable by its PID, and drop it and its PID again */
+void attach_pid(struct task* task);
+void detach_pid(struct task* task);
+
+/*
+* NULL if no task has it. The task can be destroyed meanwhile, unless the
+* caller is what destroys it, like its parent.
+*/
+struct task* find_task_by_pid(pid_t pid);
+
 #endif
@@ -0,0 +1,94 @@
+#ifndef _KERNEL_PREEMPT_H
+#define _KERNEL_PREEMPT_H
+
+#include <asm/percpu.h>
+#include <asm/smp.h>
+#include <asm/irqflags.h>
+#include <def/compile.h>
+
+/*
+* Kernel code is preemptible while its CPU's preempt_count is zero: on the
+* way out of an interrupt that came in with interrupts on, and when
+* preempt_enable() drops the count. Spinlocks hold it up by one, softirqs
+* and local_bh_disable() by SOFTIRQ_OFFSET, interrupt handlers by
+* HARDIRQ_OFFSET.
+*/
+
+#define SOFTIRQ_OFFSET (1 << 8)
+#define HARDIRQ_OFFSET (1 << 16)
+
+#define SOFTIRQ_MASK (0xff << 8)
+#define HARDIRQ_MASK (~0U << 16)
+
+DECLARE_PER_CPU(int, __preempt_count);
+
+#define preempt_count() this_cpu_read(__preempt_count)
+#define in_irq()        (preempt_count() & HARDIRQ_MASK)
+#define in_softirq()    (preempt_count() & SOFTIRQ_MASK)
+#define in_interrupt()  (preempt_count() & (HARDIRQ_MASK | SOFTIRQ_MASK))
+
+#ifdef CONFIG_PREEMPT_TRACE
+void trace_preempt_off(int cpu, unsigned long ip);
+void trace_preempt_on(int cpu, unsigned long ip);
+#else
+static inline void trace_preempt_off(int cpu, unsigned long ip){}
+static inline void trace_preempt_on(int cpu, unsigned long ip){}
+#endif
+
+void preempt_schedule(void);
+void cond_resched(void);
+
+/*
+* The count is a per-CPU variable, each change a single instruction a
+* task can't be moved in the middle of. Once it is up the task can't move
+* at all, the trace reads the CPU number then.
+*/
+static __always_inline void __preempt_count_add(int val, unsigned long ip){
+#ifdef CONFIG_PREEMPT_TRACE
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	if(!preempt_count()){
+		trace_preempt_off(smp_processor_id(), ip);
+	}
+
+	this_cpu_add(__preempt_count, val);
+
+	local_irq_restore(flags);
+#else
+	this_cpu_add(__preempt_count, val);
+#endif
+}
+
+static __always_inline int __preempt_count_sub_and_test(int val, unsigned long ip){
+	if(preempt_count() == val){
+		trace_preempt_on(smp_processor_id(), ip);
+	}
+
+	return this_cpu_sub_and_test(__preempt_count, val);
+}
+
+#define preempt_count_add(val) __preempt_count_add((val), _RET_IP_)
+#define preempt_count_sub(val) ((void)__preempt_count_sub_and_test((val), _RET_IP_))
+
+static __always_inline void preempt_disable(void){
+	__preempt_count_add(1, _RET_IP_);
+	barrier();
+}
+
+static __always_inline void preempt_enable_no_resched(void){
+	barrier();
+	__preempt_count_sub_and_test(1, _RET_IP_);
+}
+
+/* Reschedule right away if it was asked for while preemption was off */
+static __always_inline void preempt_enable(void){
+	barrier();
+
+	if(__preempt_count_sub_and_test(1, _RET_IP_)){
+		preempt_schedule();
+	}
+}
+
+#endif
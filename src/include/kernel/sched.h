@@ -3,13 +3,81 @@
 
 #include <asm/ptrace.h>
 #include <asm/process.h>
+#include <asm/fpu.h>
 #include <kernel/pid.h>
 #include <def/config.h>
 #include <kernel/init.h>
 #include <lib/list.h>
+#include <lib/rbtree.h>
+#include <sync/atomic.h>
+#include <sys/types.h>
 
 struct mm_struct;
+struct files_struct;
+struct fs_struct;
 struct wait_queue_entry;
+struct prio_array;
+struct sched_class;
+struct mutex_waiter;
+struct worker;
+
+/*
+* Static priorities, lower runs first. Nice values -20..19 map onto
+* 0..MAX_PRIO-1 with nice 0 at DEFAULT_PRIO.
+*/
+#define MAX_PRIO 40
+#define DEFAULT_PRIO 20
+
+#define NICE_TO_PRIO(nice) ((nice) + DEFAULT_PRIO)
+#define PRIO_TO_NICE(prio) ((prio) - DEFAULT_PRIO)
+
+#define MIN_NICE (-20)
+#define MAX_NICE 19
+
+// setpriority/getpriority `which`
+#define PRIO_PROCESS 0
+
+/*
+* Policies. SCHED_FIFO and SCHED_RR tasks run before everything else by
+* their real-time priority, 1..MAX_RT_PRIO-1, higher first; SCHED_RR ones
+* take turns with their equals every quantum. SCHED_NORMAL tasks share the
+* CPU by weighted virtual runtime, SCHED_BATCH tasks run from the priority
+* arrays whenever no SCHED_NORMAL task is runnable.
+*/
+#define SCHED_NORMAL 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+#define SCHED_BATCH 3
+
+#define MAX_RT_PRIO 100
+
+#define rt_policy(policy) ((policy) == SCHED_FIFO || (policy) == SCHED_RR)
+
+/*
+* clone() flags. Threads are tasks sharing the address space and joined
+* into their creator's thread group: getpid() gives the group's PID, and
+* the parent hears of the process once the last of them exits.
+*/
+#define CLONE_VM             0x00000100  // share the address space
+#define CLONE_FS             0x00000200  // share the working directory
+#define CLONE_FILES          0x00000400  // share the file table
+#define CLONE_THREAD         0x00010000  // same thread group, needs CLONE_VM
+#define CLONE_PARENT_SETTID  0x00100000  // store the child's TID at parent_tid
+#define CLONE_CHILD_CLEARTID 0x00200000  // zero child_tid and futex wake it on exit
+
+struct sched_param {
+	int sched_priority;
+};
+
+/* Fair class bookkeeping, times in ns */
+struct sched_entity {
+	struct rb_node run_node;
+	unsigned long weight;
+	uint64_t vruntime;
+	time_ns_t exec_start;
+	time_ns_t sum_exec_runtime;
+	time_ns_t prev_sum_exec_runtime; // sum_exec_runtime when last picked
+};
 
 typedef enum {
 	TASK_NEW,
@@ -21,35 +89,94 @@ typedef enum {
 
 struct task {
 	pid_t pid;
+	struct list_head pid_chain;  // in the PID hash
 	struct registers regs;
+	struct fpu fpu;              // x87/SSE registers, see asm/fpu.h
 
 	char name[PROC_NAME_MAX];
-	struct file* file_table[PROC_FD_MAX];	
+	struct files_struct* files;
 	void* kstack;
 	
 	struct list_head tasks;
 	struct list_head queue;
 
 	struct mm_struct* mm;
-	char *pwd;
+	struct fs_struct* fs;
 
 	task_state_t state;
 	int priority;
 	int exit_code;
 
+	// One while it runs, then the reaper's and the parent's wait; task_find_get() adds its own
+	atomic_t usage;
+	struct list_head reap_node;  // waiting for the reaper
+
+	int policy;
+	int rt_priority;             // SCHED_FIFO/SCHED_RR priority, 0 for the others
+	int rt_prio;                 // the one it runs at, maybe inherited; 0 when not real-time
+	const struct sched_class* sched_class;
+	int cpu;                     // run queue the task belongs to
+	int on_rq;                   // waiting in a run queue
+	volatile int on_cpu;         // running, or still being switched out
+	unsigned long cpus_allowed;  // CPUs the task may run on
+	int migrate_pending;         // left a CPU outside cpus_allowed
+	time_ns_t last_ran;          // switched out, for the cache hot check
+	struct list_head run_list;   // in rq->tasks while queued
+
+	unsigned int time_slice;     // SCHED_BATCH and SCHED_RR ticks left
+	struct prio_array* array;    // SCHED_BATCH array while queued
+
+	struct sched_entity se;
+
+	// Priority inheritance, under pi_lock
+	struct list_head pi_locks;           // mutexes held that have waiters
+	struct mutex_waiter* pi_blocked_on;  // waiting for a mutex
+
+	struct worker* worker;       // a work queue worker's, see worker.c
+
+	// Process tree, under tasklist_lock
 	struct task* parent;
 
 	struct list_head children;
 	struct list_head sibling;
+	struct list_head zombies;        // exited children not waited for, oldest first
+	struct list_head zombie_node;    // in the parent's zombies once exited
+	struct list_head child_waiters;  // sleeping in task_wait_children()
+
+	// Thread group, under tasklist_lock. The leader's own fields count for the group
+	pid_t tgid;                      // the leader's PID, what getpid() returns
+	struct task* group_leader;
+	struct list_head thread_group;   // leader: its other threads
+	struct list_head thread_node;    // in the leader's thread_group
+	int nr_threads;                  // leader: live threads, itself included
+	int group_exit;                  // leader: exit_group() called
+	int group_exit_code;
+
+	int* clear_child_tid;            // user address, zeroed and futex woken on exit
 };
 
+extern struct task* init_task;
+
 struct task* task_create(const char* name, int priority);
 void task_exit(struct task* task, int status);
 void task_destroy(struct task* task);
 
+void task_add_child(struct task* parent, struct task* child);
+int task_add_thread(struct task* leader, struct task* thread);
+void task_exit_group(struct task* task, int status);
 struct task* task_get_child(struct task* parent, pid_t pid);
-struct task* task_find_zombie_child(struct task* parent);
-void task_reparent_children(struct task* task, struct task* new_parent);
+struct task* task_find_get(pid_t pid);
+void task_put(struct task* task);
+int task_wait_children(pid_t pid, pid_t* pids, int* codes, int max, int options);
+
+static inline void task_get(struct task* task){
+	atomic_inc(&task->usage);
+}
+
+/* No credentials yet: init and kernel threads stand in for root */
+static inline int task_privileged(struct task* task){
+	return !task->mm || task->tgid == 1;
+}
 
 asmlinkage void task_sleep(struct task* task);
 asmlinkage void task_wakeup(struct task* task);
@@ -57,12 +184,35 @@ asmlinkage void task_wakeup(struct task* task);
 int task_default_wakeup(struct wait_queue_entry* entry);
 
 asmlinkage void schedule();
+asmlinkage int test_and_clear_resched(void);
+asmlinkage void preempt_schedule_irq(struct registers* regs);
+__no_return void cpu_idle(void);
 
 int __init scheduler_init();
 void __init scheduler_start();
+struct task* __init sched_init_idle(int cpu);
+void sched_init_secondary(void);
+
+void scheduler_tick(void);
+void scheduler_ipi(void);
 void scheduler_add(struct task* task);
 void scheduler_remove(struct task* task);
 
+void sched_fork(struct task* task);
+void wake_up_new_task(struct task* task);
+void sched_move_task(struct task* task);
+
+int sched_can_stop_tick(void);
+int sched_idle(void);
+int idle_cpu(int cpu);
+
+void set_task_nice(struct task* task, int nice);
+int sched_setscheduler(struct task* task, int policy, const struct sched_param* param);
+unsigned int sched_rr_timeslice_ms(struct task* task);
+int sched_setaffinity(struct task* task, unsigned long mask);
+
+void sched_report_balance(void);
+
 static inline void sleep_current(){
 	task_sleep(current);
 	schedule();
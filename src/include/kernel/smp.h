@@ -0,0 +1,34 @@
+#ifndef _KERNEL_SMP_H
+#define _KERNEL_SMP_H
+
+#include <asm/smp.h>
+#include <def/config.h>
+
+/*
+* CPUs that finished booting. Only the booting CPU sets its bit, while the
+* boot CPU waits for it, so plain stores are enough.
+*/
+extern volatile unsigned long cpu_online_mask;
+
+#define cpu_online(cpu) (!!(cpu_online_mask & (1UL << (cpu))))
+
+// Affinity mask of every CPU, including the ones that come up later
+#define CPU_MASK_ALL (~0UL)
+
+#define for_each_online_cpu(cpu) \
+	for((cpu) = 0; (cpu) < MAX_CPUS; (cpu)++) if(cpu_online(cpu))
+
+void set_cpu_online(int cpu);
+int num_online_cpus(void);
+
+typedef void (*smp_call_func_t)(void* info);
+
+void smp_send_reschedule(int cpu);
+void smp_call_function(smp_call_func_t func, void* info);
+void smp_call_function_many(unsigned long mask, smp_call_func_t func, void* info);
+
+// IPI handlers, called by the arch interrupt code
+void smp_reschedule_interrupt(void);
+void smp_call_function_interrupt(void);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _KERNEL_SOFTIRQ_H
+#define _KERNEL_SOFTIRQ_H
+
+#include <kernel/preempt.h>
+#include <sync/atomic.h>
+#include <def/compile.h>
+
+/*
+* Bottom halves. An interrupt handler does what can't wait and raises a
+* softirq for the rest, which runs once the interrupt is acknowledged,
+* with interrupts on, on the same CPU.
+*/
+enum {
+	TIMER_SOFTIRQ,     // clock event listeners
+	BLOCK_SOFTIRQ,
+	TASKLET_SOFTIRQ,
+	NR_SOFTIRQS
+};
+
+typedef void (*softirq_action_t)(void);
+
+DECLARE_PER_CPU(unsigned long, softirq_pending);
+
+#define local_softirq_pending() this_cpu_read(softirq_pending)
+
+void open_softirq(int nr, softirq_action_t action);
+
+/* Interrupts off, run on the way out of the interrupt or by ksoftirqd */
+void raise_softirq_irqoff(int nr);
+void raise_softirq(int nr);
+
+asmlinkage void do_softirq(void);
+asmlinkage void irq_exit_softirq(void);
+
+/* Hold softirqs off on this CPU, for data shared with them */
+static __always_inline void local_bh_disable(void){
+	preempt_count_add(SOFTIRQ_OFFSET);
+	barrier();
+}
+
+void local_bh_enable(void);
+
+#define TASKLET_STATE_SCHED 1  // queued to run
+#define TASKLET_STATE_RUN   2  // running on some CPU
+
+/*
+* Deferred function run from TASKLET_SOFTIRQ on the CPU that scheduled it.
+* Scheduling it again before it runs does nothing; it never runs on two
+* CPUs at once.
+*/
+struct tasklet_struct {
+	struct tasklet_struct* next;
+	atomic_t state;
+	void (*func)(unsigned long data);
+	unsigned long data;
+};
+
+#define DECLARE_TASKLET(name, _func, _data) \
+	struct tasklet_struct name = { .func = (_func), .data = (_data) }
+
+void tasklet_init(struct tasklet_struct* t, void (*func)(unsigned long), unsigned long data);
+void tasklet_schedule(struct tasklet_struct* t);
+
+/* Wait for it to be neither scheduled nor running, task context */
+void tasklet_kill(struct tasklet_struct* t);
+
+#endif
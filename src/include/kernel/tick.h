@@ -0,0 +1,24 @@
+#ifndef _KERNEL_TICK_H
+#define _KERNEL_TICK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct tick_stats {
+	uint64_t ticks_skipped;     // ticks accounted without their own interrupt
+	time_ns_t idle_ns;          // time spent in the idle task
+	unsigned long nohz_entries; // periodic to one-shot switches
+};
+
+void tick_setup_sched_timer(void);
+
+int tick_nohz_stopped(void);
+void tick_nohz_update(void);
+void tick_nohz_restart(void);
+
+void tick_idle_enter(void);
+void tick_idle_exit(void);
+
+void tick_get_stats(struct tick_stats* stats);
+
+#endif
@@ -2,6 +2,8 @@
 #define _WAIT_H
 
 #include <sync/spinlock.h>
+#include <kernel/hrtimer.h>
+#include <kernel/sched.h>
 #include <lib/list.h>
 
 struct wait_queue_entry;
@@ -46,4 +48,31 @@ int __wake_up(struct wait_queue_head *head, int count);
 #define wake_up_nr(x, nr) __wake_up(x, nr)
 #define wake_up_all(x)    __wake_up(x, 0)
 
+/*
+* Sleep on `wq` until `condition` holds or `timeout` ns passed. Evaluates
+* to 0 on timeout, otherwise the time left (at least 1).
+*/
+#define wait_event_timeout(wq, condition, timeout) ({                 \
+	time_ns_t __ret = (timeout);                                      \
+	if (!(condition)) {                                               \
+		struct wait_queue_entry __wait;                               \
+		wait_queue_entry_init(&__wait, current, task_default_wakeup); \
+		wait_queue_add((wq), &__wait);                                \
+		while (1) {                                                   \
+			task_sleep(current);                                      \
+			if (condition) {                                          \
+				current->state = TASK_RUNNING;                        \
+				break;                                                \
+			}                                                         \
+			__ret = schedule_timeout(__ret);                          \
+			if (condition || !__ret)                                  \
+				break;                                                \
+		}                                                             \
+		wait_queue_remove((wq), &__wait);                             \
+		if (!__ret && (condition))                                    \
+			__ret = 1;                                                \
+	}                                                                 \
+	__ret;                                                            \
+})
+
 #endif
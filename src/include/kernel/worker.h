@@ -1,38 +1,103 @@
 #ifndef _WORKER_H
 #define _WORKER_H
 
+#include <kernel/hrtimer.h>
+#include <sync/spinlock.h>
+#include <sync/atomic.h>
 #include <lib/list.h>
-#include <kernel/wait.h>
-#include <stdbool.h>
+#include <sys/types.h>
+
+struct work_struct;
+struct worker_pool;
+struct task;
+
+typedef void (*work_func_t)(struct work_struct *work);
+
+#define WORK_PENDING 1  // queued or its timer armed, not running yet
 
 #define INIT_WORK(_ptr, _func) \
 	do { \
 		INIT_LIST_HEAD(&((_ptr)->list)); \
 		atomic_set(&((_ptr)->data), 0); \
 		(_ptr)->func = _func; \
+		(_ptr)->pool = NULL; \
+		(_ptr)->wq = NULL; \
 	} while(0)
 
-struct work_struct;
-
-typedef void (*work_func_t)(struct work_struct *work);
+#define INIT_DELAYED_WORK(_ptr, _func) \
+	do { \
+		INIT_WORK(&(_ptr)->work, _func); \
+		hrtimer_init(&(_ptr)->timer, delayed_work_timer_fn); \
+	} while(0)
 
+/*
+* A work item is pending from the time it is queued until a worker takes
+* it off the pool's list, so it can be queued again while it runs; it
+* never runs on two workers of a pool at once.
+*/
 struct work_struct {
-	atomic_t data;
+	atomic_t data;              // WORK_PENDING
 	work_func_t func;
-	struct list_head list;
+	struct list_head list;      // in the pool's worklist, under its lock
+	struct worker_pool* pool;   // last queued on
+	struct work_queue* wq;
 };
 
+struct delayed_work {
+	struct work_struct work;
+	struct hrtimer timer;
+	int cpu;                    // queued from, for bound queues
+};
+
+#define WQ_UNBOUND 1  // run on any CPU, not the one it was queued from
+
+/*
+* Work queues don't own threads, they feed the shared worker pools: one
+* per CPU and an unbound one. A queue only tracks its items in flight,
+* for flushing and for being destroyed.
+*/
 struct work_queue {
-	pid_t thread_pid;
+	const char* name;
+	unsigned int flags;
+
 	spinlock_t lock;
 	int stopping;
-
-	struct wait_queue_head wait;
-	struct list_head works;
+	int nr_in_flight;           // queued and not done yet
+	struct list_head flushers;  // sleeping in flush_work_queue()
 };
 
-struct work_queue *alloc_work_queue(const char *name);
-int queue_work(struct work_queue *wq, struct work_struct *work);
+extern struct work_queue* system_wq;
+extern struct work_queue* system_unbound_wq;
+
+struct work_queue *alloc_work_queue(const char *name, unsigned int flags);
+void flush_work_queue(struct work_queue *wq);
 void destroy_work_queue(struct work_queue *wq);
 
+int queue_work(struct work_queue *wq, struct work_struct *work);
+int queue_delayed_work(struct work_queue *wq, struct delayed_work *dwork, time_ns_t delay);
+
+int flush_work(struct work_struct *work);
+int flush_delayed_work(struct delayed_work *dwork);
+int cancel_work_sync(struct work_struct *work);
+int cancel_delayed_work(struct delayed_work *dwork);
+int cancel_delayed_work_sync(struct delayed_work *dwork);
+
+enum hrtimer_restart delayed_work_timer_fn(struct hrtimer *timer);
+
+static inline int work_pending(struct work_struct *work){
+	return atomic_read(&work->data) & WORK_PENDING;
+}
+
+static inline int schedule_work(struct work_struct *work){
+	return queue_work(system_wq, work);
+}
+
+static inline int schedule_delayed_work(struct delayed_work *dwork, time_ns_t delay){
+	return queue_delayed_work(system_wq, dwork, delay);
+}
+
+// Concurrency management, from schedule() for tasks that are workers
+void wq_worker_sleeping(struct task *task);
+void wq_worker_running(struct task *task);
+
 #endif
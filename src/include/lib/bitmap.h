@@ -0,0 +1,51 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define BITS_TO_LONGS(nr) (((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+#define BIT_WORD(nr) ((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
+
+#define DECLARE_BITMAP(name, bits) \
+	unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline void set_bit(size_t nr, unsigned long *map){
+	map[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void clear_bit(size_t nr, unsigned long *map){
+	map[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+static inline int test_bit(size_t nr, const unsigned long *map){
+	return (map[BIT_WORD(nr)] & BIT_MASK(nr)) != 0;
+}
+
+static inline int test_and_set_bit(size_t nr, unsigned long *map){
+	int old = test_bit(nr, map);
+	set_bit(nr, map);
+	return old;
+}
+
+void bitmap_zero(unsigned long *map, size_t bits);
+
+/*
+* The find helpers return `size` when no matching bit exists
+* in [offset, size).
+*/
+size_t find_next_bit(const unsigned long *map, size_t size, size_t offset);
+size_t find_next_zero_bit(const unsigned long *map, size_t size, size_t offset);
+
+static inline size_t find_first_bit(const unsigned long *map, size_t size){
+	return find_next_bit(map, size, 0);
+}
+
+static inline size_t find_first_zero_bit(const unsigned long *map, size_t size){
+	return find_next_zero_bit(map, size, 0);
+}
+
+#endif
@@ -7,6 +7,38 @@ uint32_t __do_div_generic(uint64_t *n, uint32_t base);
 
 #ifndef do_div
 #define do_div(n, base) __do_div_generic(&(n), (base))
+/*
+* (a * mul) >> shift with the full 96 bit product, for mult/shift scaling
+* without a 64 bit division. shift must be at most 32.
+*/
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, unsigned int shift){
+	uint32_t ah = a >> 32;
+	uint32_t al = a;
+	uint64_t ret = ((uint64_t)al * mul) >> shift;
+
+	if(ah){
+		ret += ((uint64_t)ah * mul) << (32 - shift);
+	}
+
+	return ret;
+}
+
 #endif
 
+/*
+* (a * mul) >> shift with the full 96 bit product, for mult/shift scaling
+* without a 64 bit division. shift must be at most 32.
+*/
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, unsigned int shift){
+	uint32_t ah = a >> 32;
+	uint32_t al = a;
+	uint64_t ret = ((uint64_t)al * mul) >> shift;
+
+	if(ah){
+		ret += ((uint64_t)ah * mul) << (32 - shift);
+	}
+
+	return ret;
+}
+
 #endif
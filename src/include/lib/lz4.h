@@ -0,0 +1,25 @@
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* LZ4 block format codec (no frame header). Inputs are limited to 64 KiB,
+* which keeps the match table at 16-bit positions.
+*/
+
+#define LZ4_HASH_LOG 12
+#define LZ4_MEM_COMPRESS (sizeof(uint16_t) << LZ4_HASH_LOG)
+#define LZ4_MAX_INPUT_SIZE 0xFFFF
+
+/*
+* Returns the compressed size, or 0 when the output does not fit in
+* `dst_cap`. `wrkmem` must hold LZ4_MEM_COMPRESS bytes.
+*/
+size_t lz4_compress(const void *src, size_t src_len, void *dst, size_t dst_cap, void *wrkmem);
+
+/* Returns the decompressed size or -EINVAL on malformed input */
+int lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_cap);
+
+#endif
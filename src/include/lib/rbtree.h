@@ -0,0 +1,71 @@
+#ifndef _RBTREE_H
+#define _RBTREE_H
+
+#include <stddef.h>
+#include <lib/list.h>
+
+#define RB_RED   0
+#define RB_BLACK 1
+
+struct rb_node {
+	struct rb_node *rb_parent;
+	struct rb_node *rb_left;
+	struct rb_node *rb_right;
+	int rb_color;
+};
+
+struct rb_root {
+	struct rb_node *rb_node;
+};
+
+/* Root with the leftmost node cached, rb_first_cached is O(1) */
+struct rb_root_cached {
+	struct rb_root rb_root;
+	struct rb_node *rb_leftmost;
+};
+
+#define RB_ROOT (struct rb_root){ NULL }
+#define RB_ROOT_CACHED (struct rb_root_cached){ { NULL }, NULL }
+
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define RB_EMPTY_ROOT(root) ((root)->rb_node == NULL)
+
+/* Nodes off the tree point to themselves */
+#define RB_EMPTY_NODE(node) ((node)->rb_parent == (node))
+#define RB_CLEAR_NODE(node) ((node)->rb_parent = (node))
+
+/*
+* Callers walk down to the insertion point themselves and link the node
+* there, rb_insert_color then restores the balance.
+*/
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link){
+	node->rb_parent = parent;
+	node->rb_left = node->rb_right = NULL;
+	node->rb_color = RB_RED;
+	*link = node;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+
+static inline void rb_insert_color_cached(struct rb_node *node, struct rb_root_cached *root, int leftmost){
+	if (leftmost)
+		root->rb_leftmost = node;
+
+	rb_insert_color(node, &root->rb_root);
+}
+
+static inline void rb_erase_cached(struct rb_node *node, struct rb_root_cached *root){
+	if (root->rb_leftmost == node)
+		root->rb_leftmost = rb_next(node);
+
+	rb_erase(node, &root->rb_root);
+}
+
+#define rb_first_cached(root) ((root)->rb_leftmost)
+
+#endif
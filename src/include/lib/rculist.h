@@ -0,0 +1,44 @@
+#ifndef _RCULIST_H
+#define _RCULIST_H
+
+#include <lib/list.h>
+#include <sync/rcu.h>
+
+/*
+* Lists walked by RCU readers. Updaters still hold the list's lock, the
+* walk follows `next` only: an entry is fully linked before it becomes
+* reachable, and a removed one keeps pointing into the list, so a reader
+* standing on it finds its way back to the head.
+*/
+
+static inline void __list_add_rcu(struct list_head* new, struct list_head* prev, struct list_head* next){
+	new->next = next;
+	new->prev = prev;
+	rcu_assign_pointer(prev->next, new);
+	next->prev = new;
+}
+
+static inline void list_add_rcu(struct list_head* new, struct list_head* head){
+	__list_add_rcu(new, head, head->next);
+}
+
+static inline void list_add_tail_rcu(struct list_head* new, struct list_head* head){
+	__list_add_rcu(new, head->prev, head);
+}
+
+/* Unlink, `entry` can only be reused or freed after a grace period */
+static inline void list_remove_rcu(struct list_head* entry){
+	entry->next->prev = entry->prev;
+	rcu_assign_pointer(entry->prev->next, entry->next);
+	entry->prev = NULL;
+}
+
+#define list_entry_rcu(ptr, type, member) \
+	container_of(rcu_dereference(ptr), type, member)
+
+#define list_for_each_entry_rcu(pos, head, member)                 \
+	for (pos = list_entry_rcu((head)->next, typeof(*pos), member); \
+		&pos->member != (head);                                    \
+		pos = list_entry_rcu(pos->member.next, typeof(*pos), member))
+
+#endif
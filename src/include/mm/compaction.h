@@ -0,0 +1,17 @@
+#ifndef _COMPACTION_H
+#define _COMPACTION_H
+
+#include <stdint.h>
+
+/*
+* Fragmentation index of `order` in thousandths. Towards 0 an allocation
+* of that order fails for lack of memory, towards 1000 because of
+* fragmentation; -1000 when a free block of that order exists.
+*/
+int fragmentation_index(uint8_t order);
+void compaction_report(void);
+
+int compact_pages(uint8_t order);
+void wakeup_kcompactd(uint8_t order);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _KSM_H
+#define _KSM_H
+
+#include <stdint.h>
+
+struct ksm_stats {
+	unsigned long pages_shared;   // merged pages in use
+	unsigned long pages_sharing;  // PTEs mapping them
+	unsigned long pages_unshared; // candidates with no match yet
+	unsigned long pages_saved;    // pages_sharing - pages_shared
+	unsigned long full_scans;
+};
+
+/* ksm_ctl(set, old, stats): any of the pointers may be NULL */
+struct ksm_tunables {
+	uint32_t run;            // scan at all
+	uint32_t pages_to_scan;  // PTEs per wakeup, at least 1
+	uint32_t sleep_ms;       // between wakeups
+};
+
+/* Tunables, read by ksmd on every wakeup */
+extern unsigned int ksm_run;
+extern unsigned int ksm_pages_to_scan;
+extern unsigned int ksm_sleep_ms;
+
+void ksm_get_stats(struct ksm_stats *stats);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _MEMORY_MANAGER_UNIT_H
 #define _MEMORY_MANAGER_UNIT_H
 
+#include <asm-generic/paging_ops.h>
+#include <asm/percpu.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -24,6 +26,12 @@ typedef enum {
 
 struct paging_ctx;
 
+/*
+* Called for every leaf PTE that is present or holds a swap entry.
+* A non zero return stops the walk and is propagated to the caller.
+*/
+typedef int (*mmu_pte_fn_t)(struct paging_ctx *ctx, pte_t *pte, uintptr_t vaddr, void *data);
+
 extern int mmu_flags_arch(mem_flags_t flags);
 extern mem_flags_t arch_mmu_flags(int flags);
 
@@ -38,13 +46,20 @@ void mmu_set_flags(struct paging_ctx *ctx, uintptr_t vaddr, mem_flags_t flags);
 void mmu_set_flags_range(struct paging_ctx *ctx, uintptr_t vaddr, size_t size, mem_flags_t flags);
 mem_flags_t mmu_get_flags(struct paging_ctx *ctx, uintptr_t vaddr);
 
+int mmu_get_swap_entry(struct paging_ctx *ctx, uintptr_t vaddr, swp_entry_t *entry);
+int mmu_walk_ptes(struct paging_ctx *ctx, uintptr_t start, uintptr_t end, mmu_pte_fn_t fn, void *data);
+
 struct paging_ctx* mmu_create_context(void);
 struct paging_ctx* mmu_clone_context(struct paging_ctx *src);
 
+// The context in this CPU's page table base, only ever compared
+DECLARE_PER_CPU(struct paging_ctx*, active_ctx);
+
 int mmu_context_switch(struct paging_ctx *ctx);
 void mmu_destroy_context(struct paging_ctx *ctx);
 
 uintptr_t mmu_translate(struct paging_ctx *ctx, uintptr_t vaddr);
+void* mmu_ioremap(uintptr_t paddr, size_t size);
 void mmu_invlpg(struct paging_ctx *ctx, uintptr_t vaddr);
 void mmu_flush_all(struct paging_ctx *ctx);
 
@@ -24,24 +24,54 @@
 #define PG_LOCKED     (1U << 9)
 #define PG_REFERENCED (1U << 10)
 #define PG_WRITEBACK  (1U << 11)
+#define PG_ANON       (1U << 12)
+#define PG_SWAPCACHE  (1U << 13)
+#define PG_ERROR      (1U << 14)
+#define PG_ISOLATED   (1U << 15)
 
+/* 32-bit PFN used for links kept in struct page */
+#define PFN_NONE ((uint32_t)~0U)
+
+/*
+* One per physical frame, kept at 16 bytes so four share a cache line.
+* Only one of the union members is live at a time, chosen by `flags`.
+*/
 struct page {
+	uint16_t flags;
 	uint8_t order;
 	uint8_t pad;
 
-	uint16_t flags;
 	atomic_t refcount;
 
-	void* private;
+	union {
+		// PG_BUDDY: free list links
+		struct {
+			uint32_t next;
+			uint32_t prev;
+		} buddy;
 
-	struct list_head list;
-} __aligned(32);
+		// PG_SLAB and pool pages: owner metadata
+		void* private;
+
+		// PG_SWAPCACHE: swap entry and hash chain link
+		struct {
+			unsigned long entry;
+			uint32_t next;
+		} swap;
+	};
+};
 
 int page_init(void);
 
 struct page* page_alloc(uint8_t order, uint16_t flags);
 int page_free(struct page* page);
 
+int page_isolate_free(struct page* page, unsigned long max_pages);
+void page_free_info(unsigned long nr_free[MAX_ORDER], unsigned long* free_pages);
+
+struct page* pfn_to_page(uintptr_t pfn);
+uintptr_t page_to_pfn(struct page* page);
+
 struct page* phys_to_page(uintptr_t phys_addr);
 uintptr_t page_to_phys(struct page* page);
 
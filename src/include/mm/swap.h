@@ -0,0 +1,92 @@
+#ifndef _SWAP_H
+#define _SWAP_H
+
+#include <asm-generic/paging_ops.h>
+#include <sync/spinlock.h>
+#include <sync/mutex.h>
+#include <device/blkdev.h>
+#include <mm/page.h>
+#include <stdint.h>
+
+struct file;
+
+#define SWP_USED   (1 << 0)
+#define SWP_BLKDEV (1 << 1)
+
+/* Maximum references a single slot can hold (cache + mappings) */
+#define SWAP_MAP_MAX 0xFE
+
+/*
+* Slot 0 of an area, as written by mkswap. An area is only activated when
+* the magic is there, so a stray partition type can't be overwritten.
+*/
+#define SWAP_MAGIC     "SWAPSPACE2"
+#define SWAP_MAGIC_LEN 10
+#define SWAP_VERSION   1
+
+union swap_header {
+	struct {
+		char reserved[PAGE_SIZE - SWAP_MAGIC_LEN];
+		char magic[SWAP_MAGIC_LEN];
+	} magic;
+
+	struct {
+		char bootbits[1024];
+		uint32_t version;
+		uint32_t last_page;     // last usable slot
+		uint32_t nr_badpages;
+	} info;
+};
+
+struct swap_info {
+	unsigned int flags;
+	unsigned int type;
+
+	struct blkdev *bdev;
+	struct file *file;
+
+	unsigned long max;      // slots, slot 0 is the reserved header
+	unsigned long inuse;
+	unsigned long cluster_next;
+
+	unsigned long *bitmap;  // allocated slots
+	uint8_t *map;           // per slot reference count
+
+	spinlock_t lock;
+	struct mutex io_lock;   // swap file position, seek and transfer go together
+};
+
+extern unsigned long nr_swap_pages;
+extern unsigned long total_swap_pages;
+extern unsigned long swap_cache_pages;
+
+int swap_activate_bdev(struct blkdev *bdev);
+int swap_activate_file(struct file *file);
+void swap_format_header(union swap_header *hdr, unsigned long slots);
+
+swp_entry_t swap_alloc(void);
+int swap_duplicate(swp_entry_t entry);
+void swap_free(swp_entry_t entry);
+int swap_count(swp_entry_t entry);
+int swap_entry_valid(swp_entry_t entry);
+int swap_io(swp_entry_t entry, void *buffer, unsigned int nr_pages, int op, bio_end_io_t *end_io, void *private);
+
+/* Swap cache, keyed by swap entry */
+struct page* swap_cache_lookup(swp_entry_t entry);
+int swap_cache_add(struct page *page, swp_entry_t entry);
+void swap_cache_del(struct page *page);
+
+int swap_writepage(struct page *page);
+void swap_writepage_cluster(struct page **pages, int nr);
+struct page* swapin_readahead(swp_entry_t entry);
+unsigned long shrink_swap_cache(unsigned long nr_pages);
+
+/* Reclaim */
+unsigned long swap_reclaim(unsigned long nr_pages);
+struct page* page_alloc_reclaim(uint8_t order, uint16_t flags);
+
+static inline swp_entry_t page_swp_entry(struct page *page){
+	return (swp_entry_t){ .val = page->swap.entry };
+}
+
+#endif
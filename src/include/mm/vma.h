@@ -3,6 +3,8 @@
 
 #include <mm/mmu.h>
 #include <fs/vfs.h>
+#include <sync/rwsem.h>
+#include <sync/mutex.h>
 
 typedef enum {
 	PROT_MAP_POPULATE  = 1 << 0,
@@ -32,9 +34,16 @@ struct mm_struct {
 	uintptr_t brk_start;
 	uintptr_t brk;
 	atomic_t refcount;
-	spinlock_t spinlock;
+	struct rw_semaphore mmap_lock;  // the vma list, may sleep
+	struct mutex fault_lock;        // page faults, from the PTE check to the install
+
+	struct list_head mmlist;
 };
 
+/* Every live address space, scanned by swap reclaim */
+extern struct list_head mm_list;
+extern spinlock_t mm_list_lock;
+
 struct mm_struct* vma_alloc(void);
 struct vm_region* vma_lookup(struct mm_struct* mm, uintptr_t virtaddr);
 struct vm_region* vma_add(
@@ -0,0 +1,48 @@
+#ifndef _ZPOOL_H
+#define _ZPOOL_H
+
+#include <sync/spinlock.h>
+#include <lib/list.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Pool for variable sized compressed objects. Sizes are rounded up to
+* ZPOOL_CLASS_DELTA and each class carves whole pages into equal slots,
+* like the slab caches, but with much finer classes.
+*/
+
+#define ZPOOL_CLASS_DELTA 32
+#define ZPOOL_MAX_SIZE 2048
+#define ZPOOL_NR_CLASSES (ZPOOL_MAX_SIZE / ZPOOL_CLASS_DELTA)
+
+struct zpool_page {
+	struct list_head list;
+	struct page *page;
+	void *free_list;
+	uint16_t inuse;
+	uint16_t total;
+	struct zpool_class *class;
+};
+
+struct zpool_class {
+	size_t size;
+	struct list_head partial;
+	struct list_head full;
+};
+
+struct zpool {
+	struct zpool_class classes[ZPOOL_NR_CLASSES];
+	spinlock_t lock;
+
+	unsigned long pages;      // backing pages owned by the pool
+	unsigned long objects;
+};
+
+struct zpool* zpool_create(void);
+void zpool_destroy(struct zpool *pool);
+
+void* zpool_alloc(struct zpool *pool, size_t size);
+void zpool_free(struct zpool *pool, void *obj);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _MUTEX_H
+#define _MUTEX_H
+
+#include <sync/atomic.h>
+#include <lib/list.h>
+
+struct task;
+
+/*
+* Sleeping lock with priority inheritance. The owner runs at the highest
+* real-time priority among the tasks waiting on it, so a low priority
+* holder can't keep a real-time task waiting behind everything in
+* between. Only taken in task context, never with a spinlock held.
+*/
+struct mutex {
+	atomic_t owner;            // struct task*, MUTEX_HAS_WAITERS once one sleeps on it
+	struct list_head waiters;  // highest priority first, FIFO among equals
+	struct list_head pi_node;  // in owner->pi_locks while it has waiters
+};
+
+#define MUTEX_HAS_WAITERS 1
+
+#define MUTEX_INITIALIZER(name) { \
+	.owner = { 0 }, \
+	.waiters = LIST_HEAD_INIT((name).waiters), \
+	.pi_node = LIST_HEAD_INIT((name).pi_node), \
+}
+
+#define DEFINE_MUTEX(name) struct mutex name = MUTEX_INITIALIZER(name)
+
+void mutex_init(struct mutex* lock);
+void mutex_lock(struct mutex* lock);
+int mutex_trylock(struct mutex* lock);
+void mutex_unlock(struct mutex* lock);
+
+static inline struct task* mutex_owner(struct mutex* lock){
+	return (struct task*)(atomic_read(&lock->owner) & ~MUTEX_HAS_WAITERS);
+}
+
+static inline int mutex_is_locked(struct mutex* lock){
+	return mutex_owner(lock) != NULL;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _RCU_H
+#define _RCU_H
+
+#include <kernel/preempt.h>
+#include <sync/barrier.h>
+#include <def/compile.h>
+
+/*
+* Read-copy-update. Readers of an RCU protected structure only mark their
+* section, they never write a shared word and never wait. Updaters
+* serialize among themselves with their own lock, publish new objects with
+* rcu_assign_pointer() and free the ones they unlinked once every reader
+* that could still see them is gone, from call_rcu() or after
+* synchronize_rcu().
+*
+* A read section runs with preemption off and can't sleep. A CPU that
+* switched tasks, or ticked in user mode or idle, has left every section
+* it was in: once all CPUs did since a grace period started, the readers
+* of anything unlinked before it are done.
+*/
+
+struct rcu_head {
+	struct rcu_head* next;
+	void (*func)(struct rcu_head* head);
+};
+
+typedef void (*rcu_callback_t)(struct rcu_head* head);
+
+static __always_inline void rcu_read_lock(void){
+	preempt_disable();
+}
+
+static __always_inline void rcu_read_unlock(void){
+	preempt_enable();
+}
+
+/* Load an RCU protected pointer, in a read section or under the updater lock */
+#define rcu_dereference(p) ({                          \
+	__typeof__(p) ___p = *(volatile __typeof__(p)*)&(p); \
+	barrier();                                         \
+	___p;                                              \
+})
+
+/* Publish `v` in `p`, its initialization is visible before it is */
+#define rcu_assign_pointer(p, v) do {                  \
+	smp_wmb();                                         \
+	*(volatile __typeof__(p)*)&(p) = (v);              \
+} while(0)
+
+/* Run `func` from task context once a grace period passed */
+void call_rcu(struct rcu_head* head, rcu_callback_t func);
+
+/* Sleep until every read section running now is done */
+void synchronize_rcu(void);
+
+// Scheduler hooks, with interrupts off
+void rcu_scheduler_starting(void);
+void rcu_note_context_switch(void);
+void rcu_check_callbacks(void);
+int rcu_needs_cpu(void);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef _RWSEM_H
+#define _RWSEM_H
+
+#include <sync/spinlock.h>
+#include <lib/list.h>
+
+/*
+* Sleeping reader/writer lock. Any number of readers or one writer hold
+* it; the others sleep in arrival order, so a waiting writer holds up the
+* readers behind it and can't be starved. Only taken in task context.
+*/
+struct rw_semaphore {
+	int count;                 // readers holding it, RWSEM_WRITER while a writer does
+	spinlock_t lock;
+	struct list_head waiters;  // FIFO
+};
+
+#define RWSEM_WRITER -1
+
+#define RWSEM_INITIALIZER(name) { \
+	.count = 0, \
+	.waiters = LIST_HEAD_INIT((name).waiters), \
+}
+
+#define DECLARE_RWSEM(name) struct rw_semaphore name = RWSEM_INITIALIZER(name)
+
+void init_rwsem(struct rw_semaphore* sem);
+
+void down_read(struct rw_semaphore* sem);
+int down_read_trylock(struct rw_semaphore* sem);
+void up_read(struct rw_semaphore* sem);
+
+void down_write(struct rw_semaphore* sem);
+int down_write_trylock(struct rw_semaphore* sem);
+void up_write(struct rw_semaphore* sem);
+
+/* Keep holding it as a reader, letting the readers waiting behind in */
+void downgrade_write(struct rw_semaphore* sem);
+
+static inline int rwsem_is_locked(struct rw_semaphore* sem){
+	return sem->count != 0;
+}
+
+#endif
@@ -2,16 +2,66 @@
 #define _SPINLOCK_H
 
 #include <sync/atomic.h>
+#include <def/config.h>
+#include <def/compile.h>
+#include <stdint.h>
 
+/*
+* Ticket lock: a locker draws the next ticket from the high half and waits
+* for the low half to reach it, so the lock is handed out in arrival order.
+* All zero is unlocked, a zeroed spinlock_t needs no spinlock_init().
+*/
 typedef struct {
-    atomic_t locked;
+    atomic_t tickets;
+#ifdef CONFIG_LOCKSTAT
+    struct lock_class* class;
+    uint64_t acquired_at;
+#endif
 } spinlock_t;
 
+#ifdef CONFIG_LOCKSTAT
+struct lock_class_stats {
+    unsigned long acquisitions;
+    unsigned long contentions;
+    uint64_t wait_cycles;
+    uint64_t wait_max;
+    uint64_t hold_cycles;
+    uint64_t hold_max;
+} __aligned(L1_CACHE_BYTES);
+
+/* Every lock initialized at one site, see spinlock_init_class() */
+struct lock_class {
+    const char* name;
+    struct lock_class* next;
+    atomic_t registered;
+    struct lock_class_stats stats[MAX_CPUS];
+};
+
+void lockstat_set_class(spinlock_t* lock, struct lock_class* class);
+
+/* Initialize and account under `name`, with `make LOCKSTAT=1` */
+#define spinlock_init_class(lock, _name) do {              \
+        static struct lock_class __lock_class = {          \
+            .name = (_name),                               \
+        };                                                 \
+        spinlock_init(lock);                               \
+        lockstat_set_class((lock), &__lock_class);         \
+    } while(0)
+#else
+#define spinlock_init_class(lock, _name) spinlock_init(lock)
+#endif
+
 void spinlock_init(spinlock_t* lock);
 void spin_lock(spinlock_t* lock);
+int spin_trylock(spinlock_t* lock);
 void spin_unlock(spinlock_t* lock);
+int spin_is_locked(spinlock_t* lock);
 
 void spin_lock_irqsave(spinlock_t* lock, unsigned long* flags);
 void spin_unlock_irqrestore(spinlock_t* lock, unsigned long* flags);
 
-#endif
\ No newline at end of file
+/* Softirqs off while held, for locks a softirq or tasklet takes too */
+void spin_lock_bh(spinlock_t* lock);
+void spin_unlock_bh(spinlock_t* lock);
+
+#endif
@@ -34,6 +34,9 @@ typedef uint64_t timespan; // in seconds
 
 typedef uint64_t tick_t;
 
+typedef long time_t;
+typedef int clockid_t;
+
 typedef uint32_t cpu_id_t;
 
 typedef uintptr_t flags_t;
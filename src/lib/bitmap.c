@@ -0,0 +1,34 @@
+#include <lib/bitmap.h>
+#include <lib/string.h>
+
+void bitmap_zero(unsigned long *map, size_t bits){
+	memset(map, 0x0, BITS_TO_LONGS(bits) * sizeof(unsigned long));
+}
+
+static size_t _find_next(const unsigned long *map, size_t size, size_t offset, unsigned long invert){
+	if(offset >= size){
+		return size;
+	}
+
+	size_t idx = BIT_WORD(offset);
+	unsigned long word = (map[idx] ^ invert) & (~0UL << (offset % BITS_PER_LONG));
+
+	while(!word){
+		if(++idx >= BITS_TO_LONGS(size)){
+			return size;
+		}
+
+		word = map[idx] ^ invert;
+	}
+
+	size_t bit = idx * BITS_PER_LONG + __builtin_ctzl(word);
+	return bit < size ? bit : size;
+}
+
+size_t find_next_bit(const unsigned long *map, size_t size, size_t offset){
+	return _find_next(map, size, offset, 0UL);
+}
+
+size_t find_next_zero_bit(const unsigned long *map, size_t size, size_t offset){
+	return _find_next(map, size, offset, ~0UL);
+}
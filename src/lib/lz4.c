@@ -0,0 +1,196 @@
+#include <lib/lz4.h>
+#include <lib/string.h>
+#include <def/errno.h>
+
+#define MINMATCH     4
+#define LASTLITERALS 5
+#define MFLIMIT      12
+#define ML_MASK      15
+#define RUN_MASK     15
+
+static inline uint32_t lz4_read32(const uint8_t *p){
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t seq){
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline uint8_t* lz4_write_length(uint8_t *op, size_t len){
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+/* Worst case bytes needed to emit `lit` literals plus a match of `ml` */
+static inline size_t lz4_seq_bound(size_t lit, size_t ml){
+	return 1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1;
+}
+
+size_t lz4_compress(const void *src, size_t src_len, void *dst, size_t dst_cap, void *wrkmem){
+	const uint8_t *const base = src;
+	const uint8_t *const iend = base + src_len;
+	const uint8_t *const mflimit = iend - MFLIMIT;
+	const uint8_t *const matchlimit = iend - LASTLITERALS;
+
+	uint8_t *op = dst;
+	uint8_t *const oend = op + dst_cap;
+	uint16_t *table = wrkmem;
+
+	const uint8_t *ip = base;
+	const uint8_t *anchor = base;
+
+	if (src_len > LZ4_MAX_INPUT_SIZE)
+		return 0;
+
+	memset(table, 0x0, LZ4_MEM_COMPRESS);
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	table[lz4_hash(lz4_read32(ip))] = 0;
+	ip++;
+
+	while (ip < mflimit) {
+		uint32_t h = lz4_hash(lz4_read32(ip));
+		const uint8_t *ref = base + table[h];
+		table[h] = (uint16_t)(ip - base);
+
+		if (ref >= ip || lz4_read32(ref) != lz4_read32(ip)) {
+			ip++;
+			continue;
+		}
+
+		while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		size_t ml = MINMATCH;
+		while (ip + ml < matchlimit && ip[ml] == ref[ml])
+			ml++;
+
+		size_t lit = ip - anchor;
+		if ((size_t)(oend - op) < lz4_seq_bound(lit, ml) + LASTLITERALS + 1)
+			return 0;
+
+		uint8_t *token = op++;
+
+		if (lit >= RUN_MASK) {
+			*token = RUN_MASK << 4;
+			op = lz4_write_length(op, lit - RUN_MASK);
+		} else {
+			*token = (uint8_t)(lit << 4);
+		}
+
+		memcpy(op, anchor, lit);
+		op += lit;
+
+		uint16_t offset = (uint16_t)(ip - ref);
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+
+		size_t mlc = ml - MINMATCH;
+		if (mlc >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_write_length(op, mlc - ML_MASK);
+		} else {
+			*token |= (uint8_t)mlc;
+		}
+
+		ip += ml;
+		anchor = ip;
+
+		if (ip < mflimit)
+			table[lz4_hash(lz4_read32(ip - 2))] = (uint16_t)(ip - 2 - base);
+	}
+
+last_literals: ;
+	size_t lit = iend - anchor;
+	if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit)
+		return 0;
+
+	if (lit >= RUN_MASK) {
+		*op++ = RUN_MASK << 4;
+		op = lz4_write_length(op, lit - RUN_MASK);
+	} else {
+		*op++ = (uint8_t)(lit << 4);
+	}
+
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	return op - (uint8_t*)dst;
+}
+
+int lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_cap){
+	const uint8_t *ip = src;
+	const uint8_t *const iend = ip + src_len;
+
+	uint8_t *op = dst;
+	uint8_t *const oend = op + dst_cap;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t len = token >> 4;
+
+		if (len == RUN_MASK) {
+			uint8_t s;
+			do {
+				if (ip >= iend)
+					return -EINVAL;
+
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+
+		if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+			return -EINVAL;
+
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		// The last sequence carries literals only
+		if (ip >= iend)
+			break;
+
+		if (iend - ip < 2)
+			return -EINVAL;
+
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst))
+			return -EINVAL;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK) {
+			uint8_t s;
+			do {
+				if (ip >= iend)
+					return -EINVAL;
+
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+
+		len += MINMATCH;
+		if (len > (size_t)(oend - op))
+			return -EINVAL;
+
+		const uint8_t *match = op - offset;
+		while (len--)
+			*op++ = *match++;
+	}
+
+	return op - (uint8_t*)dst;
+}
@@ -0,0 +1,253 @@
+#include <lib/rbtree.h>
+
+/**
+* Red-black tree.
+*
+* Leaves are NULL and count as black. Keys live in the containing
+* structures, so the search and link step is left to the user and only the
+* rebalancing is done here.
+*/
+
+static inline int rb_is_black(const struct rb_node *node){
+	return !node || node->rb_color == RB_BLACK;
+}
+
+static void rb_replace_child(struct rb_node *old, struct rb_node *new, struct rb_node *parent, struct rb_root *root){
+	if (!parent)
+		root->rb_node = new;
+	else if (parent->rb_left == old)
+		parent->rb_left = new;
+	else
+		parent->rb_right = new;
+}
+
+static void rb_rotate_left(struct rb_node *node, struct rb_root *root){
+	struct rb_node *right = node->rb_right;
+	struct rb_node *parent = node->rb_parent;
+
+	node->rb_right = right->rb_left;
+	if (right->rb_left)
+		right->rb_left->rb_parent = node;
+
+	right->rb_left = node;
+	right->rb_parent = parent;
+	rb_replace_child(node, right, parent, root);
+	node->rb_parent = right;
+}
+
+static void rb_rotate_right(struct rb_node *node, struct rb_root *root){
+	struct rb_node *left = node->rb_left;
+	struct rb_node *parent = node->rb_parent;
+
+	node->rb_left = left->rb_right;
+	if (left->rb_right)
+		left->rb_right->rb_parent = node;
+
+	left->rb_right = node;
+	left->rb_parent = parent;
+	rb_replace_child(node, left, parent, root);
+	node->rb_parent = left;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root){
+	struct rb_node *parent, *gparent, *uncle;
+
+	while ((parent = node->rb_parent) && parent->rb_color == RB_RED) {
+		gparent = parent->rb_parent;
+
+		if (parent == gparent->rb_left) {
+			uncle = gparent->rb_right;
+
+			if (!rb_is_black(uncle)) {
+				uncle->rb_color = RB_BLACK;
+				parent->rb_color = RB_BLACK;
+				gparent->rb_color = RB_RED;
+				node = gparent;
+				continue;
+			}
+
+			if (node == parent->rb_right) {
+				rb_rotate_left(parent, root);
+				node = parent;
+				parent = node->rb_parent;
+			}
+
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			rb_rotate_right(gparent, root);
+		}
+		else {
+			uncle = gparent->rb_left;
+
+			if (!rb_is_black(uncle)) {
+				uncle->rb_color = RB_BLACK;
+				parent->rb_color = RB_BLACK;
+				gparent->rb_color = RB_RED;
+				node = gparent;
+				continue;
+			}
+
+			if (node == parent->rb_left) {
+				rb_rotate_right(parent, root);
+				node = parent;
+				parent = node->rb_parent;
+			}
+
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			rb_rotate_left(gparent, root);
+		}
+	}
+
+	root->rb_node->rb_color = RB_BLACK;
+}
+
+/* `node` (possibly NULL) under `parent` carries an extra black */
+static void rb_erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root){
+	struct rb_node *sibling;
+
+	while (node != root->rb_node && rb_is_black(node)) {
+		if (node == parent->rb_left) {
+			sibling = parent->rb_right;
+
+			if (!rb_is_black(sibling)) {
+				sibling->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				rb_rotate_left(parent, root);
+				sibling = parent->rb_right;
+			}
+
+			if (rb_is_black(sibling->rb_left) && rb_is_black(sibling->rb_right)) {
+				sibling->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+
+			if (rb_is_black(sibling->rb_right)) {
+				sibling->rb_left->rb_color = RB_BLACK;
+				sibling->rb_color = RB_RED;
+				rb_rotate_right(sibling, root);
+				sibling = parent->rb_right;
+			}
+
+			sibling->rb_color = parent->rb_color;
+			parent->rb_color = RB_BLACK;
+			sibling->rb_right->rb_color = RB_BLACK;
+			rb_rotate_left(parent, root);
+		}
+		else {
+			sibling = parent->rb_left;
+
+			if (!rb_is_black(sibling)) {
+				sibling->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				rb_rotate_right(parent, root);
+				sibling = parent->rb_left;
+			}
+
+			if (rb_is_black(sibling->rb_left) && rb_is_black(sibling->rb_right)) {
+				sibling->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+
+			if (rb_is_black(sibling->rb_left)) {
+				sibling->rb_right->rb_color = RB_BLACK;
+				sibling->rb_color = RB_RED;
+				rb_rotate_left(sibling, root);
+				sibling = parent->rb_left;
+			}
+
+			sibling->rb_color = parent->rb_color;
+			parent->rb_color = RB_BLACK;
+			sibling->rb_left->rb_color = RB_BLACK;
+			rb_rotate_right(parent, root);
+		}
+
+		node = root->rb_node;
+		break;
+	}
+
+	if (node)
+		node->rb_color = RB_BLACK;
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root){
+	struct rb_node *child, *parent;
+	int color;
+
+	if (!node->rb_left || !node->rb_right) {
+		child = node->rb_left ? node->rb_left : node->rb_right;
+		parent = node->rb_parent;
+		color = node->rb_color;
+
+		if (child)
+			child->rb_parent = parent;
+
+		rb_replace_child(node, child, parent, root);
+	}
+	else {
+		// Two children: the successor takes the node's place and color
+		struct rb_node *next = node->rb_right;
+		while (next->rb_left)
+			next = next->rb_left;
+
+		child = next->rb_right;
+		color = next->rb_color;
+
+		if (next->rb_parent == node) {
+			parent = next;
+		}
+		else {
+			parent = next->rb_parent;
+			parent->rb_left = child;
+			if (child)
+				child->rb_parent = parent;
+
+			next->rb_right = node->rb_right;
+			node->rb_right->rb_parent = next;
+		}
+
+		next->rb_left = node->rb_left;
+		node->rb_left->rb_parent = next;
+		next->rb_parent = node->rb_parent;
+		next->rb_color = node->rb_color;
+		rb_replace_child(node, next, node->rb_parent, root);
+	}
+
+	if (color == RB_BLACK)
+		rb_erase_color(child, parent, root);
+
+	RB_CLEAR_NODE(node);
+}
+
+struct rb_node *rb_first(const struct rb_root *root){
+	struct rb_node *node = root->rb_node;
+
+	if (!node)
+		return NULL;
+
+	while (node->rb_left)
+		node = node->rb_left;
+
+	return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node){
+	struct rb_node *parent;
+
+	if (node->rb_right) {
+		node = node->rb_right;
+		while (node->rb_left)
+			node = node->rb_left;
+
+		return (struct rb_node *)node;
+	}
+
+	while ((parent = node->rb_parent) && node == parent->rb_right)
+		node = parent;
+
+	return parent;
+}
@@ -0,0 +1,375 @@
+#include <mm/compaction.h>
+#include <mm/page.h>
+#include <mm/vma.h>
+#include <kernel/sched.h>
+#include <kernel/clock.h>
+#include <kernel/worker.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <lib/string.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+#include <asm-generic/paging_ctx.h>
+
+/**
+* Physical memory compaction.
+*
+* To get a free block of a given order, pick the aligned block whose pages
+* are all either free or movable, with the fewest movable ones. Its free
+* parts are pulled off the buddy free lists, then every address space is
+* walked and each PTE mapping a page inside the block is pointed at a copy
+* allocated elsewhere. Once every page of the block is isolated it goes
+* back to the buddy allocator in one piece.
+*
+* Movable means a user anonymous page mapped by a single PTE: shared COW
+* pages, swap cache and merged KSM pages have no reverse mapping here and
+* pin their block.
+*
+* An address space is walked under its fault_lock. Its threads may still
+* write on other CPUs, so the PTE is write protected and flushed before
+* the copy; such a write faults and waits for the new PTE.
+*/
+
+extern unsigned long max_pfn_mapped;
+
+struct compact_control {
+	uintptr_t start_pfn;
+	uintptr_t end_pfn;
+
+	unsigned long nr_pages;
+	unsigned long nr_isolated;
+	int failed;
+};
+
+static atomic_t compact_running;
+
+static struct work_struct kcompactd_work;
+static volatile uint8_t kcompactd_order;
+
+/* Held with interrupts off while a page is copied and remapped */
+static spinlock_t compact_lock;
+
+static int page_movable(struct page *page){
+	if (!(page->flags & PG_ANON) || page->order != 0)
+		return 0;
+
+	if (page->flags & (PG_SWAPCACHE | PG_LOCKED | PG_WRITEBACK | PG_ERROR | PG_ISOLATED))
+		return 0;
+
+	return atomic_read(&page->refcount) == 1;
+}
+
+/*
+* Number of free pages in [start, end), or -1 when the range holds
+* anything compaction cannot move. `movable` gets the rest.
+*/
+static long scan_block(uintptr_t start, uintptr_t end, unsigned long *movable){
+	long nr_free = 0;
+	*movable = 0;
+
+	for (uintptr_t pfn = start; pfn < end; ) {
+		struct page *page = pfn_to_page(pfn);
+
+		if (page->flags & PG_BUDDY) {
+			if (pfn + (1UL << page->order) > end)
+				return -1;
+
+			nr_free += 1L << page->order;
+			pfn += 1UL << page->order;
+			continue;
+		}
+
+		if (!page_movable(page))
+			return -1;
+
+		(*movable)++;
+		pfn++;
+	}
+
+	return nr_free;
+}
+
+static int pick_block(uint8_t order, struct compact_control *cc){
+	const unsigned long nr_pages = 1UL << order;
+	unsigned long best_movable = nr_pages;
+	int found = 0;
+
+	for (uintptr_t pfn = 0; pfn + nr_pages <= max_pfn_mapped; pfn += nr_pages) {
+		unsigned long movable;
+
+		if (scan_block(pfn, pfn + nr_pages, &movable) < 0)
+			continue;
+
+		if (!found || movable < best_movable) {
+			cc->start_pfn = pfn;
+			best_movable = movable;
+			found = 1;
+		}
+	}
+
+	if (!found)
+		return -ENOENT;
+
+	cc->end_pfn = cc->start_pfn + nr_pages;
+	cc->nr_pages = nr_pages;
+	cc->nr_isolated = 0;
+	cc->failed = 0;
+
+	return SUCCESS;
+}
+
+static int isolate_free_pages(struct compact_control *cc){
+	for (uintptr_t pfn = cc->start_pfn; pfn < cc->end_pfn; ) {
+		struct page *page = pfn_to_page(pfn);
+
+		if (!(page->flags & PG_BUDDY)) {
+			pfn++;
+			continue;
+		}
+
+		// Its tail past end_pfn would never be handed back
+		int order = page_isolate_free(page, cc->end_pfn - pfn);
+		if (IS_ERR_VALUE(order))
+			return order;
+
+		cc->nr_isolated += 1UL << order;
+		pfn += 1UL << order;
+	}
+
+	return SUCCESS;
+}
+
+static int migrate_pte(struct paging_ctx *ctx, pte_t *pte, uintptr_t vaddr, void *data){
+	struct compact_control *cc = data;
+	const struct paging_ops *ops = ctx->ops;
+	unsigned long flags;
+
+	const pte_t val = *pte;
+	if (!ops->pte_present(val))
+		return 0;
+
+	uintptr_t pfn = ops->pte_phys(val) >> PAGE_SHIFT;
+	if (pfn < cc->start_pfn || pfn >= cc->end_pfn)
+		return 0;
+
+	struct page *page = pfn_to_page(pfn);
+	if (page->flags & PG_ISOLATED)
+		return 0;
+
+	struct page *new_page = page_alloc(0, page->flags);
+	if (!new_page) {
+		cc->failed = -ENOMEM;
+		return 1;
+	}
+
+	spin_lock_irqsave(&compact_lock, &flags);
+
+	const pte_t cur = *pte;
+
+	if (!ops->pte_present(cur) || ops->pte_phys(cur) != ops->pte_phys(val) || !page_movable(page)) {
+		spin_unlock_irqrestore(&compact_lock, &flags);
+		page_free(new_page);
+		cc->failed = -EBUSY;
+		return 1;
+	}
+
+	mem_flags_t wp = arch_mmu_flags(ops->pte_flags(cur)) & ~MEM_WRITE;
+	ops->set_pte(pte, ops->mk_pte(ops->pte_phys(cur), mmu_flags_arch(wp)));
+	ops->flush_tlb_one(ctx, vaddr);
+
+	memcpy((void*)page_to_virt(new_page), (void*)page_to_virt(page), PAGE_SIZE);
+
+	ops->set_pte(pte, ops->mk_pte(page_to_phys(new_page), ops->pte_flags(cur)));
+	ops->flush_tlb_one(ctx, vaddr);
+
+	page->flags = PG_ISOLATED;
+	atomic_set(&page->refcount, 0);
+
+	spin_unlock_irqrestore(&compact_lock, &flags);
+
+	return ++cc->nr_isolated == cc->nr_pages;
+}
+
+static void migrate_pages(struct compact_control *cc){
+	struct mm_struct *prev = NULL;
+
+	while (cc->nr_isolated < cc->nr_pages && !cc->failed) {
+		struct mm_struct *mm = NULL;
+
+		spin_lock(&mm_list_lock);
+
+		struct list_head *pos = prev ? prev->mmlist.next : mm_list.next;
+		for (; pos != &mm_list; pos = pos->next) {
+			struct mm_struct *cur = list_entry(pos, struct mm_struct, mmlist);
+
+			if (cur->ctx && atomic_read(&cur->refcount)) {
+				vma_get(cur);
+				mm = cur;
+				break;
+			}
+		}
+
+		spin_unlock(&mm_list_lock);
+
+		if (prev)
+			vma_put(prev);
+
+		if (!mm)
+			break;
+
+		prev = mm;
+
+		/*
+		* Called from a fault we already hold this lock. Any other
+		* address space is only tried: its owner may be waiting on
+		* us for memory.
+		*/
+		const int locked = mutex_owner(&mm->fault_lock) != current;
+		if (locked && !mutex_trylock(&mm->fault_lock))
+			continue;
+
+		mmu_walk_ptes(mm->ctx, USER_SPACE_START, USER_SPACE_END, migrate_pte, cc);
+
+		if (locked)
+			mutex_unlock(&mm->fault_lock);
+	}
+
+	if (prev)
+		vma_put(prev);
+}
+
+/* Hand the block back to the buddy allocator, whole or page by page */
+static void release_block(struct compact_control *cc, uint8_t order){
+	struct page *head = pfn_to_page(cc->start_pfn);
+
+	if (cc->nr_isolated == cc->nr_pages) {
+		for (unsigned long i = 0; i < cc->nr_pages; i++)
+			head[i].flags = 0;
+
+		head->order = order;
+		atomic_set(&head->refcount, 1);
+		page_free(head);
+		return;
+	}
+
+	for (unsigned long i = 0; i < cc->nr_pages; i++) {
+		if (!(head[i].flags & PG_ISOLATED))
+			continue;
+
+		head[i].flags = 0;
+		head[i].order = 0;
+		atomic_set(&head[i].refcount, 1);
+		page_free(&head[i]);
+	}
+}
+
+/*
+* Try to assemble one free block of `order`. Must be called from process
+* context without locks held.
+*/
+int compact_pages(uint8_t order){
+	struct compact_control cc;
+
+	if (!order || order >= MAX_ORDER)
+		return -EINVAL;
+
+	if (atomic_cmpxchg(&compact_running, 0, 1) != 0)
+		return -EBUSY;
+
+	int res = pick_block(order, &cc);
+	if (IS_ERR_VALUE(res))
+		goto out;
+
+	res = isolate_free_pages(&cc);
+	if (res == SUCCESS)
+		migrate_pages(&cc);
+
+	if (res == SUCCESS)
+		res = cc.nr_isolated == cc.nr_pages ? SUCCESS : (cc.failed ? cc.failed : -EAGAIN);
+
+	release_block(&cc, order);
+
+out:
+	atomic_set(&compact_running, 0);
+	return res;
+}
+
+int fragmentation_index(uint8_t order){
+	unsigned long nr_free[MAX_ORDER];
+	unsigned long free_pages, blocks = 0;
+
+	if (order >= MAX_ORDER)
+		return -EINVAL;
+
+	page_free_info(nr_free, &free_pages);
+
+	for (int i = 0; i < MAX_ORDER; i++) {
+		if (i >= order && nr_free[i])
+			return -1000;
+
+		blocks += nr_free[i];
+	}
+
+	if (!blocks)
+		return 0;
+
+	return 1000 - (1000 + (free_pages * 1000) / (1UL << order)) / blocks;
+}
+
+void compaction_report(void){
+	printk("Compaction: fragmentation index");
+
+	for (uint8_t order = 1; order < MAX_ORDER; order++) {
+		int index = fragmentation_index(order);
+
+		if (index < 0)
+			printk(" %u:-1", order);
+		else
+			printk(" %u:%d.%03d", order, index / 1000, index % 1000);
+	}
+
+	printk("\n");
+}
+
+void wakeup_kcompactd(uint8_t order){
+	if (order > kcompactd_order)
+		kcompactd_order = order;
+}
+
+/* wakeup_kcompactd() runs inside the allocator, the tick queues the work */
+static void kcompactd_tick(void *unused){
+	if (kcompactd_order)
+		queue_work(system_unbound_wq, &kcompactd_work);
+}
+
+static tick_t kcompactd_next_tick(void *unused){
+	return kcompactd_order ? clock_get_ticks() + 1 : TICK_NONE;
+}
+
+static void kcompactd(struct work_struct *work){
+	uint8_t order = kcompactd_order;
+	kcompactd_order = 0;
+
+	if (order) {
+		int res = compact_pages(order);
+
+		printk("Compaction: order %u %s (%d)\n",
+			order, res == SUCCESS ? "done" : "failed", res);
+		compaction_report();
+	}
+}
+
+static int __init compaction_init(void){
+	spinlock_init(&compact_lock);
+	atomic_set(&compact_running, 0);
+	INIT_WORK(&kcompactd_work, kcompactd);
+
+	int res = clockevent_register_nohz_listener(kcompactd_tick, kcompactd_next_tick, NULL);
+	if (IS_ERR_VALUE(res))
+		return res;
+
+	return SUCCESS;
+}
+
+late_initcall(compaction_init);
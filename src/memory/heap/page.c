@@ -1,4 +1,5 @@
 #include <mm/page.h>
+#include <mm/compaction.h>
 #include <mm/memblock.h>
 #include <sync/spinlock.h>
 #include <kernel/printk.h>
@@ -14,7 +15,7 @@
 extern unsigned long max_pfn_mapped;
 
 struct free_area {
-	struct list_head free_list;
+	uint32_t free_list;
 	unsigned long nr_free;
 };
 
@@ -28,14 +29,43 @@ struct zone {
 
 static struct zone global_zone;
 
-static inline uintptr_t page_to_pfn(struct page *page){
+_Static_assert(sizeof(struct page) == 16, "struct page must stay 16 bytes");
+
+uintptr_t page_to_pfn(struct page *page){
 	return (uintptr_t)(page - vmemmap);
 }
 
-static inline struct page *pfn_to_page(uintptr_t pfn){
+struct page *pfn_to_page(uintptr_t pfn){
 	return &vmemmap[pfn];
 }
 
+/* Free lists are linked by PFN, PFN_NONE terminates them */
+static inline void free_list_add(struct free_area *area, struct page *page){
+	uint32_t pfn = page_to_pfn(page);
+
+	page->buddy.prev = PFN_NONE;
+	page->buddy.next = area->free_list;
+
+	if (area->free_list != PFN_NONE)
+		vmemmap[area->free_list].buddy.prev = pfn;
+
+	area->free_list = pfn;
+	area->nr_free++;
+}
+
+static inline void free_list_del(struct free_area *area, struct page *page){
+	if (page->buddy.prev != PFN_NONE)
+		vmemmap[page->buddy.prev].buddy.next = page->buddy.next;
+	else
+		area->free_list = page->buddy.next;
+
+	if (page->buddy.next != PFN_NONE)
+		vmemmap[page->buddy.next].buddy.prev = page->buddy.prev;
+
+	page->buddy.next = page->buddy.prev = PFN_NONE;
+	area->nr_free--;
+}
+
 struct page* phys_to_page(uintptr_t phys_addr) {
 	return pfn_to_page(phys_addr >> PAGE_SHIFT);
 }
@@ -81,9 +111,9 @@ static __init int pfn_range_reserved(uintptr_t start, uintptr_t pages){
 int __init page_init(void){
 	global_zone.reserved_pages = 0;
 	global_zone.free_pages = 0;
-	spinlock_init(&global_zone.lock);
+	spinlock_init_class(&global_zone.lock, "global_zone.lock");
 	for(int i = 0; i < MAX_ORDER; i++) {
-		INIT_LIST_HEAD(&global_zone.free_area[i].free_list);
+		global_zone.free_area[i].free_list = PFN_NONE;
 		global_zone.free_area[i].nr_free = 0;
 	}
 
@@ -134,10 +164,8 @@ int __init page_init(void){
 			page->order = order;
 			page->flags = PG_BUDDY;
 			atomic_set(&page->refcount, 0);
-			INIT_LIST_HEAD(&page->list);
 
-			list_add(&page->list, &global_zone.free_area[order].free_list);
-			global_zone.free_area[order].nr_free++;
+			free_list_add(&global_zone.free_area[order], page);
 			global_zone.free_pages += num_pages;
 
 			pfn += num_pages;
@@ -161,39 +189,28 @@ struct page* page_alloc(uint8_t order, uint16_t flags) {
 	for (uint8_t cur = order; cur < MAX_ORDER; cur++) {
 		struct free_area *area = &global_zone.free_area[cur];
 
-		if (list_empty(&area->free_list))
+		if (area->free_list == PFN_NONE)
 			continue;
 
-		struct page *page = list_entry(
-			area->free_list.next, struct page, list
-		);
-
-		list_remove(&page->list);
-		INIT_LIST_HEAD(&page->list);
-		area->nr_free--;
+		struct page *page = pfn_to_page(area->free_list);
+		free_list_del(area, page);
 
 		while (cur > order) {
 			cur--;
 
 			struct page *buddy = &page[1UL << cur];
 
-			INIT_LIST_HEAD(&buddy->list);
-
 			buddy->flags = PG_BUDDY;
 			buddy->order = cur;
 
 			atomic_set(&buddy->refcount, 0);
 
-			list_add(
-				&buddy->list,
-				&global_zone.free_area[cur].free_list
-			);
-
-			global_zone.free_area[cur].nr_free++;
+			free_list_add(&global_zone.free_area[cur], buddy);
 		}
 
 		page->flags = flags;
 		page->order = order;
+		page->private = NULL;
 
 		atomic_set(&page->refcount, 1);
 		global_zone.free_pages -= (1UL << order);
@@ -203,6 +220,10 @@ struct page* page_alloc(uint8_t order, uint16_t flags) {
 	}
 
 	spin_unlock(&global_zone.lock);
+
+	if (order)
+		wakeup_kcompactd(order);
+
 	return NULL;
 }
 
@@ -247,12 +268,10 @@ int page_free(struct page *page){
 		if (!(buddy->flags & PG_BUDDY) || (buddy->order != order))
 			break;
 
-		list_remove(&buddy->list);
-		global_zone.free_area[order].nr_free--;
+		free_list_del(&global_zone.free_area[order], buddy);
 
 		buddy->flags &= ~PG_BUDDY; 
 		buddy->order = 0;
-		INIT_LIST_HEAD(&buddy->list);
 
 		pfn &= ~(1UL << order); 
 		order++;
@@ -260,14 +279,12 @@ int page_free(struct page *page){
 
 	struct page *merged = pfn_to_page(pfn);
 
-	INIT_LIST_HEAD(&merged->list);
 	merged->flags = PG_BUDDY;
 	merged->order = order;
 	atomic_set(&merged->refcount, 0);
 
-	list_add(&merged->list, &global_zone.free_area[order].free_list);
+	free_list_add(&global_zone.free_area[order], merged);
 
-	global_zone.free_area[order].nr_free++;
 	global_zone.free_pages += (1UL << orig_order);
 
 out:
@@ -275,6 +292,50 @@ out:
 	return res;
 }
 
+/*
+* Take the free block headed by `page` off the free lists for compaction.
+* Its pages are marked PG_ISOLATED; returns the block order. A block that
+* has merged past `max_pages` since it was scanned is left alone (-EBUSY).
+*/
+int page_isolate_free(struct page *page, unsigned long max_pages){
+	spin_lock(&global_zone.lock);
+
+	if (!(page->flags & PG_BUDDY)) {
+		spin_unlock(&global_zone.lock);
+		return -EINVAL;
+	}
+
+	uint8_t order = page->order;
+
+	if ((1UL << order) > max_pages) {
+		spin_unlock(&global_zone.lock);
+		return -EBUSY;
+	}
+
+	free_list_del(&global_zone.free_area[order], page);
+	global_zone.free_pages -= (1UL << order);
+
+	for (unsigned long i = 0; i < (1UL << order); i++) {
+		page[i].flags = PG_ISOLATED;
+		page[i].order = 0;
+		atomic_set(&page[i].refcount, 0);
+	}
+
+	spin_unlock(&global_zone.lock);
+	return order;
+}
+
+void page_free_info(unsigned long nr_free[MAX_ORDER], unsigned long *free_pages){
+	spin_lock(&global_zone.lock);
+
+	for (int i = 0; i < MAX_ORDER; i++)
+		nr_free[i] = global_zone.free_area[i].nr_free;
+
+	*free_pages = global_zone.free_pages;
+
+	spin_unlock(&global_zone.lock);
+}
+
 void __page_add_memory(uintptr_t vaddr, size_t size){
 	uintptr_t start = ALIGN_UP((uintptr_t)vaddr, PAGE_SIZE);
     uintptr_t end = ALIGN_DOWN(start + size, PAGE_SIZE);
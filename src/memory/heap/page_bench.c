@@ -0,0 +1,74 @@
+#ifdef CONFIG_PAGE_BENCH
+
+#include <mm/page.h>
+#include <kernel/clock.h>
+#include <kernel/fork.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+/**
+* Buddy allocator throughput, run once after boot with `make PAGE_BENCH=1`.
+*
+* Each pass counts alloc/free pairs completed in one second of timer
+* ticks, either back to back (the page is split and merged again every
+* time) or in batches that keep BENCH_BATCH blocks live at once.
+* tools/bench/page_bench.sh runs the same loop on the build host, to
+* compare revisions without booting them.
+*/
+
+#define BENCH_BATCH 64
+
+static unsigned long bench_pass(uint8_t order, int batch){
+	struct page *pages[BENCH_BATCH];
+	unsigned long pairs = 0;
+
+	tick_t start = clock_get_ticks();
+	while (clock_get_ticks() == start)
+		;
+
+	tick_t end = start + 1 + TIMER_FREQUENCY;
+
+	while (clock_get_ticks() < end) {
+		int n = 0;
+
+		while (n < batch && (pages[n] = page_alloc(order, PG_KERNEL)))
+			n++;
+
+		if (!n)
+			return 0;
+
+		for (int i = 0; i < n; i++)
+			page_free(pages[i]);
+
+		pairs += n;
+	}
+
+	return pairs;
+}
+
+static int page_bench(void *unused){
+	static const uint8_t orders[] = { 0, 1, 3 };
+
+	printk("Buddy bench: struct page %u bytes\n", sizeof(struct page));
+
+	for (unsigned int i = 0; i < sizeof(orders); i++) {
+		unsigned long single = bench_pass(orders[i], 1);
+		unsigned long batched = bench_pass(orders[i], BENCH_BATCH);
+
+		printk("Buddy bench: order %u: %lu pairs/s single, %lu pairs/s batch %d\n",
+			orders[i], single, batched, BENCH_BATCH);
+	}
+
+	return SUCCESS;
+}
+
+static int __init page_bench_init(void){
+	pid_t pid = kernel_thread(page_bench, "page_bench", NULL);
+	return pid < 0 ? pid : SUCCESS;
+}
+
+late_initcall(page_bench_init);
+
+#endif
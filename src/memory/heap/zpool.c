@@ -0,0 +1,140 @@
+#include <mm/zpool.h>
+#include <mm/kheap.h>
+#include <mm/page.h>
+#include <def/config.h>
+#include <def/errno.h>
+#include <lib/string.h>
+#include <lib/assert.h>
+#include <asm/paging.h>
+
+#define ALIGN_UP(v,a)  (((v) + (a) - 1) & ~((a)-1))
+
+static inline int zpool_class_index(size_t size){
+	return ALIGN_UP(size, ZPOOL_CLASS_DELTA) / ZPOOL_CLASS_DELTA - 1;
+}
+
+static struct zpool_page* zpool_page_create(struct zpool_class *class){
+	struct page* page = page_alloc(0, PG_KERNEL | PG_SLAB);
+	if(!page)
+		return NULL;
+
+	uintptr_t virt = page_to_virt(page);
+
+	struct zpool_page *zpage = (struct zpool_page*)virt;
+	memset(zpage, 0x0, sizeof(*zpage));
+
+	zpage->page = page;
+	zpage->class = class;
+	page->private = zpage;
+
+	uintptr_t obj = ALIGN_UP(virt + sizeof(struct zpool_page), ZPOOL_CLASS_DELTA);
+	zpage->total = (PAGE_SIZE - (obj - virt)) / class->size;
+
+	for(uint16_t i = 0; i < zpage->total; i++){
+		*(void**)obj = zpage->free_list;
+		zpage->free_list = (void*)obj;
+		obj += class->size;
+	}
+
+	INIT_LIST_HEAD(&zpage->list);
+	return zpage;
+}
+
+struct zpool* zpool_create(void){
+	struct zpool *pool = kzalloc(sizeof(struct zpool));
+	if(!pool)
+		return NULL;
+
+	for(int i = 0; i < ZPOOL_NR_CLASSES; i++){
+		pool->classes[i].size = (i + 1) * ZPOOL_CLASS_DELTA;
+		INIT_LIST_HEAD(&pool->classes[i].partial);
+		INIT_LIST_HEAD(&pool->classes[i].full);
+	}
+
+	spinlock_init(&pool->lock);
+	return pool;
+}
+
+static void zpool_free_pages(struct list_head *head){
+	struct zpool_page *zpage, *next;
+
+	list_for_each_entry_safe(zpage, next, head, list){
+		list_remove(&zpage->list);
+		page_free(zpage->page);
+	}
+}
+
+void zpool_destroy(struct zpool *pool){
+	for(int i = 0; i < ZPOOL_NR_CLASSES; i++){
+		zpool_free_pages(&pool->classes[i].partial);
+		zpool_free_pages(&pool->classes[i].full);
+	}
+
+	kfree(pool);
+}
+
+void* zpool_alloc(struct zpool *pool, size_t size){
+	if(size == 0 || size > ZPOOL_MAX_SIZE)
+		return NULL;
+
+	struct zpool_class *class = &pool->classes[zpool_class_index(size)];
+	struct zpool_page *zpage;
+
+	spin_lock(&pool->lock);
+
+	if(list_empty(&class->partial)){
+		zpage = zpool_page_create(class);
+		if(!zpage){
+			spin_unlock(&pool->lock);
+			return NULL;
+		}
+
+		list_add(&zpage->list, &class->partial);
+		pool->pages++;
+	}
+	else {
+		zpage = list_first_entry(&class->partial, struct zpool_page, list);
+	}
+
+	void *obj = zpage->free_list;
+	zpage->free_list = *(void**)obj;
+	zpage->inuse++;
+	pool->objects++;
+
+	if(zpage->inuse == zpage->total){
+		list_remove(&zpage->list);
+		list_add(&zpage->list, &class->full);
+	}
+
+	spin_unlock(&pool->lock);
+	return obj;
+}
+
+void zpool_free(struct zpool *pool, void *obj){
+	if(!obj)
+		return;
+
+	struct page *page = virt_to_page((uintptr_t)obj);
+	struct zpool_page *zpage = page->private;
+	BUG_ON(!zpage || zpage->page != page);
+
+	spin_lock(&pool->lock);
+
+	if(zpage->inuse == zpage->total){
+		list_remove(&zpage->list);
+		list_add(&zpage->list, &zpage->class->partial);
+	}
+
+	*(void**)obj = zpage->free_list;
+	zpage->free_list = obj;
+	zpage->inuse--;
+	pool->objects--;
+
+	if(zpage->inuse == 0){
+		list_remove(&zpage->list);
+		page_free(page);
+		pool->pages--;
+	}
+
+	spin_unlock(&pool->lock);
+}
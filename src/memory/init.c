@@ -69,7 +69,7 @@ static void __init paging_map_ram(void){
 		last_phys_mapped = end - 1;
 	}
 
-	arch_paging_ops.flush_all();
+	arch_paging_ops.flush_all(&kernel_ctx);
 
 	max_pfn_mapped = (last_phys_mapped + 1) >> PAGE_SHIFT;
 
@@ -185,8 +185,9 @@ static __init int vmemmap_populate(void) {
 		KERNEL_VMEMMAP_START + vmemmap_size
 	);
 
-	printk("VMEMMAP: pages %u, mem %luMiB, metadata %luKiB\n",
-		total_pages, (total_pages * PAGE_SIZE) / MiB(1), vmemmap_size / KiB(1)
+	printk("VMEMMAP: pages %u, mem %luMiB, metadata %luKiB (%u bytes per page)\n",
+		total_pages, (total_pages * PAGE_SIZE) / MiB(1), vmemmap_size / KiB(1),
+		sizeof(struct page)
 	);
 
 	return SUCCESS;
@@ -0,0 +1,416 @@
+#include <mm/swap.h>
+#include <mm/kheap.h>
+#include <kernel/printk.h>
+#include <kernel/wait.h>
+#include <kernel/init.h>
+#include <lib/string.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+/**
+* Swap cache.
+*
+* A page being written out or read back lives here, hashed by its swap
+* entry, so concurrent faults on the same slot find one shared copy.
+* Hash chains are singly linked through `page->swap.next` by PFN. The
+* cache holds a page reference and a slot reference; a cache page is never
+* mapped writable, the first write goes through the COW path.
+*/
+
+#define SWAP_CACHE_HASH_SIZE 256
+
+static uint32_t swap_cache[SWAP_CACHE_HASH_SIZE];
+static spinlock_t swap_cache_lock;
+
+/* Faults waiting for a swap-in to clear PG_LOCKED */
+static struct wait_queue_head swap_read_wait;
+
+unsigned long swap_cache_pages;
+
+struct swap_cluster {
+	int nr;
+	struct page *bounce;
+	struct page *pages[SWAP_CLUSTER_MAX];
+};
+
+static inline unsigned int swap_hash(swp_entry_t entry){
+	return (entry.val ^ (entry.val >> 6)) % SWAP_CACHE_HASH_SIZE;
+}
+
+static inline int page_locked(struct page *page){
+	return *(volatile uint16_t*)&page->flags & PG_LOCKED;
+}
+
+static void wait_on_page_locked(struct page *page){
+	struct wait_queue_entry wait;
+
+	if (!page_locked(page))
+		return;
+
+	wait_queue_entry_init(&wait, current, task_default_wakeup);
+	wait_queue_add(&swap_read_wait, &wait);
+
+	while (1) {
+		task_sleep(current);
+
+		if (!page_locked(page)) {
+			current->state = TASK_RUNNING;
+			break;
+		}
+
+		schedule();
+	}
+
+	wait_queue_remove(&swap_read_wait, &wait);
+}
+
+static void unlock_page(struct page *page){
+	page->flags &= ~PG_LOCKED;
+	wake_up_all(&swap_read_wait);
+}
+
+static struct page* __swap_cache_lookup(swp_entry_t entry){
+	for (uint32_t pfn = swap_cache[swap_hash(entry)]; pfn != PFN_NONE; ) {
+		struct page *page = pfn_to_page(pfn);
+
+		if (page->swap.entry == entry.val)
+			return page;
+
+		pfn = page->swap.next;
+	}
+
+	return NULL;
+}
+
+struct page* swap_cache_lookup(swp_entry_t entry){
+	spin_lock(&swap_cache_lock);
+
+	struct page *page = __swap_cache_lookup(entry);
+	if (page)
+		page_get(page);
+
+	spin_unlock(&swap_cache_lock);
+	return page;
+}
+
+static void __swap_cache_add(struct page *page, swp_entry_t entry){
+	uint32_t *head = &swap_cache[swap_hash(entry)];
+
+	page_get(page);
+	page->swap.entry = entry.val;
+	page->swap.next = *head;
+	page->flags |= PG_SWAPCACHE;
+	*head = page_to_pfn(page);
+	swap_cache_pages++;
+}
+
+/* Consumes one slot reference, which the caller must already hold */
+int swap_cache_add(struct page *page, swp_entry_t entry){
+	if (page->flags & PG_SWAPCACHE)
+		return -EEXIST;
+
+	spin_lock(&swap_cache_lock);
+
+	if (__swap_cache_lookup(entry)) {
+		spin_unlock(&swap_cache_lock);
+		return -EEXIST;
+	}
+
+	__swap_cache_add(page, entry);
+
+	spin_unlock(&swap_cache_lock);
+	return SUCCESS;
+}
+
+static void __swap_cache_del(struct page *page){
+	const uint32_t pfn = page_to_pfn(page);
+	uint32_t *link = &swap_cache[swap_hash(page_swp_entry(page))];
+
+	while (*link != pfn)
+		link = &pfn_to_page(*link)->swap.next;
+
+	*link = page->swap.next;
+
+	page->flags &= ~PG_SWAPCACHE;
+	page->swap.entry = 0;
+	page->swap.next = PFN_NONE;
+	swap_cache_pages--;
+}
+
+void swap_cache_del(struct page *page){
+	if (!(page->flags & PG_SWAPCACHE))
+		return;
+
+	swp_entry_t entry = page_swp_entry(page);
+
+	spin_lock(&swap_cache_lock);
+	__swap_cache_del(page);
+	spin_unlock(&swap_cache_lock);
+
+	swap_free(entry);
+	page_put(page);
+}
+
+static void swap_write_done(struct page *page, int status){
+	page->flags &= ~PG_WRITEBACK;
+
+	if (IS_ERR_VALUE(status)) {
+		page->flags |= PG_ERROR | PG_DIRTY;
+		printk("Swap: write of entry %#lx failed %d\n",
+			page_swp_entry(page).val, status);
+		return;
+	}
+
+	// Nobody mapped it back while it was in flight
+	if (atomic_read(&page->refcount) == 1)
+		swap_cache_del(page);
+}
+
+static void end_swap_write(struct bio *bio){
+	swap_write_done(bio->private, bio->status);
+	kfree(bio);
+}
+
+static void end_swap_cluster_write(struct bio *bio){
+	struct swap_cluster *cluster = bio->private;
+
+	for (int i = 0; i < cluster->nr; i++)
+		swap_write_done(cluster->pages[i], bio->status);
+
+	page_free(cluster->bounce);
+	kfree(cluster);
+	kfree(bio);
+}
+
+static void end_swap_read(struct bio *bio){
+	struct page *page = bio->private;
+
+	if (IS_ERR_VALUE(bio->status))
+		page->flags |= PG_ERROR;
+
+	unlock_page(page);
+	kfree(bio);
+}
+
+int swap_writepage(struct page *page){
+	if (!(page->flags & PG_SWAPCACHE))
+		return -EINVAL;
+
+	page->flags &= ~(PG_DIRTY | PG_ERROR);
+	page->flags |= PG_WRITEBACK;
+
+	int res = swap_io(
+		page_swp_entry(page), (void*)page_to_virt(page), 1,
+		BLK_WRITE, end_swap_write, page
+	);
+
+	if (res == -ENOMEM)
+		swap_write_done(page, res);
+
+	return res;
+}
+
+static int cluster_contiguous(struct page **pages, int nr){
+	for (int i = 1; i < nr; i++) {
+		if (page_swp_entry(pages[i]).val != page_swp_entry(pages[0]).val + ((unsigned long)i << SWP_TYPE_BITS))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+* Write a batch of swap cache pages. When their slots are contiguous the
+* batch goes to disk as a single request through a bounce buffer, otherwise
+* (or when the bounce buffer cannot be allocated) page by page.
+*/
+void swap_writepage_cluster(struct page **pages, int nr){
+	if (nr <= 0)
+		return;
+
+	uint8_t order = 0;
+	while ((1 << order) < nr)
+		order++;
+
+	struct swap_cluster *cluster = NULL;
+	struct page *bounce = NULL;
+
+	if (nr > 1 && cluster_contiguous(pages, nr)) {
+		cluster = kmalloc(sizeof(struct swap_cluster));
+		bounce = cluster ? page_alloc(order, PG_KERNEL) : NULL;
+	}
+
+	if (!bounce) {
+		if (cluster)
+			kfree(cluster);
+
+		for (int i = 0; i < nr; i++)
+			swap_writepage(pages[i]);
+
+		return;
+	}
+
+	uint8_t *buffer = (uint8_t*)page_to_virt(bounce);
+
+	cluster->nr = nr;
+	cluster->bounce = bounce;
+
+	for (int i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+
+		page->flags &= ~(PG_DIRTY | PG_ERROR);
+		page->flags |= PG_WRITEBACK;
+
+		memcpy(buffer + i * PAGE_SIZE, (void*)page_to_virt(page), PAGE_SIZE);
+		cluster->pages[i] = page;
+	}
+
+	int res = swap_io(
+		page_swp_entry(pages[0]), buffer, nr,
+		BLK_WRITE, end_swap_cluster_write, cluster
+	);
+
+	if (res == -ENOMEM) {
+		for (int i = 0; i < nr; i++)
+			swap_write_done(pages[i], res);
+
+		page_free(bounce);
+		kfree(cluster);
+	}
+}
+
+/*
+* Return the cache page for `entry` with a reference held, starting the
+* read if it is not cached yet. Returns NULL when the slot is gone or
+* no memory is available.
+*/
+static struct page* read_swap_cache_async(swp_entry_t entry, int may_reclaim){
+	struct page *page = swap_cache_lookup(entry);
+	if (page)
+		return page;
+
+	if (!swap_count(entry))
+		return NULL;
+
+	const uint16_t flags = PG_ANON | PG_LOCKED;
+	page = may_reclaim ? page_alloc_reclaim(0, flags) : page_alloc(0, flags);
+	if (!page)
+		return NULL;
+
+	if (IS_ERR_VALUE(swap_duplicate(entry))) {
+		page_put(page);
+		return NULL;
+	}
+
+	// Someone else may have started the read since the lookup above
+	spin_lock(&swap_cache_lock);
+
+	struct page *cached = __swap_cache_lookup(entry);
+	if (cached) {
+		page_get(cached);
+		spin_unlock(&swap_cache_lock);
+
+		swap_free(entry);
+		page_put(page);
+		return cached;
+	}
+
+	__swap_cache_add(page, entry);
+	spin_unlock(&swap_cache_lock);
+
+	int res = swap_io(
+		entry, (void*)page_to_virt(page), 1,
+		BLK_READ, end_swap_read, page
+	);
+
+	if (res == -ENOMEM) {
+		page->flags |= PG_ERROR;
+		unlock_page(page);
+	}
+
+	return page;
+}
+
+/*
+* Bring `entry` in together with its neighbours in an aligned window of
+* SWAP_READAHEAD slots; the extra pages are left in the swap cache only.
+*/
+struct page* swapin_readahead(swp_entry_t entry){
+	struct page *page = read_swap_cache_async(entry, 1);
+	if (!page)
+		return ERR_PTR(-ENOMEM);
+
+	unsigned long offset = swp_offset(entry);
+	unsigned long start = offset & ~(SWAP_READAHEAD - 1UL);
+
+	for (unsigned long off = start; off < start + SWAP_READAHEAD; off++) {
+		swp_entry_t ra = swp_entry(swp_type(entry), off);
+
+		if (off == offset || !swap_entry_valid(ra) || !swap_count(ra))
+			continue;
+
+		struct page *ra_page = read_swap_cache_async(ra, 0);
+		if (!ra_page)
+			break;
+
+		page_put(ra_page);
+	}
+
+	wait_on_page_locked(page);
+
+	if (page->flags & PG_ERROR) {
+		swap_cache_del(page);
+		page_put(page);
+		return ERR_PTR(-EIO);
+	}
+
+	return page;
+}
+
+/*
+* Drop clean cache pages nobody maps anymore. Returns the number of pages
+* given back to the buddy allocator.
+*/
+unsigned long shrink_swap_cache(unsigned long nr_pages){
+	unsigned long freed = 0;
+
+	for (int i = 0; i < SWAP_CACHE_HASH_SIZE && freed < nr_pages; i++) {
+		spin_lock(&swap_cache_lock);
+
+		for (uint32_t pfn = swap_cache[i]; pfn != PFN_NONE; ) {
+			struct page *page = pfn_to_page(pfn);
+			pfn = page->swap.next;
+
+			if (page->flags & (PG_LOCKED | PG_WRITEBACK | PG_DIRTY))
+				continue;
+
+			if (atomic_read(&page->refcount) != 1)
+				continue;
+
+			swp_entry_t entry = page_swp_entry(page);
+			__swap_cache_del(page);
+
+			swap_free(entry);
+			page_put(page);
+
+			if (++freed >= nr_pages)
+				break;
+		}
+		spin_unlock(&swap_cache_lock);
+	}
+
+	return freed;
+}
+
+static int __init swap_cache_init(void){
+	spinlock_init(&swap_cache_lock);
+	wait_queue_head_init(&swap_read_wait);
+	swap_cache_pages = 0;
+
+	for (int i = 0; i < SWAP_CACHE_HASH_SIZE; i++)
+		swap_cache[i] = PFN_NONE;
+
+	return SUCCESS;
+}
+
+core_initcall(swap_cache_init);
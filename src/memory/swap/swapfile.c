@@ -0,0 +1,486 @@
+#include <mm/swap.h>
+#include <mm/kheap.h>
+#include <device/blkdev.h>
+#include <kernel/syscall.h>
+#include <kernel/uaccess.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <kernel/completion.h>
+#include <lib/bitmap.h>
+#include <lib/string.h>
+#include <def/config.h>
+#include <def/errno.h>
+#include <fs/stat.h>
+#include <fs/vfs.h>
+
+/**
+* Swap areas and slot allocation.
+*
+* Each area keeps a bitmap of allocated slots plus a small per slot
+* reference count (one for the swap cache, one per PTE holding the entry).
+* Slots are handed out next-fit from `cluster_next`, so pages reclaimed
+* together end up contiguous on disk and can be written in one request.
+*/
+
+static struct swap_info swap_info[SWAP_AREAS_MAX];
+static unsigned int nr_swapfiles;
+static spinlock_t swap_lock;
+
+unsigned long nr_swap_pages;
+unsigned long total_swap_pages;
+
+static struct swap_info* swap_info_get(swp_entry_t entry){
+	unsigned int type = swp_type(entry);
+	unsigned long offset = swp_offset(entry);
+
+	if (type >= nr_swapfiles)
+		return NULL;
+
+	struct swap_info *si = &swap_info[type];
+	if (!(si->flags & SWP_USED) || offset == 0 || offset >= si->max)
+		return NULL;
+
+	return si;
+}
+
+int swap_entry_valid(swp_entry_t entry){
+	return swap_info_get(entry) != NULL;
+}
+
+static int swap_setup_area(struct swap_info *si, unsigned long slots){
+	if (slots > (1UL << SWP_OFFSET_BITS))
+		slots = 1UL << SWP_OFFSET_BITS;
+
+	if (slots < 2)
+		return -EINVAL;
+
+	si->bitmap = kzalloc(BITS_TO_LONGS(slots) * sizeof(unsigned long));
+	if (!si->bitmap)
+		return -ENOMEM;
+
+	si->map = kzalloc(slots);
+	if (!si->map) {
+		kfree(si->bitmap);
+		return -ENOMEM;
+	}
+
+	// Slot 0 holds the area header and is never handed out
+	set_bit(0, si->bitmap);
+	si->map[0] = SWAP_MAP_MAX;
+
+	si->max = slots;
+	si->inuse = 0;
+	si->cluster_next = 1;
+	spinlock_init(&si->lock);
+	mutex_init(&si->io_lock);
+
+	return SUCCESS;
+}
+
+void swap_format_header(union swap_header *hdr, unsigned long slots){
+	memset(hdr, 0x0, sizeof(union swap_header));
+
+	hdr->info.version = SWAP_VERSION;
+	hdr->info.last_page = slots - 1;
+	memcpy(hdr->magic.magic, SWAP_MAGIC, SWAP_MAGIC_LEN);
+}
+
+/* Returns the usable slots, 0 when there is no valid header */
+static unsigned long swap_check_header(union swap_header *hdr, unsigned long slots){
+	if (memcmp(hdr->magic.magic, SWAP_MAGIC, SWAP_MAGIC_LEN) != 0)
+		return 0;
+
+	if (hdr->info.version != SWAP_VERSION || hdr->info.nr_badpages != 0)
+		return 0;
+
+	if (hdr->info.last_page == 0 || hdr->info.last_page >= slots)
+		return 0;
+
+	return hdr->info.last_page + 1;
+}
+
+static void swap_header_endio(struct bio *bio){
+	complete(bio->private);
+}
+
+static int swap_read_header_bdev(struct blkdev *bdev, union swap_header *hdr){
+	struct bio *bio = kzalloc(sizeof(struct bio));
+	if (!bio)
+		return -ENOMEM;
+
+	struct completion done;
+	init_completion(&done);
+
+	bio->sector = bdev->start_sector;
+	bio->nr_sectors = PAGE_SIZE / bdev->disk->sec_size;
+	bio->buffer = hdr;
+	bio->op = BLK_READ;
+	bio->end_io = swap_header_endio;
+	bio->private = &done;
+
+	int res = blk_submit_bio(bdev, bio);
+	if (IS_ERR_VALUE(res)) {
+		kfree(bio);
+		return res;
+	}
+
+	wait_for_completion(&done);
+
+	res = bio->status;
+	kfree(bio);
+	return res;
+}
+
+static int swap_read_header_file(struct file *file, union swap_header *hdr){
+	int res = vfs_lseek(file, 0, SEEK_SET);
+	if (IS_ERR_VALUE(res))
+		return res;
+
+	res = vfs_read(file, hdr, sizeof(union swap_header));
+	if (IS_ERR_VALUE(res))
+		return res;
+
+	return res == sizeof(union swap_header) ? SUCCESS : -EINVAL;
+}
+
+static struct swap_info* swap_get_free_area(void){
+	for (unsigned int i = 0; i < SWAP_AREAS_MAX; i++) {
+		if (swap_info[i].flags & SWP_USED)
+			continue;
+
+		memset(&swap_info[i], 0x0, sizeof(struct swap_info));
+		swap_info[i].type = i;
+		return &swap_info[i];
+	}
+
+	return NULL;
+}
+
+static void swap_enable_area(struct swap_info *si){
+	si->flags |= SWP_USED;
+
+	if (si->type >= nr_swapfiles)
+		nr_swapfiles = si->type + 1;
+
+	nr_swap_pages += si->max - 1;
+	total_swap_pages += si->max - 1;
+}
+
+int swap_activate_bdev(struct blkdev *bdev){
+	if (!bdev || !bdev->disk || !bdev->disk->sec_size)
+		return -EINVAL;
+
+	union swap_header *hdr = kmalloc(sizeof(union swap_header));
+	if (!hdr)
+		return -ENOMEM;
+
+	unsigned long slots = (bdev->nr_sectors * bdev->disk->sec_size) / PAGE_SIZE;
+
+	int res = swap_read_header_bdev(bdev, hdr);
+	if (res == SUCCESS)
+		slots = swap_check_header(hdr, slots);
+
+	kfree(hdr);
+
+	if (IS_ERR_VALUE(res))
+		return res;
+
+	if (!slots)
+		return -EINVAL;
+
+	spin_lock(&swap_lock);
+
+	for (unsigned int i = 0; i < nr_swapfiles; i++) {
+		if ((swap_info[i].flags & SWP_USED) && swap_info[i].bdev == bdev) {
+			spin_unlock(&swap_lock);
+			return -EBUSY;
+		}
+	}
+
+	struct swap_info *si = swap_get_free_area();
+	if (!si) {
+		spin_unlock(&swap_lock);
+		return -ENOSPC;
+	}
+
+	res = swap_setup_area(si, slots);
+	if (IS_ERR_VALUE(res)) {
+		spin_unlock(&swap_lock);
+		return res;
+	}
+
+	si->bdev = bdev;
+	si->flags |= SWP_BLKDEV;
+	swap_enable_area(si);
+
+	spin_unlock(&swap_lock);
+
+	printk("Swap: activated \"%s\" minor %u, %lu pages\n",
+		bdev->disk->name, bdev->minor, si->max - 1);
+
+	return SUCCESS;
+}
+
+/* On success the area takes over the caller's file reference */
+int swap_activate_file(struct file *file){
+	if (!file || !file->inode)
+		return -EINVAL;
+
+	union swap_header *hdr = kmalloc(sizeof(union swap_header));
+	if (!hdr)
+		return -ENOMEM;
+
+	unsigned long slots = 0;
+
+	int res = swap_read_header_file(file, hdr);
+	if (res == SUCCESS)
+		slots = swap_check_header(hdr, file->inode->size / PAGE_SIZE);
+
+	kfree(hdr);
+
+	if (IS_ERR_VALUE(res))
+		return res;
+
+	if (!slots)
+		return -EINVAL;
+
+	spin_lock(&swap_lock);
+
+	struct swap_info *si = swap_get_free_area();
+	if (!si) {
+		spin_unlock(&swap_lock);
+		return -ENOSPC;
+	}
+
+	res = swap_setup_area(si, slots);
+	if (IS_ERR_VALUE(res)) {
+		spin_unlock(&swap_lock);
+		return res;
+	}
+
+	si->file = file;
+	swap_enable_area(si);
+
+	spin_unlock(&swap_lock);
+
+	printk("Swap: activated swap file, %lu pages\n", si->max - 1);
+
+	return SUCCESS;
+}
+
+static unsigned long scan_swap_map(struct swap_info *si){
+	unsigned long offset = find_next_zero_bit(si->bitmap, si->max, si->cluster_next);
+
+	if (offset >= si->max)
+		offset = find_next_zero_bit(si->bitmap, si->max, 1);
+
+	if (offset >= si->max)
+		return 0;
+
+	set_bit(offset, si->bitmap);
+	si->map[offset] = 1;
+	si->inuse++;
+	si->cluster_next = offset + 1;
+
+	return offset;
+}
+
+swp_entry_t swap_alloc(void){
+	for (unsigned int i = 0; i < nr_swapfiles; i++) {
+		struct swap_info *si = &swap_info[i];
+
+		if (!(si->flags & SWP_USED))
+			continue;
+
+		spin_lock(&si->lock);
+		unsigned long offset = scan_swap_map(si);
+		spin_unlock(&si->lock);
+
+		if (offset) {
+			spin_lock(&swap_lock);
+			nr_swap_pages--;
+			spin_unlock(&swap_lock);
+
+			return swp_entry(si->type, offset);
+		}
+	}
+
+	return (swp_entry_t){ .val = 0 };
+}
+
+int swap_duplicate(swp_entry_t entry){
+	struct swap_info *si = swap_info_get(entry);
+	if (!si)
+		return -EINVAL;
+
+	unsigned long offset = swp_offset(entry);
+	int res = SUCCESS;
+
+	spin_lock(&si->lock);
+
+	if (!si->map[offset])
+		res = -ENOENT;
+	else if (si->map[offset] >= SWAP_MAP_MAX)
+		res = -EOVERFLOW;
+	else
+		si->map[offset]++;
+
+	spin_unlock(&si->lock);
+	return res;
+}
+
+void swap_free(swp_entry_t entry){
+	struct swap_info *si = swap_info_get(entry);
+	if (!si) {
+		printk("Swap: swap_free: bad entry %#lx\n", entry.val);
+		return;
+	}
+
+	unsigned long offset = swp_offset(entry);
+
+	spin_lock(&si->lock);
+
+	if (!si->map[offset]) {
+		spin_unlock(&si->lock);
+		printk("Swap: swap_free: unused entry %#lx\n", entry.val);
+		return;
+	}
+
+	const int freed = --si->map[offset] == 0;
+	if (freed) {
+		clear_bit(offset, si->bitmap);
+		si->inuse--;
+	}
+
+	spin_unlock(&si->lock);
+
+	if (freed) {
+		spin_lock(&swap_lock);
+		nr_swap_pages++;
+		spin_unlock(&swap_lock);
+	}
+}
+
+int swap_count(swp_entry_t entry){
+	struct swap_info *si = swap_info_get(entry);
+	if (!si)
+		return 0;
+
+	return si->map[swp_offset(entry)];
+}
+
+static int swap_file_io(struct swap_info *si, unsigned long offset, void *buffer, unsigned int nr_pages, int op){
+	const uint32_t size = nr_pages * PAGE_SIZE;
+
+	mutex_lock(&si->io_lock);
+
+	int res = vfs_lseek(si->file, offset * PAGE_SIZE, SEEK_SET);
+	if (!IS_ERR_VALUE(res)) {
+		res = (op == BLK_WRITE) ?
+			vfs_write(si->file, buffer, size) :
+			vfs_read(si->file, buffer, size);
+	}
+
+	mutex_unlock(&si->io_lock);
+
+	if (IS_ERR_VALUE(res))
+		return res;
+
+	return (uint32_t)res == size ? SUCCESS : -EIO;
+}
+
+/*
+* Move `nr_pages` contiguous slots starting at `entry` from or to `buffer`.
+* Once the bio is allocated completion is always reported through `end_io`,
+* including early errors, so only -ENOMEM is left to the caller. The block
+* layer runs requests in submit today and swap files use vfs I/O, so
+* `end_io` normally runs before this returns; callers handle either order.
+*/
+int swap_io(swp_entry_t entry, void *buffer, unsigned int nr_pages, int op, bio_end_io_t *end_io, void *private){
+	struct swap_info *si = swap_info_get(entry);
+
+	struct bio *bio = kzalloc(sizeof(struct bio));
+	if (!bio)
+		return -ENOMEM;
+
+	bio->buffer = buffer;
+	bio->op = op;
+	bio->end_io = end_io;
+	bio->private = private;
+
+	if (!si || swp_offset(entry) + nr_pages > si->max) {
+		bio->status = -EINVAL;
+		end_io(bio);
+		return -EINVAL;
+	}
+
+	if (!(si->flags & SWP_BLKDEV)) {
+		int res = swap_file_io(si, swp_offset(entry), buffer, nr_pages, op);
+
+		bio->status = res;
+		end_io(bio);
+		return res;
+	}
+
+	const unsigned int sectors_per_page = PAGE_SIZE / si->bdev->disk->sec_size;
+
+	bio->sector = si->bdev->start_sector + swp_offset(entry) * sectors_per_page;
+	bio->nr_sectors = nr_pages * sectors_per_page;
+
+	int res = blk_submit_bio(si->bdev, bio);
+	if (IS_ERR_VALUE(res)) {
+		bio->status = res;
+		end_io(bio);
+	}
+
+	return res;
+}
+
+SYSCALL_DEFINE1(swapon, const __user char*, path){
+	char kpath[PATH_MAX];
+
+	for (int i = 0; ; i++) {
+		if (i == PATH_MAX)
+			return -ENAMETOOLONG;
+
+		if (copy_from_user(&kpath[i], path + i, 1))
+			return -EFAULT;
+
+		if (kpath[i] == '\0')
+			break;
+	}
+
+	struct file *file = vfs_open(kpath, O_WRONLY, 0);
+	if (IS_ERR_VALUE(file))
+		return PTR_ERR(file);
+
+	int res;
+	umode_t mode = file->inode->mode;
+
+	if (S_ISBLK(mode)) {
+		struct blkdev *bdev = blk_lookup(MAJOR(file->inode->dev), MINOR(file->inode->dev));
+		res = bdev ? swap_activate_bdev(bdev) : -ENODEV;
+	}
+	else if (S_ISREG(mode)) {
+		res = swap_activate_file(file);
+		if (res == SUCCESS)
+			return res;
+	}
+	else {
+		res = -EINVAL;
+	}
+
+	vfs_close(file);
+	return res;
+}
+
+static int __init swap_init(void){
+	spinlock_init(&swap_lock);
+	nr_swapfiles = 0;
+	nr_swap_pages = 0;
+	total_swap_pages = 0;
+
+	return SUCCESS;
+}
+
+core_initcall(swap_init);
@@ -0,0 +1,180 @@
+#include <mm/swap.h>
+#include <mm/vma.h>
+#include <mm/compaction.h>
+#include <kernel/sched.h>
+#include <kernel/printk.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+#include <asm-generic/paging_ctx.h>
+
+/**
+* Anonymous page reclaim.
+*
+* Address spaces are scanned round robin through `mm_list`. Pages touched
+* since the last pass get their accessed bit cleared and a second chance;
+* cold ones are moved to the swap cache, their PTE replaced by the swap
+* entry, and written out in batches of SWAP_CLUSTER_MAX.
+*/
+
+struct scan_control {
+	unsigned long nr_to_reclaim;
+	unsigned long nr_reclaimed;
+
+	int nr_pending;
+	struct page *pending[SWAP_CLUSTER_MAX];
+};
+
+static void flush_pending(struct scan_control *sc){
+	swap_writepage_cluster(sc->pending, sc->nr_pending);
+	sc->nr_pending = 0;
+}
+
+static int shrink_pte(struct paging_ctx *ctx, pte_t *pte, uintptr_t vaddr, void *data){
+	struct scan_control *sc = data;
+	const struct paging_ops *ops = ctx->ops;
+	const pte_t val = *pte;
+
+	if (!ops->pte_present(val))
+		return 0;
+
+	struct page *page = phys_to_page(ops->pte_phys(val));
+
+	if (!(page->flags & PG_ANON) || page->order != 0)
+		return 0;
+
+	if (page->flags & (PG_LOCKED | PG_WRITEBACK | PG_ERROR))
+		return 0;
+
+	if (ops->pte_young(val)) {
+		ops->set_pte(pte, ops->pte_mkold(val));
+		ops->flush_tlb_one(ctx, vaddr);
+		return 0;
+	}
+
+	swp_entry_t entry;
+
+	if (page->flags & PG_SWAPCACHE) {
+		entry = page_swp_entry(page);
+	}
+	else {
+		entry = swap_alloc();
+		if (!entry.val)
+			return -ENOSPC;
+
+		swap_cache_add(page, entry);
+		page->flags |= PG_DIRTY;
+		sc->pending[sc->nr_pending++] = page;
+	}
+
+	if (IS_ERR_VALUE(swap_duplicate(entry)))
+		return 0;
+
+	ops->set_pte(pte, ops->mk_swap(entry));
+	ops->flush_tlb_one(ctx, vaddr);
+
+	// Only the swap cache is left, the page goes once written
+	if (atomic_read(&page->refcount) == 2)
+		sc->nr_reclaimed++;
+
+	page_put(page);
+
+	if (sc->nr_pending == SWAP_CLUSTER_MAX)
+		flush_pending(sc);
+
+	return sc->nr_reclaimed >= sc->nr_to_reclaim;
+}
+
+static struct mm_struct* next_mm(void){
+	struct mm_struct *mm = NULL;
+
+	spin_lock(&mm_list_lock);
+
+	if (!list_empty(&mm_list)) {
+		mm = list_first_entry(&mm_list, struct mm_struct, mmlist);
+
+		list_remove(&mm->mmlist);
+		list_add_tail(&mm->mmlist, &mm_list);
+
+		if (!mm->ctx || !atomic_read(&mm->refcount))
+			mm = NULL;
+		else
+			vma_get(mm);
+	}
+
+	spin_unlock(&mm_list_lock);
+	return mm;
+}
+
+static unsigned long count_mm(void){
+	unsigned long nr = 0;
+	struct list_head *pos;
+
+	spin_lock(&mm_list_lock);
+	list_for_each(pos, &mm_list)
+		nr++;
+	spin_unlock(&mm_list_lock);
+
+	return nr;
+}
+
+unsigned long swap_reclaim(unsigned long nr_pages){
+	struct scan_control sc = {
+		.nr_to_reclaim = nr_pages,
+		.nr_reclaimed = shrink_swap_cache(nr_pages),
+		.nr_pending = 0,
+	};
+
+	if (!total_swap_pages)
+		return sc.nr_reclaimed;
+
+	// Two passes: the first one may only age recently used pages
+	unsigned long nr_scan = count_mm() * 2;
+
+	while (nr_scan-- && sc.nr_reclaimed < sc.nr_to_reclaim) {
+		struct mm_struct *mm = next_mm();
+		if (!mm)
+			continue;
+
+		/* Its owner's faults rewrite the same PTEs. A fault on `mm`
+		* that ran out of memory holds the lock already; one of another
+		* thread of it, or a walker, gets the address space skipped.
+		*/
+		int locked = mutex_owner(&mm->fault_lock) != current;
+		if (locked && !mutex_trylock(&mm->fault_lock)) {
+			vma_put(mm);
+			continue;
+		}
+
+		int res = mmu_walk_ptes(mm->ctx, USER_SPACE_START, USER_SPACE_END, shrink_pte, &sc);
+
+		flush_pending(&sc);
+
+		if (locked)
+			mutex_unlock(&mm->fault_lock);
+
+		vma_put(mm);
+
+		if (res == -ENOSPC)
+			break;
+	}
+
+	return sc.nr_reclaimed;
+}
+
+struct page* page_alloc_reclaim(uint8_t order, uint16_t flags){
+	struct page *page = page_alloc(order, flags);
+
+	// Free memory may just be scattered, try to make a block first
+	if (!page && order && compact_pages(order) == SUCCESS)
+		page = page_alloc(order, flags);
+
+	for (int retries = 0; !page && retries < 3; retries++) {
+		if (!swap_reclaim(SWAP_CLUSTER_MAX << order))
+			break;
+
+		page = page_alloc(order, flags);
+	}
+
+	return page;
+}
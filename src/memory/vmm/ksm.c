@@ -0,0 +1,504 @@
+#include <mm/ksm.h>
+#include <mm/vma.h>
+#include <mm/kheap.h>
+#include <mm/page.h>
+#include <kernel/sched.h>
+#include <kernel/clock.h>
+#include <kernel/fork.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
+#include <kernel/syscall.h>
+#include <kernel/uaccess.h>
+#include <lib/string.h>
+#include <def/config.h>
+#include <def/errno.h>
+
+#include <asm-generic/paging_ctx.h>
+
+/**
+* Same page merging for anonymous memory.
+*
+* ksmd walks every address space in `mm_list`, a few pages per wakeup,
+* and hashes the content of each private anonymous page. Pages found equal
+* to an already merged one (stable table) or to another candidate seen in
+* the current round (unstable table) are replaced by a single read only
+* page. The stable table keeps a reference on each merged page, so it is
+* never mapped by a sole owner and the first write always takes the copy
+* branch of vm_handle_cow.
+*
+* The unstable table is thrown away at the end of every full scan, its
+* content may have changed since it was hashed.
+*
+* PTEs of an address space are only read and rewritten under its
+* fault_lock, so its faults wait and its page tables stay put. Its threads
+* may still write to the page on other CPUs: the PTE is write protected
+* and flushed before the compare, a write after that takes a COW fault
+* and waits for the merge.
+*/
+
+#define KSM_HASH_SIZE 128
+
+struct stable_node {
+	uint32_t checksum;
+	struct page *kpage;
+	struct list_head list;
+};
+
+struct unstable_node {
+	uint32_t checksum;
+	struct mm_struct *mm;
+	uintptr_t vaddr;
+	struct list_head list;
+};
+
+struct ksm_scan {
+	struct mm_struct *mm;
+	uintptr_t address;
+	long budget;
+};
+
+unsigned int ksm_run = KSM_RUN;
+unsigned int ksm_pages_to_scan = KSM_PAGES_TO_SCAN;
+unsigned int ksm_sleep_ms = KSM_SLEEP_MS;
+
+static struct list_head stable_table[KSM_HASH_SIZE];
+static struct list_head unstable_table[KSM_HASH_SIZE];
+
+static struct ksm_scan ksm_scan;
+static struct ksm_stats ksm_stats;
+
+static struct task *ksmd_task;
+static tick_t ksmd_wakeup_tick;
+
+static inline struct list_head* ksm_bucket(struct list_head *table, uint32_t checksum){
+	return &table[checksum % KSM_HASH_SIZE];
+}
+
+static uint32_t calc_checksum(struct page *page){
+	const uint32_t *data = (const uint32_t*)page_to_virt(page);
+	uint32_t hash = 2166136261U;
+
+	for (size_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++)
+		hash = (hash ^ data[i]) * 16777619U;
+
+	return hash;
+}
+
+static inline int pages_identical(struct page *a, struct page *b){
+	return !memcmp((void*)page_to_virt(a), (void*)page_to_virt(b), PAGE_SIZE);
+}
+
+/* Private anonymous page mapped exactly once and not under swap I/O */
+static struct page* ksm_candidate(const struct paging_ops *ops, pte_t val){
+	if (!ops->pte_present(val))
+		return NULL;
+
+	struct page *page = phys_to_page(ops->pte_phys(val));
+
+	if (!page || !(page->flags & PG_ANON) || page->order != 0)
+		return NULL;
+
+	if (page->flags & (PG_SWAPCACHE | PG_LOCKED | PG_WRITEBACK | PG_ERROR))
+		return NULL;
+
+	if (atomic_read(&page->refcount) != 1)
+		return NULL;
+
+	return page;
+}
+
+static inline pte_t pte_wrprotect(const struct paging_ops *ops, pte_t val){
+	mem_flags_t flags = arch_mmu_flags(ops->pte_flags(val)) & ~MEM_WRITE;
+	return ops->mk_pte(ops->pte_phys(val), mmu_flags_arch(flags));
+}
+
+/*
+* Point `pte`, which maps `page`, at the read only `kpage`. The owner's
+* fault_lock is held; the PTE is write protected before the compare.
+*/
+static int replace_page(struct paging_ctx *ctx, pte_t *pte, uintptr_t vaddr, struct page *page, struct page *kpage){
+	const struct paging_ops *ops = ctx->ops;
+	const pte_t orig = *pte;
+
+	if (!ops->pte_present(orig) || ops->pte_phys(orig) != page_to_phys(page))
+		return -EAGAIN;
+
+	pte_t wp = pte_wrprotect(ops, orig);
+	ops->set_pte(pte, wp);
+	ops->flush_tlb_one(ctx, vaddr);
+
+	if (!pages_identical(page, kpage)) {
+		ops->set_pte(pte, orig);
+		return -EAGAIN;
+	}
+
+	page_get(kpage);
+	ops->set_pte(pte, ops->mk_pte(page_to_phys(kpage), ops->pte_flags(wp)));
+	ops->flush_tlb_one(ctx, vaddr);
+
+	page_put(page);
+	return SUCCESS;
+}
+
+static int try_merge_stable(struct paging_ctx *ctx, pte_t *pte, uintptr_t vaddr, struct page *page, uint32_t checksum){
+	struct stable_node *node, *next;
+
+	list_for_each_entry_safe(node, next, ksm_bucket(stable_table, checksum), list) {
+		if (node->checksum != checksum)
+			continue;
+
+		// Swapped out behind our back, let the swap cache have it
+		if (node->kpage->flags & PG_SWAPCACHE) {
+			list_remove(&node->list);
+			page_put(node->kpage);
+			kfree(node);
+			continue;
+		}
+
+		if (replace_page(ctx, pte, vaddr, page, node->kpage) == SUCCESS)
+			return SUCCESS;
+	}
+
+	return -ENOENT;
+}
+
+static int lookup_pte(struct paging_ctx *ctx, pte_t *pte, uintptr_t vaddr, void *data){
+	*(pte_t**)data = pte;
+	return 1;
+}
+
+/*
+* Merge `page` with the candidate recorded in `node`. The other page
+* becomes the shared one and moves to the stable table. The scanned
+* address space is locked already, the candidate's is only tried: ksmd
+* must not sleep on a second fault_lock while holding one.
+*/
+static int try_merge_unstable(struct paging_ctx *ctx, pte_t *pte, uintptr_t vaddr, struct page *page, struct unstable_node *node){
+	struct mm_struct *other_mm = node->mm;
+	struct paging_ctx *other_ctx = other_mm->ctx;
+	const struct paging_ops *ops = other_ctx->ops;
+	pte_t *other_pte = NULL;
+	int res;
+
+	if (other_mm == ksm_scan.mm && node->vaddr == vaddr)
+		return -EAGAIN;
+
+	const int locked = other_mm != ksm_scan.mm;
+	if (locked && !mutex_trylock(&other_mm->fault_lock))
+		return -EAGAIN;
+
+	mmu_walk_ptes(other_ctx, node->vaddr, node->vaddr + PAGE_SIZE, lookup_pte, &other_pte);
+	if (!other_pte) {
+		res = -ENOENT;
+		goto out;
+	}
+
+	struct stable_node *stable = kmalloc(sizeof(struct stable_node));
+	if (!stable) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	const pte_t orig = *other_pte;
+	struct page *kpage = ksm_candidate(ops, orig);
+
+	if (!kpage || kpage == page) {
+		kfree(stable);
+		res = -ENOENT;
+		goto out;
+	}
+
+	ops->set_pte(other_pte, pte_wrprotect(ops, orig));
+	ops->flush_tlb_one(other_ctx, node->vaddr);
+
+	res = replace_page(ctx, pte, vaddr, page, kpage);
+	if (res != SUCCESS) {
+		ops->set_pte(other_pte, orig);
+		kfree(stable);
+		goto out;
+	}
+
+	page_get(kpage);
+
+	stable->checksum = node->checksum;
+	stable->kpage = kpage;
+	list_add(&stable->list, ksm_bucket(stable_table, stable->checksum));
+
+out:
+	if (locked)
+		mutex_unlock(&other_mm->fault_lock);
+
+	return res;
+}
+
+static void unstable_insert(uint32_t checksum, uintptr_t vaddr){
+	struct unstable_node *node = kmalloc(sizeof(struct unstable_node));
+	if (!node)
+		return;
+
+	node->checksum = checksum;
+	node->mm = ksm_scan.mm;
+	node->vaddr = vaddr;
+	vma_get(node->mm);
+
+	list_add(&node->list, ksm_bucket(unstable_table, checksum));
+}
+
+static void unstable_remove(struct unstable_node *node){
+	list_remove(&node->list);
+	vma_put(node->mm);
+	kfree(node);
+}
+
+static int ksm_scan_pte(struct paging_ctx *ctx, pte_t *pte, uintptr_t vaddr, void *data){
+	struct ksm_scan *scan = data;
+
+	if (scan->budget <= 0)
+		return 1;
+
+	scan->budget--;
+	scan->address = vaddr + PAGE_SIZE;
+
+	struct page *page = ksm_candidate(ctx->ops, *pte);
+	if (!page)
+		return 0;
+
+	uint32_t checksum = calc_checksum(page);
+
+	if (try_merge_stable(ctx, pte, vaddr, page, checksum) == SUCCESS)
+		return 0;
+
+	struct unstable_node *node, *next;
+	list_for_each_entry_safe(node, next, ksm_bucket(unstable_table, checksum), list) {
+		if (node->checksum != checksum)
+			continue;
+
+		int res = try_merge_unstable(ctx, pte, vaddr, page, node);
+		if (res == SUCCESS || res == -ENOENT)
+			unstable_remove(node);
+
+		if (res == SUCCESS)
+			return 0;
+	}
+
+	unstable_insert(checksum, vaddr);
+	return 0;
+}
+
+/*
+* Drop merged pages nobody maps anymore and recount the stable table.
+* Called between full scans, when the unstable table is empty.
+*/
+static void ksm_prune_stable(void){
+	unsigned long shared = 0, sharing = 0;
+
+	for (int i = 0; i < KSM_HASH_SIZE; i++) {
+		struct stable_node *node, *next;
+
+		list_for_each_entry_safe(node, next, &stable_table[i], list) {
+			struct page *kpage = node->kpage;
+			long users = atomic_read(&kpage->refcount) - 1;
+
+			if (kpage->flags & PG_SWAPCACHE)
+				users--;
+
+			if (users <= 0) {
+				list_remove(&node->list);
+				page_put(kpage);
+				kfree(node);
+				continue;
+			}
+
+			shared++;
+			sharing += users;
+		}
+	}
+
+	ksm_stats.pages_shared = shared;
+	ksm_stats.pages_sharing = sharing;
+	ksm_stats.pages_saved = sharing - shared;
+}
+
+static void ksm_end_round(void){
+	unsigned long unshared = 0;
+
+	for (int i = 0; i < KSM_HASH_SIZE; i++) {
+		struct unstable_node *node, *next;
+
+		list_for_each_entry_safe(node, next, &unstable_table[i], list) {
+			unstable_remove(node);
+			unshared++;
+		}
+	}
+
+	unsigned long saved = ksm_stats.pages_saved;
+
+	ksm_prune_stable();
+	ksm_stats.pages_unshared = unshared;
+	ksm_stats.full_scans++;
+
+	if (ksm_stats.pages_saved != saved) {
+		printk("KSM: %lu pages shared by %lu mappings, %lu pages saved\n",
+			ksm_stats.pages_shared, ksm_stats.pages_sharing, ksm_stats.pages_saved);
+	}
+}
+
+/* Next address space after `mm`, NULL once the end of the list is reached */
+static struct mm_struct* ksm_next_mm(struct mm_struct *mm){
+	struct mm_struct *next = NULL;
+
+	spin_lock(&mm_list_lock);
+
+	struct list_head *pos = mm ? mm->mmlist.next : mm_list.next;
+	for (; pos != &mm_list; pos = pos->next) {
+		struct mm_struct *cur = list_entry(pos, struct mm_struct, mmlist);
+
+		if (cur->ctx && atomic_read(&cur->refcount)) {
+			vma_get(cur);
+			next = cur;
+			break;
+		}
+	}
+
+	spin_unlock(&mm_list_lock);
+
+	if (mm)
+		vma_put(mm);
+
+	return next;
+}
+
+static void ksm_do_scan(long nr_pages){
+	ksm_scan.budget = nr_pages;
+
+	while (ksm_scan.budget > 0) {
+		if (!ksm_scan.mm) {
+			ksm_scan.mm = ksm_next_mm(NULL);
+			ksm_scan.address = USER_SPACE_START;
+
+			if (!ksm_scan.mm)
+				return;
+		}
+
+		mutex_lock(&ksm_scan.mm->fault_lock);
+
+		int res = mmu_walk_ptes(
+			ksm_scan.mm->ctx, ksm_scan.address, USER_SPACE_END,
+			ksm_scan_pte, &ksm_scan
+		);
+
+		mutex_unlock(&ksm_scan.mm->fault_lock);
+
+		if (res)
+			return;
+
+		ksm_scan.mm = ksm_next_mm(ksm_scan.mm);
+		ksm_scan.address = USER_SPACE_START;
+
+		if (!ksm_scan.mm)
+			ksm_end_round();
+	}
+}
+
+void ksm_get_stats(struct ksm_stats *stats){
+	memcpy(stats, &ksm_stats, sizeof(struct ksm_stats));
+}
+
+static void ksmd_tick(void *unused){
+	if (!ksmd_task || clock_get_ticks() < ksmd_wakeup_tick)
+		return;
+
+	task_wakeup(ksmd_task);
+}
+
+static tick_t ksmd_next_tick(void *unused){
+	if (!ksmd_task || ksmd_task->state != TASK_BLOCKED)
+		return TICK_NONE;
+
+	return ksmd_wakeup_tick;
+}
+
+static int ksmd(void *unused){
+	ksmd_task = current;
+
+	while (1) {
+		if (ksm_run)
+			ksm_do_scan(ksm_pages_to_scan);
+
+		unsigned long sleep = (ksm_sleep_ms * TIMER_FREQUENCY + 999) / 1000;
+		ksmd_wakeup_tick = clock_get_ticks() + (sleep ? sleep : 1);
+
+		sleep_current();
+	}
+
+	return SUCCESS;
+}
+
+/*
+* Read the tunables into `old` and the counters into `stats`, then apply
+* `set`. Changing them takes a privileged caller; ksmd runs its next round
+* with the new values on the following tick.
+*/
+SYSCALL_DEFINE3(ksm_ctl, const struct ksm_tunables __user*, set, struct ksm_tunables __user*, old, struct ksm_stats __user*, stats){
+	struct ksm_tunables cur = {
+		.run = ksm_run,
+		.pages_to_scan = ksm_pages_to_scan,
+		.sleep_ms = ksm_sleep_ms,
+	};
+	struct ksm_tunables kset;
+
+	if (set) {
+		if (copy_from_user(&kset, set, sizeof(struct ksm_tunables)))
+			return -EFAULT;
+
+		if (!kset.pages_to_scan)
+			return -EINVAL;
+
+		if (!task_privileged(current))
+			return -EPERM;
+	}
+
+	if (old && copy_to_user(old, &cur, sizeof(struct ksm_tunables)))
+		return -EFAULT;
+
+	if (stats) {
+		struct ksm_stats kstats;
+		ksm_get_stats(&kstats);
+
+		if (copy_to_user(stats, &kstats, sizeof(struct ksm_stats)))
+			return -EFAULT;
+	}
+
+	if (set) {
+		ksm_run = kset.run;
+		ksm_pages_to_scan = kset.pages_to_scan;
+		ksm_sleep_ms = kset.sleep_ms;
+		ksmd_wakeup_tick = clock_get_ticks();
+	}
+
+	return SUCCESS;
+}
+
+static int __init ksm_init(void){
+	memset(&ksm_scan, 0x0, sizeof(struct ksm_scan));
+	memset(&ksm_stats, 0x0, sizeof(struct ksm_stats));
+
+	for (int i = 0; i < KSM_HASH_SIZE; i++) {
+		INIT_LIST_HEAD(&stable_table[i]);
+		INIT_LIST_HEAD(&unstable_table[i]);
+	}
+
+	int res = clockevent_register_nohz_listener(ksmd_tick, ksmd_next_tick, NULL);
+	if (IS_ERR_VALUE(res))
+		return res;
+
+	pid_t pid = kernel_thread(ksmd, "ksmd", NULL);
+	if (pid < 0) {
+		printk("KSM: failed to start ksmd %d\n", pid);
+		return pid;
+	}
+
+	return SUCCESS;
+}
+
+late_initcall(ksm_init);
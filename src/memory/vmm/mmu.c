@@ -5,6 +5,7 @@
 #include <kernel/printk.h>
 #include <mm/memblock.h>
 #include <mm/page.h>
+#include <mm/swap.h>
 #include <mm/kheap.h>
 #include <def/errno.h>
 #include <kernel/init.h>
@@ -12,10 +13,14 @@
 #include <def/linker.h>
 #include <lib/string.h>
 #include <lib/assert.h>
+#include <sync/spinlock.h>
+#include <sync/barrier.h>
+#include <kernel/smp.h>
 
 #include <asm-generic/paging_ctx.h>
 #include <asm/page.h>
 #include <asm/paging.h>
+#include <asm/irqflags.h>
 
 /**
 * Main virtual memory management unit (MMU) kernel API
@@ -107,7 +112,7 @@ int __init mmu_early_mmap(struct paging_ctx *ctx, uintptr_t vaddr, uintptr_t pad
 		pte_t val = ctx->ops->mk_pte(paddr, arch_flags | pg->flag);
 
 		ctx->ops->set_pte(pte, val);
-		ctx->ops->flush_tlb_one(vaddr);
+		ctx->ops->flush_tlb_one(ctx, vaddr);
 
 		vaddr += PAGE_SIZE;
 		paddr += PAGE_SIZE;
@@ -136,6 +141,9 @@ static inline void free_context(struct paging_ctx* ctx){
 	kfree(ctx);
 }
 
+/* Table installs are rare, one lock for every context will do */
+static spinlock_t pgtable_lock;
+
 static void* ensure_table(const struct paging_ctx *restrict ctx, pte_t *entry, uint8_t user_table, uint8_t order) {
 	const struct paging_ops *restrict ops = ctx->ops;
 
@@ -147,7 +155,18 @@ static void* ensure_table(const struct paging_ctx *restrict ctx, pte_t *entry, u
 		memset((void*)new_tbl, 0x0, PAGE_SIZE);
 
 		pte_t e = ops->mk_table(page_to_phys(page), user_table);
-		ops->set_pte(entry, e);
+
+		// Another walker may have installed one meanwhile, keep theirs
+		spin_lock(&pgtable_lock);
+
+		if (!ops->pte_present(*entry)) {
+			ops->set_pte(entry, e);
+			page = NULL;
+		}
+
+		spin_unlock(&pgtable_lock);
+
+		if (page) page_free(page);
 	}
 
 	return ops->pte_to_virt(*entry);
@@ -160,7 +179,7 @@ static int table_empty(struct paging_ctx *ctx, void *table, uint8_t level) {
 	for (size_t i = 0; i < entries; i++) {
 		pte_t *e = &((pte_t*)table)[i];
 
-		if (pte_present(*e))
+		if (pte_present(*e) || ctx->ops->pte_swap(*e))
 			return 0;
 	}
 
@@ -214,11 +233,11 @@ static pte_t* __generic_walker(const struct paging_ctx *restrict ctx, uintptr_t
 			table = ops->pte_to_virt(pte_val);
 		} 
 		else if (create) {
-			const int is_leaf = pte_leaf(pte_val, i);
-			table = ensure_table(ctx, entry, user_table, is_leaf ? leaf_order : 0);
+			/* Empty (or swapped out) leaf slot, the caller fills it */
+			if (i == stop_level || pte_leaf(pte_val, i)) return entry;
 
+			table = ensure_table(ctx, entry, user_table, 0);
 			if (unlikely(!table)) return NULL;
-			if (is_leaf) return entry;
 		}
 		else {
 			return NULL;
@@ -252,6 +271,11 @@ static void destroy_level(
 		uintptr_t phys = pte_phys(pte_val);
 
 		if (!pte_present(pte_val)){
+			if (ops->pte_swap(pte_val)) {
+				swap_free(ops->pte_to_swp(pte_val));
+				clear_pte(entry);
+			}
+
 			continue;
 		}
 
@@ -290,8 +314,14 @@ static void rollback_clone_level(
 		const pte_t pte_val = *e;
 		uintptr_t phys = pte_phys(pte_val);
 
-		if (!pte_present(pte_val))
+		if (!pte_present(pte_val)) {
+			if (ctx->ops->pte_swap(pte_val)) {
+				swap_free(ctx->ops->pte_to_swp(pte_val));
+				ctx->ops->clear_pte(e);
+			}
+
 			continue;
+		}
 
 		uintptr_t entry_va = base_va + (i << shift);
 		if (entry_va >= USER_SPACE_END) {
@@ -322,7 +352,7 @@ static void rollback_clone_level(
 	}
 }
 
-static inline void restore_src_mods(const struct paging_ctx *restrict src, pte_t **list, pte_t *orig_vals, size_t count) {
+static inline void restore_src_mods(struct paging_ctx *restrict src, pte_t **list, pte_t *orig_vals, size_t count) {
 	for (size_t i = 0; i < count; i++) {
 		pte_t *pte = list[i];
 		pte_t old = orig_vals[i];
@@ -333,12 +363,12 @@ static inline void restore_src_mods(const struct paging_ctx *restrict src, pte_t
 		src->ops->set_pte(pte, old);
 	}
 
-	src->ops->flush_all();
+	src->ops->flush_all(src);
 }
 
 static void* clone_level(
 	const struct paging_ctx *restrict dst,
-	const struct paging_ctx *restrict src,
+	struct paging_ctx *restrict src,
 	const void *src_table,
 	const int level,
 	uintptr_t base_va
@@ -376,8 +406,15 @@ static void* clone_level(
 		pte_t *dst_e = &((pte_t*)new_table)[i];
 		const pte_t pte_val = *src_e;
 
-		if (!pte_present(pte_val))
+		if (!pte_present(pte_val)) {
+			/* Both address spaces now reference the swap slot */
+			if (src->ops->pte_swap(pte_val)) {
+				swap_duplicate(src->ops->pte_to_swp(pte_val));
+				dst->ops->set_pte(dst_e, pte_val);
+			}
+
 			continue;
+		}
 
 		uintptr_t entry_va = base_va + (i << shift);
 
@@ -407,7 +444,7 @@ static void* clone_level(
 				);
 
 				src->ops->set_pte(src_e, new_pte);
-				src->ops->flush_tlb_one(entry_va);
+				src->ops->flush_tlb_one(src, entry_va);
 			}
 
 			dst->ops->set_pte(dst_e, new_pte);
@@ -462,7 +499,7 @@ int __init mmu_init(){
 		(MEM_READ | MEM_GLOBAL)
 	);
 
-	kernel_ctx.ops->flush_all();
+	kernel_ctx.ops->flush_all(&kernel_ctx);
 
 	return OK;
 }
@@ -491,7 +528,7 @@ int mmu_mmap(struct paging_ctx *ctx, uintptr_t paddr, uintptr_t vaddr, size_t si
 
 		pte_t val = ctx->ops->mk_pte(paddr, arch_flags);
 		ctx->ops->set_pte(pte, val);
-		ctx->ops->flush_tlb_one(vaddr);
+		ctx->ops->flush_tlb_one(ctx, vaddr);
 
 		vaddr += PAGE_SIZE;
 		paddr += PAGE_SIZE;
@@ -510,15 +547,23 @@ void mmu_munmap(struct paging_ctx *ctx, uintptr_t vaddr, size_t size) {
 
 	for (; pages--; vaddr += PAGE_SIZE) {
 
-		struct walk_level levels[MAX_LEVELS];
+		struct walk_level levels[MAX_LEVELS] = {0};
+
+		if (walk_to(ctx, vaddr, levels) < 0) {
+			pte_t *pte = levels[fmt->levels - 1].entry;
+
+			if (pte && ctx->ops->pte_swap(*pte)) {
+				swap_free(ctx->ops->pte_to_swp(*pte));
+				clear_pte(pte);
+			}
 
-		if (walk_to(ctx, vaddr, levels) < 0)
 			continue;
+		}
 
 		pte_t *pte = levels[fmt->levels - 1].entry;
 
 		clear_pte(pte);
-		flush_tlb_one(vaddr);
+		flush_tlb_one(ctx, vaddr);
 
 		for (uint8_t lvl = fmt->levels - 1; lvl > 0; lvl--) {
 			void *table = levels[lvl].table;
@@ -555,7 +600,7 @@ void mmu_set_flags(struct paging_ctx *ctx, uintptr_t vaddr, mem_flags_t flags){
 		uintptr_t phys = ops->pte_phys(pte_val);
 		pte_val = ops->mk_pte(phys, arch_flags);
 		ops->set_pte(pte, pte_val);
-		ops->flush_tlb_one(vaddr);
+		ops->flush_tlb_one(ctx, vaddr);
 	}
 }
 
@@ -576,6 +621,75 @@ mem_flags_t mmu_get_flags(struct paging_ctx *ctx, uintptr_t vaddr){
 	return MEM_NOT_MAPPED;
 }
 
+int mmu_get_swap_entry(struct paging_ctx *ctx, uintptr_t vaddr, swp_entry_t *entry){
+	struct walk_level levels[MAX_LEVELS] = {0};
+
+	if (walk_to(ctx, vaddr, levels) == 0)
+		return -EEXIST;
+
+	pte_t *pte = levels[ctx->fmt->levels - 1].entry;
+	if (!pte || !ctx->ops->pte_swap(*pte))
+		return -ENOENT;
+
+	*entry = ctx->ops->pte_to_swp(*pte);
+	return SUCCESS;
+}
+
+static int walk_ptes_level(
+	struct paging_ctx *ctx,
+	void *table,
+	int level,
+	uintptr_t base_va,
+	uintptr_t start,
+	uintptr_t end,
+	mmu_pte_fn_t fn,
+	void *data
+){
+	const struct paging_ops *restrict ops = ctx->ops;
+	const size_t entries = ctx->fmt->lvl[level].mask + 1;
+	const uint8_t shift = ctx->fmt->lvl[level].shift;
+
+	for (size_t i = 0; i < entries; i++) {
+		pte_t *entry = &((pte_t*)table)[i];
+		uintptr_t entry_va = base_va + (i << shift);
+
+		if (entry_va >= end)
+			break;
+
+		if (entry_va + ((1UL << shift) - 1) < start)
+			continue;
+
+		if (!ops->pte_present(*entry)) {
+			if (!ops->pte_swap(*entry))
+				continue;
+		}
+		else if (!ops->pte_leaf(*entry, level)) {
+			int res = walk_ptes_level(
+				ctx, ops->pte_to_virt(*entry), level + 1,
+				entry_va, start, end, fn, data
+			);
+
+			if (res)
+				return res;
+
+			continue;
+		}
+
+		int res = fn(ctx, entry, entry_va, data);
+		if (res)
+			return res;
+	}
+
+	return 0;
+}
+
+int mmu_walk_ptes(struct paging_ctx *ctx, uintptr_t start, uintptr_t end, mmu_pte_fn_t fn, void *data){
+	if (end > USER_SPACE_END)
+		end = USER_SPACE_END;
+
+	return walk_ptes_level(ctx, ctx->root, 0, 0, start, end, fn, data);
+}
+
 struct paging_ctx* mmu_create_context(void){
 	return mmu_clone_context(&kernel_ctx);
 }
@@ -595,7 +709,16 @@ struct paging_ctx* mmu_clone_context(struct paging_ctx *src) {
 	return dst;
 }
 
+DEFINE_PER_CPU(struct paging_ctx*, active_ctx);
+
+/*
+* The CPU's bit goes into `cpu_mask` before the table is loaded, so a
+* flush that misses the bit came before the load. An IPI in between would
+* see the old context active and drop the bit again, hence interrupts off.
+*/
 int mmu_context_switch(struct paging_ctx *ctx){
+	unsigned long flags;
+
 	if(!ctx){
 		return -EINVAL;
 	}
@@ -605,13 +728,18 @@ int mmu_context_switch(struct paging_ctx *ctx){
 		return -EINVAL;
 	}
 
-	uintptr_t curr_phys = paging_current_table_phys();
+	local_irq_save(flags);
 
-	if(target_phys == curr_phys){
-		return OK;
+	atomic_or(1 << smp_processor_id(), &ctx->cpu_mask);
+	smp_mb();
+
+	if(target_phys != paging_current_table_phys()){
+		paging_load_table(target_phys);
 	}
 
-	paging_load_table(target_phys);
+	this_cpu_write(active_ctx, ctx);
+
+	local_irq_restore(flags);
 	return OK;
 }
 
@@ -620,7 +748,7 @@ void mmu_destroy_context(struct paging_ctx *ctx){
 
 	destroy_level(ctx, root, 0,0);
 
-	ctx->ops->flush_all();
+	ctx->ops->flush_all(ctx);
 
 	page_free(
 		virt_to_page(root)
@@ -630,10 +758,45 @@ void mmu_destroy_context(struct paging_ctx *ctx){
 	free_context(ctx);
 }
 
+/*
+* Device memory, handed out upwards from the start of the non-linear area
+* and never given back. The top 4 MiB hold the recursive mapping. Address
+* spaces only get the kernel tables that exist when they are cloned, so
+* this is meant for boot time users.
+*/
+#define IOREMAP_START ALIGN(KERNEL_NONLINEAR_START, MiB(4))
+#define IOREMAP_END   (KERNEL_VIRT_END - MiB(4))
+
+static uintptr_t ioremap_next = IOREMAP_START;
+static spinlock_t ioremap_lock;
+
+void* mmu_ioremap(uintptr_t paddr, size_t size){
+	const uintptr_t offset = paddr & (PAGE_SIZE - 1);
+	size = ALIGN(size + offset, PAGE_SIZE);
+
+	spin_lock(&ioremap_lock);
+
+	if(ioremap_next + size > IOREMAP_END){
+		spin_unlock(&ioremap_lock);
+		return NULL;
+	}
+
+	uintptr_t vaddr = ioremap_next;
+	ioremap_next += size;
+
+	spin_unlock(&ioremap_lock);
+
+	if(mmu_mmap(&kernel_ctx, paddr - offset, vaddr, size, MEM_READ | MEM_WRITE | MEM_DEVICE) != OK){
+		return NULL;
+	}
+
+	return (void*)(vaddr + offset);
+}
+
 void mmu_invlpg(struct paging_ctx *ctx, uintptr_t vaddr){
-	ctx->ops->flush_tlb_one(vaddr);
+	ctx->ops->flush_tlb_one(ctx, vaddr);
 }
 
 void mmu_flush_all(struct paging_ctx *ctx){
-	ctx->ops->flush_all();
+	ctx->ops->flush_all(ctx);
 }
\ No newline at end of file
@@ -7,12 +7,20 @@
 #define ALIGN_DOWN(v,a) ((v) & ~((a)-1))
 #define ALIGN_UP(v,a)  (((v) + (a) - 1) & ~((a)-1))
 
+LIST_HEAD(mm_list);
+spinlock_t mm_list_lock;
+
 struct mm_struct* vma_alloc(void){
 	struct mm_struct* mm = kzalloc(sizeof(struct mm_struct));
 
 	if(mm){
 		atomic_set(&mm->refcount, 1);
-		spinlock_init(&mm->spinlock);
+		init_rwsem(&mm->mmap_lock);
+		mutex_init(&mm->fault_lock);
+
+		spin_lock(&mm_list_lock);
+		list_add_tail(&mm->mmlist, &mm_list);
+		spin_unlock(&mm_list_lock);
 	}
 
 	return mm;
@@ -45,22 +53,6 @@ struct vm_region* vma_add(
 		aligned_offset -= delta;
 	}
 
-	spin_lock(&mm->spinlock);
-
-	struct vm_region* prev = NULL;
-	struct vm_region* curr = mm->vma;
-	while (curr && curr->start < aligned_end) {
-		if (aligned_start < curr->end && aligned_end > curr->start) {
-			spin_unlock(&mm->spinlock);
-			return ERR_PTR(-EINVAL);
-		}
-
-		prev = curr;
-		curr = curr->next;
-	}
-
-	spin_unlock(&mm->spinlock);
-
 	struct vm_region* new_region = kzalloc(sizeof(struct vm_region));
 	if (!new_region){
 		return ERR_PTR(-ENOMEM);
@@ -72,13 +64,24 @@ struct vm_region* vma_add(
 	new_region->prot_flags = prot_flags;
 	new_region->file = file;
 	new_region->file_offset = aligned_offset;
-	new_region->next = curr;
 
-	if (file){
-		file_get(file);
+	// The overlap check and the insert in one go, nothing can slip in between
+	down_write(&mm->mmap_lock);
+
+	struct vm_region* prev = NULL;
+	struct vm_region* curr = mm->vma;
+	while (curr && curr->start < aligned_end) {
+		if (aligned_start < curr->end && aligned_end > curr->start) {
+			up_write(&mm->mmap_lock);
+			kfree(new_region);
+			return ERR_PTR(-EINVAL);
+		}
+
+		prev = curr;
+		curr = curr->next;
 	}
 
-	spin_lock(&mm->spinlock);
+	new_region->next = curr;
 
 	if (prev){
 		prev->next = new_region;
@@ -87,30 +90,34 @@ struct vm_region* vma_add(
 		mm->vma = new_region;
 	}
 
-	spin_unlock(&mm->spinlock);
+	up_write(&mm->mmap_lock);
+
+	if (file){
+		file_get(file);
+	}
 
 	return new_region;
 }
 
 struct vm_region* vma_lookup(struct mm_struct* mm, uintptr_t virtaddr){
-	struct vm_region* region = mm->vma;
+	down_read(&mm->mmap_lock);
 
-	spin_lock(&mm->spinlock);
+	struct vm_region* region = mm->vma;
 	while (region && virtaddr >= region->start) {
 		if (virtaddr < region->end){
-			spin_unlock(&mm->spinlock);
+			up_read(&mm->mmap_lock);
 			return region;
 		}
 
 		region = region->next;
 	}
 
-	spin_unlock(&mm->spinlock);
+	up_read(&mm->mmap_lock);
 	return NULL;
 }
 
 int vma_remove(struct mm_struct* mm, uintptr_t virtaddr){
-	spin_lock(&mm->spinlock);
+	down_write(&mm->mmap_lock);
 
 	struct vm_region* prev = NULL;
 	struct vm_region* region = mm->vma;
@@ -127,7 +134,7 @@ int vma_remove(struct mm_struct* mm, uintptr_t virtaddr){
 			}
 
 			kfree(region);
-			spin_unlock(&mm->spinlock);
+			up_write(&mm->mmap_lock);
 			return SUCCESS;
 		}
 
@@ -135,7 +142,7 @@ int vma_remove(struct mm_struct* mm, uintptr_t virtaddr){
 		region = region->next;
 	}
 
-	spin_unlock(&mm->spinlock);
+	up_write(&mm->mmap_lock);
 
 	return -ENOENT;
 }
@@ -156,6 +163,10 @@ void vma_clean(struct mm_struct* mm){
 }
 
 void vma_destroy(struct mm_struct* mm){
+	spin_lock(&mm_list_lock);
+	list_remove(&mm->mmlist);
+	spin_unlock(&mm_list_lock);
+
 	if(mm->vma) vma_clean(mm);
 	if(mm->ctx) mmu_destroy_context(mm->ctx);
 
@@ -168,7 +179,7 @@ struct mm_struct* vma_dup(struct mm_struct* mm){
 		return NULL;
 	}
 
-	spin_lock(&mm->spinlock);
+	down_read(&mm->mmap_lock);
 	struct vm_region* cur = mm->vma;
 	while(cur){
 		struct vm_region* region = vma_add(
@@ -182,15 +193,19 @@ struct mm_struct* vma_dup(struct mm_struct* mm){
 		);
 
 		if(IS_ERR_VALUE(region)){
-			spin_unlock(&mm->spinlock);
+			up_read(&mm->mmap_lock);
 			goto out_free;
 		}
 
 		cur = cur->next;
 	}
-	spin_unlock(&mm->spinlock);
+	up_read(&mm->mmap_lock);
 
+	// Write protects the parent's PTEs for COW
+	mutex_lock(&mm->fault_lock);
 	struct paging_ctx* cloned_ctx = mmu_clone_context(mm->ctx);
+	mutex_unlock(&mm->fault_lock);
+
 	if(!cloned_ctx){
 		goto out_free;
 	}
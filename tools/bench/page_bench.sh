@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Buddy allocator throughput of several revisions on the build host.
+#
+# page_bench.c needs a booted kernel; this builds page.c of each revision
+# (with its own headers) into a static 32-bit binary instead and runs
+# them in turn, ROUNDS times, so they share the same machine noise.
+#
+# usage: tools/bench/page_bench.sh [-r ROUNDS] REV...
+
+set -e
+
+ROUNDS=1
+if [ "$1" = "-r" ]; then
+	ROUNDS=$2
+	shift 2
+fi
+
+[ $# -gt 0 ] || { echo "usage: $0 [-r ROUNDS] REV..." >&2; exit 1; }
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(git -C "$BENCH" rev-parse --show-toplevel)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+CFLAGS="-m32 -O2 -std=gnu11 -ffreestanding -nostdlib -nostdinc -static -fno-pic -fno-stack-protector"
+
+for rev in "$@"; do
+	dir="$WORK/$rev"
+	mkdir -p "$dir"
+
+	git -C "$ROOT" archive "$rev" \
+		src/include src/arch/i386/include src/arch/i386/kernel/atomic.c \
+		src/memory/heap/page.c src/lib/list.c | tar -x -C "$dir"
+
+	gcc $CFLAGS -I"$dir/src/include" -I"$dir/src/arch/i386/include" \
+		-include "$BENCH/page_bench_shim.h" "$BENCH/page_bench_host.c" \
+		"$dir/src/memory/heap/page.c" "$dir/src/arch/i386/kernel/atomic.c" \
+		"$dir/src/lib/list.c" -o "$dir/bench"
+done
+
+for round in $(seq "$ROUNDS"); do
+	for rev in "$@"; do
+		"$WORK/$rev/bench" | sed "s|^|$rev |"
+	done
+done
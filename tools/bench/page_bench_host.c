@@ -0,0 +1,165 @@
+#include <mm/page.h>
+#include <mm/memblock.h>
+#include <sync/spinlock.h>
+
+/**
+* Host side run of the buddy allocator, see page_bench.sh.
+*
+* page.c of one revision is linked into a static 32-bit Linux binary with
+* no libc. The loop is page_bench.c's, alloc/free pairs for orders 0, 1
+* and 3, back to back and in batches of 64, but it runs a fixed number of
+* pairs timed with rdtsc. Each figure is the median of BENCH_RUNS runs in
+* cycles per pair. Every revision gets the same test-and-set lock, so
+* only the allocator itself is compared.
+*/
+
+#define BENCH_PAGES 32768 // 128 MiB
+#define BENCH_BATCH 64
+#define BENCH_PAIRS_SHIFT 21
+#define BENCH_PAIRS (1UL << BENCH_PAIRS_SHIFT)
+#define BENCH_RUNS 7
+
+char bench_vmemmap[BENCH_PAGES * sizeof(struct page)] __attribute__((aligned(64)));
+unsigned long max_pfn_mapped = BENCH_PAGES;
+struct memblock memblock;
+
+int memblock_is_reserved(uint64_t base, size_t size){
+	return 0;
+}
+
+int printk(const char* restrict fmt, ...){
+	return 0;
+}
+
+// Only called on allocation failure, from revisions with compaction
+__attribute__((weak)) void wakeup_kcompactd(uint8_t order){
+}
+
+void spinlock_init(spinlock_t* lock){
+	*(volatile int*)lock = 0;
+}
+
+void spin_lock(spinlock_t* lock){
+	while (!__sync_bool_compare_and_swap((int*)lock, 0, 1))
+		;
+}
+
+void spin_unlock(spinlock_t* lock){
+	__sync_lock_release((int*)lock);
+}
+
+static void sys_write(const char *s){
+	int len = 0, res;
+
+	while (s[len])
+		len++;
+
+	__asm__ volatile("int $0x80" : "=a"(res) : "a"(4), "b"(1), "c"(s), "d"(len) : "memory");
+}
+
+static __attribute__((noreturn)) void sys_exit(int status){
+	__asm__ volatile("int $0x80" :: "a"(1), "b"(status));
+	__builtin_unreachable();
+}
+
+static void print_ulong(unsigned long val){
+	char buf[16];
+	int i = sizeof(buf) - 1;
+
+	buf[i] = '\0';
+	do {
+		buf[--i] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	sys_write(&buf[i]);
+}
+
+// `val` in hundredths
+static void print_fixed(unsigned long val){
+	print_ulong(val / 100);
+	sys_write(val % 100 < 10 ? ".0" : ".");
+	print_ulong(val % 100);
+}
+
+static inline unsigned long long rdtsc(void){
+	unsigned int lo, hi;
+
+	__asm__ volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi));
+	return ((unsigned long long)hi << 32) | lo;
+}
+
+// Cycles per alloc/free pair, in hundredths
+static unsigned long bench_pass(uint8_t order, int batch){
+	struct page *pages[BENCH_BATCH];
+	unsigned long pairs = 0;
+
+	unsigned long long start = rdtsc();
+
+	while (pairs < BENCH_PAIRS) {
+		int n = 0;
+
+		while (n < batch && (pages[n] = page_alloc(order, PG_KERNEL)))
+			n++;
+
+		if (!n)
+			sys_exit(1);
+
+		for (int i = 0; i < n; i++)
+			page_free(pages[i]);
+
+		pairs += n;
+	}
+
+	return ((rdtsc() - start) * 100) >> BENCH_PAIRS_SHIFT;
+}
+
+static unsigned long bench_median(uint8_t order, int batch){
+	unsigned long runs[BENCH_RUNS];
+
+	for (int i = 0; i < BENCH_RUNS; i++) {
+		runs[i] = bench_pass(order, batch);
+
+		for (int j = i; j > 0 && runs[j] < runs[j - 1]; j--) {
+			unsigned long tmp = runs[j];
+			runs[j] = runs[j - 1];
+			runs[j - 1] = tmp;
+		}
+	}
+
+	return runs[BENCH_RUNS / 2];
+}
+
+void _start(void){
+	static const uint8_t orders[] = { 0, 1, 3 };
+
+	page_init();
+
+	// Every frame goes to the allocator, like __page_add_memory()
+	for (unsigned long pfn = 0; pfn < BENCH_PAGES; pfn++) {
+		struct page *page = phys_to_page(pfn << PAGE_SHIFT);
+
+		page->flags = 0;
+		page->order = 0;
+		atomic_set(&page->refcount, 0);
+		page_free(page);
+	}
+
+	sys_write("struct page ");
+	print_ulong(sizeof(struct page));
+	sys_write(" bytes\n");
+
+	for (unsigned int i = 0; i < sizeof(orders); i++) {
+		bench_pass(orders[i], 1);
+
+		sys_write("order ");
+		print_ulong(orders[i]);
+		sys_write(": single ");
+		print_fixed(bench_median(orders[i], 1));
+		sys_write(" cycles/pair, batch 64 ");
+		print_fixed(bench_median(orders[i], BENCH_BATCH));
+		sys_write(" cycles/pair\n");
+	}
+
+	sys_exit(0);
+}
@@ -0,0 +1,10 @@
+/*
+* Force-included before page.c: vmemmap becomes an array of the host
+* binary, the included config.h keeps its guard for page.c's own include.
+*/
+#include <def/config.h>
+
+#undef KERNEL_VMEMMAP_START
+
+extern char bench_vmemmap[];
+#define KERNEL_VMEMMAP_START ((uintptr_t)bench_vmemmap)